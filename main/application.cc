@@ -9,6 +9,9 @@
 #include "mcp_server.h"
 #include "assets.h"
 #include "settings.h"
+#include "tracing.h"
+#include "boot_sequencer.h"
+#include "download_checkpoint.h"
 
 #include <cstring>
 #include <esp_log.h>
@@ -36,6 +39,7 @@ Application::Application() {
     esp_timer_create_args_t clock_timer_args = {
         .callback = [](void* arg) {
             Application* app = (Application*)arg;
+            app->main_loop_profiler_.CheckWatchdog();
             xEventGroupSetBits(app->event_group_, MAIN_EVENT_CLOCK_TICK);
         },
         .arg = this,
@@ -59,31 +63,76 @@ bool Application::SetDeviceState(DeviceState state) {
 }
 
 void Application::Initialize() {
+#if CONFIG_USE_EVENT_TRACING
+    Tracer::GetInstance().Start();
+#endif
+    // The board constructor sets up the display and the codec
+    int64_t boot_start_us = esp_timer_get_time();
     auto& board = Board::GetInstance();
     SetDeviceState(kDeviceStateStarting);
 
+    BootSequencer boot;
+    int board_step = boot.AddCompleted("board", boot_start_us);
+
     // Setup the display
     auto display = board.GetDisplay();
 
     // Print board name/version info
     display->SetChatMessage("system", SystemInfo::GetUserAgent().c_str());
 
-    // Setup the audio service
-    auto codec = board.GetAudioCodec();
-    audio_service_.Initialize(codec);
-    audio_service_.Start();
-
     AudioServiceCallbacks callbacks;
     callbacks.on_send_queue_available = [this]() {
-        xEventGroupSetBits(event_group_, MAIN_EVENT_SEND_AUDIO);
+        NotifyAudioSender();
     };
     callbacks.on_wake_word_detected = [this](const std::string& wake_word) {
+        if (GetDeviceState() == kDeviceStateIdle) {
+            interaction_timeline_.Begin("wake_word");
+        }
         xEventGroupSetBits(event_group_, MAIN_EVENT_WAKE_WORD_DETECTED);
     };
     callbacks.on_vad_change = [this](bool speaking) {
         xEventGroupSetBits(event_group_, MAIN_EVENT_VAD_CHANGE);
     };
-    audio_service_.SetCallbacks(callbacks);
+    callbacks.on_audio_output = [this]() {
+        interaction_timeline_.Mark(kInteractionPhaseFirstPlayback);
+    };
+
+    // Setup the audio service
+    int audio_step = boot.Add("audio", [this, &board, callbacks]() {
+        audio_service_.Initialize(board.GetAudioCodec());
+        audio_service_.Start();
+        audio_service_.SetCallbacks(callbacks);
+    }, {board_step});
+
+    // Map and verify the assets partition
+    int assets_step = boot.Add("assets", []() {
+        Assets::GetInstance();
+    }, {board_step});
+
+    // Fonts, emoji and the wake word models come from the assets, unless a new version is
+    // waiting to be downloaded into the only slot, then they are applied by CheckAssetsVersion() after the download
+    int apply_step = boot.Add("assets_apply", [this]() {
+        auto& assets = Assets::GetInstance();
+        Settings settings("assets");
+        if (assets.partition_valid() && (settings.GetString("download_url").empty() || assets.dual_slot())) {
+            assets_applied_ = assets.Apply();
+        }
+    }, {assets_step, audio_step});
+
+#if CONFIG_SPIRAM
+    // Without PSRAM the model is loaded once the device is idle, leaving the memory to the activation
+    boot.Add("wake_word", [this]() {
+        audio_service_.InitializeWakeWord();
+    }, {apply_step});
+#else
+    (void)apply_step;
+#endif
+
+    xTaskCreate([](void* arg) {
+        Application* app = static_cast<Application*>(arg);
+        app->AudioSenderTask();
+        vTaskDelete(NULL);
+    }, "audio_sender", 4096 * 2, this, 9, &audio_sender_task_handle_);
 
     // Add state change listeners
     state_machine_.AddStateChangeListener([this](DeviceState old_state, DeviceState new_state) {
@@ -94,9 +143,11 @@ void Application::Initialize() {
     esp_timer_start_periodic(clock_timer_handle_, 1000000);
 
     // Add MCP common tools (only once during initialization)
-    auto& mcp_server = McpServer::GetInstance();
-    mcp_server.AddCommonTools();
-    mcp_server.AddUserOnlyTools();
+    boot.Add("mcp_tools", []() {
+        auto& mcp_server = McpServer::GetInstance();
+        mcp_server.AddCommonTools();
+        mcp_server.AddUserOnlyTools();
+    }, {assets_step});
 
     // Set network event callback for UI updates and network state handling
     board.SetNetworkEventCallback([this](NetworkEvent event, const std::string& data) {
@@ -155,8 +206,12 @@ void Application::Initialize() {
         }
     });
 
-    // Start network asynchronously
-    board.StartNetwork();
+    // Start network asynchronously, entering the WiFi config mode plays a sound
+    boot.Add("network", [&board]() {
+        board.StartNetwork();
+    }, {audio_step});
+
+    boot.Run();
 
     // Update the status bar immediately to show the network state
     display->UpdateStatusBar(true);
@@ -168,7 +223,6 @@ void Application::Run() {
 
     const EventBits_t ALL_EVENTS = 
         MAIN_EVENT_SCHEDULE |
-        MAIN_EVENT_SEND_AUDIO |
         MAIN_EVENT_WAKE_WORD_DETECTED |
         MAIN_EVENT_VAD_CHANGE |
         MAIN_EVENT_CLOCK_TICK |
@@ -179,57 +233,72 @@ void Application::Run() {
         MAIN_EVENT_START_LISTENING |
         MAIN_EVENT_STOP_LISTENING |
         MAIN_EVENT_ACTIVATION_DONE |
-        MAIN_EVENT_STATE_CHANGED;
+        MAIN_EVENT_STATE_CHANGED |
+        MAIN_EVENT_AUDIO_CHANNEL_OPENED |
+        MAIN_EVENT_AUDIO_CHANNEL_OPEN_FAILED;
 
     while (true) {
         auto bits = xEventGroupWaitBits(event_group_, ALL_EVENTS, pdTRUE, pdFALSE, portMAX_DELAY);
+        int64_t iteration_start_us = esp_timer_get_time();
 
         if (bits & MAIN_EVENT_ERROR) {
+            MainLoopProfiler::Scope scope(main_loop_profiler_, "MAIN_EVENT_ERROR");
             SetDeviceState(kDeviceStateIdle);
             Alert(Lang::Strings::ERROR, last_error_message_.c_str(), "circle_xmark", Lang::Sounds::OGG_EXCLAMATION);
         }
 
         if (bits & MAIN_EVENT_NETWORK_CONNECTED) {
+            MainLoopProfiler::Scope scope(main_loop_profiler_, "HandleNetworkConnectedEvent");
             HandleNetworkConnectedEvent();
         }
 
         if (bits & MAIN_EVENT_NETWORK_DISCONNECTED) {
+            MainLoopProfiler::Scope scope(main_loop_profiler_, "HandleNetworkDisconnectedEvent");
             HandleNetworkDisconnectedEvent();
         }
 
         if (bits & MAIN_EVENT_ACTIVATION_DONE) {
+            MainLoopProfiler::Scope scope(main_loop_profiler_, "HandleActivationDoneEvent");
             HandleActivationDoneEvent();
         }
 
         if (bits & MAIN_EVENT_STATE_CHANGED) {
+            MainLoopProfiler::Scope scope(main_loop_profiler_, "HandleStateChangedEvent");
             HandleStateChangedEvent();
         }
 
+        if (bits & MAIN_EVENT_AUDIO_CHANNEL_OPENED) {
+            MainLoopProfiler::Scope scope(main_loop_profiler_, "HandleAudioChannelOpenResult");
+            HandleAudioChannelOpenResult(true);
+        }
+
+        if (bits & MAIN_EVENT_AUDIO_CHANNEL_OPEN_FAILED) {
+            MainLoopProfiler::Scope scope(main_loop_profiler_, "HandleAudioChannelOpenResult");
+            HandleAudioChannelOpenResult(false);
+        }
+
         if (bits & MAIN_EVENT_TOGGLE_CHAT) {
+            MainLoopProfiler::Scope scope(main_loop_profiler_, "HandleToggleChatEvent");
             HandleToggleChatEvent();
         }
 
         if (bits & MAIN_EVENT_START_LISTENING) {
+            MainLoopProfiler::Scope scope(main_loop_profiler_, "HandleStartListeningEvent");
             HandleStartListeningEvent();
         }
 
         if (bits & MAIN_EVENT_STOP_LISTENING) {
+            MainLoopProfiler::Scope scope(main_loop_profiler_, "HandleStopListeningEvent");
             HandleStopListeningEvent();
         }
 
-        if (bits & MAIN_EVENT_SEND_AUDIO) {
-            while (auto packet = audio_service_.PopPacketFromSendQueue()) {
-                if (protocol_ && !protocol_->SendAudio(std::move(packet))) {
-                    break;
-                }
-            }
-        }
-
         if (bits & MAIN_EVENT_WAKE_WORD_DETECTED) {
+            MainLoopProfiler::Scope scope(main_loop_profiler_, "HandleWakeWordDetectedEvent");
             HandleWakeWordDetectedEvent();
         }
 
         if (bits & MAIN_EVENT_VAD_CHANGE) {
+            MainLoopProfiler::Scope scope(main_loop_profiler_, "MAIN_EVENT_VAD_CHANGE");
             if (GetDeviceState() == kDeviceStateListening) {
                 auto led = Board::GetInstance().GetLed();
                 led->OnStateChanged();
@@ -237,23 +306,128 @@ void Application::Run() {
         }
 
         if (bits & MAIN_EVENT_SCHEDULE) {
-            std::unique_lock<std::mutex> lock(mutex_);
-            auto tasks = std::move(main_tasks_);
-            lock.unlock();
-            for (auto& task : tasks) {
+            MainLoopProfiler::Scope scope(main_loop_profiler_, "MAIN_EVENT_SCHEDULE");
+            // Bounded per wakeup so that tasks scheduling more tasks can not starve other events
+            ScheduledTask task;
+            std::source_location site;
+            int budget = SCHEDULE_QUEUE_SIZE;
+            while (budget-- > 0 && schedule_queue_.Pop(task, site)) {
+                MainLoopProfiler::Scope task_scope(main_loop_profiler_, SourceFileName(site.file_name()), site.line());
                 task();
+                task.Reset();
+            }
+            if (budget < 0) {
+                xEventGroupSetBits(event_group_, MAIN_EVENT_SCHEDULE);
             }
         }
 
         if (bits & MAIN_EVENT_CLOCK_TICK) {
+            MainLoopProfiler::Scope scope(main_loop_profiler_, "MAIN_EVENT_CLOCK_TICK");
             clock_ticks_++;
             auto display = Board::GetInstance().GetDisplay();
             display->UpdateStatusBar();
         
+            // Measure RTT while an audio session is active
+            if (clock_ticks_ % TRANSPORT_PING_INTERVAL_SECONDS == 0 && protocol_ && protocol_->IsAudioChannelOpened()) {
+                protocol_->SendPing();
+            }
+
             // Print debug info every 10 seconds
             if (clock_ticks_ % 10 == 0) {
                 SystemInfo::PrintHeapStats();
+                if (protocol_) {
+                    json_dispatcher_.PrintStats(protocol_->json_arena());
+                    if (protocol_->IsAudioChannelOpened()) {
+                        protocol_->transport_stats().Print();
+                    }
+                }
+                schedule_queue_.Print();
+                schedule_queue_.ResetStats();
+                main_loop_profiler_.Print();
+
+                AudioSendStats send_stats;
+                {
+                    std::lock_guard<std::mutex> lock(audio_send_stats_mutex_);
+                    send_stats = audio_send_stats_;
+                    audio_send_stats_ = AudioSendStats();
+                }
+                if (send_stats.packets > 0) {
+                    ESP_LOGI(TAG, "Audio send: %lu packets, avg %d ms, max %d ms, %lu slow, %lu failed, max backlog %u",
+                        (unsigned long)send_stats.packets, (int)(send_stats.total_us / send_stats.packets / 1000),
+                        (int)(send_stats.max_us / 1000), (unsigned long)send_stats.slow_sends,
+                        (unsigned long)send_stats.failures, (unsigned)send_stats.max_backlog);
+                }
+            }
+        }
+
+        // Time spent handling one wakeup, events queue up behind it
+        main_loop_profiler_.RecordIteration(esp_timer_get_time() - iteration_start_us);
+    }
+}
+
+void Application::NotifyAudioSender() {
+    if (audio_sender_task_handle_ != nullptr) {
+        xTaskNotifyGive(audio_sender_task_handle_);
+    }
+}
+
+void Application::AudioSenderTask() {
+    bool congested = false;
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        // Pending uplink audio is held until the start listening message is sent
+        while (!pending_uplink_) {
+            // A copy keeps the protocol alive during the send, the main task may reset protocol_ meanwhile
+            std::shared_ptr<Protocol> protocol;
+            {
+                std::lock_guard<std::mutex> protocol_lock(protocol_mutex_);
+                protocol = protocol_;
+            }
+            if (!protocol) {
+                break;
+            }
+            size_t backlog = audio_service_.GetSendQueueSize();
+            auto packet = audio_service_.PopPacketFromSendQueue();
+            if (!packet) {
+                break;
+            }
+
+            // Backpressure: the network can not keep up, the encoder stalls once the send queue is full
+            if (backlog >= AUDIO_SEND_BACKLOG_WARNING && !congested) {
+                ESP_LOGW(TAG, "Uplink congested, %u packets waiting", (unsigned)backlog);
+            }
+            congested = backlog >= AUDIO_SEND_BACKLOG_WARNING;
+
+            TRACE_COUNTER("send_queue", backlog);
+            int64_t start_us = esp_timer_get_time();
+            TRACE_BEGIN("SendAudio", 0);
+            bool success = protocol->SendAudio(std::move(packet));
+            TRACE_END("SendAudio");
+            int64_t elapsed_us = esp_timer_get_time() - start_us;
+            {
+                std::lock_guard<std::mutex> lock(audio_send_stats_mutex_);
+                auto& stats = audio_send_stats_;
+                stats.packets++;
+                stats.total_us += elapsed_us;
+                if (elapsed_us > stats.max_us) {
+                    stats.max_us = elapsed_us;
+                }
+                if (elapsed_us > AUDIO_SEND_SLOW_THRESHOLD_MS * 1000) {
+                    stats.slow_sends++;
+                }
+                if (backlog > stats.max_backlog) {
+                    stats.max_backlog = backlog;
+                }
+                if (!success) {
+                    stats.failures++;
+                }
             }
+            if (!success) {
+                // Channel closed or network error, wait for the next packet
+                break;
+            }
+            interaction_timeline_.Mark(kInteractionPhaseFirstUplink);
         }
     }
 }
@@ -288,7 +462,7 @@ void Application::HandleNetworkDisconnectedEvent() {
     auto state = GetDeviceState();
     if (state == kDeviceStateConnecting || state == kDeviceStateListening || state == kDeviceStateSpeaking) {
         ESP_LOGI(TAG, "Closing audio channel due to network disconnection");
-        protocol_->CloseAudioChannel();
+        CloseAudioChannel();
     }
 
     // Update the status bar immediately to show the network state
@@ -318,6 +492,77 @@ void Application::HandleActivationDoneEvent() {
     board.SetPowerSaveLevel(PowerSaveLevel::LOW_POWER);
 }
 
+bool Application::StartInteractionBenchmark(int count, int interval_seconds, const std::string& wake_word) {
+    bool expected = false;
+    if (!benchmark_running_.compare_exchange_strong(expected, true)) {
+        ESP_LOGW(TAG, "Benchmark task already running");
+        return false;
+    }
+    benchmark_count_ = count;
+    benchmark_interval_seconds_ = interval_seconds;
+    benchmark_wake_word_ = wake_word;
+    auto ret = xTaskCreate([](void* arg) {
+        Application* app = static_cast<Application*>(arg);
+        app->InteractionBenchmarkTask();
+        app->benchmark_running_ = false;
+        vTaskDelete(NULL);
+    }, "benchmark", 4096, this, 2, nullptr);
+    if (ret != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create the benchmark task");
+        benchmark_running_ = false;
+        return false;
+    }
+    return true;
+}
+
+// Each run starts from idle with the audio channel closed, so that the handshake is part of the measurement
+void Application::InteractionBenchmarkTask() {
+    auto wait_for = [this](std::function<bool()> condition, int timeout_ms) {
+        for (int elapsed_ms = 0; elapsed_ms < timeout_ms; elapsed_ms += 100) {
+            if (condition()) {
+                return true;
+            }
+            vTaskDelay(pdMS_TO_TICKS(100));
+        }
+        return condition();
+    };
+
+    ESP_LOGI(TAG, "Benchmark: %d interactions with %s, %d seconds apart", benchmark_count_,
+        benchmark_wake_word_.c_str(), benchmark_interval_seconds_);
+    uint32_t completed_before = interaction_timeline_.completed();
+    for (int i = 0; i < benchmark_count_; i++) {
+        // The reply returns to listening in auto stop and realtime modes, close the channel to get back to idle
+        bool closing = false;
+        bool idle = wait_for([this, &closing]() {
+            auto state = GetDeviceState();
+            if (state == kDeviceStateListening && !closing) {
+                closing = true;
+                Schedule([this]() {
+                    if (GetDeviceState() == kDeviceStateListening) {
+                        CloseAudioChannel();
+                    }
+                });
+            }
+            return state == kDeviceStateIdle;
+        }, 10000);
+        if (!idle) {
+            ESP_LOGE(TAG, "Benchmark: device is not idle, stopping");
+            break;
+        }
+        vTaskDelay(pdMS_TO_TICKS(benchmark_interval_seconds_ * 1000));
+
+        uint32_t completed = interaction_timeline_.completed();
+        WakeWordInvoke(benchmark_wake_word_);
+        if (!wait_for([this, completed]() { return interaction_timeline_.completed() != completed; }, 30000)) {
+            ESP_LOGW(TAG, "Benchmark: no reply audio in interaction %d", i + 1);
+        }
+        // Let the reply finish before the next run
+        wait_for([this]() { return GetDeviceState() != kDeviceStateSpeaking; }, 60000);
+    }
+    ESP_LOGI(TAG, "Benchmark done, %lu of %d interactions completed",
+        (unsigned long)(interaction_timeline_.completed() - completed_before), benchmark_count_);
+}
+
 void Application::ActivationTask() {
     // Create OTA object for activation process
     ota_ = std::make_unique<Ota>();
@@ -328,6 +573,16 @@ void Application::ActivationTask() {
     // Check for new firmware version
     CheckNewVersion();
 
+    // After the version check, so that the download does not share its HTTP connection
+    if (background_assets_download_) {
+        background_assets_download_ = false;
+        xTaskCreate([](void* arg) {
+            Application* app = static_cast<Application*>(arg);
+            app->AssetsDownloadTask();
+            vTaskDelete(NULL);
+        }, "assets_download", 4096 * 2, this, 1, nullptr);
+    }
+
     // Initialize the protocol
     InitializeProtocol();
 
@@ -354,10 +609,16 @@ void Application::CheckAssetsVersion() {
     Settings settings("assets", true);
     // Check if there is a new assets need to be downloaded
     std::string download_url = settings.GetString("download_url");
+    std::string download_sha256 = settings.GetString("download_sha256");
+    std::string manifest_url = settings.GetString("manifest_url");
 
-    if (!download_url.empty()) {
-        settings.EraseKey("download_url");
+    // With two slots the current assets stay in use, the download runs in the background once activation is done
+    if (!download_url.empty() && assets.dual_slot() && assets_applied_) {
+        background_assets_download_ = true;
+        return;
+    }
 
+    if (!download_url.empty()) {
         char message[256];
         snprintf(message, sizeof(message), Lang::Strings::FOUND_NEW_ASSETS, download_url.c_str());
         Alert(Lang::Strings::LOADING_ASSETS, message, "cloud_arrow_down", Lang::Sounds::OGG_UPGRADE);
@@ -374,7 +635,14 @@ void Application::CheckAssetsVersion() {
                 snprintf(buffer, sizeof(buffer), "%d%% %uKB/s", progress, speed / 1024);
                 display->SetChatMessage("system", buffer);
             }).detach();
-        });
+        }, download_sha256, manifest_url);
+
+        // An interrupted download keeps its URL, so that the next check resumes it from the checkpoint
+        if (success || !DownloadCheckpoint("assets").IsPending()) {
+            settings.EraseKey("download_url");
+            settings.EraseKey("download_sha256");
+            settings.EraseKey("manifest_url");
+        }
 
         board.SetPowerSaveLevel(PowerSaveLevel::LOW_POWER);
         vTaskDelay(pdMS_TO_TICKS(1000));
@@ -387,12 +655,43 @@ void Application::CheckAssetsVersion() {
         }
     }
 
-    // Apply assets
-    assets.Apply();
+    // Apply assets, unless they were applied at boot and nothing was downloaded
+    if (!assets_applied_ || !download_url.empty()) {
+        assets.Apply();
+    }
     display->SetChatMessage("system", "");
     display->SetEmotion("microchip_ai");
 }
 
+void Application::AssetsDownloadTask() {
+    auto& assets = Assets::GetInstance();
+    Settings settings("assets", true);
+    std::string download_url = settings.GetString("download_url");
+    int last_progress = -1;
+    bool success = assets.Download(download_url, [&last_progress](int progress, size_t speed) -> void {
+        if (progress / 10 != last_progress / 10) {
+            last_progress = progress;
+            ESP_LOGI(TAG, "Assets download %d%% %uKB/s", progress, speed / 1024);
+        }
+    }, settings.GetString("download_sha256"), settings.GetString("manifest_url"), ASSETS_DOWNLOAD_CONNECT_ID);
+
+    // An interrupted download keeps its URL, so that the next check resumes it from the checkpoint
+    if (success || !DownloadCheckpoint("assets").IsPending()) {
+        settings.EraseKey("download_url");
+        settings.EraseKey("download_sha256");
+        settings.EraseKey("manifest_url");
+    }
+    if (!success) {
+        ESP_LOGE(TAG, "Failed to download the assets, the current ones stay in use");
+        return;
+    }
+
+    // The new slot is mapped, point the theme at it from the main task, like the other UI changes
+    Schedule([]() {
+        Assets::GetInstance().Apply();
+    });
+}
+
 void Application::CheckNewVersion() {
     const int MAX_RETRY = 10;
     int retry_count = 0;
@@ -431,7 +730,8 @@ void Application::CheckNewVersion() {
         retry_delay = 10; // Reset retry delay
 
         if (ota_->HasNewVersion()) {
-            if (UpgradeFirmware(ota_->GetFirmwareUrl(), ota_->GetFirmwareVersion())) {
+            if (UpgradeFirmware(ota_->GetFirmwareUrl(), ota_->GetFirmwareVersion(), ota_->GetFirmwareSha256(),
+                    ota_->GetFirmwareDeltaUrl(), ota_->GetFirmwareCompressedUrl())) {
                 return; // This line will never be reached after reboot
             }
             // If upgrade failed, continue to normal operation
@@ -475,13 +775,18 @@ void Application::InitializeProtocol() {
 
     display->SetStatus(Lang::Strings::LOADING_PROTOCOL);
 
+    std::shared_ptr<Protocol> protocol;
     if (ota_->HasMqttConfig()) {
-        protocol_ = std::make_unique<MqttProtocol>();
+        protocol = std::make_shared<MqttProtocol>();
     } else if (ota_->HasWebsocketConfig()) {
-        protocol_ = std::make_unique<WebsocketProtocol>();
+        protocol = std::make_shared<WebsocketProtocol>();
     } else {
         ESP_LOGW(TAG, "No protocol specified in the OTA config, using MQTT");
-        protocol_ = std::make_unique<MqttProtocol>();
+        protocol = std::make_shared<MqttProtocol>();
+    }
+    {
+        std::lock_guard<std::mutex> lock(protocol_mutex_);
+        protocol_ = protocol;
     }
 
     protocol_->OnConnected([this]() {
@@ -495,6 +800,7 @@ void Application::InitializeProtocol() {
     
     protocol_->OnIncomingAudio([this](std::unique_ptr<AudioStreamPacket> packet) {
         if (GetDeviceState() == kDeviceStateSpeaking) {
+            interaction_timeline_.Mark(kInteractionPhaseFirstDownlink);
             audio_service_.PushPacketToDecodeQueue(std::move(packet));
         }
     });
@@ -516,95 +822,117 @@ void Application::InitializeProtocol() {
         });
     });
     
-    protocol_->OnIncomingJson([this, display](const cJSON* root) {
-        // Parse JSON data
-        auto type = cJSON_GetObjectItem(root, "type");
-        if (strcmp(type->valuestring, "tts") == 0) {
-            auto state = cJSON_GetObjectItem(root, "state");
-            if (strcmp(state->valuestring, "start") == 0) {
-                Schedule([this]() {
-                    aborted_ = false;
-                    SetDeviceState(kDeviceStateSpeaking);
-                });
-            } else if (strcmp(state->valuestring, "stop") == 0) {
-                Schedule([this]() {
-                    if (GetDeviceState() == kDeviceStateSpeaking) {
-                        if (listening_mode_ == kListeningModeManualStop) {
-                            SetDeviceState(kDeviceStateIdle);
-                        } else {
-                            SetDeviceState(kDeviceStateListening);
-                        }
+    InitializeMessageHandlers();
+    protocol_->OnIncomingJson([this](const JsonMessage& message) {
+        json_dispatcher_.Dispatch(message);
+    });
+    
+    protocol_->Start();
+}
+
+void Application::InitializeMessageHandlers() {
+    auto display = Board::GetInstance().GetDisplay();
+
+    json_dispatcher_.Register("tts", [this, display](const JsonMessage& message) {
+        std::string_view state;
+        if (!message.GetString("state", state)) {
+            return;
+        }
+        if (state == "start") {
+            interaction_timeline_.Mark(kInteractionPhaseTtsStart);
+            Schedule([this]() {
+                aborted_ = false;
+                SetDeviceState(kDeviceStateSpeaking);
+            });
+        } else if (state == "stop") {
+            Schedule([this]() {
+                if (GetDeviceState() == kDeviceStateSpeaking) {
+                    if (listening_mode_ == kListeningModeManualStop) {
+                        SetDeviceState(kDeviceStateIdle);
+                    } else {
+                        SetDeviceState(kDeviceStateListening);
                     }
-                });
-            } else if (strcmp(state->valuestring, "sentence_start") == 0) {
-                auto text = cJSON_GetObjectItem(root, "text");
-                if (cJSON_IsString(text)) {
-                    ESP_LOGI(TAG, "<< %s", text->valuestring);
-                    Schedule([display, message = std::string(text->valuestring)]() {
-                        display->SetChatMessage("assistant", message.c_str());
-                    });
                 }
-            }
-        } else if (strcmp(type->valuestring, "stt") == 0) {
-            auto text = cJSON_GetObjectItem(root, "text");
-            if (cJSON_IsString(text)) {
-                ESP_LOGI(TAG, ">> %s", text->valuestring);
-                Schedule([display, message = std::string(text->valuestring)]() {
-                    display->SetChatMessage("user", message.c_str());
+            });
+        } else if (state == "sentence_start") {
+            std::string_view text;
+            if (message.GetString("text", text)) {
+                ESP_LOGI(TAG, "<< %.*s", (int)text.size(), text.data());
+                Schedule([display, text_str = std::string(text)]() {
+                    display->SetChatMessage("assistant", text_str.c_str());
                 });
             }
-        } else if (strcmp(type->valuestring, "llm") == 0) {
-            auto emotion = cJSON_GetObjectItem(root, "emotion");
-            if (cJSON_IsString(emotion)) {
-                Schedule([display, emotion_str = std::string(emotion->valuestring)]() {
-                    display->SetEmotion(emotion_str.c_str());
+        }
+    });
+
+    json_dispatcher_.Register("stt", [this, display](const JsonMessage& message) {
+        interaction_timeline_.Mark(kInteractionPhaseStt);
+        std::string_view text;
+        if (message.GetString("text", text)) {
+            ESP_LOGI(TAG, ">> %.*s", (int)text.size(), text.data());
+            Schedule([display, text_str = std::string(text)]() {
+                display->SetChatMessage("user", text_str.c_str());
+            });
+        }
+    });
+
+    json_dispatcher_.Register("llm", [this, display](const JsonMessage& message) {
+        std::string_view emotion;
+        if (message.GetString("emotion", emotion)) {
+            Schedule([display, emotion_str = std::string(emotion)]() {
+                display->SetEmotion(emotion_str.c_str());
+            });
+        }
+    });
+
+    json_dispatcher_.Register("mcp", [](const JsonMessage& message) {
+        // MCP payloads are nested, fall back to the cJSON tree
+        auto payload = cJSON_GetObjectItem(message.tree(), "payload");
+        if (cJSON_IsObject(payload)) {
+            McpServer::GetInstance().ParseMessage(payload);
+        }
+    });
+
+    json_dispatcher_.Register("system", [this](const JsonMessage& message) {
+        std::string_view command;
+        if (message.GetString("command", command)) {
+            ESP_LOGI(TAG, "System command: %.*s", (int)command.size(), command.data());
+            if (command == "reboot") {
+                // Do a reboot if user requests a OTA update
+                Schedule([this]() {
+                    Reboot();
                 });
-            }
-        } else if (strcmp(type->valuestring, "mcp") == 0) {
-            auto payload = cJSON_GetObjectItem(root, "payload");
-            if (cJSON_IsObject(payload)) {
-                McpServer::GetInstance().ParseMessage(payload);
-            }
-        } else if (strcmp(type->valuestring, "system") == 0) {
-            auto command = cJSON_GetObjectItem(root, "command");
-            if (cJSON_IsString(command)) {
-                ESP_LOGI(TAG, "System command: %s", command->valuestring);
-                if (strcmp(command->valuestring, "reboot") == 0) {
-                    // Do a reboot if user requests a OTA update
-                    Schedule([this]() {
-                        Reboot();
-                    });
-                } else {
-                    ESP_LOGW(TAG, "Unknown system command: %s", command->valuestring);
-                }
-            }
-        } else if (strcmp(type->valuestring, "alert") == 0) {
-            auto status = cJSON_GetObjectItem(root, "status");
-            auto message = cJSON_GetObjectItem(root, "message");
-            auto emotion = cJSON_GetObjectItem(root, "emotion");
-            if (cJSON_IsString(status) && cJSON_IsString(message) && cJSON_IsString(emotion)) {
-                Alert(status->valuestring, message->valuestring, emotion->valuestring, Lang::Sounds::OGG_VIBRATION);
             } else {
-                ESP_LOGW(TAG, "Alert command requires status, message and emotion");
+                ESP_LOGW(TAG, "Unknown system command: %.*s", (int)command.size(), command.data());
             }
+        }
+    });
+
+    json_dispatcher_.Register("alert", [this](const JsonMessage& message) {
+        std::string_view status, text, emotion;
+        if (message.GetString("status", status) && message.GetString("message", text) && message.GetString("emotion", emotion)) {
+            Alert(std::string(status).c_str(), std::string(text).c_str(), std::string(emotion).c_str(), Lang::Sounds::OGG_VIBRATION);
+        } else {
+            ESP_LOGW(TAG, "Alert command requires status, message and emotion");
+        }
+    });
+
 #if CONFIG_RECEIVE_CUSTOM_MESSAGE
-        } else if (strcmp(type->valuestring, "custom") == 0) {
-            auto payload = cJSON_GetObjectItem(root, "payload");
-            ESP_LOGI(TAG, "Received custom message: %s", cJSON_PrintUnformatted(root));
-            if (cJSON_IsObject(payload)) {
-                Schedule([this, display, payload_str = std::string(cJSON_PrintUnformatted(payload))]() {
-                    display->SetChatMessage("system", payload_str.c_str());
-                });
-            } else {
-                ESP_LOGW(TAG, "Invalid custom message format: missing payload");
-            }
-#endif
+    json_dispatcher_.Register("custom", [this, display](const JsonMessage& message) {
+        auto raw = message.raw();
+        ESP_LOGI(TAG, "Received custom message: %.*s", (int)raw.size(), raw.data());
+        // The payload is forwarded as its raw JSON text, no need to print it from a cJSON tree
+        std::string_view payload;
+        JsonValueKind kind;
+        if (message.GetRaw("payload", payload, &kind) && kind == kJsonValueObject) {
+            Schedule([display, payload_str = std::string(payload)]() {
+                display->SetChatMessage("system", payload_str.c_str());
+            });
         } else {
-            ESP_LOGW(TAG, "Unknown message type: %s", type->valuestring);
+            ESP_LOGW(TAG, "Invalid custom message format: missing payload");
         }
     });
-    
-    protocol_->Start();
+#endif
 }
 
 void Application::ShowActivationCode(const std::string& code, const std::string& message) {
@@ -691,18 +1019,13 @@ void Application::HandleToggleChatEvent() {
     }
 
     if (state == kDeviceStateIdle) {
-        if (!protocol_->IsAudioChannelOpened()) {
-            SetDeviceState(kDeviceStateConnecting);
-            if (!protocol_->OpenAudioChannel()) {
-                return;
-            }
-        }
-
-        SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
+        OpenAudioChannelAsync([this]() {
+            SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
+        });
     } else if (state == kDeviceStateSpeaking) {
         AbortSpeaking(kAbortReasonNone);
     } else if (state == kDeviceStateListening) {
-        protocol_->CloseAudioChannel();
+        CloseAudioChannel();
     }
 }
 
@@ -724,20 +1047,109 @@ void Application::HandleStartListeningEvent() {
     }
     
     if (state == kDeviceStateIdle) {
-        if (!protocol_->IsAudioChannelOpened()) {
-            SetDeviceState(kDeviceStateConnecting);
-            if (!protocol_->OpenAudioChannel()) {
-                return;
-            }
-        }
-
-        SetListeningMode(kListeningModeManualStop);
+        OpenAudioChannelAsync([this]() {
+            SetListeningMode(kListeningModeManualStop);
+        });
     } else if (state == kDeviceStateSpeaking) {
         AbortSpeaking(kAbortReasonNone);
         SetListeningMode(kListeningModeManualStop);
     }
 }
 
+// Open the audio channel on a worker task so that the main loop keeps running during the handshake.
+// Voice processing starts right away: packets wait in the send queue (bounded, newest dropped) and
+// are flushed once the listening state is entered, or dropped if the open fails.
+// on_opened / on_failed run on the main task.
+void Application::OpenAudioChannelAsync(std::function<void()> on_opened, std::function<void()> on_failed) {
+    if (audio_channel_opening_) {
+        ESP_LOGW(TAG, "Audio channel is already opening");
+        return;
+    }
+    if (protocol_->IsAudioChannelOpened()) {
+        on_opened();
+        return;
+    }
+
+    SetDeviceState(kDeviceStateConnecting);
+    audio_service_.EnablePendingUplink(true);
+    audio_service_.EnableVoiceProcessing(true);
+    audio_service_.EnableWakeWordDetection(false);
+
+    // The sender holds the queued packets until the start listening message is sent
+    pending_uplink_ = true;
+    audio_channel_opening_ = true;
+    audio_channel_open_cancelled_ = false;
+    on_audio_channel_opened_ = std::move(on_opened);
+    on_audio_channel_open_failed_ = std::move(on_failed);
+    interaction_timeline_.Mark(kInteractionPhaseChannelOpening);
+    auto ret = xTaskCreate([](void* arg) {
+        Application* app = static_cast<Application*>(arg);
+        // The copy keeps the protocol alive if ResetProtocol() or Reboot() releases it during the handshake
+        std::shared_ptr<Protocol> protocol;
+        {
+            std::lock_guard<std::mutex> lock(app->protocol_mutex_);
+            protocol = app->protocol_;
+        }
+        bool opened = protocol && protocol->OpenAudioChannel();
+        xEventGroupSetBits(app->event_group_, opened ? MAIN_EVENT_AUDIO_CHANNEL_OPENED : MAIN_EVENT_AUDIO_CHANNEL_OPEN_FAILED);
+        vTaskDelete(NULL);
+    }, "open_channel", 4096 * 2, this, 4, nullptr);
+    if (ret != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create the open channel task");
+        HandleAudioChannelOpenResult(false);
+        SetDeviceState(kDeviceStateIdle);
+    }
+}
+
+void Application::HandleAudioChannelOpenResult(bool opened) {
+    audio_channel_opening_ = false;
+    bool cancelled = audio_channel_open_cancelled_;
+    audio_channel_open_cancelled_ = false;
+    auto on_opened = std::move(on_audio_channel_opened_);
+    auto on_failed = std::move(on_audio_channel_open_failed_);
+
+    int dropped = audio_service_.EnablePendingUplink(false);
+    if (dropped > 0) {
+        ESP_LOGW(TAG, "Dropped %d pending uplink packets during the handshake", dropped);
+    }
+    if (!opened || !protocol_) {
+        audio_service_.EnableVoiceProcessing(false);
+        audio_service_.ClearSendQueue();
+        pending_uplink_ = false;
+        NotifyAudioSender();
+        if (on_failed) {
+            on_failed();
+        }
+        return;
+    }
+
+    // A close was requested or the state changed while the handshake was running (e.g. network lost)
+    if (cancelled || GetDeviceState() != kDeviceStateConnecting) {
+        ESP_LOGW(TAG, "Audio channel opened after it was closed or the state changed, closing it");
+        audio_service_.ClearSendQueue();
+        pending_uplink_ = false;
+        NotifyAudioSender();
+        protocol_->CloseAudioChannel();
+        return;
+    }
+    interaction_timeline_.Mark(kInteractionPhaseChannelOpened);
+    if (on_opened) {
+        on_opened();
+    }
+}
+
+// The handshake runs on the open_channel worker, which is still using the protocol. A close requested
+// meanwhile is left to HandleAudioChannelOpenResult, which closes the channel once the open returns.
+void Application::CloseAudioChannel() {
+    if (audio_channel_opening_) {
+        audio_channel_open_cancelled_ = true;
+        return;
+    }
+    if (protocol_) {
+        protocol_->CloseAudioChannel();
+    }
+}
+
 void Application::HandleStopListeningEvent() {
     auto state = GetDeviceState();
     
@@ -763,30 +1175,26 @@ void Application::HandleWakeWordDetectedEvent() {
     if (state == kDeviceStateIdle) {
         audio_service_.EncodeWakeWord();
 
-        if (!protocol_->IsAudioChannelOpened()) {
-            SetDeviceState(kDeviceStateConnecting);
-            if (!protocol_->OpenAudioChannel()) {
-                audio_service_.EnableWakeWordDetection(true);
-                return;
-            }
-        }
-
-        auto wake_word = audio_service_.GetLastWakeWord();
-        ESP_LOGI(TAG, "Wake word detected: %s", wake_word.c_str());
+        OpenAudioChannelAsync([this]() {
+            auto wake_word = audio_service_.GetLastWakeWord();
+            ESP_LOGI(TAG, "Wake word detected: %s", wake_word.c_str());
 #if CONFIG_SEND_WAKE_WORD_DATA
-        // Encode and send the wake word data to the server
-        while (auto packet = audio_service_.PopWakeWordPacket()) {
-            protocol_->SendAudio(std::move(packet));
-        }
-        // Set the chat state to wake word detected
-        protocol_->SendWakeWordDetected(wake_word);
-        SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
+            // Encode and send the wake word data to the server
+            while (auto packet = audio_service_.PopWakeWordPacket()) {
+                protocol_->SendAudio(std::move(packet));
+            }
+            // Set the chat state to wake word detected
+            protocol_->SendWakeWordDetected(wake_word);
+            SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
 #else
-        // Set flag to play popup sound after state changes to listening
-        // (PlaySound here would be cleared by ResetDecoder in EnableVoiceProcessing)
-        play_popup_on_listening_ = true;
-        SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
+            // Set flag to play popup sound after state changes to listening
+            // (PlaySound here would be cleared by ResetDecoder in EnableVoiceProcessing)
+            play_popup_on_listening_ = true;
+            SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
 #endif
+        }, [this]() {
+            audio_service_.EnableWakeWordDetection(true);
+        });
     } else if (state == kDeviceStateSpeaking) {
         AbortSpeaking(kAbortReasonWakeWordDetected);
     } else if (state == kDeviceStateActivating) {
@@ -798,6 +1206,7 @@ void Application::HandleWakeWordDetectedEvent() {
 void Application::HandleStateChangedEvent() {
     DeviceState new_state = state_machine_.GetState();
     clock_ticks_ = 0;
+    TRACE_INSTANT("device_state", new_state);
 
     auto& board = Board::GetInstance();
     auto display = board.GetDisplay();
@@ -809,6 +1218,8 @@ void Application::HandleStateChangedEvent() {
         case kDeviceStateIdle:
             display->SetStatus(Lang::Strings::STANDBY);
             display->SetEmotion("neutral");
+            pending_uplink_ = false;
+            interaction_timeline_.Abandon();
             audio_service_.EnableVoiceProcessing(false);
             audio_service_.EnableWakeWordDetection(true);
             break;
@@ -821,8 +1232,13 @@ void Application::HandleStateChangedEvent() {
             display->SetStatus(Lang::Strings::LISTENING);
             display->SetEmotion("neutral");
 
-            // Make sure the audio processor is running
-            if (!audio_service_.IsAudioProcessorRunning()) {
+            if (pending_uplink_) {
+                // Voice processing started before the handshake, send what was captured as a burst
+                protocol_->SendStartListening(listening_mode_);
+                pending_uplink_ = false;
+                NotifyAudioSender();
+            } else if (!audio_service_.IsAudioProcessorRunning()) {
+                // Make sure the audio processor is running
                 // For auto mode, wait for playback queue to be empty before enabling voice processing
                 // This prevents audio truncation when STOP arrives late due to network jitter
                 if (listening_mode_ == kListeningModeAutoStop) {
@@ -861,14 +1277,6 @@ void Application::HandleStateChangedEvent() {
     }
 }
 
-void Application::Schedule(std::function<void()>&& callback) {
-    {
-        std::lock_guard<std::mutex> lock(mutex_);
-        main_tasks_.push_back(std::move(callback));
-    }
-    xEventGroupSetBits(event_group_, MAIN_EVENT_SCHEDULE);
-}
-
 void Application::AbortSpeaking(AbortReason reason) {
     ESP_LOGI(TAG, "Abort speaking");
     aborted_ = true;
@@ -885,17 +1293,21 @@ void Application::SetListeningMode(ListeningMode mode) {
 void Application::Reboot() {
     ESP_LOGI(TAG, "Rebooting...");
     // Disconnect the audio channel
-    if (protocol_ && protocol_->IsAudioChannelOpened()) {
-        protocol_->CloseAudioChannel();
+    if (audio_channel_opening_ || (protocol_ && protocol_->IsAudioChannelOpened())) {
+        CloseAudioChannel();
+    }
+    {
+        std::lock_guard<std::mutex> lock(protocol_mutex_);
+        protocol_.reset();
     }
-    protocol_.reset();
     audio_service_.Stop();
 
     vTaskDelay(pdMS_TO_TICKS(1000));
     esp_restart();
 }
 
-bool Application::UpgradeFirmware(const std::string& url, const std::string& version) {
+bool Application::UpgradeFirmware(const std::string& url, const std::string& version, const std::string& sha256,
+    const std::string& delta_url, const std::string& compressed_url) {
     auto& board = Board::GetInstance();
     auto display = board.GetDisplay();
 
@@ -903,9 +1315,9 @@ bool Application::UpgradeFirmware(const std::string& url, const std::string& ver
     std::string version_info = version.empty() ? "(Manual upgrade)" : version;
 
     // Close audio channel if it's open
-    if (protocol_ && protocol_->IsAudioChannelOpened()) {
+    if (audio_channel_opening_ || (protocol_ && protocol_->IsAudioChannelOpened())) {
         ESP_LOGI(TAG, "Closing audio channel before firmware upgrade");
-        protocol_->CloseAudioChannel();
+        CloseAudioChannel();
     }
     ESP_LOGI(TAG, "Starting firmware upgrade from URL: %s", upgrade_url.c_str());
 
@@ -921,13 +1333,15 @@ bool Application::UpgradeFirmware(const std::string& url, const std::string& ver
     audio_service_.Stop();
     vTaskDelay(pdMS_TO_TICKS(1000));
 
-    bool upgrade_success = Ota::Upgrade(upgrade_url, [display](int progress, size_t speed) {
+    auto progress_callback = [display](int progress, size_t speed) {
         std::thread([display, progress, speed]() {
             char buffer[32];
             snprintf(buffer, sizeof(buffer), "%d%% %uKB/s", progress, speed / 1024);
             display->SetChatMessage("system", buffer);
         }).detach();
-    });
+    };
+    // A delta against the running firmware is much smaller, then the compressed image; the full image is the fallback
+    bool upgrade_success = Ota::StartUpgrade(upgrade_url, delta_url, compressed_url, progress_callback, sha256);
 
     if (!upgrade_success) {
         // Upgrade failed, restart audio service and continue running
@@ -955,40 +1369,40 @@ void Application::WakeWordInvoke(const std::string& wake_word) {
     auto state = GetDeviceState();
     
     if (state == kDeviceStateIdle) {
-        audio_service_.EncodeWakeWord();
-
-        if (!protocol_->IsAudioChannelOpened()) {
-            SetDeviceState(kDeviceStateConnecting);
-            if (!protocol_->OpenAudioChannel()) {
-                audio_service_.EnableWakeWordDetection(true);
+        interaction_timeline_.Begin("invoke");
+        Schedule([this, wake_word]() {
+            if (GetDeviceState() != kDeviceStateIdle) {
                 return;
             }
-        }
+            audio_service_.EncodeWakeWord();
 
-        ESP_LOGI(TAG, "Wake word detected: %s", wake_word.c_str());
+            OpenAudioChannelAsync([this, wake_word]() {
+                ESP_LOGI(TAG, "Wake word detected: %s", wake_word.c_str());
 #if CONFIG_USE_AFE_WAKE_WORD || CONFIG_USE_CUSTOM_WAKE_WORD
-        // Encode and send the wake word data to the server
-        while (auto packet = audio_service_.PopWakeWordPacket()) {
-            protocol_->SendAudio(std::move(packet));
-        }
-        // Set the chat state to wake word detected
-        protocol_->SendWakeWordDetected(wake_word);
-        SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
+                // Encode and send the wake word data to the server
+                while (auto packet = audio_service_.PopWakeWordPacket()) {
+                    protocol_->SendAudio(std::move(packet));
+                }
+                // Set the chat state to wake word detected
+                protocol_->SendWakeWordDetected(wake_word);
+                SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
 #else
-        // Set flag to play popup sound after state changes to listening
-        // (PlaySound here would be cleared by ResetDecoder in EnableVoiceProcessing)
-        play_popup_on_listening_ = true;
-        SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
+                // Set flag to play popup sound after state changes to listening
+                // (PlaySound here would be cleared by ResetDecoder in EnableVoiceProcessing)
+                play_popup_on_listening_ = true;
+                SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
 #endif
+            }, [this]() {
+                audio_service_.EnableWakeWordDetection(true);
+            });
+        });
     } else if (state == kDeviceStateSpeaking) {
         Schedule([this]() {
             AbortSpeaking(kAbortReasonNone);
         });
     } else if (state == kDeviceStateListening) {   
         Schedule([this]() {
-            if (protocol_) {
-                protocol_->CloseAudioChannel();
-            }
+            CloseAudioChannel();
         });
     }
 }
@@ -998,7 +1412,7 @@ bool Application::CanEnterSleepMode() {
         return false;
     }
 
-    if (protocol_ && protocol_->IsAudioChannelOpened()) {
+    if (audio_channel_opening_ || (protocol_ && protocol_->IsAudioChannelOpened())) {
         return false;
     }
 
@@ -1010,7 +1424,7 @@ bool Application::CanEnterSleepMode() {
     return true;
 }
 
-void Application::SendMcpMessage(const std::string& payload) {
+void Application::SendMcpMessage(std::string payload) {
     // Always schedule to run in main task for thread safety
     Schedule([this, payload = std::move(payload)]() {
         if (protocol_) {
@@ -1040,8 +1454,8 @@ void Application::SetAecMode(AecMode mode) {
         }
 
         // If the AEC mode is changed, close the audio channel
-        if (protocol_ && protocol_->IsAudioChannelOpened()) {
-            protocol_->CloseAudioChannel();
+        if (audio_channel_opening_ || (protocol_ && protocol_->IsAudioChannelOpened())) {
+            CloseAudioChannel();
         }
     });
 }
@@ -1053,10 +1467,11 @@ void Application::PlaySound(const std::string_view& sound) {
 void Application::ResetProtocol() {
     Schedule([this]() {
         // Close audio channel if opened
-        if (protocol_ && protocol_->IsAudioChannelOpened()) {
-            protocol_->CloseAudioChannel();
+        if (audio_channel_opening_ || (protocol_ && protocol_->IsAudioChannelOpened())) {
+            CloseAudioChannel();
         }
-        // Reset protocol
+        // An open or send in progress keeps its own copy of the protocol
+        std::lock_guard<std::mutex> lock(protocol_mutex_);
         protocol_.reset();
     });
 }
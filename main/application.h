@@ -8,10 +8,14 @@
 
 #include <string>
 #include <mutex>
-#include <deque>
 #include <memory>
+#include <atomic>
 
 #include "protocol.h"
+#include "json_dispatcher.h"
+#include "schedule_queue.h"
+#include "main_loop_profiler.h"
+#include "interaction_timeline.h"
 #include "ota.h"
 #include "audio_service.h"
 #include "device_state.h"
@@ -19,7 +23,6 @@
 
 // Main event bits
 #define MAIN_EVENT_SCHEDULE             (1 << 0)
-#define MAIN_EVENT_SEND_AUDIO           (1 << 1)
 #define MAIN_EVENT_WAKE_WORD_DETECTED   (1 << 2)
 #define MAIN_EVENT_VAD_CHANGE           (1 << 3)
 #define MAIN_EVENT_ERROR                (1 << 4)
@@ -31,6 +34,27 @@
 #define MAIN_EVENT_START_LISTENING      (1 << 10)
 #define MAIN_EVENT_STOP_LISTENING       (1 << 11)
 #define MAIN_EVENT_STATE_CHANGED        (1 << 12)
+#define MAIN_EVENT_AUDIO_CHANNEL_OPENED (1 << 13)
+#define MAIN_EVENT_AUDIO_CHANNEL_OPEN_FAILED (1 << 14)
+
+// Interval of timestamped pings while an audio channel is open
+#define TRANSPORT_PING_INTERVAL_SECONDS 10
+// Uplink sender: a SendAudio call longer than this is counted as slow, and a
+// send queue deeper than this many packets is reported as congestion
+#define AUDIO_SEND_SLOW_THRESHOLD_MS 50
+#define AUDIO_SEND_BACKLOG_WARNING 10
+// Network connection id of the background assets download, apart from the protocols (0-2), the
+// MCP uploads (3) and the session recorder (4); it is shared with the trace upload, a debug tool
+#define ASSETS_DOWNLOAD_CONNECT_ID 5
+
+struct AudioSendStats {
+    uint32_t packets = 0;
+    uint32_t failures = 0;
+    uint32_t slow_sends = 0;
+    int64_t total_us = 0;
+    int64_t max_us = 0;
+    size_t max_backlog = 0;
+};
 
 
 enum AecMode {
@@ -73,9 +97,15 @@ public:
     bool SetDeviceState(DeviceState state);
 
     /**
-     * Schedule a callback to be executed in the main task
+     * Schedule a callback to be executed in the main task.
+     * Captures up to SCHEDULE_TASK_INLINE_SIZE bytes are stored without heap allocation,
+     * the call site identifies the task in the latency and profiler stats.
      */
-    void Schedule(std::function<void()>&& callback);
+    template <typename F>
+    void Schedule(F&& callback, const std::source_location& site = std::source_location::current()) {
+        schedule_queue_.Push(ScheduledTask(std::forward<F>(callback)), site);
+        xEventGroupSetBits(event_group_, MAIN_EVENT_SCHEDULE);
+    }
 
     /**
      * Alert with status, message, emotion and optional sound
@@ -105,13 +135,26 @@ public:
 
     void Reboot();
     void WakeWordInvoke(const std::string& wake_word);
-    bool UpgradeFirmware(const std::string& url, const std::string& version = "");
+    bool UpgradeFirmware(const std::string& url, const std::string& version = "", const std::string& sha256 = "",
+        const std::string& delta_url = "", const std::string& compressed_url = "");
     bool CanEnterSleepMode();
-    void SendMcpMessage(const std::string& payload);
+    void SendMcpMessage(std::string payload);
     void SetAecMode(AecMode mode);
     AecMode GetAecMode() const { return aec_mode_; }
     void PlaySound(const std::string_view& sound);
     AudioService& GetAudioService() { return audio_service_; }
+    // Only valid in the main task, the protocol may be reset by ResetProtocol()
+    Protocol* GetProtocol() { return protocol_.get(); }
+    // Only valid in the main task
+    MainLoopProfiler& GetMainLoopProfiler() { return main_loop_profiler_; }
+    // Phases are marked from any task
+    InteractionTimeline& GetInteractionTimeline() { return interaction_timeline_; }
+
+    /**
+     * Run count wake word interactions, interval_seconds apart, in a background task (thread-safe)
+     * Each one is measured from the invoke to the first reply audio played, see InteractionTimeline
+     */
+    bool StartInteractionBenchmark(int count, int interval_seconds, const std::string& wake_word);
     
     /**
      * Reset protocol resources (thread-safe)
@@ -124,9 +167,12 @@ private:
     Application();
     ~Application();
 
-    std::mutex mutex_;
-    std::deque<std::function<void()>> main_tasks_;
-    std::unique_ptr<Protocol> protocol_;
+    ScheduleQueue schedule_queue_;
+    // protocol_ is assigned and reset under protocol_mutex_. The open and send tasks copy it under the
+    // lock and do their network I/O on the copy, so the lock is never held across a send or a handshake
+    std::shared_ptr<Protocol> protocol_;
+    std::mutex protocol_mutex_;
+    JsonDispatcher json_dispatcher_;
     EventGroupHandle_t event_group_ = nullptr;
     esp_timer_handle_t clock_timer_handle_ = nullptr;
     DeviceStateMachine state_machine_;
@@ -139,7 +185,31 @@ private:
     bool has_server_time_ = false;
     bool aborted_ = false;
     bool assets_version_checked_ = false;
+    bool assets_applied_ = false;  // Applied by the boot sequence, before the version check
+    bool background_assets_download_ = false;  // Started by the activation task after the version check
     bool play_popup_on_listening_ = false;  // Flag to play popup sound after state changes to listening
+    // Audio captured during the handshake waits for the start listening message
+    std::atomic<bool> pending_uplink_ = false;
+    // Read by CanEnterSleepMode() from the power save timers
+    std::atomic<bool> audio_channel_opening_ = false;
+    // Set when a close is requested during the handshake, see CloseAudioChannel()
+    bool audio_channel_open_cancelled_ = false;
+    std::function<void()> on_audio_channel_opened_;
+    std::function<void()> on_audio_channel_open_failed_;
+
+    // Main loop responsiveness, the window is reported and reset every 10 seconds
+    MainLoopProfiler main_loop_profiler_;
+    // Wake word to first reply audio
+    InteractionTimeline interaction_timeline_;
+    std::atomic<bool> benchmark_running_ = false;
+    int benchmark_count_ = 0;
+    int benchmark_interval_seconds_ = 0;
+    std::string benchmark_wake_word_;
+
+    // Uplink audio is sent by a dedicated task so that main loop work does not add jitter
+    TaskHandle_t audio_sender_task_handle_ = nullptr;
+    std::mutex audio_send_stats_mutex_;
+    AudioSendStats audio_send_stats_;
     int clock_ticks_ = 0;
     TaskHandle_t activation_task_handle_ = nullptr;
 
@@ -154,13 +224,23 @@ private:
     void HandleActivationDoneEvent();
     void HandleWakeWordDetectedEvent();
 
+    // Interaction benchmark task (runs in background)
+    void InteractionBenchmarkTask();
+
     // Activation task (runs in background)
     void ActivationTask();
+    void AudioSenderTask();
+    void NotifyAudioSender();
 
     // Helper methods
     void CheckAssetsVersion();
+    void AssetsDownloadTask();
     void CheckNewVersion();
     void InitializeProtocol();
+    void InitializeMessageHandlers();
+    void OpenAudioChannelAsync(std::function<void()> on_opened, std::function<void()> on_failed = nullptr);
+    void HandleAudioChannelOpenResult(bool opened);
+    void CloseAudioChannel();
     void ShowActivationCode(const std::string& code, const std::string& message);
     void SetListeningMode(ListeningMode mode);
     
@@ -2,6 +2,12 @@
 #include "board.h"
 #include "display.h"
 #include "application.h"
+#include "settings.h"
+#include "sha256_digest.h"
+#include "flash_stream_writer.h"
+#include "download_checkpoint.h"
+#include "assets_diff_updater.h"
+#include "stream_decompressor.h"
 #include "lvgl_theme.h"
 #include "emote_display.h"
 #include "expression_emote.h"
@@ -13,22 +19,27 @@
 #include <esp_log.h>
 #include <esp_timer.h>
 #include <cbin_font.h>
+#include <algorithm>
+#include <cstring>
 
 
 #define TAG "Assets"
 #define PARTITION_LABEL "assets"
-
-struct mmap_assets_table {
-    char asset_name[32];          /*!< Name of the asset */
-    uint32_t asset_size;          /*!< Size of the asset */
-    uint32_t asset_offset;        /*!< Offset of the asset */
-    uint16_t asset_width;         /*!< Width of the asset */
-    uint16_t asset_height;        /*!< Height of the asset */
-};
+// Optional second slot, see partitions/v2/README.md
+#define SLOT_B_PARTITION_LABEL "assets_b"
+// Read size and pause of the background verification, so that it does not hold the flash
+#define VERIFY_CHUNK_SIZE 4096
+#define VERIFY_PAUSE_CHUNKS 16
+
+// The name field is NUL padded, a name of the full field length has no terminator
+static std::string_view AssetName(const mmap_assets_table& item) {
+    return std::string_view(item.asset_name, strnlen(item.asset_name, sizeof(item.asset_name)));
+}
 
 Assets::Assets() {
 #if HAVE_LVGL
     strategy_ = std::make_unique<Assets::LvglStrategy>();
+    FindSlots();
 #else
     strategy_ = std::make_unique<Assets::EmoteStrategy>();
 #endif
@@ -40,7 +51,23 @@ Assets::~Assets() {
     UnApplyPartition();
 }
 
+void Assets::FindSlots() {
+    slot_partitions_[0] = esp_partition_find_first(ESP_PARTITION_TYPE_ANY, ESP_PARTITION_SUBTYPE_ANY, PARTITION_LABEL);
+    slot_partitions_[1] = esp_partition_find_first(ESP_PARTITION_TYPE_ANY, ESP_PARTITION_SUBTYPE_ANY, SLOT_B_PARTITION_LABEL);
+    if (slot_partitions_[0] == nullptr || slot_partitions_[1] == nullptr) {
+        slot_partitions_[1] = nullptr;
+        return;
+    }
+    Settings settings("assets");
+    active_slot_ = settings.GetInt("slot") == 1 ? 1 : 0;
+    ESP_LOGI(TAG, "Two assets slots found, the active one is %s", slot_partitions_[active_slot_]->label);
+}
+
 bool Assets::FindPartition(Assets* assets) {
+    if (assets->dual_slot()) {
+        assets->partition_ = assets->slot_partitions_[assets->active_slot_];
+        return true;
+    }
     assets->partition_ = esp_partition_find_first(ESP_PARTITION_TYPE_ANY, ESP_PARTITION_SUBTYPE_ANY, PARTITION_LABEL);
     if (assets->partition_ == nullptr) {
         ESP_LOGI(TAG, "No assets partition found");
@@ -63,10 +90,32 @@ void Assets::UnApplyPartition() {
     }
 }
 
-bool Assets::GetAssetData(const std::string& name, void*& ptr, size_t& size) {
+bool Assets::GetAssetData(std::string_view name, void*& ptr, size_t& size) {
     return strategy_ ? strategy_->GetAssetData(this, name, ptr, size) : false;
 }
 
+bool Assets::SwitchSlot() {
+    int previous_slot = active_slot_;
+    active_slot_ = 1 - previous_slot;
+    if (!strategy_->SwitchPartition(this)) {
+        ESP_LOGE(TAG, "Failed to switch to the assets slot %s", slot_partitions_[active_slot_]->label);
+        active_slot_ = previous_slot;
+        return false;
+    }
+    // The slot is only recorded once it is mapped and verified
+    Settings settings("assets", true);
+    settings.SetInt("slot", active_slot_);
+    slot_switched_ = true;
+    ESP_LOGI(TAG, "Switched to the assets slot %s", partition_->label);
+    return true;
+}
+
+void Assets::ReleaseAssetData(std::string_view name) {
+    if (strategy_) {
+        strategy_->ReleaseAssetData(this, name);
+    }
+}
+
 bool Assets::LoadSrmodelsFromIndex(Assets* assets, cJSON* root) {
     void* ptr = nullptr;
     size_t size = 0;
@@ -80,6 +129,7 @@ bool Assets::LoadSrmodelsFromIndex(Assets* assets, cJSON* root) {
         }
 
         root = cJSON_ParseWithLength(static_cast<char*>(ptr), size);
+        assets->ReleaseAssetData("index.json");
         if (root == nullptr) {
             ESP_LOGE(TAG, "The index.json file is not valid");
             return false;
@@ -126,24 +176,83 @@ uint32_t Assets::LvglStrategy::CalculateChecksum(const char* data, uint32_t leng
     return checksum & 0xFFFF;
 }
 
+// FNV-1a over the partition address, the generation bumped by each download, the header and the file table
+int32_t Assets::LvglStrategy::CalculateFingerprint(const esp_partition_t* partition, const char* table, uint32_t length, int32_t generation) {
+    uint32_t hash = 2166136261u;
+    auto update = [&hash](const void* data, size_t size) {
+        auto bytes = static_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < size; i++) {
+            hash = (hash ^ bytes[i]) * 16777619u;
+        }
+    };
+    update(&partition->address, sizeof(partition->address));
+    update(&partition->size, sizeof(partition->size));
+    update(&generation, sizeof(generation));
+    update(table, length);
+    return static_cast<int32_t>(hash);
+}
+
+// Reads the partition through esp_partition_read, so that unmapping it for a download is safe
+void Assets::LvglStrategy::VerifyTask(void* arg) {
+    auto args = static_cast<VerifyArgs*>(arg);
+    auto start_time = esp_timer_get_time();
+    char* buffer = static_cast<char*>(malloc(VERIFY_CHUNK_SIZE));
+    uint32_t checksum = 0;
+    bool read_ok = buffer != nullptr;
+    for (uint32_t offset = 0, chunk = 0; read_ok && offset < args->length; offset += VERIFY_CHUNK_SIZE, chunk++) {
+        uint32_t size = std::min<uint32_t>(VERIFY_CHUNK_SIZE, args->length - offset);
+        read_ok = esp_partition_read(args->partition, 12 + offset, buffer, size) == ESP_OK;
+        checksum += CalculateChecksum(buffer, size);
+        if (chunk % VERIFY_PAUSE_CHUNKS == VERIFY_PAUSE_CHUNKS - 1) {
+            vTaskDelay(1);
+        }
+    }
+    free(buffer);
+    checksum &= 0xFFFF;
+
+    if (!read_ok) {
+        ESP_LOGW(TAG, "Background verification could not read the assets partition");
+    } else if (checksum != args->checksum) {
+        // A download in the meantime bumps the generation and stores its own fingerprint
+        Settings settings("assets", true);
+        if (settings.GetInt("verified_fp") == args->fingerprint) {
+            ESP_LOGE(TAG, "Background verification failed, checksum 0x%lx, expected 0x%lx, the next boot checks the assets in full",
+                checksum, args->checksum);
+            settings.EraseKey("verified_fp");
+        }
+    } else {
+        ESP_LOGI(TAG, "Background verification passed in %d ms", int((esp_timer_get_time() - start_time) / 1000));
+    }
+    delete args;
+    vTaskDelete(NULL);
+}
+
 bool Assets::LvglStrategy::InitializePartition(Assets* assets) {
     assets->partition_valid_ = false;
-    assets_.clear();
 
     if (!Assets::FindPartition(assets)) {
         return false;
     }
 
+    // A partition that fails the checks stays mapped without a file table
+    Mapping mapping;
+    bool valid = MapPartition(assets, assets->partition_, mapping);
+    std::lock_guard<std::mutex> lock(mutex_);
+    mapping_ = mapping;
+    return valid;
+}
+
+bool Assets::LvglStrategy::MapPartition(Assets* assets, const esp_partition_t* partition, Mapping& mapping) {
     int free_pages = spi_flash_mmap_get_free_pages(SPI_FLASH_MMAP_DATA);
     uint32_t storage_size = free_pages * 64 * 1024;
     ESP_LOGI(TAG, "The storage free size is %ld KB", storage_size / 1024);
-    ESP_LOGI(TAG, "The partition size is %ld KB", assets->partition_->size / 1024);
-    if (storage_size < assets->partition_->size) {
-        ESP_LOGE(TAG, "The free size %ld KB is less than assets partition required %ld KB", storage_size / 1024, assets->partition_->size / 1024);
+    ESP_LOGI(TAG, "The partition size is %ld KB", partition->size / 1024);
+    if (storage_size < partition->size) {
+        ESP_LOGE(TAG, "The free size %ld KB is less than assets partition required %ld KB", storage_size / 1024, partition->size / 1024);
         return false;
     }
 
-    esp_err_t err = esp_partition_mmap(assets->partition_, 0, assets->partition_->size, ESP_PARTITION_MMAP_DATA, (const void**)&mmap_root_, &mmap_handle_);
+    esp_err_t err = esp_partition_mmap(partition, 0, partition->size, ESP_PARTITION_MMAP_DATA, (const void**)&mapping.root, &mapping.handle);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Failed to mmap assets partition: %s", esp_err_to_name(err));
         return false;
@@ -151,65 +260,147 @@ bool Assets::LvglStrategy::InitializePartition(Assets* assets) {
 
     assets->partition_valid_ = true;
 
-    uint32_t stored_files = *(uint32_t*)(mmap_root_ + 0);
-    uint32_t stored_chksum = *(uint32_t*)(mmap_root_ + 4);
-    uint32_t stored_len = *(uint32_t*)(mmap_root_ + 8);
+    uint32_t stored_files = *(uint32_t*)(mapping.root + 0);
+    uint32_t stored_chksum = *(uint32_t*)(mapping.root + 4);
+    uint32_t stored_len = *(uint32_t*)(mapping.root + 8);
 
-    if (stored_len > assets->partition_->size - 12) {
-        ESP_LOGD(TAG, "The stored_len (0x%lx) is greater than the partition size (0x%lx) - 12", stored_len, assets->partition_->size);
+    if (stored_len > partition->size - 12) {
+        ESP_LOGD(TAG, "The stored_len (0x%lx) is greater than the partition size (0x%lx) - 12", stored_len, partition->size);
         return false;
     }
 
-    auto start_time = esp_timer_get_time();
-    uint32_t calculated_checksum = CalculateChecksum(mmap_root_ + 12, stored_len);
-    auto end_time = esp_timer_get_time();
-    ESP_LOGI(TAG, "The checksum calculation time is %d ms", int((end_time - start_time) / 1000));
-
-    if (calculated_checksum != stored_chksum) {
-        ESP_LOGE(TAG, "The calculated checksum (0x%lx) does not match the stored checksum (0x%lx)", calculated_checksum, stored_chksum);
+    uint32_t table_len = 12 + stored_files * sizeof(mmap_assets_table);
+    if (table_len > 12 + stored_len) {
+        ESP_LOGE(TAG, "The file table (%lu files) does not fit in the stored_len (0x%lx)", stored_files, stored_len);
         return false;
     }
 
-    checksum_valid_ = true;
+    // The full checksum reads the whole partition, it only runs after a download or flash.
+    // Once it passed, later boots compare the fingerprint of the header and the file table.
+    Settings settings("assets", true);
+    int32_t generation = settings.GetInt("generation");
+    int32_t fingerprint = CalculateFingerprint(partition, mapping.root, table_len, generation);
+    if (assets->download_verified_) {
+        // Hashed with SHA-256 while it was written
+        assets->download_verified_ = false;
+        settings.SetInt("verified_fp", fingerprint);
+    } else if (settings.GetInt("verified_fp", ~fingerprint) == fingerprint) {
+        ESP_LOGI(TAG, "The assets were verified at a previous boot, skipping the checksum");
+#if CONFIG_ASSETS_BACKGROUND_VERIFY
+        auto args = new VerifyArgs{partition, stored_len, stored_chksum, fingerprint};
+        xTaskCreate(VerifyTask, "assets_verify", 3072, args, 1, nullptr);
+#endif
+    } else {
+        auto start_time = esp_timer_get_time();
+        uint32_t calculated_checksum = CalculateChecksum(mapping.root + 12, stored_len);
+        auto end_time = esp_timer_get_time();
+        ESP_LOGI(TAG, "The checksum calculation time is %d ms", int((end_time - start_time) / 1000));
+
+        if (calculated_checksum != stored_chksum) {
+            ESP_LOGE(TAG, "The calculated checksum (0x%lx) does not match the stored checksum (0x%lx)", calculated_checksum, stored_chksum);
+            settings.EraseKey("verified_fp");
+            return false;
+        }
+        settings.SetInt("verified_fp", fingerprint);
+    }
 
-    for (uint32_t i = 0; i < stored_files; i++) {
-        auto item = (const mmap_assets_table*)(mmap_root_ + 12 + i * sizeof(mmap_assets_table));
-        auto asset = Asset{
-            .size = static_cast<size_t>(item->asset_size),
-            .offset = static_cast<size_t>(12 + sizeof(mmap_assets_table) * stored_files + item->asset_offset)
-        };
-        assets_[item->asset_name] = asset;
+    mapping.table = (const mmap_assets_table*)(mapping.root + 12);
+    mapping.file_count = stored_files;
+    // Tables packed before the name order fall back to a linear scan
+    mapping.sorted = true;
+    for (uint32_t i = 1; i < mapping.file_count && mapping.sorted; i++) {
+        mapping.sorted = AssetName(mapping.table[i - 1]) < AssetName(mapping.table[i]);
+    }
+    if (!mapping.sorted) {
+        ESP_LOGW(TAG, "The file table is not sorted by name, looking up %lu files linearly", mapping.file_count);
     }
-    return checksum_valid_;
+    return true;
 }
 
 void Assets::LvglStrategy::UnApplyPartition(Assets* assets) {
-    if (mmap_handle_ != 0) {
-        esp_partition_munmap(mmap_handle_);
-        mmap_handle_ = 0;
-        mmap_root_ = nullptr;
+    std::lock_guard<std::mutex> lock(mutex_);
+    cache_.Clear();
+    if (mapping_.handle != 0) {
+        esp_partition_munmap(mapping_.handle);
+    }
+    mapping_ = Mapping();
+    if (retired_mmap_handle_ != 0) {
+        esp_partition_munmap(retired_mmap_handle_);
+        retired_mmap_handle_ = 0;
     }
-    checksum_valid_ = false;
-    assets_.clear();
     (void)assets; // Unused parameter
 }
 
-bool Assets::LvglStrategy::GetAssetData(Assets* assets, const std::string& name, void*& ptr, size_t& size) {
-    auto asset = assets_.find(name);
-    if (asset == assets_.end()) {
+bool Assets::LvglStrategy::SwitchPartition(Assets* assets) {
+    // The theme, the wake word and the acquired cache copies still point into the current mapping,
+    // it stays until restart and the new slot is mapped next to it
+    if (retired_mmap_handle_ != 0) {
+        ESP_LOGE(TAG, "The assets already switched slots, restart first");
         return false;
     }
-    auto data = (const char*)(mmap_root_ + asset->second.offset);
+    auto partition = assets->slot_partitions_[assets->active_slot_];
+    Mapping mapping;
+    if (!MapPartition(assets, partition, mapping)) {
+        if (mapping.handle != 0) {
+            esp_partition_munmap(mapping.handle);
+        }
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    retired_mmap_handle_ = mapping_.handle;
+    mapping_ = mapping;
+    assets->partition_ = partition;
+    cache_.Retire();
+    return true;
+}
+
+const mmap_assets_table* Assets::LvglStrategy::FindAsset(const Mapping& mapping, std::string_view name) {
+    if (mapping.table == nullptr) {
+        return nullptr;
+    }
+    if (!mapping.sorted) {
+        for (uint32_t i = 0; i < mapping.file_count; i++) {
+            if (AssetName(mapping.table[i]) == name) {
+                return &mapping.table[i];
+            }
+        }
+        return nullptr;
+    }
+    auto end = mapping.table + mapping.file_count;
+    auto item = std::lower_bound(mapping.table, end, name, [](const mmap_assets_table& entry, std::string_view key) {
+        return AssetName(entry) < key;
+    });
+    return item != end && AssetName(*item) == name ? item : nullptr;
+}
+
+bool Assets::LvglStrategy::GetAssetData(Assets* assets, std::string_view name, void*& ptr, size_t& size) {
+    // The lookup and the decompression see one mapping, a slot switch replaces it as a whole
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto asset = FindAsset(mapping_, name);
+    if (asset == nullptr) {
+        return false;
+    }
+    auto data = (const char*)(mapping_.root + 12 + sizeof(mmap_assets_table) * mapping_.file_count + asset->asset_offset);
     if (data[0] != 'Z' || data[1] != 'Z') {
-        ESP_LOGE(TAG, "The asset %s is not valid with magic %02x%02x", name.c_str(), data[0], data[1]);
+        ESP_LOGE(TAG, "The asset %.*s is not valid with magic %02x%02x", int(name.size()), name.data(), data[0], data[1]);
         return false;
     }
 
+    // Compressed files are decompressed into the cache, the others are used in place
+    if (asset->asset_size >= 4 && memcmp(data + 2, STREAM_COMPRESSED_MAGIC, 4) == 0) {
+        return cache_.Acquire(name, data + 2, asset->asset_size, ptr, size);
+    }
     ptr = static_cast<void*>(const_cast<char*>(data + 2));
-    size = asset->second.size;
+    size = asset->asset_size;
     return true;
 }
 
+void Assets::LvglStrategy::ReleaseAssetData(Assets* assets, std::string_view name) {
+    cache_.Release(name);
+    (void)assets; // Unused parameter
+}
+
 bool Assets::LvglStrategy::Apply(Assets* assets) {
     void* ptr = nullptr;
     size_t size = 0;
@@ -218,7 +409,9 @@ bool Assets::LvglStrategy::Apply(Assets* assets) {
         return false;
     }
 
+    // The parsed tree has its own copy of the strings
     cJSON* root = cJSON_ParseWithLength(static_cast<char*>(ptr), size);
+    assets->ReleaseAssetData("index.json");
     if (root == nullptr) {
         ESP_LOGE(TAG, "The index.json file is not valid");
         return false;
@@ -232,7 +425,13 @@ bool Assets::LvglStrategy::Apply(Assets* assets) {
         }
     }
 
-    Assets::LoadSrmodelsFromIndex(assets, root);
+    if (!assets->slot_switched_) {
+        Assets::LoadSrmodelsFromIndex(assets, root);
+    }
+
+    // The LVGL task and the tasks that update the UI read the themes, change them under the display lock
+    auto display = Board::GetInstance().GetDisplay();
+    DisplayLockGuard display_lock(display);
 
     auto& theme_manager = LvglThemeManager::GetInstance();
     auto light_theme = theme_manager.GetTheme("light");
@@ -331,7 +530,6 @@ bool Assets::LvglStrategy::Apply(Assets* assets) {
         }
     }
 
-    auto display = Board::GetInstance().GetDisplay();
     ESP_LOGI(TAG, "Refreshing display theme...");
 
     auto current_theme = display->GetTheme();
@@ -392,10 +590,12 @@ void Assets::EmoteStrategy::UnApplyPartition(Assets* assets) {
     (void)assets; // Unused parameter
 }
 
-bool Assets::EmoteStrategy::GetAssetData(Assets* assets, const std::string& name, void*& ptr, size_t& size) {
+bool Assets::EmoteStrategy::GetAssetData(Assets* assets, std::string_view key, void*& ptr, size_t& size) {
     auto display = Board::GetInstance().GetDisplay();
     auto* emote_display = dynamic_cast<emote::EmoteDisplay*>(display);
     if (emote_display && emote_display->GetEmoteHandle() != nullptr) {
+        // The emote library looks names up by C string
+        std::string name(key);
         const uint8_t* data = nullptr;
         size_t data_size = 0;
         if (ESP_OK == emote_get_asset_data_by_name(emote_display->GetEmoteHandle(), name.c_str(), &data, &data_size)) {
@@ -422,123 +622,200 @@ bool Assets::EmoteStrategy::Apply(Assets* assets) {
     return true;
 }
 
-bool Assets::Download(std::string url, std::function<void(int progress, size_t speed)> progress_callback) {
+bool Assets::Download(std::string url, std::function<void(int progress, size_t speed)> progress_callback, const std::string& sha256,
+    const std::string& manifest_url, int connect_id) {
     ESP_LOGI(TAG, "Downloading new version of assets from %s", url.c_str());
 
-    // 取消当前资源分区的内存映射
-    UnApplyPartition();
-
-    // 下载新的资源文件
-    auto network = Board::GetInstance().GetNetwork();
-    auto http = network->CreateHttp(0);
-    
-    if (!http->Open("GET", url)) {
-        ESP_LOGE(TAG, "Failed to open HTTP connection");
-        return false;
+    // 有两个槽时写入未使用的槽，当前的资源保持映射，校验通过后再切换
+    const esp_partition_t* partition = partition_;
+    if (dual_slot()) {
+        if (slot_switched_) {
+            ESP_LOGE(TAG, "The assets already switched slots, restart first");
+            return false;
+        }
+        partition = slot_partitions_[1 - active_slot_];
+        ESP_LOGI(TAG, "Writing the assets slot %s", partition->label);
+    } else {
+        // 取消当前资源分区的内存映射
+        UnApplyPartition();
+
+        // 分区内容即将改变，使缓存的校验结果失效
+        Settings settings("assets", true);
+        settings.SetInt("generation", settings.GetInt("generation") + 1);
+        settings.EraseKey("verified_fp");
+    }
+    download_verified_ = false;
+
+    // 有清单时只下载变化的文件；分区不支持、空间不足或碎片过多时下载完整文件，重新紧凑排列
+    // 未完成的完整下载优先续传
+    DownloadCheckpoint checkpoint("assets");
+    if (!manifest_url.empty() && !checkpoint.IsPending()) {
+        // 两个槽时与正在使用的槽比较，保留的文件从它复制
+        AssetsDiffUpdater updater(partition, connect_id, partition_);
+        if (updater.Update(url, manifest_url, progress_callback)) {
+            // 变化的文件边下载边校验，保留的文件也已按哈希检查
+            download_verified_ = true;
+            if (dual_slot()) {
+                return SwitchSlot();
+            }
+            if (!InitializePartition()) {
+                ESP_LOGE(TAG, "Failed to re-initialize assets partition");
+                return false;
+            }
+            return true;
+        }
+        ESP_LOGW(TAG, "Differential update is not possible, downloading the whole assets file");
     }
 
-    if (http->GetStatusCode() != 200) {
-        ESP_LOGE(TAG, "Failed to get assets, status code: %d", http->GetStatusCode());
+    // 下载新的资源文件，上次中断的下载从检查点继续
+    auto network = Board::GetInstance().GetNetwork();
+    auto http = network->CreateHttp(connect_id);
+    size_t resume_offset = 0;
+    size_t content_length = 0;
+    if (!checkpoint.Open(http.get(), url, sha256, resume_offset, content_length)) {
         return false;
     }
 
-    size_t content_length = http->GetBodyLength();
     if (content_length == 0) {
         ESP_LOGE(TAG, "Failed to get content length");
         return false;
     }
 
-    if (content_length > partition_->size) {
-        ESP_LOGE(TAG, "Assets file size (%u) is larger than partition size (%lu)", content_length, partition_->size);
+    if (content_length > partition->size) {
+        ESP_LOGE(TAG, "Assets file size (%u) is larger than partition size (%lu)", content_length, partition->size);
         return false;
     }
 
     // 定义扇区大小为4KB（ESP32的标准扇区大小）
     const size_t SECTOR_SIZE = esp_partition_get_main_flash_sector_size();
-    
-    // 计算需要擦除的扇区数量
-    size_t sectors_to_erase = (content_length + SECTOR_SIZE - 1) / SECTOR_SIZE; // 向上取整
-    size_t total_erase_size = sectors_to_erase * SECTOR_SIZE;
-    
-    ESP_LOGI(TAG, "Sector size: %u, content length: %u, sectors to erase: %u, total erase size: %u", 
-             SECTOR_SIZE, content_length, sectors_to_erase, total_erase_size);
-    
-    // 写入新的资源文件到分区，一边erase一边写入
-    char buffer[512];
-    size_t total_written = 0;
-    size_t recent_written = 0;
-    size_t current_sector = 0;
-    auto last_calc_time = esp_timer_get_time();
-    
-    while (true) {
-        int ret = http->Read(buffer, sizeof(buffer));
-        if (ret < 0) {
-            ESP_LOGE(TAG, "Failed to read HTTP data: %s", esp_err_to_name(ret));
-            return false;
+    auto align_to_sector = [SECTOR_SIZE](size_t size) {
+        return (size + SECTOR_SIZE - 1) / SECTOR_SIZE * SECTOR_SIZE;
+    };
+    // 压缩的资源文件在收到文件头后才知道解压后的大小
+    size_t image_size = content_length;
+    size_t total_erase_size = align_to_sector(image_size);
+    ESP_LOGI(TAG, "Sector size: %u, content length: %u, total erase size: %u", SECTOR_SIZE, content_length, total_erase_size);
+
+    // 边写入边计算 SHA-256，代替下载完成后对整个分区的校验
+    // payload_digest 覆盖头部、文件表与数据，与文件尾部的摘要比较；file_digest 覆盖整个文件，与服务器提供的摘要比较
+    Sha256Digest payload_digest;
+    std::unique_ptr<Sha256Digest> file_digest;
+    if (!sha256.empty()) {
+        file_digest = std::make_unique<Sha256Digest>();
+    }
+    std::string head;
+    std::string trailer;
+    size_t payload_end = SIZE_MAX;
+    auto update_digests = [&](size_t offset, const char* data, size_t size) {
+        if (file_digest) {
+            file_digest->Update(data, size);
         }
-
-        if (ret == 0) {
-            break;
+        // 头部的 12 个字节包含数据长度，在此之前的字节都属于 payload
+        if (head.size() < 12) {
+            head.append(data, std::min<size_t>(12 - head.size(), size));
+            if (head.size() == 12) {
+                payload_end = 12 + *(const uint32_t*)(head.data() + 8);
+            }
+        }
+        size_t chunk_end = offset + size;
+        if (offset < payload_end) {
+            payload_digest.Update(data, std::min(chunk_end, payload_end) - offset);
         }
+        if (chunk_end > payload_end && trailer.size() < ASSETS_DIGEST_TRAILER_SIZE) {
+            size_t start = std::max(offset, payload_end) - offset;
+            trailer.append(data + start, std::min<size_t>(size - start, ASSETS_DIGEST_TRAILER_SIZE - trailer.size()));
+        }
+    };
 
-        // 检查是否需要擦除新的扇区
-        size_t write_end_offset = total_written + ret;
-        size_t needed_sectors = (write_end_offset + SECTOR_SIZE - 1) / SECTOR_SIZE;
-        
-        // 擦除需要的新扇区
-        while (current_sector < needed_sectors) {
-            size_t sector_start = current_sector * SECTOR_SIZE;
-            size_t sector_end = (current_sector + 1) * SECTOR_SIZE;
-            
-            // 确保擦除范围不超过分区大小
-            if (sector_end > partition_->size) {
-                ESP_LOGE(TAG, "Sector end (%u) exceeds partition size (%lu)", sector_end, partition_->size);
+    // 续传时已写入的部分从 flash 读回，重建摘要
+    if (resume_offset > 0 && !DownloadCheckpoint::ReadBack(partition, resume_offset, update_digests)) {
+        checkpoint.Clear();
+        return false;
+    }
+
+    // 网络读取与擦除、写入 flash 并行进行，写入任务按块处理，并提前擦除下一块
+    // 检查点之后的扇区可能已写入过，从续传位置重新擦除
+    // 压缩的文件边解压边写入，写入的是原始数据；中断后从头下载
+    FlashStreamWriter writer;
+    size_t erased_end = resume_offset;
+    StreamDecompressor decompressor([&](size_t offset, const char* data, size_t size) -> bool {
+        if (offset == 0 && decompressor.compressed()) {
+            image_size = decompressor.original_size();
+            total_erase_size = align_to_sector(image_size);
+            ESP_LOGI(TAG, "The assets file is compressed, %u bytes once decompressed", image_size);
+            if (image_size > partition->size) {
+                ESP_LOGE(TAG, "Decompressed assets size (%u) is larger than partition size (%lu)", image_size, partition->size);
                 return false;
             }
-            
-            ESP_LOGD(TAG, "Erasing sector %u (offset: %u, size: %u)", current_sector, sector_start, SECTOR_SIZE);
-            esp_err_t err = esp_partition_erase_range(partition_, sector_start, SECTOR_SIZE);
+        }
+        if (offset + size > image_size) {
+            ESP_LOGE(TAG, "Received more data than the content length (%u)", image_size);
+            return false;
+        }
+        size_t erase_end = std::min(align_to_sector(offset + size + writer.block_size()), total_erase_size);
+        if (erase_end > erased_end) {
+            esp_err_t err = esp_partition_erase_range(partition, erased_end, erase_end - erased_end);
             if (err != ESP_OK) {
-                ESP_LOGE(TAG, "Failed to erase sector %u at offset %u: %s", current_sector, sector_start, esp_err_to_name(err));
+                ESP_LOGE(TAG, "Failed to erase assets partition at offset %u: %s", erased_end, esp_err_to_name(err));
                 return false;
             }
-            
-            current_sector++;
+            erased_end = erase_end;
         }
 
-        // 写入数据到分区
-        esp_err_t err = esp_partition_write(partition_, total_written, buffer, ret);
+        esp_err_t err = esp_partition_write(partition, offset, data, size);
         if (err != ESP_OK) {
-            ESP_LOGE(TAG, "Failed to write to assets partition at offset %u: %s", total_written, esp_err_to_name(err));
+            ESP_LOGE(TAG, "Failed to write to assets partition at offset %u: %s", offset, esp_err_to_name(err));
             return false;
         }
 
-        total_written += ret;
-        recent_written += ret;
-
-        // 计算进度和速度
-        if (esp_timer_get_time() - last_calc_time >= 1000000 || total_written == content_length || ret == 0) {
-            size_t progress = total_written * 100 / content_length;
-            size_t speed = recent_written; // 每秒的字节数
-            ESP_LOGI(TAG, "Progress: %u%% (%u/%u), Speed: %u B/s, Sectors erased: %u", 
-                     progress, total_written, content_length, speed, current_sector);
-            if (progress_callback) {
-                progress_callback(progress, speed);
-            }
-            last_calc_time = esp_timer_get_time();
-            recent_written = 0; // 重置最近写入的字节数
+        update_digests(offset, data, size);
+        if (!decompressor.compressed()) {
+            checkpoint.Update(offset + size);
         }
-    }
-    
+        return true;
+    }, resume_offset);
+    bool success = writer.Run(http.get(), content_length, [&decompressor](size_t, const char* data, size_t size) -> bool {
+        return decompressor.Feed(data, size);
+    }, progress_callback, resume_offset);
     http->Close();
 
-    if (total_written != content_length) {
-        ESP_LOGE(TAG, "Downloaded size (%u) does not match expected size (%u)", total_written, content_length);
+    if (!success || !decompressor.Finish()) {
+        return false;
+    }
+    if (writer.bytes_written() != content_length) {
+        ESP_LOGE(TAG, "Downloaded size (%u) does not match expected size (%u)", writer.bytes_written(), content_length);
         return false;
     }
+    size_t total_written = decompressor.bytes_output();
+
+    ESP_LOGI(TAG, "Assets download completed, total written: %u bytes, total erased: %u", total_written, erased_end);
+    // 摘要不符时也不再续传，下次重新下载
+    checkpoint.Clear();
 
-    ESP_LOGI(TAG, "Assets download completed, total written: %u bytes, total sectors erased: %u", 
-             total_written, current_sector);
+    bool verified = false;
+    if (file_digest) {
+        if (!Sha256Digest::Matches(file_digest->Finish(), sha256)) {
+            ESP_LOGE(TAG, "The SHA-256 of the download does not match %s", sha256.c_str());
+            return false;
+        }
+        verified = true;
+    }
+    if (trailer.size() == ASSETS_DIGEST_TRAILER_SIZE && memcmp(trailer.data(), ASSETS_DIGEST_MAGIC, 4) == 0) {
+        auto digest = payload_digest.Finish();
+        if (memcmp(trailer.data() + 4, digest.data(), digest.size()) != 0) {
+            ESP_LOGE(TAG, "The SHA-256 of the assets does not match the trailer");
+            return false;
+        }
+        verified = true;
+    }
+    if (verified) {
+        ESP_LOGI(TAG, "The assets SHA-256 is verified");
+    }
+    download_verified_ = verified;
+
+    if (dual_slot()) {
+        return SwitchSlot();
+    }
 
     // 重新初始化资源分区
     if (!InitializePartition()) {
@@ -2,22 +2,35 @@
 #define ASSETS_H
 
 #include <string>
+#include <string_view>
 #include <functional>
 #include <memory>
+#include <mutex>
+#include <atomic>
+
+#include "assets_cache.h"
 
 #include <cJSON.h>
 #include <esp_partition.h>
 #include <model_path.h>
-#include <map>
 #include <string>
 
 #if HAVE_LVGL
 #include <spi_flash_mmap.h>
 #endif
 
-struct Asset {
-    size_t size;
-    size_t offset;
+// Optional trailer after the payload: magic, then the SHA-256 of the header, file table and data
+#define ASSETS_DIGEST_MAGIC "ZSHA"
+#define ASSETS_DIGEST_TRAILER_SIZE (4 + 32)
+// Optional section after the trailer: magic, the number of files, then the SHA-256 of each file in table order
+#define ASSETS_FILE_HASHES_MAGIC "ZFHT"
+
+struct mmap_assets_table {
+    char asset_name[32];          /*!< Name of the asset */
+    uint32_t asset_size;          /*!< Size of the asset */
+    uint32_t asset_offset;        /*!< Offset of the asset */
+    uint16_t asset_width;         /*!< Width of the asset */
+    uint16_t asset_height;        /*!< Height of the asset */
 };
 
 class Assets {
@@ -28,11 +41,20 @@ public:
     }
     ~Assets();
 
-    bool Download(std::string url, std::function<void(int progress, size_t speed)> progress_callback);
+    // sha256 is the hex digest of the whole file from the server, it may be empty.
+    // With a manifest_url, only the changed files are downloaded when the partition allows it.
+    // connect_id is the network connection id of the HTTP requests
+    bool Download(std::string url, std::function<void(int progress, size_t speed)> progress_callback, const std::string& sha256 = "",
+        const std::string& manifest_url = "", int connect_id = 0);
     bool Apply();
-    bool GetAssetData(const std::string& name, void*& ptr, size_t& size);
+    // Files stored compressed are decompressed into a cache, ptr stays valid until ReleaseAssetData().
+    // Callers that only read the data once release it, the others keep it for as long as the assets
+    bool GetAssetData(std::string_view name, void*& ptr, size_t& size);
+    void ReleaseAssetData(std::string_view name);
 
     inline bool partition_valid() const { return partition_valid_; }
+    // With a second assets partition, Download() writes the slot that is not in use and switches to it once verified
+    inline bool dual_slot() const { return slot_partitions_[1] != nullptr; }
     inline std::string default_assets_url() const { return default_assets_url_; }
 
 private:
@@ -42,6 +64,8 @@ private:
 
     bool InitializePartition();
     void UnApplyPartition();
+    void FindSlots();
+    bool SwitchSlot();
     static bool FindPartition(Assets* assets);
     static bool LoadSrmodelsFromIndex(Assets* assets, cJSON* root = nullptr);
   
@@ -51,7 +75,13 @@ private:
         virtual bool Apply(Assets* assets) = 0;
         virtual bool InitializePartition(Assets* assets) = 0;
         virtual void UnApplyPartition(Assets* assets) = 0;
-        virtual bool GetAssetData(Assets* assets, const std::string& name, void*& ptr, size_t& size) = 0;
+        virtual bool GetAssetData(Assets* assets, std::string_view name, void*& ptr, size_t& size) = 0;
+        virtual void ReleaseAssetData(Assets*, std::string_view) {}
+        // Maps the partition of the active slot in place of the current one
+        virtual bool SwitchPartition(Assets* assets) {
+            UnApplyPartition(assets);
+            return InitializePartition(assets);
+        }
     };
     
     class LvglStrategy : public AssetStrategy {
@@ -59,13 +89,38 @@ private:
         bool Apply(Assets* assets) override;
         bool InitializePartition(Assets* assets) override;
         void UnApplyPartition(Assets* assets) override;
-        bool GetAssetData(Assets* assets, const std::string& name, void*& ptr, size_t& size) override;
+        bool GetAssetData(Assets* assets, std::string_view name, void*& ptr, size_t& size) override;
+        void ReleaseAssetData(Assets* assets, std::string_view name) override;
+        bool SwitchPartition(Assets* assets) override;
     private:
         static uint32_t CalculateChecksum(const char* data, uint32_t length);
-        std::map<std::string, Asset> assets_;
-        esp_partition_mmap_handle_t mmap_handle_ = 0;
-        const char* mmap_root_ = nullptr;
-        bool checksum_valid_ = false;
+        static int32_t CalculateFingerprint(const esp_partition_t* partition, const char* table, uint32_t length, int32_t generation);
+        static void VerifyTask(void* arg);
+
+        // A mapping of the partition, replaced as a whole under mutex_ so that lookups on other tasks
+        // never see a half switched slot
+        struct Mapping {
+            esp_partition_mmap_handle_t handle = 0;
+            const char* root = nullptr;
+            const mmap_assets_table* table = nullptr;  // Only set once the partition is verified
+            uint32_t file_count = 0;
+            bool sorted = false;  // By name, for a binary search
+        };
+        bool MapPartition(Assets* assets, const esp_partition_t* partition, Mapping& mapping);
+        static const mmap_assets_table* FindAsset(const Mapping& mapping, std::string_view name);
+
+        struct VerifyArgs {
+            const esp_partition_t* partition;
+            uint32_t length;
+            uint32_t checksum;
+            int32_t fingerprint;
+        };
+        std::mutex mutex_;
+        // The file table is looked up in place in the mapped partition
+        Mapping mapping_;
+        // The mapping of the previous slot after a switch, kept until restart
+        esp_partition_mmap_handle_t retired_mmap_handle_ = 0;
+        AssetsCache cache_{CONFIG_ASSETS_CACHE_SIZE * 1024};
     };
     
     class EmoteStrategy : public AssetStrategy {
@@ -73,7 +128,7 @@ private:
         bool Apply(Assets* assets) override;
         bool InitializePartition(Assets* assets) override;
         void UnApplyPartition(Assets* assets) override;
-        bool GetAssetData(Assets* assets, const std::string& name, void*& ptr, size_t& size) override;
+        bool GetAssetData(Assets* assets, std::string_view name, void*& ptr, size_t& size) override;
     };
     
     // Strategy instance
@@ -81,9 +136,15 @@ private:
 
 protected:
     const esp_partition_t* partition_ = nullptr;
-    bool partition_valid_ = false;
+    std::atomic<bool> partition_valid_ = false;
     std::string default_assets_url_;
     srmodel_list_t* models_list_ = nullptr;
+    const esp_partition_t* slot_partitions_[2] = {};
+    int active_slot_ = 0;
+    // Set after a switch at runtime, the wake word keeps the models of the previous slot until restart
+    bool slot_switched_ = false;
+    // Set by Download() when the data was hashed on the way in, so the next InitializePartition() skips the checksum
+    bool download_verified_ = false;
 };
 
 #endif
@@ -0,0 +1,122 @@
+#include "assets_cache.h"
+#include "stream_decompressor.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include <cstring>
+
+#define TAG "AssetsCache"
+
+AssetsCache::~AssetsCache() {
+    Clear();
+}
+
+bool AssetsCache::Acquire(std::string_view name, const void* data, size_t size, void*& ptr, size_t& decompressed_size) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+        if (it->name == name) {
+            entries_.splice(entries_.begin(), entries_, it);
+            it->acquired++;
+            ptr = it->data;
+            decompressed_size = it->size;
+            return true;
+        }
+    }
+
+    if (size < STREAM_COMPRESSED_HEADER_SIZE) {
+        ESP_LOGE(TAG, "The compressed file %.*s is truncated", int(name.size()), name.data());
+        return false;
+    }
+    uint32_t original_size;
+    memcpy(&original_size, static_cast<const char*>(data) + 8, sizeof(original_size));
+    Evict(original_size);
+
+    auto start_time = esp_timer_get_time();
+    // An empty file still gets a buffer
+    size_t buffer_size = original_size > 0 ? original_size : 1;
+    auto buffer = static_cast<uint8_t*>(heap_caps_malloc(buffer_size, MALLOC_CAP_SPIRAM));
+    if (buffer == nullptr) {
+        buffer = static_cast<uint8_t*>(heap_caps_malloc(buffer_size, MALLOC_CAP_8BIT));
+        if (buffer == nullptr) {
+            ESP_LOGE(TAG, "Failed to allocate %lu bytes for %.*s", original_size, int(name.size()), name.data());
+            return false;
+        }
+    }
+    StreamDecompressor decompressor([buffer, original_size](size_t offset, const char* chunk, size_t chunk_size) -> bool {
+        if (offset + chunk_size > original_size) {
+            return false;
+        }
+        memcpy(buffer + offset, chunk, chunk_size);
+        return true;
+    });
+    if (!decompressor.Feed(static_cast<const char*>(data), size) || !decompressor.Finish() ||
+        !decompressor.compressed() || decompressor.bytes_output() != original_size) {
+        ESP_LOGE(TAG, "Failed to decompress %.*s", int(name.size()), name.data());
+        heap_caps_free(buffer);
+        return false;
+    }
+
+    entries_.push_front(Entry{std::string(name), buffer, original_size, 1});
+    used_ += original_size;
+    ESP_LOGI(TAG, "Decompressed %.*s, %u -> %lu bytes in %d ms, cache %u / %u bytes", int(name.size()), name.data(), size, original_size,
+        int((esp_timer_get_time() - start_time) / 1000), used_, budget_);
+    if (used_ > budget_) {
+        ESP_LOGW(TAG, "The acquired files are over the cache budget");
+    }
+    ptr = buffer;
+    decompressed_size = original_size;
+    return true;
+}
+
+void AssetsCache::Release(std::string_view name) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& entry : entries_) {
+        if (entry.name == name) {
+            if (entry.acquired > 0) {
+                entry.acquired--;
+            }
+            return;
+        }
+    }
+}
+
+void AssetsCache::Evict(size_t needed) {
+    auto it = entries_.end();
+    while (used_ + needed > budget_ && it != entries_.begin()) {
+        --it;
+        if (it->acquired == 0) {
+            used_ -= it->size;
+            heap_caps_free(it->data);
+            it = entries_.erase(it);
+        }
+    }
+}
+
+void AssetsCache::Clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& entry : entries_) {
+        heap_caps_free(entry.data);
+    }
+    for (auto& entry : retired_) {
+        heap_caps_free(entry.data);
+    }
+    entries_.clear();
+    retired_.clear();
+    used_ = 0;
+}
+
+void AssetsCache::Retire() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = entries_.begin(); it != entries_.end();) {
+        auto next = std::next(it);
+        if (it->acquired > 0) {
+            retired_.splice(retired_.end(), entries_, it);
+        } else {
+            heap_caps_free(it->data);
+            entries_.erase(it);
+        }
+        it = next;
+    }
+    used_ = 0;
+}
@@ -0,0 +1,49 @@
+#ifndef ASSETS_CACHE_H
+#define ASSETS_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+/*
+ * Decompressed copies of the assets files that are stored compressed (scripts/stream_compress.py),
+ * in PSRAM when available. A copy stays valid while it is acquired; released copies are kept for
+ * the next request and dropped least recently used first once the cache is over its byte budget.
+ */
+class AssetsCache {
+public:
+    explicit AssetsCache(size_t budget) : budget_(budget) {}
+    ~AssetsCache();
+    AssetsCache(const AssetsCache&) = delete;
+    AssetsCache& operator=(const AssetsCache&) = delete;
+
+    // data is the compressed file in the partition; ptr is valid until as many Release() as Acquire()
+    bool Acquire(std::string_view name, const void* data, size_t size, void*& ptr, size_t& decompressed_size);
+    void Release(std::string_view name);
+    // Drops every copy, acquired or not, when the partition is about to change
+    void Clear();
+    // Drops the released copies and keeps the acquired ones until Clear(), when the assets switch
+    // to another slot while the previous files are still in use
+    void Retire();
+
+private:
+    struct Entry {
+        std::string name;
+        uint8_t* data;
+        size_t size;
+        int acquired;
+    };
+
+    std::mutex mutex_;
+    std::list<Entry> entries_;  // Most recently used first
+    std::list<Entry> retired_;
+    size_t budget_;
+    size_t used_ = 0;
+
+    void Evict(size_t needed);
+};
+
+#endif // ASSETS_CACHE_H
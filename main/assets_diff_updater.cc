@@ -0,0 +1,525 @@
+#include "assets_diff_updater.h"
+#include "assets.h"
+#include "board.h"
+#include "flash_stream_writer.h"
+
+#include <cJSON.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <set>
+
+#define TAG "AssetsDiffUpdater"
+#define ASSETS_HEADER_SIZE 12
+// Every file is stored after a "ZZ" prefix
+#define ASSETS_FILE_PREFIX_SIZE 2
+// Changed files closer than this in the assets file are fetched with one request
+#define RANGE_MERGE_GAP (16 * 1024)
+#define READ_CHUNK_SIZE 4096
+
+bool AssetsDiffUpdater::Update(const std::string& url, const std::string& manifest_url, ProgressCallback progress) {
+    auto start_time = esp_timer_get_time();
+    if (!ReadCurrent() || !FetchManifest(manifest_url) || !Plan()) {
+        return false;
+    }
+    if (!changed_.empty() && !FetchFiles(url, progress)) {
+        return false;
+    }
+    if (copy_mode() && !CopyKeptFiles()) {
+        return false;
+    }
+    if (!Finish()) {
+        return false;
+    }
+    ESP_LOGI(TAG, "Updated %u of %u files in %d ms", changed_.size(), files_.size(),
+        int((esp_timer_get_time() - start_time) / 1000));
+    return true;
+}
+
+bool AssetsDiffUpdater::ReadCurrent() {
+    uint32_t header[3];
+    if (esp_partition_read(source_, 0, header, sizeof(header)) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to read the assets header");
+        return false;
+    }
+    uint32_t file_count = header[0];
+    uint32_t stored_len = header[2];
+    if (stored_len > source_->size - ASSETS_HEADER_SIZE || file_count > stored_len / sizeof(mmap_assets_table)) {
+        ESP_LOGW(TAG, "The assets partition has no valid header");
+        return false;
+    }
+
+    current_table_.resize(file_count * sizeof(mmap_assets_table));
+    if (esp_partition_read(source_, ASSETS_HEADER_SIZE, current_table_.data(), current_table_.size()) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to read the assets table");
+        return false;
+    }
+
+    // The per-file hashes follow the payload and the optional digest trailer
+    uint32_t position = ASSETS_HEADER_SIZE + stored_len;
+    char magic[4];
+    if (position + sizeof(magic) <= source_->size && esp_partition_read(source_, position, magic, sizeof(magic)) == ESP_OK &&
+        memcmp(magic, ASSETS_DIGEST_MAGIC, sizeof(magic)) == 0) {
+        position += ASSETS_DIGEST_TRAILER_SIZE;
+    }
+    uint32_t hashes_header[2];
+    uint32_t hashes_size = file_count * sizeof(Sha256Digest::Digest);
+    if (position + sizeof(hashes_header) + hashes_size > source_->size ||
+        esp_partition_read(source_, position, hashes_header, sizeof(hashes_header)) != ESP_OK ||
+        memcmp(hashes_header, ASSETS_FILE_HASHES_MAGIC, 4) != 0 || hashes_header[1] != file_count) {
+        ESP_LOGW(TAG, "The assets partition has no per-file hashes");
+        return false;
+    }
+    std::vector<Sha256Digest::Digest> hashes(file_count);
+    if (esp_partition_read(source_, position + sizeof(hashes_header), hashes.data(), hashes_size) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to read the per-file hashes");
+        return false;
+    }
+    current_end_ = position + sizeof(hashes_header) + hashes_size;
+
+    uint32_t data_start = ASSETS_HEADER_SIZE + file_count * sizeof(mmap_assets_table);
+    for (uint32_t i = 0; i < file_count; i++) {
+        auto item = reinterpret_cast<const mmap_assets_table*>(current_table_.data() + i * sizeof(mmap_assets_table));
+        std::string name(item->asset_name, strnlen(item->asset_name, sizeof(item->asset_name)));
+        current_[name] = CurrentFile{data_start + item->asset_offset, item->asset_size, hashes[i]};
+    }
+    return true;
+}
+
+bool AssetsDiffUpdater::FetchManifest(const std::string& manifest_url) {
+    auto network = Board::GetInstance().GetNetwork();
+    auto http = network->CreateHttp(connect_id_);
+    if (!http->Open("GET", manifest_url)) {
+        ESP_LOGE(TAG, "Failed to open HTTP connection");
+        return false;
+    }
+    if (http->GetStatusCode() != 200) {
+        ESP_LOGE(TAG, "Failed to get the assets manifest, status code: %d", http->GetStatusCode());
+        return false;
+    }
+    std::string data = http->ReadAll();
+    http->Close();
+
+    cJSON* root = cJSON_Parse(data.c_str());
+    if (root == nullptr) {
+        ESP_LOGE(TAG, "Failed to parse the assets manifest");
+        return false;
+    }
+    bool valid = false;
+    cJSON* size = cJSON_GetObjectItem(root, "size");
+    cJSON* files = cJSON_GetObjectItem(root, "files");
+    if (cJSON_IsNumber(size) && cJSON_IsArray(files)) {
+        file_size_ = size->valuedouble;
+        valid = true;
+        std::set<std::string> names;
+        cJSON* item = nullptr;
+        cJSON_ArrayForEach(item, files) {
+            cJSON* name = cJSON_GetObjectItem(item, "name");
+            cJSON* offset = cJSON_GetObjectItem(item, "offset");
+            cJSON* file_size = cJSON_GetObjectItem(item, "size");
+            cJSON* width = cJSON_GetObjectItem(item, "width");
+            cJSON* height = cJSON_GetObjectItem(item, "height");
+            cJSON* sha256 = cJSON_GetObjectItem(item, "sha256");
+            if (!cJSON_IsString(name) || !cJSON_IsNumber(offset) || !cJSON_IsNumber(file_size) || !cJSON_IsString(sha256) ||
+                strlen(name->valuestring) > sizeof(mmap_assets_table::asset_name) || strlen(sha256->valuestring) != 64 ||
+                offset->valuedouble + ASSETS_FILE_PREFIX_SIZE + file_size->valuedouble > file_size_ ||
+                !names.insert(name->valuestring).second) {
+                valid = false;
+                break;
+            }
+            files_.push_back(NewFile{
+                .name = name->valuestring,
+                .size = static_cast<uint32_t>(file_size->valuedouble),
+                .width = static_cast<uint16_t>(cJSON_IsNumber(width) ? width->valueint : 0),
+                .height = static_cast<uint16_t>(cJSON_IsNumber(height) ? height->valueint : 0),
+                .sha256 = sha256->valuestring,
+                .digest = {},
+                .source = static_cast<uint32_t>(offset->valuedouble),
+                .target = 0,
+                .current = 0,
+                .keep = false,
+            });
+        }
+    }
+    cJSON_Delete(root);
+    if (!valid || files_.empty()) {
+        ESP_LOGE(TAG, "The assets manifest is not valid");
+        return false;
+    }
+    return true;
+}
+
+bool AssetsDiffUpdater::Plan() {
+    const uint32_t sector_size = esp_partition_get_main_flash_sector_size();
+    auto align_to_sector = [sector_size](uint32_t size) {
+        return (size + sector_size - 1) / sector_size * sector_size;
+    };
+
+    // Kept files must stay clear of the new table, the others are appended after the used space.
+    // Copying to another partition, every file goes where it is in the assets file
+    table_end_ = ASSETS_HEADER_SIZE + files_.size() * sizeof(mmap_assets_table);
+    uint32_t live_size = 0;
+    uint32_t changed_size = 0;
+    for (size_t i = 0; i < files_.size(); i++) {
+        auto& file = files_[i];
+        auto it = current_.find(file.name);
+        file.keep = it != current_.end() && it->second.size == file.size && (copy_mode() || it->second.offset >= table_end_) &&
+            Sha256Digest::Matches(it->second.sha256, file.sha256);
+        if (file.keep) {
+            file.current = it->second.offset;
+            file.target = copy_mode() ? file.source : it->second.offset;
+            file.digest = it->second.sha256;
+        } else {
+            changed_.push_back(i);
+            changed_size += ASSETS_FILE_PREFIX_SIZE + file.size;
+        }
+        live_size += ASSETS_FILE_PREFIX_SIZE + file.size;
+    }
+    if (copy_mode()) {
+        return PlanCopy(changed_size);
+    }
+    if (changed_.empty() && BuildTable() == current_table_) {
+        return true;
+    }
+    std::sort(changed_.begin(), changed_.end(), [this](size_t a, size_t b) {
+        return files_[a].source < files_[b].source;
+    });
+
+    erased_end_ = std::max(align_to_sector(current_end_), align_to_sector(table_end_));
+    payload_end_ = erased_end_;
+    for (auto index : changed_) {
+        files_[index].target = payload_end_;
+        payload_end_ += ASSETS_FILE_PREFIX_SIZE + files_[index].size;
+    }
+
+    uint32_t hashes_end = payload_end_ + 8 + files_.size() * sizeof(Sha256Digest::Digest);
+    if (hashes_end > partition_->size) {
+        ESP_LOGW(TAG, "The changed files (%lu bytes) do not fit after the used space, the partition needs compacting", changed_size);
+        return false;
+    }
+    uint32_t data_size = payload_end_ - table_end_;
+    uint32_t wasted = data_size > live_size ? data_size - live_size : 0;
+    int wasted_percent = data_size > 0 ? int(uint64_t(wasted) * 100 / data_size) : 0;
+    ESP_LOGI(TAG, "%u of %u files changed, %lu bytes to download, %d%% of the data space unused after the update",
+        changed_.size(), files_.size(), changed_size, wasted_percent);
+    if (wasted_percent > CONFIG_ASSETS_DIFF_COMPACT_PERCENT) {
+        ESP_LOGW(TAG, "The unused space crosses %d%%, the partition needs compacting", CONFIG_ASSETS_DIFF_COMPACT_PERCENT);
+        return false;
+    }
+    return true;
+}
+
+bool AssetsDiffUpdater::PlanCopy(uint32_t changed_size) {
+    const uint32_t sector_size = esp_partition_get_main_flash_sector_size();
+    auto align_to_sector = [sector_size](uint32_t size) {
+        return (size + sector_size - 1) / sector_size * sector_size;
+    };
+
+    std::sort(changed_.begin(), changed_.end(), [this](size_t a, size_t b) {
+        return files_[a].source < files_[b].source;
+    });
+    payload_end_ = table_end_;
+    for (auto& file : files_) {
+        if (!file.keep) {
+            file.target = file.source;
+        }
+        payload_end_ = std::max<uint32_t>(payload_end_, file.target + ASSETS_FILE_PREFIX_SIZE + file.size);
+    }
+    uint32_t hashes_end = payload_end_ + 8 + files_.size() * sizeof(Sha256Digest::Digest);
+    if (hashes_end > partition_->size) {
+        ESP_LOGW(TAG, "The assets (%lu bytes) do not fit in the partition %s", hashes_end, partition_->label);
+        return false;
+    }
+    ESP_LOGI(TAG, "%u of %u files changed, %lu bytes to download, the others are copied from %s",
+        changed_.size(), files_.size(), changed_size, source_->label);
+
+    // The target holds no assets in use, it is erased up front and rewritten, the header sectors last
+    erased_end_ = align_to_sector(hashes_end);
+    esp_err_t err = esp_partition_erase_range(partition_, 0, erased_end_);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to erase the partition %s: %s", partition_->label, esp_err_to_name(err));
+        return false;
+    }
+    return true;
+}
+
+bool AssetsDiffUpdater::CopyKeptFiles() {
+    auto buffer = static_cast<uint8_t*>(malloc(READ_CHUNK_SIZE));
+    if (buffer == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate the copy buffer");
+        return false;
+    }
+    bool success = true;
+    for (auto& file : files_) {
+        if (!file.keep) {
+            continue;
+        }
+        uint32_t length = ASSETS_FILE_PREFIX_SIZE + file.size;
+        for (uint32_t position = 0; position < length && success; position += READ_CHUNK_SIZE) {
+            uint32_t size = std::min<uint32_t>(READ_CHUNK_SIZE, length - position);
+            success = esp_partition_read(source_, file.current + position, buffer, size) == ESP_OK &&
+                esp_partition_write(partition_, file.target + position, buffer, size) == ESP_OK;
+        }
+        if (!success) {
+            ESP_LOGE(TAG, "Failed to copy %s from %s", file.name.c_str(), source_->label);
+            break;
+        }
+    }
+    free(buffer);
+    return success;
+}
+
+bool AssetsDiffUpdater::FetchFiles(const std::string& url, ProgressCallback progress) {
+    const uint32_t sector_size = esp_partition_get_main_flash_sector_size();
+    auto align_to_sector = [sector_size](uint32_t size) {
+        return (size + sector_size - 1) / sector_size * sector_size;
+    };
+    const uint32_t erase_limit = align_to_sector(payload_end_ + 8 + files_.size() * sizeof(Sha256Digest::Digest));
+
+    std::vector<Range> ranges;
+    size_t total = 0;
+    for (size_t i = 0; i < changed_.size(); i++) {
+        auto& file = files_[changed_[i]];
+        uint32_t end = file.source + ASSETS_FILE_PREFIX_SIZE + file.size;
+        if (!ranges.empty() && file.source >= ranges.back().end && file.source - ranges.back().end <= RANGE_MERGE_GAP) {
+            total += end - ranges.back().end;
+            ranges.back().end = end;
+            ranges.back().file_count++;
+        } else {
+            total += end - file.source;
+            ranges.push_back(Range{file.source, end, i, 1});
+        }
+    }
+    ESP_LOGI(TAG, "Fetching %u bytes in %u ranges", total, ranges.size());
+
+    auto network = Board::GetInstance().GetNetwork();
+    std::atomic<size_t> fetched = 0;
+    for (auto& range : ranges) {
+        auto http = network->CreateHttp(connect_id_);
+        http->SetHeader("Range", "bytes=" + std::to_string(range.start) + "-" + std::to_string(range.end - 1));
+        if (!http->Open("GET", url)) {
+            ESP_LOGE(TAG, "Failed to open HTTP connection");
+            return false;
+        }
+        if (http->GetStatusCode() != 206) {
+            ESP_LOGW(TAG, "The server did not send a range, status code: %d", http->GetStatusCode());
+            return false;
+        }
+        auto content_range = http->GetResponseHeader("Content-Range");
+        unsigned long first = 0, last = 0, file_size = 0;
+        if (sscanf(content_range.c_str(), "bytes %lu-%lu/%lu", &first, &last, &file_size) != 3 ||
+            first != range.start || last + 1 != range.end || file_size != file_size_) {
+            ESP_LOGE(TAG, "Unexpected Content-Range \"%s\" for %lu-%lu", content_range.c_str(), range.start, range.end - 1);
+            return false;
+        }
+
+        // Cuts the received blocks into the files of the range, skipping the data between them
+        size_t file_index = range.first_file;
+        std::unique_ptr<Sha256Digest> digest;
+        FlashStreamWriter writer;
+        bool success = writer.Run(http.get(), range.end - range.start, [&](size_t offset, const char* data, size_t size) -> bool {
+            uint32_t start = range.start + offset;
+            uint32_t end = start + size;
+            while (file_index < range.first_file + range.file_count) {
+                auto& file = files_[changed_[file_index]];
+                uint32_t file_end = file.source + ASSETS_FILE_PREFIX_SIZE + file.size;
+                if (file.source >= end) {
+                    break;
+                }
+                uint32_t slice_start = std::max(start, file.source);
+                uint32_t slice_end = std::min(end, file_end);
+                uint32_t target = file.target + (slice_start - file.source);
+
+                uint32_t erase_end = std::min(align_to_sector(target + (slice_end - slice_start) + writer.block_size()), erase_limit);
+                if (erase_end > erased_end_) {
+                    esp_err_t err = esp_partition_erase_range(partition_, erased_end_, erase_end - erased_end_);
+                    if (err != ESP_OK) {
+                        ESP_LOGE(TAG, "Failed to erase assets partition at offset %lu: %s", erased_end_, esp_err_to_name(err));
+                        return false;
+                    }
+                    erased_end_ = erase_end;
+                }
+                esp_err_t err = esp_partition_write(partition_, target, data + (slice_start - start), slice_end - slice_start);
+                if (err != ESP_OK) {
+                    ESP_LOGE(TAG, "Failed to write to assets partition at offset %lu: %s", target, esp_err_to_name(err));
+                    return false;
+                }
+
+                if (slice_start == file.source) {
+                    digest = std::make_unique<Sha256Digest>();
+                }
+                for (uint32_t i = slice_start; i < std::min(slice_end, file.source + ASSETS_FILE_PREFIX_SIZE); i++) {
+                    if (data[i - start] != 'Z') {
+                        ESP_LOGE(TAG, "The file %s has no valid prefix in the assets file", file.name.c_str());
+                        return false;
+                    }
+                }
+                uint32_t content_start = std::max(slice_start, file.source + ASSETS_FILE_PREFIX_SIZE);
+                if (content_start < slice_end) {
+                    digest->Update(data + (content_start - start), slice_end - content_start);
+                }
+                if (slice_end < file_end) {
+                    break;
+                }
+
+                file.digest = digest->Finish();
+                digest.reset();
+                if (!Sha256Digest::Matches(file.digest, file.sha256)) {
+                    ESP_LOGE(TAG, "The SHA-256 of %s does not match the manifest", file.name.c_str());
+                    return false;
+                }
+                file_index++;
+            }
+            fetched += size;
+            return true;
+        }, [&](int, size_t speed) {
+            if (progress) {
+                progress(total > 0 ? fetched * 100 / total : 100, speed);
+            }
+        });
+        http->Close();
+        if (!success) {
+            return false;
+        }
+        if (file_index != range.first_file + range.file_count) {
+            ESP_LOGE(TAG, "The range %lu-%lu ended before its files", range.start, range.end - 1);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool AssetsDiffUpdater::Finish() {
+    // Kept files were matched by the hashes stored with them, their data is checked as well
+    for (auto& file : files_) {
+        if (!file.keep) {
+            continue;
+        }
+        Sha256Digest digest;
+        bool prefix_valid = false;
+        bool read_ok = ReadRange(file.target, ASSETS_FILE_PREFIX_SIZE + file.size, [&](const uint8_t* data, size_t size) {
+            if (!prefix_valid) {
+                prefix_valid = data[0] == 'Z' && data[1] == 'Z';
+                data += ASSETS_FILE_PREFIX_SIZE;
+                size -= ASSETS_FILE_PREFIX_SIZE;
+            }
+            digest.Update(data, size);
+        });
+        if (!read_ok || !prefix_valid || digest.Finish() != file.digest) {
+            ESP_LOGW(TAG, "The file %s in the partition does not match its hash", file.name.c_str());
+            return false;
+        }
+    }
+
+    auto table = BuildTable();
+    if (!copy_mode() && changed_.empty() && table == current_table_) {
+        ESP_LOGI(TAG, "The assets are up to date");
+        return true;
+    }
+
+    const uint32_t sector_size = esp_partition_get_main_flash_sector_size();
+    auto align_to_sector = [sector_size](uint32_t size) {
+        return (size + sector_size - 1) / sector_size * sector_size;
+    };
+
+    // The per-file hashes go right after the payload, for the next update
+    std::vector<uint8_t> hashes(8 + files_.size() * sizeof(Sha256Digest::Digest));
+    uint32_t file_count = files_.size();
+    memcpy(hashes.data(), ASSETS_FILE_HASHES_MAGIC, 4);
+    memcpy(hashes.data() + 4, &file_count, sizeof(file_count));
+    for (size_t i = 0; i < files_.size(); i++) {
+        memcpy(hashes.data() + 8 + i * sizeof(Sha256Digest::Digest), files_[i].digest.data(), sizeof(Sha256Digest::Digest));
+    }
+    uint32_t hashes_end = align_to_sector(payload_end_ + hashes.size());
+    if (hashes_end > erased_end_) {
+        if (esp_partition_erase_range(partition_, erased_end_, hashes_end - erased_end_) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to erase the per-file hashes");
+            return false;
+        }
+        erased_end_ = hashes_end;
+    }
+    if (esp_partition_write(partition_, payload_end_, hashes.data(), hashes.size()) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to write the per-file hashes");
+        return false;
+    }
+
+    // The checksum covers the table and everything up to the end of the payload, unused space included
+    uint32_t checksum = 0;
+    for (auto byte : table) {
+        checksum += byte;
+    }
+    if (!ReadRange(table_end_, payload_end_ - table_end_, [&checksum](const uint8_t* data, size_t size) {
+        for (size_t i = 0; i < size; i++) {
+            checksum += data[i];
+        }
+    })) {
+        return false;
+    }
+    checksum &= 0xFFFF;
+
+    // The header sectors also hold the beginning of the data, they are read, patched and written back
+    uint32_t header_end = align_to_sector(table_end_);
+    auto buffer = static_cast<uint8_t*>(heap_caps_malloc(header_end, MALLOC_CAP_SPIRAM));
+    if (buffer == nullptr) {
+        buffer = static_cast<uint8_t*>(heap_caps_malloc(header_end, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT));
+    }
+    if (buffer == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate %lu bytes for the header sectors", header_end);
+        return false;
+    }
+    bool success = esp_partition_read(partition_, 0, buffer, header_end) == ESP_OK;
+    if (success) {
+        uint32_t header[3] = { file_count, checksum, payload_end_ - ASSETS_HEADER_SIZE };
+        memcpy(buffer, header, sizeof(header));
+        memcpy(buffer + ASSETS_HEADER_SIZE, table.data(), table.size());
+        success = esp_partition_erase_range(partition_, 0, header_end) == ESP_OK &&
+            esp_partition_write(partition_, 0, buffer, header_end) == ESP_OK;
+        if (!success) {
+            ESP_LOGE(TAG, "Failed to write the assets header, the partition needs a full download");
+        }
+    } else {
+        ESP_LOGE(TAG, "Failed to read the assets header sectors");
+    }
+    heap_caps_free(buffer);
+    return success;
+}
+
+std::vector<uint8_t> AssetsDiffUpdater::BuildTable() const {
+    std::vector<uint8_t> table(files_.size() * sizeof(mmap_assets_table));
+    for (size_t i = 0; i < files_.size(); i++) {
+        auto& file = files_[i];
+        mmap_assets_table item = {};
+        memcpy(item.asset_name, file.name.data(), std::min(file.name.size(), sizeof(item.asset_name)));
+        item.asset_size = file.size;
+        item.asset_offset = file.target - table_end_;
+        item.asset_width = file.width;
+        item.asset_height = file.height;
+        memcpy(table.data() + i * sizeof(item), &item, sizeof(item));
+    }
+    return table;
+}
+
+bool AssetsDiffUpdater::ReadRange(uint32_t offset, uint32_t length, std::function<void(const uint8_t* data, size_t size)> callback) {
+    auto buffer = static_cast<uint8_t*>(malloc(READ_CHUNK_SIZE));
+    if (buffer == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate the read buffer");
+        return false;
+    }
+    bool success = true;
+    for (uint32_t position = 0; position < length; position += READ_CHUNK_SIZE) {
+        uint32_t size = std::min<uint32_t>(READ_CHUNK_SIZE, length - position);
+        if (esp_partition_read(partition_, offset + position, buffer, size) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to read assets partition at offset %lu", offset + position);
+            success = false;
+            break;
+        }
+        callback(buffer, size);
+    }
+    free(buffer);
+    return success;
+}
@@ -0,0 +1,88 @@
+#ifndef ASSETS_DIFF_UPDATER_H
+#define ASSETS_DIFF_UPDATER_H
+
+#include "sha256_digest.h"
+
+#include <esp_partition.h>
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+/*
+ * Updates the assets partition with only the files that changed. The manifest generated next to
+ * the assets file lists the files with their SHA-256 and offset in it; files that are already in
+ * the partition with the same hash stay where they are, the others are fetched with Range requests
+ * and appended after the used space. The header and file table are rewritten last, so that an
+ * interruption before that leaves the previous assets intact.
+ * Returns false, without touching the used space, when the partition has no per-file hashes, the
+ * files do not fit or the wasted space would cross CONFIG_ASSETS_DIFF_COMPACT_PERCENT; a full
+ * download then rewrites the partition packed.
+ * With a source partition, the other assets slot, the files are compared with the source and the
+ * target is written packed in the layout of the assets file: kept files are copied from the source.
+ */
+class AssetsDiffUpdater {
+public:
+    using ProgressCallback = std::function<void(int progress, size_t speed)>;
+
+    // connect_id is the network connection id of the HTTP requests
+    AssetsDiffUpdater(const esp_partition_t* partition, int connect_id = 0, const esp_partition_t* source = nullptr)
+        : partition_(partition), source_(source != nullptr ? source : partition), connect_id_(connect_id) {}
+
+    bool Update(const std::string& url, const std::string& manifest_url, ProgressCallback progress);
+
+private:
+    struct CurrentFile {
+        uint32_t offset;  // Of the "ZZ" prefix in the partition
+        uint32_t size;
+        Sha256Digest::Digest sha256;
+    };
+
+    struct NewFile {
+        std::string name;
+        uint32_t size;
+        uint16_t width;
+        uint16_t height;
+        std::string sha256;       // Hex, from the manifest
+        Sha256Digest::Digest digest;
+        uint32_t source;          // Offset of the "ZZ" prefix in the assets file
+        uint32_t target;          // Offset of the "ZZ" prefix in the partition
+        uint32_t current;         // Offset of the "ZZ" prefix of a kept file in the source partition
+        bool keep;
+    };
+
+    struct Range {
+        uint32_t start;
+        uint32_t end;
+        size_t first_file;        // Index in changed_
+        size_t file_count;
+    };
+
+    const esp_partition_t* partition_;
+    const esp_partition_t* source_;  // The partition the current files are read from
+    int connect_id_;
+    std::map<std::string, CurrentFile> current_;
+    std::vector<uint8_t> current_table_;
+    uint32_t current_end_ = 0;    // End of the payload, the trailer and the file hashes
+    std::vector<NewFile> files_;
+    std::vector<size_t> changed_; // Indexes in files_, in the order of the assets file
+    uint32_t file_size_ = 0;      // Of the whole assets file
+    uint32_t table_end_ = 0;
+    uint32_t payload_end_ = 0;
+    uint32_t erased_end_ = 0;     // Erased space starts at the first sector after the used space
+
+    bool ReadCurrent();
+    bool FetchManifest(const std::string& manifest_url);
+    bool Plan();
+    bool PlanCopy(uint32_t changed_size);
+    bool FetchFiles(const std::string& url, ProgressCallback progress);
+    bool CopyKeptFiles();
+    bool Finish();
+    std::vector<uint8_t> BuildTable() const;
+    bool ReadRange(uint32_t offset, uint32_t length, std::function<void(const uint8_t* data, size_t size)> callback);
+    bool copy_mode() const { return source_ != partition_; }
+};
+
+#endif // ASSETS_DIFF_UPDATER_H
@@ -1,4 +1,5 @@
 #include "audio_service.h"
+#include "tracing.h"
 #include <esp_log.h>
 #include <cstring>
 
@@ -182,6 +183,7 @@ void AudioService::Stop() {
 }
 
 bool AudioService::ReadAudioData(std::vector<int16_t>& data, int sample_rate, int samples) {
+    TRACE_SCOPE("audio_read");
     if (!codec_->input_enabled()) {
         esp_timer_stop(audio_power_timer_);
         esp_timer_start_periodic(audio_power_timer_, AUDIO_POWER_CHECK_INTERVAL_MS * 1000);
@@ -314,7 +316,13 @@ void AudioService::AudioOutputTask() {
             esp_timer_start_periodic(audio_power_timer_, AUDIO_POWER_CHECK_INTERVAL_MS * 1000);
             codec_->EnableOutput(true);
         }
-        codec_->OutputData(task->pcm);
+        {
+            TRACE_SCOPE("audio_write");
+            codec_->OutputData(task->pcm);
+        }
+        if (callbacks_.on_audio_output) {
+            callbacks_.on_audio_output();
+        }
 
         /* Update the last output time */
         last_output_time_ = std::chrono::steady_clock::now();
@@ -337,7 +345,7 @@ void AudioService::OpusCodecTask() {
         std::unique_lock<std::mutex> lock(audio_queue_mutex_);
         audio_queue_cv_.wait(lock, [this]() {
             return service_stopped_ ||
-                (!audio_encode_queue_.empty() && audio_send_queue_.size() < MAX_SEND_PACKETS_IN_QUEUE) ||
+                (!audio_encode_queue_.empty() && (pending_uplink_ || audio_send_queue_.size() < MAX_SEND_PACKETS_IN_QUEUE)) ||
                 (!audio_decode_queue_.empty() && audio_playback_queue_.size() < MAX_PLAYBACK_TASKS_IN_QUEUE);
         });
         if (service_stopped_) {
@@ -371,7 +379,9 @@ void AudioService::OpusCodecTask() {
                 };
                 esp_audio_dec_info_t dec_info = {};
                 std::unique_lock<std::mutex> decoder_lock(decoder_mutex_);
+                TRACE_BEGIN("opus_decode", packet->payload.size());
                 auto ret = esp_opus_dec_decode(opus_decoder_, &raw, &out_frame, &dec_info);
+                TRACE_END("opus_decode");
                 decoder_lock.unlock();
                 if (ret == ESP_AUDIO_ERR_OK) {
                     task->pcm.resize(out_frame.decoded_size / sizeof(int16_t));
@@ -387,6 +397,7 @@ void AudioService::OpusCodecTask() {
                     }
                     lock.lock();
                     audio_playback_queue_.push_back(std::move(task));
+                    TRACE_COUNTER("playback_queue", audio_playback_queue_.size());
                     audio_queue_cv_.notify_all();
                     debug_statistics_.decode_count++;
                 } else {
@@ -400,7 +411,7 @@ void AudioService::OpusCodecTask() {
             debug_statistics_.decode_count++;
         }
         /* Encode the audio to send queue */
-        if (!audio_encode_queue_.empty() && audio_send_queue_.size() < MAX_SEND_PACKETS_IN_QUEUE) {
+        if (!audio_encode_queue_.empty() && (pending_uplink_ || audio_send_queue_.size() < MAX_SEND_PACKETS_IN_QUEUE)) {
             auto task = std::move(audio_encode_queue_.front());
             audio_encode_queue_.pop_front();
             audio_queue_cv_.notify_all();
@@ -422,14 +433,21 @@ void AudioService::OpusCodecTask() {
                     .len = (uint32_t)encoder_outbuf_size_,
                     .encoded_bytes = 0,
                 };
+                TRACE_BEGIN("opus_encode", 0);
                 auto ret = esp_opus_enc_process(opus_encoder_, &in, &out);
+                TRACE_END("opus_encode");
                 if (ret == ESP_AUDIO_ERR_OK) {
                     packet->payload.assign(buf.data(), buf.data() + out.encoded_bytes);
 
                     if (task->type == kAudioTaskTypeEncodeToSendQueue) {
                         {
                             std::lock_guard<std::mutex> lock2(audio_queue_mutex_);
-                            audio_send_queue_.push_back(std::move(packet));
+                            // During a slow handshake keep the start of the utterance, drop what comes after
+                            if (pending_uplink_ && audio_send_queue_.size() >= MAX_SEND_PACKETS_IN_QUEUE) {
+                                pending_uplink_dropped_++;
+                            } else {
+                                audio_send_queue_.push_back(std::move(packet));
+                            }
                         }
                         if (callbacks_.on_send_queue_available) {
                             callbacks_.on_send_queue_available();
@@ -521,6 +539,7 @@ bool AudioService::PushPacketToDecodeQueue(std::unique_ptr<AudioStreamPacket> pa
         }
     }
     audio_decode_queue_.push_back(std::move(packet));
+    TRACE_COUNTER("decode_queue", audio_decode_queue_.size());
     audio_queue_cv_.notify_all();
     return true;
 }
@@ -536,6 +555,26 @@ std::unique_ptr<AudioStreamPacket> AudioService::PopPacketFromSendQueue() {
     return packet;
 }
 
+int AudioService::EnablePendingUplink(bool enable) {
+    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
+    pending_uplink_ = enable;
+    int dropped = pending_uplink_dropped_;
+    pending_uplink_dropped_ = 0;
+    audio_queue_cv_.notify_all();
+    return dropped;
+}
+
+void AudioService::ClearSendQueue() {
+    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
+    audio_send_queue_.clear();
+    audio_queue_cv_.notify_all();
+}
+
+size_t AudioService::GetSendQueueSize() {
+    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
+    return audio_send_queue_.size();
+}
+
 void AudioService::EncodeWakeWord() {
     if (wake_word_) {
         wake_word_->EncodeWakeWordData();
@@ -543,6 +582,10 @@ void AudioService::EncodeWakeWord() {
 }
 
 const std::string& AudioService::GetLastWakeWord() const {
+    static const std::string empty;
+    if (!wake_word_) {
+        return empty;
+    }
     return wake_word_->GetLastDetectedWakeWord();
 }
 
@@ -554,6 +597,20 @@ std::unique_ptr<AudioStreamPacket> AudioService::PopWakeWordPacket() {
     return nullptr;
 }
 
+bool AudioService::InitializeWakeWord() {
+    if (!wake_word_) {
+        return false;
+    }
+    if (!wake_word_initialized_) {
+        if (!wake_word_->Initialize(codec_, models_list_)) {
+            ESP_LOGE(TAG, "Failed to initialize wake word");
+            return false;
+        }
+        wake_word_initialized_ = true;
+    }
+    return true;
+}
+
 void AudioService::EnableWakeWordDetection(bool enable) {
     if (!wake_word_) {
         return;
@@ -561,12 +618,8 @@ void AudioService::EnableWakeWordDetection(bool enable) {
 
     ESP_LOGD(TAG, "%s wake word detection", enable ? "Enabling" : "Disabling");
     if (enable) {
-        if (!wake_word_initialized_) {
-            if (!wake_word_->Initialize(codec_, models_list_)) {
-                ESP_LOGE(TAG, "Failed to initialize wake word");
-                return;
-            }
-            wake_word_initialized_ = true;
+        if (!InitializeWakeWord()) {
+            return;
         }
         // Reset input resampler to clear cached data from previous mode (e.g. AudioProcessor)
         // This prevents buffer overflow when switching between different feed sizes
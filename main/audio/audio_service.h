@@ -80,6 +80,8 @@ struct AudioServiceCallbacks {
     std::function<void(const std::string&)> on_wake_word_detected;
     std::function<void(bool)> on_vad_change;
     std::function<void(void)> on_audio_testing_queue_full;
+    // Called by the output task after each frame is written to the codec
+    std::function<void(void)> on_audio_output;
 };
 
 
@@ -120,6 +122,8 @@ public:
     bool IsAudioProcessorRunning() const { return xEventGroupGetBits(event_group_) & AS_EVENT_AUDIO_PROCESSOR_RUNNING; }
     bool IsAfeWakeWord();
 
+    // Loads the wake word model ahead of the first EnableWakeWordDetection(true), not thread-safe with it
+    bool InitializeWakeWord();
     void EnableWakeWordDetection(bool enable);
     void EnableVoiceProcessing(bool enable);
     void EnableAudioTesting(bool enable);
@@ -129,6 +133,11 @@ public:
 
     bool PushPacketToDecodeQueue(std::unique_ptr<AudioStreamPacket> packet, bool wait = false);
     std::unique_ptr<AudioStreamPacket> PopPacketFromSendQueue();
+    // While the audio channel is opening, the send queue keeps the first packets, the start of the utterance,
+    // and drops the newer ones instead of stalling the encoder. Returns the number of dropped packets when disabled.
+    int EnablePendingUplink(bool enable);
+    void ClearSendQueue();
+    size_t GetSendQueueSize();
     void PlaySound(const std::string_view& sound);
     bool ReadAudioData(std::vector<int16_t>& data, int sample_rate, int samples);
     void ResetDecoder();
@@ -179,6 +188,8 @@ private:
     bool voice_detected_ = false;
     bool service_stopped_ = true;
     bool audio_input_need_warmup_ = false;
+    bool pending_uplink_ = false;
+    int pending_uplink_dropped_ = 0;
 
     esp_timer_handle_t audio_power_timer_ = nullptr;
     std::chrono::steady_clock::time_point last_input_time_;
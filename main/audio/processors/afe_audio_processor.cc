@@ -1,4 +1,5 @@
 #include "afe_audio_processor.h"
+#include "tracing.h"
 #include <esp_log.h>
 
 #define PROCESSOR_RUNNING 0x01
@@ -142,14 +143,17 @@ void AfeAudioProcessor::AudioProcessorTask() {
         if (vad_state_change_callback_) {
             if (res->vad_state == VAD_SPEECH && !is_speaking_) {
                 is_speaking_ = true;
+                TRACE_INSTANT("vad", 1);
                 vad_state_change_callback_(true);
             } else if (res->vad_state == VAD_SILENCE && is_speaking_) {
                 is_speaking_ = false;
+                TRACE_INSTANT("vad", 0);
                 vad_state_change_callback_(false);
             }
         }
 
         if (output_callback_) {
+            TRACE_SCOPE("afe_output");
             size_t samples = res->data_size / sizeof(int16_t);
             
             // Add data to buffer
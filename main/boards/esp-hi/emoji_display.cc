@@ -88,6 +88,11 @@ void EmojiPlayer::StartPlayer(const std::string& asset_name, bool repeat, int fp
         }
 
         anim_player_set_src_data(player_handle_, src_data, src_len);
+        // The previous animation is no longer played, a compressed one stays in the assets cache until it is dropped
+        if (!current_file_.empty()) {
+            assets.ReleaseAssetData(current_file_);
+        }
+        current_file_ = filename;
         anim_player_get_segment(player_handle_, &start, &end);
         if(asset_name == "wake"){
             start = 7;
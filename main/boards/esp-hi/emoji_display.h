@@ -28,6 +28,7 @@ private:
     static void OnFlush(anim_player_handle_t handle, int x_start, int y_start, int x_end, int y_end, const void *color_data);
 
     anim_player_handle_t player_handle_;
+    std::string current_file_;
 };
 
 class EmojiWidget : public Display {
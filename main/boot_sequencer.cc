@@ -0,0 +1,120 @@
+#include "boot_sequencer.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <algorithm>
+#include <cassert>
+
+#define TAG "BootSequencer"
+
+int BootSequencer::Add(const char* name, std::function<void()> callback, std::initializer_list<int> after) {
+    assert(steps_.size() < BOOT_SEQUENCER_MAX_STEPS);
+    Step step;
+    step.name = name;
+    step.callback = std::move(callback);
+    for (int id : after) {
+        assert(id >= 0 && id < (int)steps_.size());
+        step.after_mask |= 1u << id;
+    }
+    steps_.push_back(std::move(step));
+    return steps_.size() - 1;
+}
+
+int BootSequencer::AddCompleted(const char* name, int64_t start_us) {
+    assert(steps_.size() < BOOT_SEQUENCER_MAX_STEPS);
+    Step step;
+    step.name = name;
+    step.started = true;
+    step.start_us = start_us;
+    step.end_us = esp_timer_get_time();
+    steps_.push_back(std::move(step));
+    done_mask_ |= 1u << (steps_.size() - 1);
+    finished_++;
+    return steps_.size() - 1;
+}
+
+void BootSequencer::Run() {
+    run_start_us_ = esp_timer_get_time();
+    for (auto& step : steps_) {
+        if (step.started) {
+            run_start_us_ = std::min(run_start_us_, step.start_us);
+        }
+    }
+    int pending = (int)steps_.size() - finished_;
+    int workers = std::min(BOOT_SEQUENCER_WORKERS, pending - 1);
+    for (int i = 0; i < workers; i++) {
+        // Counted before the worker starts so that it cannot leave first, and given back if it was not created
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            active_workers_++;
+        }
+        auto ret = xTaskCreate([](void* arg) {
+            BootSequencer* sequencer = static_cast<BootSequencer*>(arg);
+            sequencer->WorkerLoop();
+            vTaskDelete(NULL);
+        }, "boot_worker", 4096 * 2, this, uxTaskPriorityGet(nullptr), nullptr);
+        if (ret != pdPASS) {
+            ESP_LOGW(TAG, "Failed to create a boot worker, %d of %d running", i, workers);
+            std::lock_guard<std::mutex> lock(mutex_);
+            active_workers_--;
+            break;
+        }
+    }
+
+    // The calling task takes part, then waits for the workers to leave before the sequencer goes away
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        active_workers_++;
+    }
+    WorkerLoop();
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this]() { return active_workers_ == 0; });
+    LogReport(esp_timer_get_time() - run_start_us_);
+}
+
+void BootSequencer::WorkerLoop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (finished_ < (int)steps_.size()) {
+        auto it = std::find_if(steps_.begin(), steps_.end(), [this](const Step& step) {
+            return !step.started && (step.after_mask & ~done_mask_) == 0;
+        });
+        if (it == steps_.end()) {
+            cv_.wait(lock);
+            continue;
+        }
+
+        Step& step = *it;
+        step.started = true;
+        lock.unlock();
+        step.start_us = esp_timer_get_time();
+        step.callback();
+        step.end_us = esp_timer_get_time();
+        lock.lock();
+
+        done_mask_ |= 1u << (it - steps_.begin());
+        finished_++;
+        cv_.notify_all();
+    }
+    active_workers_--;
+    cv_.notify_all();
+}
+
+void BootSequencer::LogReport(int64_t total_us) const {
+    std::vector<const Step*> sorted;
+    int64_t serial_us = 0;
+    for (auto& step : steps_) {
+        sorted.push_back(&step);
+        serial_us += step.end_us - step.start_us;
+    }
+    std::sort(sorted.begin(), sorted.end(), [](const Step* a, const Step* b) {
+        return a->start_us < b->start_us;
+    });
+
+    ESP_LOGI(TAG, "Boot steps done in %d ms (%d ms one after another)", (int)(total_us / 1000), (int)(serial_us / 1000));
+    for (auto step : sorted) {
+        ESP_LOGI(TAG, "  %-12s at %5d ms, took %5d ms", step->name,
+            (int)((step->start_us - run_start_us_) / 1000), (int)((step->end_us - step->start_us) / 1000));
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef BOOT_SEQUENCER_H
+#define BOOT_SEQUENCER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <mutex>
+#include <vector>
+
+// Tasks running boot steps, the calling task runs steps as well
+#define BOOT_SEQUENCER_WORKERS 2
+#define BOOT_SEQUENCER_MAX_STEPS 16
+
+/*
+ * Runs the independent initialization steps of the boot concurrently.
+ * Each step starts once the steps it depends on have finished; Run() returns when all
+ * steps are done and logs how long each one took and when it started.
+ */
+class BootSequencer {
+public:
+    // Returns the id to use in the dependencies of later steps
+    int Add(const char* name, std::function<void()> callback, std::initializer_list<int> after = {});
+    // Records a step that already ran on the calling task, from start_us until now
+    int AddCompleted(const char* name, int64_t start_us);
+    void Run();
+
+private:
+    struct Step {
+        const char* name;
+        std::function<void()> callback;
+        uint32_t after_mask = 0;
+        bool started = false;
+        int64_t start_us = 0;
+        int64_t end_us = 0;
+    };
+
+    std::vector<Step> steps_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    uint32_t done_mask_ = 0;
+    int finished_ = 0;
+    int active_workers_ = 0;
+    int64_t run_start_us_ = 0;
+
+    void WorkerLoop();
+    void LogReport(int64_t total_us) const;
+};
+
+#endif // BOOT_SEQUENCER_H
@@ -14,6 +14,7 @@
 #include <cstring>
 
 #include "board.h"
+#include "tracing.h"
 
 #define TAG "LcdDisplay"
 
@@ -348,10 +349,17 @@ LcdDisplay::~LcdDisplay() {
 }
 
 bool LcdDisplay::Lock(int timeout_ms) {
-    return lvgl_port_lock(timeout_ms);
+    TRACE_BEGIN("lvgl_lock_wait", timeout_ms);
+    bool locked = lvgl_port_lock(timeout_ms);
+    TRACE_END("lvgl_lock_wait");
+    if (locked) {
+        TRACE_BEGIN("lvgl_locked", 0);
+    }
+    return locked;
 }
 
 void LcdDisplay::Unlock() {
+    TRACE_END("lvgl_locked");
     lvgl_port_unlock();
 }
 
@@ -0,0 +1,140 @@
+#include "download_checkpoint.h"
+#include "settings.h"
+
+#include <esp_log.h>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+
+#define TAG "DownloadCheckpoint"
+#define READ_BACK_CHUNK_SIZE 4096
+
+DownloadCheckpoint::DownloadCheckpoint(const std::string& name) : name_(name) {
+}
+
+bool DownloadCheckpoint::Open(Http* http, const std::string& url, const std::string& sha256, size_t& offset, size_t& total_size) {
+    offset = 0;
+    total_size = 0;
+
+    size_t resume_offset = 0;
+    size_t saved_total = 0;
+    std::string etag;
+    {
+        Settings settings("download");
+        resume_offset = settings.GetInt(Key("offset"));
+        saved_total = settings.GetInt(Key("total"));
+        etag = settings.GetString(Key("etag"));
+        // The expected SHA-256 identifies the file even when the URL is signed differently each time
+        bool same_file = !sha256.empty() ? settings.GetString(Key("sha256")) == sha256
+            : !etag.empty() && settings.GetString(Key("url")) == url;
+        if (!same_file || resume_offset >= saved_total) {
+            resume_offset = 0;
+        }
+    }
+
+    if (resume_offset > 0) {
+        http->SetHeader("Range", "bytes=" + std::to_string(resume_offset) + "-");
+        if (!etag.empty()) {
+            // The server sends the whole file instead if it has changed since
+            http->SetHeader("If-Range", etag);
+        }
+    }
+    if (!http->Open("GET", url)) {
+        ESP_LOGE(TAG, "Failed to open HTTP connection");
+        return false;
+    }
+
+    int status_code = http->GetStatusCode();
+    if (resume_offset > 0 && status_code == 206) {
+        // Content-Range: bytes <first>-<last>/<total>
+        auto content_range = http->GetResponseHeader("Content-Range");
+        unsigned long first = 0, last = 0, total = 0;
+        if (sscanf(content_range.c_str(), "bytes %lu-%lu/%lu", &first, &last, &total) != 3 ||
+            first != resume_offset || total != saved_total || last + 1 != total) {
+            ESP_LOGE(TAG, "Unexpected Content-Range \"%s\", the next attempt starts over", content_range.c_str());
+            Clear();
+            return false;
+        }
+        ESP_LOGI(TAG, "Resuming the %s download at %u/%u", name_.c_str(), resume_offset, saved_total);
+        offset = resume_offset;
+        total_size = saved_total;
+        saved_offset_ = offset;
+        enabled_ = true;
+        return true;
+    }
+    if (status_code == 416) {
+        ESP_LOGE(TAG, "The server rejected the range, the next attempt starts over");
+        Clear();
+        return false;
+    }
+    if (status_code != 200) {
+        ESP_LOGE(TAG, "Failed to get %s, status code: %d", name_.c_str(), status_code);
+        return false;
+    }
+    if (resume_offset > 0) {
+        ESP_LOGW(TAG, "The server sent the whole file, restarting the %s download", name_.c_str());
+    }
+
+    total_size = http->GetBodyLength();
+    Start(url, http->GetResponseHeader("ETag"), sha256, total_size);
+    return true;
+}
+
+void DownloadCheckpoint::Start(const std::string& url, const std::string& etag, const std::string& sha256, size_t total_size) {
+    saved_offset_ = 0;
+    enabled_ = total_size > 0 && (!etag.empty() || !sha256.empty());
+    if (!enabled_) {
+        Clear();
+        return;
+    }
+    Settings settings("download", true);
+    settings.SetString(Key("url"), url);
+    settings.SetString(Key("etag"), etag);
+    settings.SetString(Key("sha256"), sha256);
+    settings.SetInt(Key("total"), total_size);
+    settings.SetInt(Key("offset"), 0);
+}
+
+void DownloadCheckpoint::Update(size_t offset) {
+    if (!enabled_ || offset - saved_offset_ < DOWNLOAD_CHECKPOINT_INTERVAL) {
+        return;
+    }
+    Settings settings("download", true);
+    settings.SetInt(Key("offset"), offset);
+    saved_offset_ = offset;
+}
+
+void DownloadCheckpoint::Clear() {
+    enabled_ = false;
+    saved_offset_ = 0;
+    Settings settings("download", true);
+    for (auto field : { "url", "etag", "sha256", "total", "offset" }) {
+        settings.EraseKey(Key(field));
+    }
+}
+
+bool DownloadCheckpoint::IsPending() const {
+    Settings settings("download");
+    return settings.GetInt(Key("offset")) > 0;
+}
+
+bool DownloadCheckpoint::ReadBack(const esp_partition_t* partition, size_t length,
+    std::function<void(size_t offset, const char* data, size_t size)> callback) {
+    char* buffer = static_cast<char*>(malloc(READ_BACK_CHUNK_SIZE));
+    if (buffer == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate the read back buffer");
+        return false;
+    }
+    for (size_t offset = 0; offset < length; offset += READ_BACK_CHUNK_SIZE) {
+        size_t size = std::min<size_t>(READ_BACK_CHUNK_SIZE, length - offset);
+        esp_err_t err = esp_partition_read(partition, offset, buffer, size);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to read back partition %s at offset %u: %s", partition->label, offset, esp_err_to_name(err));
+            free(buffer);
+            return false;
+        }
+        callback(offset, buffer, size);
+    }
+    free(buffer);
+    return true;
+}
@@ -0,0 +1,48 @@
+#ifndef DOWNLOAD_CHECKPOINT_H
+#define DOWNLOAD_CHECKPOINT_H
+
+#include <esp_partition.h>
+
+#include <cstddef>
+#include <functional>
+#include <string>
+
+#include <http.h>
+
+// Bytes between two checkpoints, a multiple of the flash stream blocks
+#define DOWNLOAD_CHECKPOINT_INTERVAL (256 * 1024)
+
+/*
+ * Progress of a download to flash kept in NVS, so that an interrupted download continues with an
+ * HTTP Range request instead of starting over. A checkpoint is only resumed for the same entity:
+ * the same URL and ETag (sent back as If-Range), or the same expected SHA-256, and the same size.
+ * Downloads that have neither an ETag nor a SHA-256 always start from zero.
+ */
+class DownloadCheckpoint {
+public:
+    // name is the key prefix in NVS, "ota" or "assets"
+    explicit DownloadCheckpoint(const std::string& name);
+
+    // Opens the URL, with a Range request when a checkpoint matches. offset is where the response
+    // body starts, 0 when the server sent the whole file; total_size is the size of the whole file
+    bool Open(Http* http, const std::string& url, const std::string& sha256, size_t& offset, size_t& total_size);
+    // Called once the data before offset is in flash, saved every DOWNLOAD_CHECKPOINT_INTERVAL bytes
+    void Update(size_t offset);
+    void Clear();
+    // True when a download is left to resume
+    bool IsPending() const;
+
+    // Reads back the part of a partition written before a resume, to rebuild the digests
+    static bool ReadBack(const esp_partition_t* partition, size_t length,
+        std::function<void(size_t offset, const char* data, size_t size)> callback);
+
+private:
+    std::string name_;
+    bool enabled_ = false;
+    size_t saved_offset_ = 0;
+
+    std::string Key(const char* field) const { return name_ + "_" + field; }
+    void Start(const std::string& url, const std::string& etag, const std::string& sha256, size_t total_size);
+};
+
+#endif // DOWNLOAD_CHECKPOINT_H
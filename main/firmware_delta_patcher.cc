@@ -0,0 +1,191 @@
+#include "firmware_delta_patcher.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#define TAG "FirmwareDelta"
+// Output is written in whole flash sectors
+#define OUTPUT_BUFFER_SIZE 4096
+
+FirmwareDeltaPatcher::FirmwareDeltaPatcher(const esp_partition_t* source, OutputCallback output)
+    : source_(source), output_(std::move(output)) {
+    buffer_ = static_cast<uint8_t*>(malloc(OUTPUT_BUFFER_SIZE));
+}
+
+FirmwareDeltaPatcher::~FirmwareDeltaPatcher() {
+    free(buffer_);
+}
+
+bool FirmwareDeltaPatcher::Feed(const char* data, size_t size) {
+    if (buffer_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate the output buffer");
+        return false;
+    }
+    auto bytes = reinterpret_cast<const uint8_t*>(data);
+    while (size > 0) {
+        if (state_ == kStateInsertData) {
+            size_t length = std::min(size, insert_remaining_);
+            if (!Emit(bytes, length)) {
+                return false;
+            }
+            bytes += length;
+            size -= length;
+            insert_remaining_ -= length;
+            if (insert_remaining_ == 0) {
+                state_ = kStateCommand;
+                field_needed_ = 1;
+            }
+            continue;
+        }
+
+        size_t length = std::min(size, field_needed_ - field_size_);
+        memcpy(field_ + field_size_, bytes, length);
+        field_size_ += length;
+        bytes += length;
+        size -= length;
+        if (field_size_ == field_needed_) {
+            field_size_ = 0;
+            if (!HandleField()) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool FirmwareDeltaPatcher::HandleField() {
+    uint32_t values[2];
+    switch (state_) {
+    case kStateHeader: {
+        if (memcmp(field_, FIRMWARE_DELTA_MAGIC, 4) != 0) {
+            ESP_LOGE(TAG, "Not a firmware delta");
+            return false;
+        }
+        Sha256Digest::Digest source_sha256;
+        memcpy(values, field_ + 4, 4);
+        source_size_ = values[0];
+        memcpy(source_sha256.data(), field_ + 8, source_sha256.size());
+        memcpy(values, field_ + 40, 4);
+        target_size_ = values[0];
+        memcpy(target_sha256_.data(), field_ + 44, target_sha256_.size());
+        ESP_LOGI(TAG, "Delta from %u bytes to %u bytes", source_size_, target_size_);
+        if (source_size_ > source_->size || !VerifySource(source_sha256)) {
+            return false;
+        }
+        state_ = kStateCommand;
+        field_needed_ = 1;
+        return true;
+    }
+    case kStateCommand:
+        if (field_[0] == FIRMWARE_DELTA_OP_COPY) {
+            state_ = kStateCopy;
+            field_needed_ = 8;
+        } else if (field_[0] == FIRMWARE_DELTA_OP_INSERT) {
+            state_ = kStateInsertLength;
+            field_needed_ = 4;
+        } else {
+            ESP_LOGE(TAG, "Unknown delta command 0x%02x", field_[0]);
+            return false;
+        }
+        return true;
+    case kStateCopy:
+        memcpy(values, field_, 8);
+        if (values[0] > source_size_ || values[1] > source_size_ - values[0] || values[1] > target_size_ - produced_) {
+            ESP_LOGE(TAG, "Copy of %lu bytes at %lu is out of bounds", values[1], values[0]);
+            return false;
+        }
+        if (!Copy(values[0], values[1])) {
+            return false;
+        }
+        state_ = kStateCommand;
+        field_needed_ = 1;
+        return true;
+    case kStateInsertLength:
+        memcpy(values, field_, 4);
+        if (values[0] > target_size_ - produced_) {
+            ESP_LOGE(TAG, "Insert of %lu bytes is out of bounds", values[0]);
+            return false;
+        }
+        insert_remaining_ = values[0];
+        state_ = insert_remaining_ > 0 ? kStateInsertData : kStateCommand;
+        field_needed_ = 1;
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool FirmwareDeltaPatcher::VerifySource(const Sha256Digest::Digest& expected) {
+    auto start_time = esp_timer_get_time();
+    Sha256Digest digest;
+    for (size_t offset = 0; offset < source_size_; offset += OUTPUT_BUFFER_SIZE) {
+        size_t size = std::min<size_t>(OUTPUT_BUFFER_SIZE, source_size_ - offset);
+        if (esp_partition_read(source_, offset, buffer_, size) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to read the source at offset %u", offset);
+            return false;
+        }
+        digest.Update(buffer_, size);
+    }
+    if (digest.Finish() != expected) {
+        ESP_LOGE(TAG, "The delta was not made for the running firmware");
+        return false;
+    }
+    ESP_LOGI(TAG, "The running firmware matches the delta source, checked in %d ms",
+        int((esp_timer_get_time() - start_time) / 1000));
+    return true;
+}
+
+bool FirmwareDeltaPatcher::Emit(const uint8_t* data, size_t size) {
+    while (size > 0) {
+        size_t length = std::min(size, OUTPUT_BUFFER_SIZE - buffer_size_);
+        memcpy(buffer_ + buffer_size_, data, length);
+        buffer_size_ += length;
+        produced_ += length;
+        data += length;
+        size -= length;
+        if (buffer_size_ == OUTPUT_BUFFER_SIZE && !Flush()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool FirmwareDeltaPatcher::Copy(size_t offset, size_t length) {
+    // Read straight into the output buffer
+    while (length > 0) {
+        size_t size = std::min(length, OUTPUT_BUFFER_SIZE - buffer_size_);
+        esp_err_t err = esp_partition_read(source_, offset, buffer_ + buffer_size_, size);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to read the source at offset %u: %s", offset, esp_err_to_name(err));
+            return false;
+        }
+        buffer_size_ += size;
+        produced_ += size;
+        offset += size;
+        length -= size;
+        if (buffer_size_ == OUTPUT_BUFFER_SIZE && !Flush()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool FirmwareDeltaPatcher::Flush() {
+    if (buffer_size_ == 0) {
+        return true;
+    }
+    bool success = output_(buffer_, buffer_size_);
+    buffer_size_ = 0;
+    return success;
+}
+
+bool FirmwareDeltaPatcher::Finish() {
+    if (state_ != kStateCommand || field_size_ != 0 || produced_ != target_size_) {
+        ESP_LOGE(TAG, "The delta ended after %u of %u bytes", produced_, target_size_);
+        return false;
+    }
+    return Flush();
+}
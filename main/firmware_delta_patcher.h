@@ -0,0 +1,80 @@
+#ifndef FIRMWARE_DELTA_PATCHER_H
+#define FIRMWARE_DELTA_PATCHER_H
+
+#include "sha256_digest.h"
+
+#include <esp_partition.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#define FIRMWARE_DELTA_MAGIC "XZD1"
+#define FIRMWARE_DELTA_HEADER_SIZE (4 + 4 + 32 + 4 + 32)
+#define FIRMWARE_DELTA_OP_COPY 0x01
+#define FIRMWARE_DELTA_OP_INSERT 0x02
+
+/*
+ * Rebuilds a firmware image from a delta made by scripts/firmware_delta.py against the running image,
+ * as the delta is received. RAM use is one output buffer, whatever the size of the image.
+ *
+ * Format, little endian:
+ *   header   "XZD1", source size (u32), source SHA-256, target size (u32), target SHA-256
+ *   commands until the target size is produced
+ *     0x01 COPY    source offset (u32), length (u32)
+ *     0x02 INSERT  length (u32), then the bytes
+ * The source is the first source size bytes of the source partition, checked against its SHA-256
+ * before anything is output.
+ */
+class FirmwareDeltaPatcher {
+public:
+    // Receives the target image in order, returns false to stop
+    using OutputCallback = std::function<bool(const uint8_t* data, size_t size)>;
+
+    FirmwareDeltaPatcher(const esp_partition_t* source, OutputCallback output);
+    ~FirmwareDeltaPatcher();
+    FirmwareDeltaPatcher(const FirmwareDeltaPatcher&) = delete;
+    FirmwareDeltaPatcher& operator=(const FirmwareDeltaPatcher&) = delete;
+
+    // Feeds the next part of the delta, false if it is not valid or the output failed
+    bool Feed(const char* data, size_t size);
+    // Outputs the rest, true if the delta ended exactly with the whole target
+    bool Finish();
+
+    size_t target_size() const { return target_size_; }
+    const Sha256Digest::Digest& target_sha256() const { return target_sha256_; }
+
+private:
+    enum State {
+        kStateHeader,
+        kStateCommand,
+        kStateCopy,
+        kStateInsertLength,
+        kStateInsertData,
+    };
+
+    const esp_partition_t* source_;
+    OutputCallback output_;
+    State state_ = kStateHeader;
+    // Fixed size fields are gathered here, as they may be split between two blocks
+    uint8_t field_[FIRMWARE_DELTA_HEADER_SIZE];
+    size_t field_size_ = 0;
+    size_t field_needed_ = FIRMWARE_DELTA_HEADER_SIZE;
+    size_t insert_remaining_ = 0;
+
+    size_t source_size_ = 0;
+    size_t target_size_ = 0;
+    Sha256Digest::Digest target_sha256_ = {};
+    size_t produced_ = 0;
+
+    uint8_t* buffer_ = nullptr;
+    size_t buffer_size_ = 0;
+
+    bool HandleField();
+    bool VerifySource(const Sha256Digest::Digest& expected);
+    bool Emit(const uint8_t* data, size_t size);
+    bool Copy(size_t offset, size_t length);
+    bool Flush();
+};
+
+#endif // FIRMWARE_DELTA_PATCHER_H
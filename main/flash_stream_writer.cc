@@ -0,0 +1,156 @@
+#include "flash_stream_writer.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include <algorithm>
+
+#define TAG "FlashStreamWriter"
+
+FlashStreamWriter::~FlashStreamWriter() {
+    if (free_queue_ != nullptr) {
+        vQueueDelete(free_queue_);
+    }
+    if (full_queue_ != nullptr) {
+        vQueueDelete(full_queue_);
+    }
+    if (writer_done_ != nullptr) {
+        vSemaphoreDelete(writer_done_);
+    }
+    heap_caps_free(buffers_);
+}
+
+bool FlashStreamWriter::AllocateBlocks() {
+    block_size_ = FLASH_STREAM_BLOCK_SIZE;
+    block_count_ = FLASH_STREAM_BLOCK_COUNT;
+    buffers_ = (char*)heap_caps_malloc(block_size_ * block_count_, MALLOC_CAP_SPIRAM);
+    if (buffers_ == nullptr) {
+        block_size_ = FLASH_STREAM_INTERNAL_BLOCK_SIZE;
+        block_count_ = FLASH_STREAM_INTERNAL_BLOCK_COUNT;
+        buffers_ = (char*)heap_caps_malloc(block_size_ * block_count_, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        if (buffers_ == nullptr) {
+            ESP_LOGE(TAG, "Failed to allocate the download buffers");
+            return false;
+        }
+    }
+
+    free_queue_ = xQueueCreate(block_count_, sizeof(Block));
+    // One more slot for the end marker
+    full_queue_ = xQueueCreate(block_count_ + 1, sizeof(Block));
+    writer_done_ = xSemaphoreCreateBinary();
+    if (free_queue_ == nullptr || full_queue_ == nullptr || writer_done_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to create the block queues");
+        return false;
+    }
+    for (int i = 0; i < block_count_; i++) {
+        Block block = { buffers_ + i * block_size_, 0 };
+        xQueueSend(free_queue_, &block, 0);
+    }
+    return true;
+}
+
+bool FlashStreamWriter::Run(Http* http, size_t content_length, WriteCallback write, ProgressCallback progress, size_t start_offset) {
+    if (!AllocateBlocks()) {
+        return false;
+    }
+    write_ = std::move(write);
+    bytes_written_ = start_offset;
+    ESP_LOGI(TAG, "Streaming %u bytes from offset %u in %d x %u byte blocks", content_length - start_offset, start_offset,
+        block_count_, block_size_);
+
+    // The writer runs above the reader so that a full block is written as soon as it is received
+    TaskHandle_t writer_task = nullptr;
+    if (xTaskCreate([](void* arg) {
+        FlashStreamWriter* writer = static_cast<FlashStreamWriter*>(arg);
+        writer->WriterTask();
+        vTaskDelete(NULL);
+    }, "flash_writer", 4096 + 2048, this, uxTaskPriorityGet(nullptr) + 1, &writer_task) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create the writer task");
+        return false;
+    }
+
+    size_t total_read = start_offset, recent_read = 0;
+    auto start_time = esp_timer_get_time();
+    auto last_calc_time = start_time;
+    bool read_ok = true;
+    bool end_of_body = false;
+    while (!end_of_body && !write_failed_) {
+        Block block;
+        xQueueReceive(free_queue_, &block, portMAX_DELAY);
+        if (write_failed_) {
+            break;
+        }
+
+        block.size = 0;
+        while (block.size < block_size_) {
+            int ret = http->Read(block.data + block.size, block_size_ - block.size);
+            if (ret < 0) {
+                ESP_LOGE(TAG, "Failed to read HTTP data: %s", esp_err_to_name(ret));
+                read_ok = false;
+                break;
+            }
+            if (ret == 0) {
+                end_of_body = true;
+                break;
+            }
+            block.size += ret;
+            total_read += ret;
+            recent_read += ret;
+
+            // Calculate speed and progress every second
+            if (esp_timer_get_time() - last_calc_time >= 1000000) {
+                size_t percent = content_length > 0 ? total_read * 100 / content_length : 0;
+                ESP_LOGI(TAG, "Progress: %u%% (%u/%u), Speed: %uB/s, Written: %u", percent, total_read, content_length,
+                    recent_read, (size_t)bytes_written_);
+                if (progress) {
+                    progress(percent, recent_read);
+                }
+                last_calc_time = esp_timer_get_time();
+                recent_read = 0;
+            }
+        }
+        if (!read_ok) {
+            break;
+        }
+        if (block.size > 0) {
+            xQueueSend(full_queue_, &block, portMAX_DELAY);
+        }
+    }
+
+    // The end marker stops the writer once the blocks before it are written
+    Block end = { nullptr, 0 };
+    xQueueSend(full_queue_, &end, portMAX_DELAY);
+    xSemaphoreTake(writer_done_, portMAX_DELAY);
+
+    if (!read_ok || write_failed_) {
+        return false;
+    }
+    if (progress) {
+        progress(100, recent_read);
+    }
+    int elapsed_ms = (esp_timer_get_time() - start_time) / 1000;
+    size_t streamed = bytes_written_ - start_offset;
+    ESP_LOGI(TAG, "Wrote %u bytes in %d ms, %u KB/s", streamed, elapsed_ms,
+        elapsed_ms > 0 ? (size_t)(streamed * 1000ULL / 1024 / elapsed_ms) : 0);
+    return true;
+}
+
+void FlashStreamWriter::WriterTask() {
+    while (true) {
+        Block block;
+        xQueueReceive(full_queue_, &block, portMAX_DELAY);
+        if (block.size == 0) {
+            break;
+        }
+        // After a failure the remaining blocks are only returned, so that the reader is not blocked
+        if (!write_failed_) {
+            if (write_(bytes_written_, block.data, block.size)) {
+                bytes_written_ += block.size;
+            } else {
+                write_failed_ = true;
+            }
+        }
+        xQueueSend(free_queue_, &block, portMAX_DELAY);
+    }
+    xSemaphoreGive(writer_done_);
+}
@@ -0,0 +1,64 @@
+#ifndef FLASH_STREAM_WRITER_H
+#define FLASH_STREAM_WRITER_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+
+#include <http.h>
+
+// Blocks are a multiple of the 4 KB flash sector, in PSRAM when available
+#define FLASH_STREAM_BLOCK_SIZE (32 * 1024)
+#define FLASH_STREAM_BLOCK_COUNT 4
+#define FLASH_STREAM_INTERNAL_BLOCK_SIZE 4096
+#define FLASH_STREAM_INTERNAL_BLOCK_COUNT 2
+
+/*
+ * Streams an HTTP body to flash with the network and the flash overlapped: the calling task
+ * reads the body into a ring of blocks, a writer task passes each full block to the write
+ * callback (erase, write, hash) while the next one is being received.
+ * Callbacks run on the writer task, in order; blocks are full except the last one.
+ * A resumed download passes the offset its body starts at, content_length stays the total size.
+ */
+class FlashStreamWriter {
+public:
+    // Returns false to stop the download
+    using WriteCallback = std::function<bool(size_t offset, const char* data, size_t size)>;
+    using ProgressCallback = std::function<void(int progress, size_t speed)>;
+
+    FlashStreamWriter() = default;
+    ~FlashStreamWriter();
+    FlashStreamWriter(const FlashStreamWriter&) = delete;
+    FlashStreamWriter& operator=(const FlashStreamWriter&) = delete;
+
+    bool Run(Http* http, size_t content_length, WriteCallback write, ProgressCallback progress = nullptr, size_t start_offset = 0);
+
+    size_t bytes_written() const { return bytes_written_; }
+    size_t block_size() const { return block_size_; }
+
+private:
+    struct Block {
+        char* data;
+        size_t size;  // 0 marks the end of the stream
+    };
+
+    char* buffers_ = nullptr;
+    size_t block_size_ = 0;
+    int block_count_ = 0;
+    QueueHandle_t free_queue_ = nullptr;
+    QueueHandle_t full_queue_ = nullptr;
+    SemaphoreHandle_t writer_done_ = nullptr;
+    WriteCallback write_;
+    std::atomic<bool> write_failed_ = false;
+    std::atomic<size_t> bytes_written_ = 0;
+
+    bool AllocateBlocks();
+    void WriterTask();
+};
+
+#endif // FLASH_STREAM_WRITER_H
@@ -0,0 +1,105 @@
+#ifndef INLINE_FUNCTION_H
+#define INLINE_FUNCTION_H
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/*
+ * A move-only void() callable with inline storage.
+ * Callables up to Capacity bytes are stored in place without touching the heap,
+ * larger ones fall back to a heap allocation (see on_heap()).
+ */
+template <size_t Capacity>
+class InlineFunction {
+public:
+    InlineFunction() = default;
+
+    template <typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, InlineFunction>>>
+    InlineFunction(F&& f) {
+        using T = std::decay_t<F>;
+        if constexpr (sizeof(T) <= Capacity && alignof(T) <= alignof(std::max_align_t) &&
+                      std::is_nothrow_move_constructible_v<T>) {
+            new (storage_) T(std::forward<F>(f));
+            ops_ = &InlineOps<T>::kOps;
+        } else {
+            *reinterpret_cast<T**>(storage_) = new T(std::forward<F>(f));
+            ops_ = &HeapOps<T>::kOps;
+        }
+    }
+
+    InlineFunction(InlineFunction&& other) noexcept {
+        MoveFrom(other);
+    }
+
+    InlineFunction& operator=(InlineFunction&& other) noexcept {
+        if (this != &other) {
+            Reset();
+            MoveFrom(other);
+        }
+        return *this;
+    }
+
+    InlineFunction(const InlineFunction&) = delete;
+    InlineFunction& operator=(const InlineFunction&) = delete;
+
+    ~InlineFunction() {
+        Reset();
+    }
+
+    void operator()() {
+        ops_->invoke(storage_);
+    }
+
+    explicit operator bool() const { return ops_ != nullptr; }
+    bool on_heap() const { return ops_ != nullptr && ops_->on_heap; }
+
+    void Reset() {
+        if (ops_ != nullptr) {
+            ops_->destroy(storage_);
+            ops_ = nullptr;
+        }
+    }
+
+private:
+    struct Ops {
+        void (*invoke)(void* storage);
+        // Move constructs into dst and destroys src
+        void (*move)(void* dst, void* src);
+        void (*destroy)(void* storage);
+        bool on_heap;
+    };
+
+    template <typename T>
+    struct InlineOps {
+        static void Invoke(void* storage) { (*static_cast<T*>(storage))(); }
+        static void Move(void* dst, void* src) {
+            new (dst) T(std::move(*static_cast<T*>(src)));
+            static_cast<T*>(src)->~T();
+        }
+        static void Destroy(void* storage) { static_cast<T*>(storage)->~T(); }
+        static constexpr Ops kOps = { Invoke, Move, Destroy, false };
+    };
+
+    template <typename T>
+    struct HeapOps {
+        static void Invoke(void* storage) { (**static_cast<T**>(storage))(); }
+        static void Move(void* dst, void* src) { *static_cast<T**>(dst) = *static_cast<T**>(src); }
+        static void Destroy(void* storage) { delete *static_cast<T**>(storage); }
+        static constexpr Ops kOps = { Invoke, Move, Destroy, true };
+    };
+
+    alignas(std::max_align_t) unsigned char storage_[Capacity < sizeof(void*) ? sizeof(void*) : Capacity];
+    const Ops* ops_ = nullptr;
+
+    void MoveFrom(InlineFunction& other) {
+        if (other.ops_ != nullptr) {
+            other.ops_->move(storage_, other.storage_);
+            ops_ = other.ops_;
+            other.ops_ = nullptr;
+        }
+    }
+};
+
+#endif // INLINE_FUNCTION_H
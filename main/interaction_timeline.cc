@@ -0,0 +1,174 @@
+#include "interaction_timeline.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <algorithm>
+#include <cstdio>
+
+#define TAG "InteractionTimeline"
+
+static const char* const kPhaseNames[kInteractionPhaseCount] = {
+    "wake_word",
+    "channel_opening",
+    "server_hello",
+    "channel_opened",
+    "first_uplink",
+    "stt",
+    "tts_start",
+    "first_downlink",
+    "first_playback",
+};
+
+const char* InteractionTimeline::GetPhaseName(InteractionPhase phase) {
+    return kPhaseNames[phase];
+}
+
+void InteractionTimeline::Begin(const char* trigger) {
+    active_ = false;
+    for (auto& mark : marks_us_) {
+        mark.store(0, std::memory_order_relaxed);
+    }
+    trigger_ = trigger;
+    marks_us_[kInteractionPhaseWakeWord] = esp_timer_get_time();
+    active_ = true;
+}
+
+void InteractionTimeline::Mark(InteractionPhase phase) {
+    if (!active_.load(std::memory_order_relaxed)) {
+        return;
+    }
+    // Local sounds (e.g. the popup) are played before the reply, only count playback after downlink audio
+    if (phase == kInteractionPhaseFirstPlayback && marks_us_[kInteractionPhaseFirstDownlink].load() == 0) {
+        return;
+    }
+    int64_t expected = 0;
+    if (!marks_us_[phase].compare_exchange_strong(expected, esp_timer_get_time())) {
+        return;
+    }
+    if (phase == kInteractionPhaseFirstPlayback && active_.exchange(false)) {
+        Complete();
+    }
+}
+
+void InteractionTimeline::Abandon() {
+    if (!active_.exchange(false)) {
+        return;
+    }
+    int reached = kInteractionPhaseWakeWord;
+    for (int i = 0; i < kInteractionPhaseCount; i++) {
+        if (marks_us_[i].load() != 0) {
+            reached = i;
+        }
+    }
+    ESP_LOGW(TAG, "Interaction (%s) ended without audio, last phase %s", trigger_.load(), kPhaseNames[reached]);
+    std::lock_guard<std::mutex> lock(mutex_);
+    abandoned_++;
+}
+
+void InteractionTimeline::Complete() {
+    int64_t start_us = marks_us_[kInteractionPhaseWakeWord];
+    int offsets_ms[kInteractionPhaseCount];
+    for (int i = 0; i < kInteractionPhaseCount; i++) {
+        int64_t mark_us = marks_us_[i];
+        offsets_ms[i] = mark_us != 0 ? (int)((mark_us - start_us) / 1000) : -1;
+    }
+    int total_ms = offsets_ms[kInteractionPhaseFirstPlayback];
+
+    char breakdown[192];
+    int length = 0;
+    for (int i = kInteractionPhaseWakeWord + 1; i < kInteractionPhaseCount && length < (int)sizeof(breakdown); i++) {
+        if (offsets_ms[i] >= 0) {
+            length += snprintf(breakdown + length, sizeof(breakdown) - length, "%s%s %d",
+                length > 0 ? ", " : "", kPhaseNames[i], offsets_ms[i]);
+        }
+    }
+    ESP_LOGI(TAG, "Wake to first audio %d ms (%s): %s", total_ms, trigger_.load(), breakdown);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint32_t count = completed_.load() + 1;
+    for (int i = 0; i < kInteractionPhaseCount; i++) {
+        last_ms_[i] = offsets_ms[i];
+        if (offsets_ms[i] < 0) {
+            continue;
+        }
+        auto& stats = phases_[i];
+        if (stats.count == 0 || offsets_ms[i] < stats.min_ms) {
+            stats.min_ms = offsets_ms[i];
+        }
+        if (offsets_ms[i] > stats.max_ms) {
+            stats.max_ms = offsets_ms[i];
+        }
+        stats.count++;
+        stats.total_ms += offsets_ms[i];
+    }
+    last_trigger_ = trigger_;
+    totals_ms_[(count - 1) % INTERACTION_TIMELINE_HISTORY] = total_ms;
+    completed_ = count;
+
+    auto& total = phases_[kInteractionPhaseFirstPlayback];
+    ESP_LOGI(TAG, "Wake to first audio over %lu interactions: avg %d ms, p50 %d ms, p90 %d ms, min %d ms, max %d ms, %lu abandoned",
+        (unsigned long)count, (int)(total.total_ms / total.count), TotalPercentile(50), TotalPercentile(90),
+        total.min_ms, total.max_ms, (unsigned long)abandoned_);
+}
+
+int InteractionTimeline::TotalPercentile(int percent) const {
+    uint32_t count = std::min<uint32_t>(completed_.load(), INTERACTION_TIMELINE_HISTORY);
+    if (count == 0) {
+        return 0;
+    }
+    int sorted[INTERACTION_TIMELINE_HISTORY];
+    std::copy(totals_ms_, totals_ms_ + count, sorted);
+    std::sort(sorted, sorted + count);
+    return sorted[(count - 1) * percent / 100];
+}
+
+void InteractionTimeline::WriteJson(JsonWriter& writer) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint32_t count = completed_.load();
+    writer.BeginObject();
+    writer.Key("completed").Int(count);
+    writer.Key("abandoned").Int(abandoned_);
+    if (count > 0) {
+        // Percentiles over the most recent interactions
+        writer.Key("p50_ms").Int(TotalPercentile(50));
+        writer.Key("p90_ms").Int(TotalPercentile(90));
+    }
+
+    // Milliseconds from the wake word to each phase
+    writer.Key("phases").BeginObject();
+    for (int i = kInteractionPhaseWakeWord + 1; i < kInteractionPhaseCount; i++) {
+        auto& stats = phases_[i];
+        if (stats.count == 0) {
+            continue;
+        }
+        writer.Key(kPhaseNames[i]).BeginObject()
+            .Key("count").Int(stats.count)
+            .Key("avg_ms").Int(stats.total_ms / stats.count)
+            .Key("min_ms").Int(stats.min_ms)
+            .Key("max_ms").Int(stats.max_ms)
+            .EndObject();
+    }
+    writer.EndObject();
+
+    if (count > 0) {
+        writer.Key("last").BeginObject();
+        writer.Key("trigger").String(last_trigger_ != nullptr ? last_trigger_ : "");
+        for (int i = kInteractionPhaseWakeWord + 1; i < kInteractionPhaseCount; i++) {
+            if (last_ms_[i] >= 0) {
+                writer.Key(kPhaseNames[i]).Int(last_ms_[i]);
+            }
+        }
+        writer.EndObject();
+    }
+    writer.EndObject();
+}
+
+void InteractionTimeline::Reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    completed_ = 0;
+    abandoned_ = 0;
+    for (auto& stats : phases_) {
+        stats = PhaseStats();
+    }
+    last_trigger_ = nullptr;
+}
@@ -0,0 +1,72 @@
+#ifndef INTERACTION_TIMELINE_H
+#define INTERACTION_TIMELINE_H
+
+#include "json_writer.h"
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+// Totals kept for the percentiles of wake to first audio
+#define INTERACTION_TIMELINE_HISTORY 32
+
+enum InteractionPhase {
+    kInteractionPhaseWakeWord,
+    kInteractionPhaseChannelOpening,
+    kInteractionPhaseServerHello,
+    kInteractionPhaseChannelOpened,
+    kInteractionPhaseFirstUplink,
+    kInteractionPhaseStt,
+    kInteractionPhaseTtsStart,
+    kInteractionPhaseFirstDownlink,
+    kInteractionPhaseFirstPlayback,
+    kInteractionPhaseCount
+};
+
+/*
+ * Time from wake word detection to the first TTS sample written to I2S, broken down by phase.
+ * Phases are marked from the tasks where they happen, the first mark of each phase wins.
+ * Phases that do not happen in an interaction (e.g. the handshake when the channel is
+ * already open) are left out of its breakdown.
+ */
+class InteractionTimeline {
+public:
+    struct PhaseStats {
+        uint32_t count = 0;
+        int64_t total_ms = 0;
+        int min_ms = 0;
+        int max_ms = 0;
+    };
+
+    // trigger names what started the interaction, it must be a string literal
+    void Begin(const char* trigger);
+    void Mark(InteractionPhase phase);
+    // Called when the device returns to idle, an interaction without audio is counted as abandoned
+    void Abandon();
+
+    uint32_t completed() const { return completed_.load(std::memory_order_relaxed); }
+
+    void WriteJson(JsonWriter& writer) const;
+    void Reset();
+
+    static const char* GetPhaseName(InteractionPhase phase);
+
+private:
+    std::atomic<bool> active_ = false;
+    std::atomic<int64_t> marks_us_[kInteractionPhaseCount] = {};
+    std::atomic<const char*> trigger_ = nullptr;
+    std::atomic<uint32_t> completed_ = 0;
+
+    // Aggregates, guarded for the MCP tool and the completing task
+    mutable std::mutex mutex_;
+    uint32_t abandoned_ = 0;
+    PhaseStats phases_[kInteractionPhaseCount];
+    int last_ms_[kInteractionPhaseCount] = {};
+    const char* last_trigger_ = nullptr;
+    int totals_ms_[INTERACTION_TIMELINE_HISTORY] = {};
+
+    void Complete();
+    int TotalPercentile(int percent) const;
+};
+
+#endif // INTERACTION_TIMELINE_H
@@ -0,0 +1,247 @@
+#include "main_loop_profiler.h"
+#include "tracing.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <cstdio>
+#include <cstring>
+
+#define TAG "MainLoopProfiler"
+
+static const int64_t kBucketBoundsUs[MAIN_LOOP_PROFILER_BUCKETS - 1] = {
+    500, 1000, 2000, 5000, 10000, 20000, 50000, 100000, 500000
+};
+
+void MainLoopProfiler::Window::Add(int64_t duration_us) {
+    count++;
+    total_us += duration_us;
+    if (duration_us > max_us) {
+        max_us = duration_us;
+    }
+    if (duration_us > MAIN_LOOP_STALL_THRESHOLD_MS * 1000) {
+        slow++;
+    }
+    int bucket = 0;
+    while (bucket < MAIN_LOOP_PROFILER_BUCKETS - 1 && duration_us >= kBucketBoundsUs[bucket]) {
+        bucket++;
+    }
+    histogram[bucket]++;
+}
+
+int64_t MainLoopProfiler::Window::Percentile(int percent) const {
+    if (count == 0) {
+        return 0;
+    }
+    uint32_t rank = (count * (uint64_t)percent + 99) / 100;
+    uint32_t seen = 0;
+    for (int i = 0; i < MAIN_LOOP_PROFILER_BUCKETS - 1; i++) {
+        seen += histogram[i];
+        if (seen >= rank) {
+            return kBucketBoundsUs[i] < max_us ? kBucketBoundsUs[i] : max_us;
+        }
+    }
+    return max_us;
+}
+
+MainLoopProfiler::Scope::Scope(MainLoopProfiler& profiler, const char* name, int line)
+    : profiler_(profiler), parent_(profiler.current_scope_), name_(name), line_(line) {
+    start_us_ = esp_timer_get_time();
+    TRACE_BEGIN(name_, line_);
+    profiler_.current_scope_ = this;
+    profiler_.Publish(name_, line_, start_us_);
+}
+
+MainLoopProfiler::Scope::~Scope() {
+    int64_t duration_us = esp_timer_get_time() - start_us_;
+    TRACE_END(name_);
+    profiler_.current_scope_ = parent_;
+    if (parent_ != nullptr) {
+        profiler_.Publish(parent_->name_, parent_->line_, parent_->start_us_);
+    } else {
+        profiler_.Publish(nullptr, 0, 0);
+    }
+
+    bool slow = profiler_.Record(name_, line_, duration_us);
+    if (slow && !child_reported_) {
+        if (line_ != 0) {
+            ESP_LOGW(TAG, "Slow scheduled task %s:%d took %d ms", name_, line_, (int)(duration_us / 1000));
+        } else {
+            ESP_LOGW(TAG, "Slow handler %s took %d ms", name_, (int)(duration_us / 1000));
+        }
+    }
+    if (parent_ != nullptr && (slow || child_reported_)) {
+        parent_->child_reported_ = true;
+    }
+}
+
+void MainLoopProfiler::Publish(const char* name, int line, int64_t since_us) {
+    running_name_.store(nullptr, std::memory_order_relaxed);
+    running_line_.store(line, std::memory_order_relaxed);
+    running_since_us_.store(since_us, std::memory_order_relaxed);
+    running_name_.store(name, std::memory_order_release);
+}
+
+MainLoopProfiler::Entry& MainLoopProfiler::FindEntry(const char* name, int line) {
+    for (int i = 0; i < entry_count_; i++) {
+        auto& entry = entries_[i];
+        if (entry.line == line && (entry.name == name || strcmp(entry.name, name) == 0)) {
+            return entry;
+        }
+    }
+    if (entry_count_ < MAIN_LOOP_PROFILER_MAX_ENTRIES) {
+        auto& entry = entries_[entry_count_++];
+        entry.name = name;
+        entry.line = line;
+        return entry;
+    }
+    // The last slot collects everything that does not fit
+    auto& other = entries_[MAIN_LOOP_PROFILER_MAX_ENTRIES];
+    other.name = "other";
+    other.line = 0;
+    return other;
+}
+
+bool MainLoopProfiler::Record(const char* name, int line, int64_t duration_us) {
+    auto& entry = FindEntry(name, line);
+    entry.window.Add(duration_us);
+    entry.lifetime.Add(duration_us);
+    if (duration_us <= MAIN_LOOP_STALL_THRESHOLD_MS * 1000) {
+        return false;
+    }
+
+    auto& event = slow_events_[slow_event_count_ % MAIN_LOOP_PROFILER_SLOW_HISTORY];
+    event.name = name;
+    event.line = line;
+    event.duration_ms = duration_us / 1000;
+    event.uptime_ms = esp_timer_get_time() / 1000;
+    slow_event_count_++;
+    return true;
+}
+
+void MainLoopProfiler::RecordIteration(int64_t duration_us) {
+    iteration_window_.Add(duration_us);
+    iteration_lifetime_.Add(duration_us);
+}
+
+void MainLoopProfiler::CheckWatchdog() {
+    const char* name = running_name_.load(std::memory_order_acquire);
+    if (name == nullptr) {
+        return;
+    }
+    int line = running_line_.load(std::memory_order_relaxed);
+    int64_t running_ms = (esp_timer_get_time() - running_since_us_.load(std::memory_order_relaxed)) / 1000;
+    if (running_ms < MAIN_LOOP_WATCHDOG_MS) {
+        return;
+    }
+    if (line != 0) {
+        ESP_LOGW(TAG, "Main loop blocked in scheduled task %s:%d for %d ms", name, line, (int)running_ms);
+    } else {
+        ESP_LOGW(TAG, "Main loop blocked in %s for %d ms", name, (int)running_ms);
+    }
+}
+
+void MainLoopProfiler::Print() {
+    auto& it = iteration_window_;
+    ESP_LOGI(TAG, "Main loop: %lu iterations, p50 %d ms, p99 %d ms, max %d ms, %lu stalls over %d ms",
+        (unsigned long)it.count, (int)(it.Percentile(50) / 1000), (int)(it.Percentile(99) / 1000),
+        (int)(it.max_us / 1000), (unsigned long)it.slow, MAIN_LOOP_STALL_THRESHOLD_MS);
+
+    // The three handlers with the most time in this window
+    const Entry* top[3] = {};
+    for (int i = 0; i <= MAIN_LOOP_PROFILER_MAX_ENTRIES; i++) {
+        const Entry* entry = &entries_[i];
+        if (entry->name == nullptr || entry->window.count == 0) {
+            continue;
+        }
+        for (int j = 0; j < 3; j++) {
+            if (top[j] == nullptr || entry->window.total_us > top[j]->window.total_us) {
+                for (int k = 2; k > j; k--) {
+                    top[k] = top[k - 1];
+                }
+                top[j] = entry;
+                break;
+            }
+        }
+    }
+    for (auto entry : top) {
+        if (entry == nullptr) {
+            break;
+        }
+        auto& w = entry->window;
+        char name[48];
+        if (entry->line != 0) {
+            snprintf(name, sizeof(name), "%s:%d", entry->name, entry->line);
+        } else {
+            snprintf(name, sizeof(name), "%s", entry->name);
+        }
+        ESP_LOGI(TAG, "  %s: %lu runs, total %d ms, p95 %d ms, max %d ms, %lu slow",
+            name, (unsigned long)w.count, (int)(w.total_us / 1000),
+            (int)(w.Percentile(95) / 1000), (int)(w.max_us / 1000), (unsigned long)w.slow);
+    }
+
+    iteration_window_ = Window();
+    for (auto& entry : entries_) {
+        entry.window = Window();
+    }
+}
+
+void MainLoopProfiler::WriteJson(JsonWriter& writer) const {
+    auto write_window = [&writer](const Window& w) {
+        writer.Key("count").Int(w.count)
+            .Key("slow").Int(w.slow)
+            .Key("total_us").Int(w.total_us)
+            .Key("p50_us").Int(w.Percentile(50))
+            .Key("p95_us").Int(w.Percentile(95))
+            .Key("p99_us").Int(w.Percentile(99))
+            .Key("max_us").Int(w.max_us);
+    };
+
+    writer.BeginObject();
+    writer.Key("threshold_ms").Int(MAIN_LOOP_STALL_THRESHOLD_MS);
+    writer.Key("iterations").BeginObject();
+    write_window(iteration_lifetime_);
+    writer.EndObject();
+
+    writer.Key("handlers").BeginArray();
+    for (int i = 0; i <= MAIN_LOOP_PROFILER_MAX_ENTRIES; i++) {
+        auto& entry = entries_[i];
+        if (entry.name == nullptr || entry.lifetime.count == 0) {
+            continue;
+        }
+        writer.BeginObject();
+        writer.Key("name").String(entry.name);
+        if (entry.line != 0) {
+            writer.Key("line").Int(entry.line);
+        }
+        write_window(entry.lifetime);
+        writer.EndObject();
+    }
+    writer.EndArray();
+
+    // Most recent first
+    writer.Key("slow_events").BeginArray();
+    uint32_t count = slow_event_count_ < MAIN_LOOP_PROFILER_SLOW_HISTORY ? slow_event_count_ : MAIN_LOOP_PROFILER_SLOW_HISTORY;
+    for (uint32_t i = 0; i < count; i++) {
+        auto& event = slow_events_[(slow_event_count_ - 1 - i) % MAIN_LOOP_PROFILER_SLOW_HISTORY];
+        writer.BeginObject();
+        writer.Key("name").String(event.name);
+        if (event.line != 0) {
+            writer.Key("line").Int(event.line);
+        }
+        writer.Key("duration_ms").Int(event.duration_ms);
+        writer.Key("uptime_ms").Int(event.uptime_ms);
+        writer.EndObject();
+    }
+    writer.EndArray();
+    writer.EndObject();
+}
+
+void MainLoopProfiler::Reset() {
+    iteration_window_ = Window();
+    iteration_lifetime_ = Window();
+    for (auto& entry : entries_) {
+        entry = Entry();
+    }
+    entry_count_ = 0;
+    slow_event_count_ = 0;
+}
@@ -0,0 +1,100 @@
+#ifndef MAIN_LOOP_PROFILER_H
+#define MAIN_LOOP_PROFILER_H
+
+#include "json_writer.h"
+
+#include <atomic>
+#include <cstdint>
+#include <source_location>
+
+// A main loop iteration longer than this is counted as a stall, a handler longer than this is reported
+#define MAIN_LOOP_STALL_THRESHOLD_MS 100
+// The watchdog reports a handler that is still running after this long
+#define MAIN_LOOP_WATCHDOG_MS 1000
+// Distinct handlers and call sites tracked, the rest are accounted as "other"
+#define MAIN_LOOP_PROFILER_MAX_ENTRIES 24
+#define MAIN_LOOP_PROFILER_BUCKETS 10
+#define MAIN_LOOP_PROFILER_SLOW_HISTORY 8
+
+/*
+ * Times every event handler and scheduled task run by the main loop.
+ * Handlers are named by a string literal, scheduled tasks by the call site of Schedule().
+ * Statistics are kept for the current 10 second window (printed and reset by Print())
+ * and since boot (returned by WriteJson()). Only the main task records and reads them;
+ * CheckWatchdog() may be called from any task to report a handler that does not return.
+ */
+class MainLoopProfiler {
+public:
+    // Times the enclosing block. Nested scopes (scheduled tasks inside the schedule event)
+    // are recorded separately, only the innermost slow scope is reported.
+    class Scope {
+    public:
+        Scope(MainLoopProfiler& profiler, const char* name, int line = 0);
+        ~Scope();
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        MainLoopProfiler& profiler_;
+        Scope* parent_;
+        const char* name_;
+        int line_;
+        int64_t start_us_;
+        bool child_reported_ = false;
+    };
+
+    void RecordIteration(int64_t duration_us);
+    void CheckWatchdog();
+
+    void Print();
+    void WriteJson(JsonWriter& writer) const;
+    void Reset();
+
+private:
+    struct Window {
+        uint32_t count = 0;
+        uint32_t slow = 0;
+        int64_t total_us = 0;
+        int64_t max_us = 0;
+        // Upper bounds: 0.5, 1, 2, 5, 10, 20, 50, 100, 500 ms and above
+        uint32_t histogram[MAIN_LOOP_PROFILER_BUCKETS] = {};
+
+        void Add(int64_t duration_us);
+        // Upper bound of the bucket holding the percentile, capped by the maximum
+        int64_t Percentile(int percent) const;
+    };
+
+    struct Entry {
+        const char* name = nullptr;
+        int line = 0;  // Non-zero for scheduled tasks, name is then the source file
+        Window window;
+        Window lifetime;
+    };
+
+    struct SlowEvent {
+        const char* name = nullptr;
+        int line = 0;
+        int duration_ms = 0;
+        int64_t uptime_ms = 0;
+    };
+
+    Entry entries_[MAIN_LOOP_PROFILER_MAX_ENTRIES + 1];
+    int entry_count_ = 0;
+    Window iteration_window_;
+    Window iteration_lifetime_;
+    SlowEvent slow_events_[MAIN_LOOP_PROFILER_SLOW_HISTORY];
+    uint32_t slow_event_count_ = 0;
+
+    Scope* current_scope_ = nullptr;
+    // Published for the watchdog on other tasks
+    std::atomic<const char*> running_name_ = nullptr;
+    std::atomic<int> running_line_ = 0;
+    std::atomic<int64_t> running_since_us_ = 0;
+
+    Entry& FindEntry(const char* name, int line);
+    bool Record(const char* name, int line, int64_t duration_us);
+    void Publish(const char* name, int line, int64_t since_us);
+};
+
+#endif // MAIN_LOOP_PROFILER_H
@@ -15,6 +15,7 @@
 #include "oled_display.h"
 #include "board.h"
 #include "settings.h"
+#include "tracing.h"
 #include "lvgl_theme.h"
 #include "lvgl_display.h"
 
@@ -135,6 +136,166 @@ void McpServer::AddUserOnlyTools() {
             return board.GetSystemInfoJson();
         });
 
+    AddUserOnlyTool("self.system.get_main_loop_profile",
+        "Get the main loop responsiveness since boot: run count, p50/p95/p99/max duration and slow runs of every event handler "
+        "and scheduled task (by call site), plus the most recent runs over the threshold.\n"
+        "Args:\n"
+        "  `reset`: Clear the statistics after reading them.",
+        PropertyList({
+            Property("reset", kPropertyTypeBoolean, false)
+        }),
+        [](const PropertyList& properties) -> ReturnValue {
+            auto& profiler = Application::GetInstance().GetMainLoopProfiler();
+            JsonWriter writer;
+            profiler.WriteJson(writer);
+            if (properties["reset"].value<bool>()) {
+                profiler.Reset();
+            }
+            return writer.Release();
+        });
+
+    AddUserOnlyTool("self.system.get_interaction_latency",
+        "Get the wake word to first reply audio latency: completed and abandoned interactions, p50/p90 of the total "
+        "and the average/min/max time from the wake word to each phase (channel open, server hello, first uplink, "
+        "stt, tts start, first downlink, first playback), plus the breakdown of the last interaction.\n"
+        "Args:\n"
+        "  `reset`: Clear the statistics after reading them.",
+        PropertyList({
+            Property("reset", kPropertyTypeBoolean, false)
+        }),
+        [](const PropertyList& properties) -> ReturnValue {
+            auto& timeline = Application::GetInstance().GetInteractionTimeline();
+            JsonWriter writer;
+            timeline.WriteJson(writer);
+            if (properties["reset"].value<bool>()) {
+                timeline.Reset();
+            }
+            return writer.Release();
+        });
+
+    AddUserOnlyTool("self.benchmark.wake_to_audio",
+        "Run wake word interactions in a loop to measure the wake to first audio latency. "
+        "Each run waits for idle, invokes the wake word and waits for the reply audio; "
+        "read the results with self.system.get_interaction_latency.\n"
+        "Args:\n"
+        "  `count`: Number of interactions.\n"
+        "  `interval_seconds`: Idle time before each interaction.\n"
+        "  `wake_word`: Wake word sent to the server, the last detected one if empty.",
+        PropertyList({
+            Property("count", kPropertyTypeInteger, 10, 1, 100),
+            Property("interval_seconds", kPropertyTypeInteger, 3, 1, 60),
+            Property("wake_word", kPropertyTypeString, std::string(""))
+        }),
+        [](const PropertyList& properties) -> ReturnValue {
+            auto& app = Application::GetInstance();
+            auto wake_word = properties["wake_word"].value<std::string>();
+            if (wake_word.empty()) {
+                wake_word = app.GetAudioService().GetLastWakeWord();
+            }
+            if (wake_word.empty()) {
+                throw std::runtime_error("No wake word was detected yet, set `wake_word`");
+            }
+            if (!app.StartInteractionBenchmark(properties["count"].value<int>(), properties["interval_seconds"].value<int>(), wake_word)) {
+                throw std::runtime_error("Failed to start the benchmark, it may be already running");
+            }
+            return true;
+        });
+
+    AddUserOnlyTool("self.network.get_transport_stats",
+        "Get the transport quality of the current audio session: bytes and packets in each direction, send failures, loss, jitter, RTT and server clock offset",
+        PropertyList(),
+        [](const PropertyList& properties) -> ReturnValue {
+            auto protocol = Application::GetInstance().GetProtocol();
+            if (protocol == nullptr) {
+                throw std::runtime_error("Protocol is not initialized");
+            }
+            JsonWriter writer;
+            protocol->transport_stats().WriteJson(writer);
+            return writer.Release();
+        });
+
+    AddUserOnlyTool("self.network.start_session_recording",
+        "Record the audio packets and JSON messages of the following sessions with their timing, for offline replay.\n"
+        "Args:\n"
+        "  `target`: A file path on a mounted filesystem (e.g. /sdcard/session.bin) or udp://host:port to stream the log.",
+        PropertyList({
+            Property("target", kPropertyTypeString)
+        }),
+        [](const PropertyList& properties) -> ReturnValue {
+            auto protocol = Application::GetInstance().GetProtocol();
+            if (protocol == nullptr) {
+                throw std::runtime_error("Protocol is not initialized");
+            }
+            auto target = properties["target"].value<std::string>();
+            if (!protocol->session_recorder().Start(target)) {
+                throw std::runtime_error("Failed to start recording to " + target);
+            }
+            return true;
+        });
+
+    AddUserOnlyTool("self.network.stop_session_recording",
+        "Stop the session recording and return the number of records, bytes and dropped records",
+        PropertyList(),
+        [](const PropertyList& properties) -> ReturnValue {
+            auto protocol = Application::GetInstance().GetProtocol();
+            if (protocol == nullptr) {
+                throw std::runtime_error("Protocol is not initialized");
+            }
+            auto& recorder = protocol->session_recorder();
+            recorder.Stop();
+            auto stats = recorder.GetStats();
+            JsonWriter writer;
+            writer.BeginObject()
+                .Add("target", recorder.target())
+                .Add("records", (int)stats.records)
+                .Key("bytes").Int((int64_t)stats.bytes)
+                .Add("dropped", (int)stats.dropped)
+                .EndObject();
+            return writer.Release();
+        });
+
+#if CONFIG_USE_EVENT_TRACING
+    AddUserOnlyTool("self.trace.start",
+        "Clear the event trace and start recording. Events of the audio, main and network tasks are kept in a ring buffer.",
+        PropertyList(),
+        [](const PropertyList& properties) -> ReturnValue {
+            if (!Tracer::GetInstance().Start()) {
+                throw std::runtime_error("Failed to start tracing");
+            }
+            return true;
+        });
+
+    AddUserOnlyTool("self.trace.stop",
+        "Stop recording the event trace, the recorded events are kept for upload",
+        PropertyList(),
+        [](const PropertyList& properties) -> ReturnValue {
+            Tracer::GetInstance().Stop();
+            return true;
+        });
+
+    AddUserOnlyTool("self.trace.upload",
+        "Upload the event trace in the background, to be converted with scripts/trace_to_chrome.py.\n"
+        "Args:\n"
+        "  `target`: udp://host:port, an http(s) URL to POST to, or a file path on a mounted filesystem.",
+        PropertyList({
+            Property("target", kPropertyTypeString)
+        }),
+        [](const PropertyList& properties) -> ReturnValue {
+            auto& tracer = Tracer::GetInstance();
+            auto target = properties["target"].value<std::string>();
+            if (!tracer.Upload(target)) {
+                throw std::runtime_error("Failed to upload the trace to " + target);
+            }
+            auto stats = tracer.GetStats();
+            JsonWriter writer;
+            writer.BeginObject()
+                .Key("capacity").Int(stats.capacity)
+                .Key("recorded").Int(stats.recorded)
+                .EndObject();
+            return writer.Release();
+        });
+#endif
+
     AddUserOnlyTool("self.reboot", "Reboot the system",
         PropertyList(),
         [this](const PropertyList& properties) -> ReturnValue {
@@ -149,17 +310,25 @@ void McpServer::AddUserOnlyTools() {
         });
 
     // Firmware upgrade
-    AddUserOnlyTool("self.upgrade_firmware", "Upgrade firmware from a specific URL. This will download and install the firmware, then reboot the device.",
+    AddUserOnlyTool("self.upgrade_firmware", "Upgrade firmware from a specific URL. This will download and install the firmware, then reboot the device.\n"
+        "Args:\n"
+        "  `url`: The URL of the firmware binary file to download and install, optionally compressed by scripts/stream_compress.py.\n"
+        "  `sha256`: Optional hex SHA-256 of the firmware, once decompressed; the upgrade is rejected if it does not match.\n"
+        "  `delta_url`: Optional delta from the running firmware to this file (scripts/firmware_delta.py), tried before the full file.",
         PropertyList({
-            Property("url", kPropertyTypeString, "The URL of the firmware binary file to download and install")
+            Property("url", kPropertyTypeString, "The URL of the firmware binary file to download and install"),
+            Property("sha256", kPropertyTypeString, std::string("")),
+            Property("delta_url", kPropertyTypeString, std::string(""))
         }),
         [this](const PropertyList& properties) -> ReturnValue {
             auto url = properties["url"].value<std::string>();
+            auto sha256 = properties["sha256"].value<std::string>();
+            auto delta_url = properties["delta_url"].value<std::string>();
             ESP_LOGI(TAG, "User requested firmware upgrade from URL: %s", url.c_str());
             
             auto& app = Application::GetInstance();
-            app.Schedule([url, &app]() {
-                bool success = app.UpgradeFirmware(url);
+            app.Schedule([url, sha256, delta_url, &app]() {
+                bool success = app.UpgradeFirmware(url, "", sha256, delta_url);
                 if (!success) {
                     ESP_LOGE(TAG, "Firmware upgrade failed");
                 }
@@ -287,14 +456,20 @@ void McpServer::AddUserOnlyTools() {
     // Assets download url
     auto& assets = Assets::GetInstance();
     if (assets.partition_valid()) {
-        AddUserOnlyTool("self.assets.set_download_url", "Set the download url for the assets",
+        AddUserOnlyTool("self.assets.set_download_url", "Set the download url for the assets, with the optional hex SHA-256 of the file.\n"
+            "With the url of its manifest (the .manifest.json generated next to it), only the changed files are downloaded.\n"
+            "The file may be compressed by scripts/stream_compress.py, the SHA-256 is then the one of the decompressed file.",
             PropertyList({
-                Property("url", kPropertyTypeString)
+                Property("url", kPropertyTypeString),
+                Property("sha256", kPropertyTypeString, std::string("")),
+                Property("manifest_url", kPropertyTypeString, std::string(""))
             }),
             [](const PropertyList& properties) -> ReturnValue {
                 auto url = properties["url"].value<std::string>();
                 Settings settings("assets", true);
                 settings.SetString("download_url", url);
+                settings.SetString("download_sha256", properties["sha256"].value<std::string>());
+                settings.SetString("manifest_url", properties["manifest_url"].value<std::string>());
                 return true;
             });
     }
@@ -392,10 +567,15 @@ void McpServer::ParseMessage(const cJSON* json) {
             }
         }
         auto app_desc = esp_app_get_description();
-        std::string message = "{\"protocolVersion\":\"2024-11-05\",\"capabilities\":{\"tools\":{}},\"serverInfo\":{\"name\":\"" BOARD_NAME "\",\"version\":\"";
-        message += app_desc->version;
-        message += "\"}}";
-        ReplyResult(id_int, message);
+        JsonWriter writer;
+        BeginReply(writer, id_int);
+        writer.Key("result").BeginObject();
+        writer.Add("protocolVersion", "2024-11-05");
+        writer.Key("capabilities").BeginObject().Key("tools").BeginObject().EndObject().EndObject();
+        writer.Key("serverInfo").BeginObject().Add("name", BOARD_NAME).Add("version", app_desc->version).EndObject();
+        writer.EndObject();
+        writer.EndObject();
+        Application::GetInstance().SendMcpMessage(writer.Release());
     } else if (method_str == "tools/list") {
         std::string cursor_str = "";
         bool list_user_only_tools = false;
@@ -435,30 +615,33 @@ void McpServer::ParseMessage(const cJSON* json) {
     }
 }
 
-void McpServer::ReplyResult(int id, const std::string& result) {
-    std::string payload = "{\"jsonrpc\":\"2.0\",\"id\":";
-    payload += std::to_string(id) + ",\"result\":";
-    payload += result;
-    payload += "}";
-    Application::GetInstance().SendMcpMessage(payload);
+// Writes the JSON-RPC envelope, the caller adds "result" or "error" and closes the object
+void McpServer::BeginReply(JsonWriter& writer, int id) {
+    writer.BeginObject().Add("jsonrpc", "2.0").Add("id", id);
 }
 
 void McpServer::ReplyError(int id, const std::string& message) {
-    std::string payload = "{\"jsonrpc\":\"2.0\",\"id\":";
-    payload += std::to_string(id);
-    payload += ",\"error\":{\"message\":\"";
-    payload += message;
-    payload += "\"}}";
-    Application::GetInstance().SendMcpMessage(payload);
+    JsonWriter writer(message.size() + 64);
+    BeginReply(writer, id);
+    writer.Key("error").BeginObject().Add("message", message).EndObject();
+    writer.EndObject();
+    Application::GetInstance().SendMcpMessage(writer.Release());
 }
 
 void McpServer::GetToolsList(int id, const std::string& cursor, bool list_user_only_tools) {
     const int max_payload_size = 8000;
-    std::string json = "{\"tools\":[";
+    // The whole reply is written into a single preallocated buffer
+    JsonWriter writer(max_payload_size + 64);
+    BeginReply(writer, id);
+    writer.Key("result");
+    size_t result_start = writer.size();
+    writer.BeginObject();
+    writer.Key("tools").BeginArray();
     
     bool found_cursor = cursor.empty();
     auto it = tools_.begin();
     std::string next_cursor = "";
+    int tool_count = 0;
     
     while (it != tools_.end()) {
         // 如果我们还没有找到起始位置，继续搜索
@@ -476,36 +659,34 @@ void McpServer::GetToolsList(int id, const std::string& cursor, bool list_user_o
             continue;
         }
         
-        // 添加tool前检查大小
-        std::string tool_json = (*it)->to_json() + ",";
-        if (json.length() + tool_json.length() + 30 > max_payload_size) {
+        // 添加tool后检查大小，超出限制则回滚
+        auto checkpoint = writer.Save();
+        (*it)->WriteJson(writer);
+        if (writer.size() - result_start + 30 > max_payload_size) {
             // 如果添加这个tool会超出大小限制，设置next_cursor并退出循环
+            writer.Restore(checkpoint);
             next_cursor = (*it)->name();
             break;
         }
         
-        json += tool_json;
+        tool_count++;
         ++it;
     }
     
-    if (json.back() == ',') {
-        json.pop_back();
-    }
-    
-    if (json.back() == '[' && !tools_.empty()) {
+    if (tool_count == 0 && !tools_.empty()) {
         // 如果没有添加任何tool，返回错误
         ESP_LOGE(TAG, "tools/list: Failed to add tool %s because of payload size limit", next_cursor.c_str());
         ReplyError(id, "Failed to add tool " + next_cursor + " because of payload size limit");
         return;
     }
 
-    if (next_cursor.empty()) {
-        json += "]}";
-    } else {
-        json += "],\"nextCursor\":\"" + next_cursor + "\"}";
+    writer.EndArray();
+    if (!next_cursor.empty()) {
+        writer.Add("nextCursor", next_cursor);
     }
-    
-    ReplyResult(id, json);
+    writer.EndObject();
+    writer.EndObject();
+    Application::GetInstance().SendMcpMessage(writer.Release());
 }
 
 void McpServer::DoToolCall(int id, const std::string& tool_name, const cJSON* tool_arguments) {
@@ -554,7 +735,12 @@ void McpServer::DoToolCall(int id, const std::string& tool_name, const cJSON* to
     auto& app = Application::GetInstance();
     app.Schedule([this, id, tool_iter, arguments = std::move(arguments)]() {
         try {
-            ReplyResult(id, (*tool_iter)->Call(arguments));
+            JsonWriter writer;
+            BeginReply(writer, id);
+            writer.Key("result");
+            (*tool_iter)->Call(arguments, writer);
+            writer.EndObject();
+            Application::GetInstance().SendMcpMessage(writer.Release());
         } catch (const std::exception& e) {
             ESP_LOGE(TAG, "tools/call: %s", e.what());
             ReplyError(id, e.what());
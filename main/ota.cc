@@ -1,6 +1,11 @@
 #include "ota.h"
 #include "system_info.h"
 #include "settings.h"
+#include "sha256_digest.h"
+#include "flash_stream_writer.h"
+#include "download_checkpoint.h"
+#include "firmware_delta_patcher.h"
+#include "stream_decompressor.h"
 #include "assets/lang_config.h"
 
 #include <cJSON.h>
@@ -218,6 +223,14 @@ esp_err_t Ota::CheckVersion() {
         if (cJSON_IsString(url)) {
             firmware_url_ = url->valuestring;
         }
+        cJSON *sha256 = cJSON_GetObjectItem(firmware, "sha256");
+        firmware_sha256_ = cJSON_IsString(sha256) ? sha256->valuestring : "";
+        // Optional delta against the running firmware, chosen by the server from the elf_sha256 in the request
+        cJSON *delta_url = cJSON_GetObjectItem(firmware, "delta_url");
+        firmware_delta_url_ = cJSON_IsString(delta_url) ? delta_url->valuestring : "";
+        // Optional compressed image, made by scripts/stream_compress.py, with the same SHA-256 once decompressed
+        cJSON *compressed_url = cJSON_GetObjectItem(firmware, "compressed_url");
+        firmware_compressed_url_ = cJSON_IsString(compressed_url) ? compressed_url->valuestring : "";
 
         if (cJSON_IsString(version) && cJSON_IsString(url)) {
             // Check if the version is newer, for example, 0.1.0 is newer than 0.0.1
@@ -261,7 +274,7 @@ void Ota::MarkCurrentVersionValid() {
     }
 }
 
-bool Ota::Upgrade(const std::string& firmware_url, std::function<void(int progress, size_t speed)> callback) {
+bool Ota::Upgrade(const std::string& firmware_url, std::function<void(int progress, size_t speed)> callback, const std::string& sha256) {
     ESP_LOGI(TAG, "Upgrading firmware from %s", firmware_url.c_str());
     esp_ota_handle_t update_handle = 0;
     auto update_partition = esp_ota_get_next_update_partition(NULL);
@@ -271,82 +284,191 @@ bool Ota::Upgrade(const std::string& firmware_url, std::function<void(int progre
     }
 
     ESP_LOGI(TAG, "Writing to partition %s at offset 0x%lx", update_partition->label, update_partition->address);
-    bool image_header_checked = false;
-    std::string image_header;
 
+    // An interrupted download continues from its checkpoint with a Range request
     auto network = Board::GetInstance().GetNetwork();
     auto http = network->CreateHttp(0);
-    if (!http->Open("GET", firmware_url)) {
-        ESP_LOGE(TAG, "Failed to open HTTP connection");
-        return false;
-    }
-
-    if (http->GetStatusCode() != 200) {
-        ESP_LOGE(TAG, "Failed to get firmware, status code: %d", http->GetStatusCode());
+    DownloadCheckpoint checkpoint("ota");
+    size_t resume_offset = 0;
+    size_t content_length = 0;
+    if (!checkpoint.Open(http.get(), firmware_url, sha256, resume_offset, content_length)) {
         return false;
     }
 
-    size_t content_length = http->GetBodyLength();
     if (content_length == 0) {
         ESP_LOGE(TAG, "Failed to get content length");
         return false;
     }
 
-    char buffer[512];
-    size_t total_read = 0, recent_read = 0;
-    auto last_calc_time = esp_timer_get_time();
-    while (true) {
-        int ret = http->Read(buffer, sizeof(buffer));
-        if (ret < 0) {
-            ESP_LOGE(TAG, "Failed to read HTTP data: %s", esp_err_to_name(ret));
+    // Hashed as it is written, esp_ota_end() only checks the image against its own appended hash
+    Sha256Digest digest;
+
+    bool image_header_checked = false;
+    if (resume_offset > 0) {
+        // The image header was checked before the interruption, the written part is hashed again from flash
+        if (!DownloadCheckpoint::ReadBack(update_partition, resume_offset, [&digest](size_t, const char* data, size_t size) {
+            digest.Update(data, size);
+        })) {
+            checkpoint.Clear();
             return false;
         }
+        esp_err_t err = esp_ota_resume(update_partition, OTA_WITH_SEQUENTIAL_WRITES, resume_offset, &update_handle);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to resume OTA: %s", esp_err_to_name(err));
+            checkpoint.Clear();
+            return false;
+        }
+        image_header_checked = true;
+    }
+
+    // The network is read while the previous block is erased and written by the writer task
+    // A compressed image is written as it is decompressed, it starts over if interrupted
+    std::string image_header;
+    StreamDecompressor decompressor([&](size_t offset, const char* data, size_t size) -> bool {
+        if (!image_header_checked) {
+            image_header.append(data, size);
+            if (image_header.size() < sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t) + sizeof(esp_app_desc_t)) {
+                return true;
+            }
+            esp_app_desc_t new_app_info;
+            memcpy(&new_app_info, image_header.data() + sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t), sizeof(esp_app_desc_t));
 
-        // Calculate speed and progress every second
-        recent_read += ret;
-        total_read += ret;
-        if (esp_timer_get_time() - last_calc_time >= 1000000 || ret == 0) {
-            size_t progress = total_read * 100 / content_length;
-            ESP_LOGI(TAG, "Progress: %u%% (%u/%u), Speed: %uB/s", progress, total_read, content_length, recent_read);
-            if (callback) {
-                callback(progress, recent_read);
+            auto current_version = esp_app_get_description()->version;
+            ESP_LOGI(TAG, "Current version: %s, New version: %s", current_version, new_app_info.version);
+
+            if (esp_ota_begin(update_partition, OTA_WITH_SEQUENTIAL_WRITES, &update_handle)) {
+                esp_ota_abort(update_handle);
+                update_handle = 0;
+                ESP_LOGE(TAG, "Failed to begin OTA");
+                return false;
             }
-            last_calc_time = esp_timer_get_time();
-            recent_read = 0;
+            image_header_checked = true;
+
+            // The header may have been received over several blocks
+            data = image_header.data();
+            size = image_header.size();
         }
+        auto err = esp_ota_write(update_handle, data, size);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to write OTA data: %s", esp_err_to_name(err));
+            return false;
+        }
+        digest.Update(data, size);
+        if (!image_header.empty()) {
+            offset = 0;
+            std::string().swap(image_header);
+        }
+        if (!decompressor.compressed()) {
+            checkpoint.Update(offset + size);
+        }
+        return true;
+    }, resume_offset);
+    FlashStreamWriter writer;
+    bool success = writer.Run(http.get(), content_length, [&decompressor](size_t, const char* data, size_t size) -> bool {
+        return decompressor.Feed(data, size);
+    }, callback, resume_offset);
+    http->Close();
 
-        if (ret == 0) {
-            break;
+    if (!success || !decompressor.Finish() || !image_header_checked) {
+        if (update_handle != 0) {
+            esp_ota_abort(update_handle);
         }
+        return false;
+    }
+    // A complete image is not resumed, whether it is valid or not
+    checkpoint.Clear();
 
-        if (!image_header_checked) {
-            image_header.append(buffer, ret);
-            if (image_header.size() >= sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t) + sizeof(esp_app_desc_t)) {
-                esp_app_desc_t new_app_info;
-                memcpy(&new_app_info, image_header.data() + sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t), sizeof(esp_app_desc_t));
-                
-                auto current_version = esp_app_get_description()->version;
-                ESP_LOGI(TAG, "Current version: %s, New version: %s", current_version, new_app_info.version);
-
-                if (esp_ota_begin(update_partition, OTA_WITH_SEQUENTIAL_WRITES, &update_handle)) {
-                    esp_ota_abort(update_handle);
-                    ESP_LOGE(TAG, "Failed to begin OTA");
-                    return false;
-                }
+    if (!sha256.empty()) {
+        if (!Sha256Digest::Matches(digest.Finish(), sha256)) {
+            ESP_LOGE(TAG, "The SHA-256 of the firmware does not match %s", sha256.c_str());
+            esp_ota_abort(update_handle);
+            return false;
+        }
+        ESP_LOGI(TAG, "The firmware SHA-256 is verified");
+    }
+
+    return CompleteUpgrade(update_handle, update_partition);
+}
 
-                image_header_checked = true;
-                std::string().swap(image_header);
+bool Ota::UpgradeDelta(const std::string& delta_url, std::function<void(int progress, size_t speed)> callback, const std::string& sha256) {
+    // The delta would overwrite the part of an interrupted full download that is left to resume
+    if (DownloadCheckpoint("ota").IsPending()) {
+        ESP_LOGI(TAG, "Resuming the full firmware download instead of the delta");
+        return false;
+    }
+    ESP_LOGI(TAG, "Upgrading firmware with the delta from %s", delta_url.c_str());
+    auto update_partition = esp_ota_get_next_update_partition(NULL);
+    auto running_partition = esp_ota_get_running_partition();
+    if (update_partition == NULL || running_partition == NULL) {
+        ESP_LOGE(TAG, "Failed to get the running and update partitions");
+        return false;
+    }
+
+    auto network = Board::GetInstance().GetNetwork();
+    auto http = network->CreateHttp(0);
+    if (!http->Open("GET", delta_url)) {
+        ESP_LOGE(TAG, "Failed to open HTTP connection");
+        return false;
+    }
+    if (http->GetStatusCode() != 200) {
+        ESP_LOGE(TAG, "Failed to get the firmware delta, status code: %d", http->GetStatusCode());
+        return false;
+    }
+    size_t content_length = http->GetBodyLength();
+    if (content_length == 0) {
+        ESP_LOGE(TAG, "Failed to get content length");
+        return false;
+    }
+
+    // The new image is rebuilt from the running one on the writer task, the OTA begins with its first sector
+    esp_ota_handle_t update_handle = 0;
+    Sha256Digest digest;
+    FirmwareDeltaPatcher patcher(running_partition, [&](const uint8_t* data, size_t size) -> bool {
+        if (update_handle == 0) {
+            if (esp_ota_begin(update_partition, OTA_WITH_SEQUENTIAL_WRITES, &update_handle) != ESP_OK) {
+                esp_ota_abort(update_handle);
+                update_handle = 0;
+                ESP_LOGE(TAG, "Failed to begin OTA");
+                return false;
             }
         }
-        auto err = esp_ota_write(update_handle, buffer, ret);
+        auto err = esp_ota_write(update_handle, data, size);
         if (err != ESP_OK) {
             ESP_LOGE(TAG, "Failed to write OTA data: %s", esp_err_to_name(err));
-            esp_ota_abort(update_handle);
             return false;
         }
-    }
+        digest.Update(data, size);
+        return true;
+    });
+    // The delta itself may be compressed
+    StreamDecompressor decompressor([&patcher](size_t, const char* data, size_t size) -> bool {
+        return patcher.Feed(data, size);
+    });
+    FlashStreamWriter writer;
+    bool success = writer.Run(http.get(), content_length, [&decompressor](size_t, const char* data, size_t size) -> bool {
+        return decompressor.Feed(data, size);
+    }, callback);
     http->Close();
 
+    if (!success || !decompressor.Finish() || !patcher.Finish() || update_handle == 0) {
+        if (update_handle != 0) {
+            esp_ota_abort(update_handle);
+        }
+        return false;
+    }
+
+    auto image_digest = digest.Finish();
+    if (image_digest != patcher.target_sha256() || (!sha256.empty() && !Sha256Digest::Matches(image_digest, sha256))) {
+        ESP_LOGE(TAG, "The SHA-256 of the patched firmware does not match");
+        esp_ota_abort(update_handle);
+        return false;
+    }
+    ESP_LOGI(TAG, "Patched %u bytes of firmware from a %u byte delta", patcher.target_size(), content_length);
+
+    return CompleteUpgrade(update_handle, update_partition);
+}
+
+bool Ota::CompleteUpgrade(esp_ota_handle_t update_handle, const esp_partition_t* update_partition) {
     esp_err_t err = esp_ota_end(update_handle);
     if (err != ESP_OK) {
         if (err == ESP_ERR_OTA_VALIDATE_FAILED) {
@@ -367,8 +489,22 @@ bool Ota::Upgrade(const std::string& firmware_url, std::function<void(int progre
     return true;
 }
 
-bool Ota::StartUpgrade(std::function<void(int progress, size_t speed)> callback) {
-    return Upgrade(firmware_url_, callback);
+bool Ota::StartUpgrade(const std::string& firmware_url, const std::string& delta_url, const std::string& compressed_url,
+    std::function<void(int progress, size_t speed)> callback, const std::string& sha256) {
+    if (!delta_url.empty()) {
+        if (UpgradeDelta(delta_url, callback, sha256)) {
+            return true;
+        }
+        ESP_LOGW(TAG, "Delta upgrade failed, downloading the full image");
+    }
+    // Like the delta, the compressed image would discard an interrupted full download that is left to resume
+    if (!compressed_url.empty() && !DownloadCheckpoint("ota").IsPending()) {
+        if (Upgrade(compressed_url, callback, sha256)) {
+            return true;
+        }
+        ESP_LOGW(TAG, "Compressed upgrade failed, downloading the uncompressed image");
+    }
+    return Upgrade(firmware_url, callback, sha256);
 }
 
 
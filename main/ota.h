@@ -5,6 +5,7 @@
 #include <string>
 
 #include <esp_err.h>
+#include <esp_ota_ops.h>
 #include "board.h"
 
 class Ota {
@@ -20,13 +21,22 @@ public:
     bool HasWebsocketConfig() { return has_websocket_config_; }
     bool HasActivationCode() { return has_activation_code_; }
     bool HasServerTime() { return has_server_time_; }
-    bool StartUpgrade(std::function<void(int progress, size_t speed)> callback);
-    static bool Upgrade(const std::string& firmware_url, std::function<void(int progress, size_t speed)> callback);
+    // sha256 is the hex digest of the image from the server, checked before the new image is made bootable.
+    // The file may be compressed by scripts/stream_compress.py, sha256 is then the one of the decompressed image
+    static bool Upgrade(const std::string& firmware_url, std::function<void(int progress, size_t speed)> callback, const std::string& sha256 = "");
+    // Rebuilds the image from a delta against the running firmware, false when the full image is needed
+    static bool UpgradeDelta(const std::string& delta_url, std::function<void(int progress, size_t speed)> callback, const std::string& sha256 = "");
+    // Tries the delta, then the compressed image, and falls back to the full image; empty URLs are skipped
+    static bool StartUpgrade(const std::string& firmware_url, const std::string& delta_url, const std::string& compressed_url,
+        std::function<void(int progress, size_t speed)> callback, const std::string& sha256 = "");
     void MarkCurrentVersionValid();
 
     const std::string& GetFirmwareVersion() const { return firmware_version_; }
     const std::string& GetCurrentVersion() const { return current_version_; }
     const std::string& GetFirmwareUrl() const { return firmware_url_; }
+    const std::string& GetFirmwareSha256() const { return firmware_sha256_; }
+    const std::string& GetFirmwareDeltaUrl() const { return firmware_delta_url_; }
+    const std::string& GetFirmwareCompressedUrl() const { return firmware_compressed_url_; }
     const std::string& GetActivationMessage() const { return activation_message_; }
     const std::string& GetActivationCode() const { return activation_code_; }
     std::string GetCheckVersionUrl();
@@ -44,6 +54,9 @@ private:
     std::string current_version_;
     std::string firmware_version_;
     std::string firmware_url_;
+    std::string firmware_sha256_;
+    std::string firmware_delta_url_;
+    std::string firmware_compressed_url_;
     std::string activation_challenge_;
     std::string serial_number_;
     int activation_timeout_ms_ = 30000;
@@ -53,6 +66,7 @@ private:
     bool IsNewVersionAvailable(const std::string& currentVersion, const std::string& newVersion);
     std::string GetActivationPayload();
     std::unique_ptr<Http> SetupHttp();
+    static bool CompleteUpgrade(esp_ota_handle_t update_handle, const esp_partition_t* update_partition);
 };
 
 #endif // _OTA_H
@@ -0,0 +1,70 @@
+#include "json_dispatcher.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#define TAG "JsonDispatcher"
+
+void JsonDispatcher::Register(std::string_view type, Handler handler) {
+    for (auto& entry : handlers_) {
+        if (entry.type == type) {
+            entry.handler = std::move(handler);
+            return;
+        }
+    }
+    handlers_.push_back({type, std::move(handler)});
+}
+
+bool JsonDispatcher::Dispatch(const JsonMessage& message) {
+    auto start_time = esp_timer_get_time();
+    auto type = message.type();
+
+    const Handler* handler = nullptr;
+    for (auto& entry : handlers_) {
+        if (entry.type == type) {
+            handler = &entry.handler;
+            break;
+        }
+    }
+    if (handler == nullptr) {
+        {
+            std::lock_guard<std::mutex> lock(stats_mutex_);
+            stats_.message_count++;
+            stats_.unknown_count++;
+        }
+        ESP_LOGW(TAG, "Unknown message type: %.*s", (int)type.size(), type.data());
+        return false;
+    }
+
+    (*handler)(message);
+
+    int elapsed_us = (int)(esp_timer_get_time() - start_time);
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats_.message_count++;
+    stats_.handled_count++;
+    if (message.has_tree()) {
+        stats_.tree_count++;
+    }
+    stats_.total_dispatch_us += elapsed_us;
+    if (elapsed_us > stats_.max_dispatch_us) {
+        stats_.max_dispatch_us = elapsed_us;
+    }
+    return true;
+}
+
+JsonDispatchStats JsonDispatcher::GetStats() const {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    return stats_;
+}
+
+void JsonDispatcher::PrintStats(const JsonArena& arena) const {
+    auto stats = GetStats();
+    if (stats.message_count == 0) {
+        return;
+    }
+    // Unknown types are not timed, the average is over the handled messages only
+    ESP_LOGI(TAG, "messages: %lu, cJSON fallback: %lu, unknown: %lu, avg: %d us, max: %d us, arena peak: %u, overflow: %u",
+        stats.message_count, stats.tree_count, stats.unknown_count,
+        stats.handled_count > 0 ? (int)(stats.total_dispatch_us / stats.handled_count) : 0, stats.max_dispatch_us,
+        arena.peak_used(), arena.overflow_count());
+}
@@ -0,0 +1,46 @@
+#ifndef JSON_DISPATCHER_H
+#define JSON_DISPATCHER_H
+
+#include "json_message.h"
+
+#include <functional>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+struct JsonDispatchStats {
+    uint32_t message_count = 0;
+    uint32_t handled_count = 0;    // Messages passed to a handler, the ones that are timed
+    uint32_t tree_count = 0;       // Messages that needed a cJSON tree
+    uint32_t unknown_count = 0;
+    int64_t total_dispatch_us = 0;
+    int max_dispatch_us = 0;
+};
+
+/*
+ * Routes incoming JSON messages to handlers by their "type" field.
+ * Handlers are registered once and looked up without building a cJSON tree,
+ * so hot messages (tts, stt, llm) are served from the receive buffer directly.
+ */
+class JsonDispatcher {
+public:
+    using Handler = std::function<void(const JsonMessage& message)>;
+
+    void Register(std::string_view type, Handler handler);
+    bool Dispatch(const JsonMessage& message);
+
+    // Updated by the task that dispatches and read from others, so both take a lock
+    JsonDispatchStats GetStats() const;
+    void PrintStats(const JsonArena& arena) const;
+
+private:
+    struct Entry {
+        std::string_view type;
+        Handler handler;
+    };
+    std::vector<Entry> handlers_;
+    mutable std::mutex stats_mutex_;
+    JsonDispatchStats stats_;
+};
+
+#endif // JSON_DISPATCHER_H
@@ -0,0 +1,368 @@
+#include "json_message.h"
+
+#include <esp_log.h>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+
+#define TAG "JsonMessage"
+
+char* JsonArena::Allocate(size_t size) {
+    if (used_ + size <= buffer_.size()) {
+        char* ptr = buffer_.data() + used_;
+        used_ += size;
+        if (used_ > peak_used_) {
+            peak_used_ = used_;
+        }
+        return ptr;
+    }
+    overflow_count_++;
+    overflow_.emplace_back(new char[size]);
+    return overflow_.back().get();
+}
+
+void JsonArena::Reset() {
+    used_ = 0;
+    overflow_.clear();
+}
+
+static inline const char* SkipWhitespace(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) {
+        p++;
+    }
+    return p;
+}
+
+// p points to the opening quote, returns the position after the closing quote
+static const char* SkipString(const char* p, const char* end, bool& escaped) {
+    escaped = false;
+    for (p++; p < end; p++) {
+        if (*p == '\\') {
+            escaped = true;
+            p++;
+        } else if (*p == '"') {
+            return p + 1;
+        }
+    }
+    return nullptr;
+}
+
+// Skip an object or array, p points to the opening bracket
+static const char* SkipContainer(const char* p, const char* end) {
+    int depth = 0;
+    bool escaped;
+    while (p < end) {
+        char c = *p;
+        if (c == '"') {
+            p = SkipString(p, end, escaped);
+            if (p == nullptr) {
+                return nullptr;
+            }
+            continue;
+        }
+        if (c == '{' || c == '[') {
+            depth++;
+        } else if (c == '}' || c == ']') {
+            if (--depth == 0) {
+                return p + 1;
+            }
+        }
+        p++;
+    }
+    return nullptr;
+}
+
+static void AppendUtf8(char*& out, uint32_t code) {
+    if (code < 0x80) {
+        *out++ = (char)code;
+    } else if (code < 0x800) {
+        *out++ = (char)(0xC0 | (code >> 6));
+        *out++ = (char)(0x80 | (code & 0x3F));
+    } else if (code < 0x10000) {
+        *out++ = (char)(0xE0 | (code >> 12));
+        *out++ = (char)(0x80 | ((code >> 6) & 0x3F));
+        *out++ = (char)(0x80 | (code & 0x3F));
+    } else {
+        *out++ = (char)(0xF0 | (code >> 18));
+        *out++ = (char)(0x80 | ((code >> 12) & 0x3F));
+        *out++ = (char)(0x80 | ((code >> 6) & 0x3F));
+        *out++ = (char)(0x80 | (code & 0x3F));
+    }
+}
+
+static bool ParseHex4(const char* p, const char* end, uint32_t& code) {
+    if (end - p < 4) {
+        return false;
+    }
+    code = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = p[i];
+        code <<= 4;
+        if (c >= '0' && c <= '9') code |= c - '0';
+        else if (c >= 'a' && c <= 'f') code |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') code |= c - 'A' + 10;
+        else return false;
+    }
+    return true;
+}
+
+JsonMessage::JsonMessage(const char* data, size_t size, JsonArena& arena)
+    : data_(data), size_(size), arena_(arena) {
+    arena_.Reset();
+}
+
+JsonMessage::~JsonMessage() {
+    if (tree_ != nullptr) {
+        cJSON_Delete(tree_);
+    }
+}
+
+bool JsonMessage::Parse() {
+    const char* end = data_ + size_;
+    // Tolerate a trailing null terminator in the buffer
+    while (end > data_ && end[-1] == '\0') {
+        end--;
+    }
+    const char* p = SkipWhitespace(data_, end);
+    if (p >= end || *p != '{') {
+        return false;
+    }
+    p = SkipWhitespace(p + 1, end);
+    if (p < end && *p == '}') {
+        return true;
+    }
+
+    bool too_many_fields = false;
+    while (p < end) {
+        if (*p != '"') {
+            return false;
+        }
+        bool escaped;
+        const char* key_end = SkipString(p, end, escaped);
+        if (key_end == nullptr) {
+            return false;
+        }
+        std::string_view key(p + 1, key_end - p - 2);
+
+        p = SkipWhitespace(key_end, end);
+        if (p >= end || *p != ':') {
+            return false;
+        }
+        p = SkipWhitespace(p + 1, end);
+        if (p >= end) {
+            return false;
+        }
+
+        Field field = { key, {}, kJsonValueLiteral, false };
+        const char* value_end;
+        if (*p == '"') {
+            value_end = SkipString(p, end, field.escaped);
+            if (value_end == nullptr) {
+                return false;
+            }
+            field.kind = kJsonValueString;
+            field.value = std::string_view(p + 1, value_end - p - 2);
+        } else if (*p == '{' || *p == '[') {
+            value_end = SkipContainer(p, end);
+            if (value_end == nullptr) {
+                return false;
+            }
+            field.kind = *p == '{' ? kJsonValueObject : kJsonValueArray;
+            field.value = std::string_view(p, value_end - p);
+        } else {
+            value_end = p;
+            while (value_end < end && *value_end != ',' && *value_end != '}' &&
+                *value_end != ' ' && *value_end != '\t' && *value_end != '\n' && *value_end != '\r') {
+                value_end++;
+            }
+            field.kind = (*p == '-' || (*p >= '0' && *p <= '9')) ? kJsonValueNumber : kJsonValueLiteral;
+            field.value = std::string_view(p, value_end - p);
+        }
+
+        if (field_count_ < fields_.size()) {
+            fields_[field_count_++] = field;
+        } else {
+            too_many_fields = true;
+        }
+
+        p = SkipWhitespace(value_end, end);
+        if (p >= end) {
+            return false;
+        }
+        if (*p == '}') {
+            if (too_many_fields) {
+                return ParseTree();
+            }
+            GetString("type", type_);
+            return true;
+        }
+        if (*p != ',') {
+            return false;
+        }
+        p = SkipWhitespace(p + 1, end);
+    }
+    return false;
+}
+
+// More fields than the index holds, the accessors read a cJSON tree of the whole message instead
+bool JsonMessage::ParseTree() {
+    ESP_LOGW(TAG, "More than %d fields, parsing the whole message", JSON_MESSAGE_MAX_FIELDS);
+    tree_only_ = true;
+    if (tree() == nullptr) {
+        return false;
+    }
+    auto type = cJSON_GetObjectItem(tree_, "type");
+    if (cJSON_IsString(type)) {
+        type_ = type->valuestring;
+    }
+    return true;
+}
+
+const cJSON* JsonMessage::FindTreeItem(std::string_view key) const {
+    if (tree() == nullptr) {
+        return nullptr;
+    }
+    for (auto item = tree_->child; item != nullptr; item = item->next) {
+        if (item->string != nullptr && key == item->string) {
+            return item;
+        }
+    }
+    return nullptr;
+}
+
+const JsonMessage::Field* JsonMessage::FindField(std::string_view key) const {
+    for (size_t i = 0; i < field_count_; i++) {
+        if (fields_[i].key == key) {
+            return &fields_[i];
+        }
+    }
+    return nullptr;
+}
+
+bool JsonMessage::GetString(std::string_view key, std::string_view& value) const {
+    if (tree_only_) {
+        auto item = FindTreeItem(key);
+        if (!cJSON_IsString(item)) {
+            return false;
+        }
+        value = item->valuestring;
+        return true;
+    }
+    auto field = FindField(key);
+    if (field == nullptr || field->kind != kJsonValueString) {
+        return false;
+    }
+    value = field->escaped ? Unescape(field->value) : field->value;
+    return true;
+}
+
+bool JsonMessage::GetNumber(std::string_view key, double& value) const {
+    if (tree_only_) {
+        auto item = FindTreeItem(key);
+        if (!cJSON_IsNumber(item)) {
+            return false;
+        }
+        value = item->valuedouble;
+        return true;
+    }
+    auto field = FindField(key);
+    if (field == nullptr || field->kind != kJsonValueNumber) {
+        return false;
+    }
+    // Numbers are short, copy to terminate the string for strtod
+    char buffer[32];
+    size_t length = std::min(field->value.size(), sizeof(buffer) - 1);
+    memcpy(buffer, field->value.data(), length);
+    buffer[length] = '\0';
+    value = strtod(buffer, nullptr);
+    return true;
+}
+
+bool JsonMessage::GetRaw(std::string_view key, std::string_view& value, JsonValueKind* kind) const {
+    if (tree_only_) {
+        auto item = FindTreeItem(key);
+        if (item == nullptr) {
+            return false;
+        }
+        // Printed back to text, the copy lives in the arena like unescaped strings
+        char* text = cJSON_PrintUnformatted(item);
+        if (text == nullptr) {
+            return false;
+        }
+        size_t length = strlen(text);
+        char* copy = arena_.Allocate(length);
+        memcpy(copy, text, length);
+        cJSON_free(text);
+        // Strings are returned without quotes, like the indexed fields
+        if (cJSON_IsString(item) && length >= 2) {
+            value = std::string_view(copy + 1, length - 2);
+        } else {
+            value = std::string_view(copy, length);
+        }
+        if (kind != nullptr) {
+            *kind = cJSON_IsString(item) ? kJsonValueString : cJSON_IsNumber(item) ? kJsonValueNumber :
+                cJSON_IsObject(item) ? kJsonValueObject : cJSON_IsArray(item) ? kJsonValueArray : kJsonValueLiteral;
+        }
+        return true;
+    }
+    auto field = FindField(key);
+    if (field == nullptr) {
+        return false;
+    }
+    value = field->value;
+    if (kind != nullptr) {
+        *kind = field->kind;
+    }
+    return true;
+}
+
+std::string_view JsonMessage::Unescape(std::string_view value) const {
+    // Unescaped text is never longer than the escaped text
+    char* out = arena_.Allocate(value.size());
+    char* start = out;
+    const char* p = value.data();
+    const char* end = p + value.size();
+    while (p < end) {
+        if (*p != '\\' || p + 1 >= end) {
+            *out++ = *p++;
+            continue;
+        }
+        p++;
+        switch (*p) {
+        case 'b': *out++ = '\b'; p++; break;
+        case 'f': *out++ = '\f'; p++; break;
+        case 'n': *out++ = '\n'; p++; break;
+        case 'r': *out++ = '\r'; p++; break;
+        case 't': *out++ = '\t'; p++; break;
+        case 'u': {
+            uint32_t code;
+            if (!ParseHex4(p + 1, end, code)) {
+                *out++ = *p++;
+                break;
+            }
+            p += 5;
+            // Surrogate pair
+            uint32_t low;
+            if (code >= 0xD800 && code <= 0xDBFF && end - p >= 6 && p[0] == '\\' && p[1] == 'u' &&
+                ParseHex4(p + 2, end, low) && low >= 0xDC00 && low <= 0xDFFF) {
+                code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                p += 6;
+            }
+            AppendUtf8(out, code);
+            break;
+        }
+        default:
+            // \" \\ \/
+            *out++ = *p++;
+            break;
+        }
+    }
+    return std::string_view(start, out - start);
+}
+
+const cJSON* JsonMessage::tree() const {
+    if (tree_ == nullptr) {
+        tree_ = cJSON_ParseWithLength(data_, size_);
+    }
+    return tree_;
+}
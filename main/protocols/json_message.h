@@ -0,0 +1,98 @@
+#ifndef JSON_MESSAGE_H
+#define JSON_MESSAGE_H
+
+#include <cJSON.h>
+
+#include <string_view>
+#include <memory>
+#include <vector>
+#include <array>
+
+#define JSON_ARENA_SIZE 1024
+// Messages with more top level fields are parsed into a cJSON tree instead
+#define JSON_MESSAGE_MAX_FIELDS 16
+
+/*
+ * Scratch memory for decoding a single message, reset before each message.
+ * Allocations that do not fit the inline buffer fall back to the heap and are
+ * released on the next reset.
+ */
+class JsonArena {
+public:
+    char* Allocate(size_t size);
+    void Reset();
+
+    size_t used() const { return used_; }
+    size_t peak_used() const { return peak_used_; }
+    size_t overflow_count() const { return overflow_count_; }
+
+private:
+    std::array<char, JSON_ARENA_SIZE> buffer_;
+    size_t used_ = 0;
+    size_t peak_used_ = 0;
+    size_t overflow_count_ = 0;
+    std::vector<std::unique_ptr<char[]>> overflow_;
+};
+
+enum JsonValueKind {
+    kJsonValueString,
+    kJsonValueNumber,
+    kJsonValueObject,
+    kJsonValueArray,
+    kJsonValueLiteral,   // true, false or null
+};
+
+/*
+ * A view of a JSON object held in a receive buffer.
+ * Top level fields are indexed in place without building a cJSON tree, string values
+ * are returned as views into the buffer (or into the arena if they contain escapes).
+ * A cJSON tree is only built on demand for handlers that need nested access.
+ * The buffer must outlive the message.
+ */
+class JsonMessage {
+public:
+    JsonMessage(const char* data, size_t size, JsonArena& arena);
+    ~JsonMessage();
+    JsonMessage(const JsonMessage&) = delete;
+    JsonMessage& operator=(const JsonMessage&) = delete;
+
+    // Returns false if the buffer is not a JSON object
+    bool Parse();
+
+    std::string_view type() const { return type_; }
+    std::string_view raw() const { return std::string_view(data_, size_); }
+
+    bool GetString(std::string_view key, std::string_view& value) const;
+    bool GetNumber(std::string_view key, double& value) const;
+    // Raw JSON text of any value, e.g. a nested object
+    bool GetRaw(std::string_view key, std::string_view& value, JsonValueKind* kind = nullptr) const;
+
+    // Fallback for nested access, parsed once and owned by the message
+    const cJSON* tree() const;
+    bool has_tree() const { return tree_ != nullptr; }
+
+private:
+    struct Field {
+        std::string_view key;
+        std::string_view value;  // Raw text, strings without quotes
+        JsonValueKind kind;
+        bool escaped;
+    };
+
+    const char* data_;
+    size_t size_;
+    JsonArena& arena_;
+    std::array<Field, JSON_MESSAGE_MAX_FIELDS> fields_;
+    size_t field_count_ = 0;
+    std::string_view type_;
+    mutable cJSON* tree_ = nullptr;
+    // Set when the message has more than JSON_MESSAGE_MAX_FIELDS fields, see ParseTree()
+    bool tree_only_ = false;
+
+    bool ParseTree();
+    const cJSON* FindTreeItem(std::string_view key) const;
+    const Field* FindField(std::string_view key) const;
+    std::string_view Unescape(std::string_view value) const;
+};
+
+#endif // JSON_MESSAGE_H
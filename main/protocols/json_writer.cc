@@ -0,0 +1,139 @@
+#include "json_writer.h"
+
+#include <charconv>
+
+JsonWriter::JsonWriter(size_t reserve_size) : out_(&buffer_) {
+    buffer_.reserve(reserve_size);
+}
+
+JsonWriter::JsonWriter(std::string& buffer) : out_(&buffer) {
+}
+
+void JsonWriter::BeforeValue() {
+    if (after_key_) {
+        after_key_ = false;
+        return;
+    }
+    if (depth_ == 0) {
+        return;
+    }
+    uint32_t bit = 1u << (depth_ & 31);
+    if (has_items_ & bit) {
+        out_->push_back(',');
+    } else {
+        has_items_ |= bit;
+    }
+}
+
+JsonWriter& JsonWriter::BeginObject() {
+    BeforeValue();
+    out_->push_back('{');
+    depth_++;
+    has_items_ &= ~(1u << (depth_ & 31));
+    return *this;
+}
+
+JsonWriter& JsonWriter::EndObject() {
+    out_->push_back('}');
+    depth_--;
+    return *this;
+}
+
+JsonWriter& JsonWriter::BeginArray() {
+    BeforeValue();
+    out_->push_back('[');
+    depth_++;
+    has_items_ &= ~(1u << (depth_ & 31));
+    return *this;
+}
+
+JsonWriter& JsonWriter::EndArray() {
+    out_->push_back(']');
+    depth_--;
+    return *this;
+}
+
+JsonWriter& JsonWriter::Key(std::string_view key) {
+    BeforeValue();
+    out_->push_back('"');
+    AppendEscaped(*out_, key);
+    out_->append("\":", 2);
+    after_key_ = true;
+    return *this;
+}
+
+JsonWriter& JsonWriter::String(std::string_view value) {
+    BeforeValue();
+    out_->push_back('"');
+    AppendEscaped(*out_, value);
+    out_->push_back('"');
+    return *this;
+}
+
+JsonWriter& JsonWriter::Int(int64_t value) {
+    BeforeValue();
+    char buffer[24];
+    auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    out_->append(buffer, result.ptr - buffer);
+    return *this;
+}
+
+JsonWriter& JsonWriter::Bool(bool value) {
+    BeforeValue();
+    if (value) {
+        out_->append("true", 4);
+    } else {
+        out_->append("false", 5);
+    }
+    return *this;
+}
+
+JsonWriter& JsonWriter::Null() {
+    BeforeValue();
+    out_->append("null", 4);
+    return *this;
+}
+
+JsonWriter& JsonWriter::Raw(std::string_view json) {
+    BeforeValue();
+    out_->append(json.data(), json.size());
+    return *this;
+}
+
+void JsonWriter::Restore(const Checkpoint& checkpoint) {
+    out_->resize(checkpoint.size);
+    depth_ = checkpoint.depth;
+    has_items_ = checkpoint.has_items;
+    after_key_ = checkpoint.after_key;
+}
+
+void JsonWriter::AppendEscaped(std::string& out, std::string_view value) {
+    static const char hex_chars[] = "0123456789abcdef";
+    const char* p = value.data();
+    const char* end = p + value.size();
+    const char* run = p;
+    for (; p < end; p++) {
+        unsigned char c = (unsigned char)*p;
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        // Flush the run of characters that need no escaping
+        out.append(run, p - run);
+        run = p + 1;
+        switch (c) {
+        case '"': out.append("\\\"", 2); break;
+        case '\\': out.append("\\\\", 2); break;
+        case '\n': out.append("\\n", 2); break;
+        case '\r': out.append("\\r", 2); break;
+        case '\t': out.append("\\t", 2); break;
+        case '\b': out.append("\\b", 2); break;
+        case '\f': out.append("\\f", 2); break;
+        default: {
+            char escaped[6] = { '\\', 'u', '0', '0', hex_chars[c >> 4], hex_chars[c & 0xF] };
+            out.append(escaped, 6);
+            break;
+        }
+        }
+    }
+    out.append(run, end - run);
+}
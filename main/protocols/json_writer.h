@@ -0,0 +1,72 @@
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+
+/*
+ * Streaming JSON serializer that appends straight into a string buffer.
+ * Commas are inserted automatically, strings are escaped, and a checkpoint
+ * can be restored to drop a partially written value (e.g. when a size limit is hit).
+ *
+ *   JsonWriter writer;
+ *   writer.BeginObject().Add("type", "hello").Add("version", 3).EndObject();
+ *   SendText(writer.str());
+ */
+class JsonWriter {
+public:
+    struct Checkpoint {
+        size_t size;
+        int depth;
+        uint32_t has_items;
+        bool after_key;
+    };
+
+    // Writes into an internal buffer with the given capacity reserved up front
+    explicit JsonWriter(size_t reserve_size = 256);
+    // Appends to a buffer provided by the caller, which must outlive the writer
+    explicit JsonWriter(std::string& buffer);
+    JsonWriter(const JsonWriter&) = delete;
+    JsonWriter& operator=(const JsonWriter&) = delete;
+
+    JsonWriter& BeginObject();
+    JsonWriter& EndObject();
+    JsonWriter& BeginArray();
+    JsonWriter& EndArray();
+    JsonWriter& Key(std::string_view key);
+
+    JsonWriter& String(std::string_view value);
+    JsonWriter& Int(int64_t value);
+    JsonWriter& Bool(bool value);
+    JsonWriter& Null();
+    // Appends an already serialized JSON value
+    JsonWriter& Raw(std::string_view json);
+
+    JsonWriter& Add(std::string_view key, std::string_view value) { return Key(key).String(value); }
+    JsonWriter& Add(std::string_view key, const char* value) { return Key(key).String(value); }
+    JsonWriter& Add(std::string_view key, int value) { return Key(key).Int(value); }
+    JsonWriter& Add(std::string_view key, bool value) { return Key(key).Bool(value); }
+    JsonWriter& AddRaw(std::string_view key, std::string_view json) { return Key(key).Raw(json); }
+
+    Checkpoint Save() const { return { out_->size(), depth_, has_items_, after_key_ }; }
+    void Restore(const Checkpoint& checkpoint);
+
+    size_t size() const { return out_->size(); }
+    const std::string& str() const { return *out_; }
+    // Moves the written JSON out of the writer
+    std::string Release() { return std::move(*out_); }
+
+    static void AppendEscaped(std::string& out, std::string_view value);
+
+private:
+    std::string buffer_;
+    std::string* out_;
+    int depth_ = 0;
+    uint32_t has_items_ = 0;  // Bit n is set when the container at depth n already has an item
+    bool after_key_ = false;
+
+    void BeforeValue();
+};
+
+#endif // JSON_WRITER_H
@@ -2,6 +2,8 @@
 #include "board.h"
 #include "application.h"
 #include "settings.h"
+#include "json_writer.h"
+#include "tracing.h"
 
 #include <esp_log.h>
 #include <cstring>
@@ -98,35 +100,61 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
     });
 
     mqtt_->OnMessage([this](const std::string& topic, const std::string& payload) {
-        cJSON* root = cJSON_Parse(payload.c_str());
-        if (root == nullptr) {
+        transport_stats_.OnReceived(payload.size());
+        TRACE_INSTANT("rx_json", payload.size());
+        session_recorder_.Record(kSessionRecordIncomingJson, payload.data(), payload.size());
+        JsonMessage message(payload.data(), payload.size(), json_arena_);
+        if (!message.Parse()) {
             ESP_LOGE(TAG, "Failed to parse json message %s", payload.c_str());
             return;
         }
-        cJSON* type = cJSON_GetObjectItem(root, "type");
-        if (!cJSON_IsString(type)) {
+        if (message.type().empty()) {
             ESP_LOGE(TAG, "Message type is invalid");
-            cJSON_Delete(root);
             return;
         }
 
-        if (strcmp(type->valuestring, "hello") == 0) {
-            ParseServerHello(root);
-        } else if (strcmp(type->valuestring, "goodbye") == 0) {
-            auto session_id = cJSON_GetObjectItem(root, "session_id");
-            ESP_LOGI(TAG, "Received goodbye message, session_id: %s", session_id ? session_id->valuestring : "null");
-            if (session_id == nullptr || session_id_ == session_id->valuestring) {
+        if (message.type() == "hello") {
+            // The index accepts some text that cJSON rejects, then there is no tree
+            auto root = message.tree();
+            if (root == nullptr) {
+                ESP_LOGE(TAG, "Invalid server hello");
+            } else {
+                ParseServerHello(root);
+            }
+        } else if (message.type() == "pong") {
+            HandlePong(message);
+        } else if (message.type() == "goodbye") {
+            std::string_view session_id;
+            bool has_session_id = message.GetString("session_id", session_id);
+            ESP_LOGI(TAG, "Received goodbye message, session_id: %.*s", (int)session_id.size(), session_id.data());
+            std::string current_session_id;
+            {
+                std::lock_guard<std::mutex> lock(channel_mutex_);
+                current_session_id = session_id_;
+            }
+            if (!has_session_id || session_id == current_session_id) {
+                // The server ended the session, it can not be resumed
+                udp_resume_ttl_seconds_ = 0;
                 auto alive = alive_;  // Capture alive flag
                 Application::GetInstance().Schedule([this, alive]() {
-                    if (*alive) {
-                        CloseAudioChannel();
+                    if (!*alive) {
+                        return;
                     }
+                    {
+                        // A parked session was already closed on our side, only drop the UDP session
+                        std::lock_guard<std::mutex> lock(channel_mutex_);
+                        if (!session_opened_) {
+                            udp_.reset();
+                            resume_deadline_us_ = 0;
+                            return;
+                        }
+                    }
+                    CloseAudioChannel();
                 });
             }
         } else if (on_incoming_json_ != nullptr) {
-            on_incoming_json_(root);
+            on_incoming_json_(message);
         }
-        cJSON_Delete(root);
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
 
@@ -154,71 +182,155 @@ bool MqttProtocol::SendText(const std::string& text) {
     if (publish_topic_.empty()) {
         return false;
     }
+    TRACE_INSTANT("tx_json", text.size());
+    session_recorder_.Record(kSessionRecordOutgoingJson, text.data(), text.size());
     if (!mqtt_->Publish(publish_topic_, text)) {
         ESP_LOGE(TAG, "Failed to publish message: %s", text.c_str());
+        transport_stats_.OnSent(text.size(), false);
         SetError(Lang::Strings::SERVER_ERROR);
         return false;
     }
+    transport_stats_.OnSent(text.size(), true);
     return true;
 }
 
 bool MqttProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
     std::lock_guard<std::mutex> lock(channel_mutex_);
-    if (udp_ == nullptr) {
+    if (udp_ == nullptr || !session_opened_) {
         return false;
     }
+    session_recorder_.Record(kSessionRecordOutgoingAudio, packet->payload.data(), packet->payload.size(), packet->timestamp);
+    return SendUdpPacket(MQTT_UDP_PACKET_TYPE_AUDIO, packet->payload.data(), packet->payload.size(), packet->timestamp);
+}
 
+// Must be called with channel_mutex_ held
+bool MqttProtocol::SendUdpPacket(uint8_t type, const uint8_t* payload, size_t size, uint32_t timestamp) {
     std::string nonce(aes_nonce_);
-    *(uint16_t*)&nonce[2] = htons(packet->payload.size());
-    *(uint32_t*)&nonce[8] = htonl(packet->timestamp);
+    nonce[0] = type;
+    *(uint16_t*)&nonce[2] = htons(size);
+    *(uint32_t*)&nonce[8] = htonl(timestamp);
     *(uint32_t*)&nonce[12] = htonl(++local_sequence_);
 
     std::string encrypted;
-    encrypted.resize(aes_nonce_.size() + packet->payload.size());
+    encrypted.resize(aes_nonce_.size() + size);
     memcpy(encrypted.data(), nonce.data(), nonce.size());
 
     size_t nc_off = 0;
     uint8_t stream_block[16] = {0};
-    if (mbedtls_aes_crypt_ctr(&aes_ctx_, packet->payload.size(), &nc_off, (uint8_t*)nonce.c_str(), stream_block,
-        (uint8_t*)packet->payload.data(), (uint8_t*)&encrypted[nonce.size()]) != 0) {
-        ESP_LOGE(TAG, "Failed to encrypt audio data");
+    if (mbedtls_aes_crypt_ctr(&aes_ctx_, size, &nc_off, (uint8_t*)nonce.c_str(), stream_block,
+        payload, (uint8_t*)&encrypted[nonce.size()]) != 0) {
+        ESP_LOGE(TAG, "Failed to encrypt udp packet");
         return false;
     }
 
-    return udp_->Send(encrypted) > 0;
+    bool success = udp_->Send(encrypted) > 0;
+    transport_stats_.OnSent(encrypted.size(), success);
+    return success;
 }
 
 void MqttProtocol::CloseAudioChannel() {
+    std::string session_id;
     {
         std::lock_guard<std::mutex> lock(channel_mutex_);
-        udp_.reset();
+        session_id = session_id_;
+        session_opened_ = false;
+        // Keep the UDP session for a quick resume if the server allows it.
+        // The sequence numbers keep counting so that the AES-CTR counter is never reused.
+        int resume_ttl_seconds = udp_resume_ttl_seconds_;
+        if (udp_ != nullptr && resume_ttl_seconds > 0 && !error_occurred_) {
+            resume_deadline_us_ = esp_timer_get_time() + (int64_t)resume_ttl_seconds * 1000000;
+        } else {
+            udp_.reset();
+            resume_deadline_us_ = 0;
+        }
     }
 
-    std::string message = "{";
-    message += "\"session_id\":\"" + session_id_ + "\",";
-    message += "\"type\":\"goodbye\"";
-    message += "}";
-    SendText(message);
+    JsonWriter writer;
+    writer.BeginObject().Add("session_id", session_id).Add("type", "goodbye").EndObject();
+    SendText(writer.str());
 
     if (on_audio_channel_closed_ != nullptr) {
         on_audio_channel_closed_();
     }
 }
 
+bool MqttProtocol::ResumeUdpSession() {
+    // A concurrent close or server hello may reassign session_id_
+    std::string session_id;
+    {
+        std::lock_guard<std::mutex> lock(channel_mutex_);
+        session_id = session_id_;
+        if (udp_ == nullptr) {
+            return false;
+        }
+        if (esp_timer_get_time() >= resume_deadline_us_) {
+            ESP_LOGI(TAG, "UDP session expired, request a new one");
+            udp_.reset();
+            return false;
+        }
+    }
+
+    /*
+     * Resume packet uses the same header as the audio packet with type 0x02,
+     * the payload is the encrypted session id. The server echoes it back to confirm.
+     */
+    for (int attempt = 0; attempt < MQTT_UDP_RESUME_ATTEMPTS; attempt++) {
+        xEventGroupClearBits(event_group_handle_, MQTT_PROTOCOL_UDP_RESUME_EVENT);
+        {
+            std::lock_guard<std::mutex> lock(channel_mutex_);
+            if (!SendUdpPacket(MQTT_UDP_PACKET_TYPE_RESUME, (const uint8_t*)session_id.data(), session_id.size(), 0)) {
+                break;
+            }
+        }
+        EventBits_t bits = xEventGroupWaitBits(event_group_handle_, MQTT_PROTOCOL_UDP_RESUME_EVENT, pdTRUE, pdFALSE,
+            pdMS_TO_TICKS(MQTT_UDP_RESUME_TIMEOUT_MS));
+        if (bits & MQTT_PROTOCOL_UDP_RESUME_EVENT) {
+            ESP_LOGI(TAG, "UDP session resumed, session_id: %s", session_id.c_str());
+            return true;
+        }
+    }
+
+    ESP_LOGW(TAG, "Failed to resume UDP session, fall back to hello");
+    std::lock_guard<std::mutex> lock(channel_mutex_);
+    udp_.reset();
+    return false;
+}
+
 bool MqttProtocol::OpenAudioChannel() {
+    auto start_time = esp_timer_get_time();
     if (mqtt_ == nullptr || !mqtt_->IsConnected()) {
         ESP_LOGI(TAG, "MQTT is not connected, try to connect now");
         if (!StartMqttClient(true)) {
+            RecordChannelOpen(start_time, false);
             return false;
         }
     }
 
     error_occurred_ = false;
-    session_id_ = "";
+    transport_stats_.Reset();
+    if (ResumeUdpSession()) {
+        {
+            std::lock_guard<std::mutex> lock(channel_mutex_);
+            session_opened_ = true;
+        }
+        last_incoming_time_ = std::chrono::steady_clock::now();
+        RecordChannelOpen(start_time, true, true);
+        if (on_audio_channel_opened_ != nullptr) {
+            on_audio_channel_opened_();
+        }
+        return true;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(channel_mutex_);
+        session_id_ = "";
+    }
+    udp_resume_ttl_seconds_ = 0;
     xEventGroupClearBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT);
 
     auto message = GetHelloMessage();
     if (!SendText(message)) {
+        RecordChannelOpen(start_time, false);
         return false;
     }
 
@@ -227,6 +339,7 @@ bool MqttProtocol::OpenAudioChannel() {
     if (!(bits & MQTT_PROTOCOL_SERVER_HELLO_EVENT)) {
         ESP_LOGE(TAG, "Failed to receive server hello");
         SetError(Lang::Strings::SERVER_TIMEOUT);
+        RecordChannelOpen(start_time, false);
         return false;
     }
 
@@ -243,12 +356,19 @@ bool MqttProtocol::OpenAudioChannel() {
             ESP_LOGE(TAG, "Invalid audio packet size: %u", data.size());
             return;
         }
-        if (data[0] != 0x01) {
+        uint8_t type = data[0];
+        if (type != MQTT_UDP_PACKET_TYPE_AUDIO && type != MQTT_UDP_PACKET_TYPE_RESUME) {
             ESP_LOGE(TAG, "Invalid audio packet type: %x", data[0]);
             return;
         }
         uint32_t timestamp = ntohl(*(uint32_t*)&data[8]);
         uint32_t sequence = ntohl(*(uint32_t*)&data[12]);
+        transport_stats_.OnSequence(sequence);
+        if (type == MQTT_UDP_PACKET_TYPE_AUDIO && session_opened_) {
+            transport_stats_.OnAudioReceived(data.size(), timestamp);
+        } else {
+            transport_stats_.OnReceived(data.size());
+        }
         if (sequence < remote_sequence_) {
             ESP_LOGW(TAG, "Received audio packet with old sequence: %lu, expected: %lu", sequence, remote_sequence_);
             return;
@@ -272,14 +392,31 @@ bool MqttProtocol::OpenAudioChannel() {
             ESP_LOGE(TAG, "Failed to decrypt audio data, ret: %d", ret);
             return;
         }
+        remote_sequence_ = sequence;
+        if (type == MQTT_UDP_PACKET_TYPE_RESUME) {
+            std::string resumed_session_id(packet->payload.begin(), packet->payload.end());
+            if (resumed_session_id == session_id_) {
+                xEventGroupSetBits(event_group_handle_, MQTT_PROTOCOL_UDP_RESUME_EVENT);
+            } else {
+                ESP_LOGW(TAG, "Resume ack with unknown session: %s", resumed_session_id.c_str());
+            }
+            return;
+        }
+        // Drop audio received while the session is parked
+        if (!session_opened_) {
+            return;
+        }
         if (on_incoming_audio_ != nullptr) {
+            TRACE_INSTANT("rx_audio", packet->payload.size());
+            session_recorder_.Record(kSessionRecordIncomingAudio, packet->payload.data(), packet->payload.size(), packet->timestamp);
             on_incoming_audio_(std::move(packet));
         }
-        remote_sequence_ = sequence;
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
 
     udp_->Connect(udp_server_, udp_port_);
+    session_opened_ = true;
+    RecordChannelOpen(start_time, true);
 
     if (on_audio_channel_opened_ != nullptr) {
         on_audio_channel_opened_();
@@ -289,27 +426,25 @@ bool MqttProtocol::OpenAudioChannel() {
 
 std::string MqttProtocol::GetHelloMessage() {
     // 发送 hello 消息申请 UDP 通道
-    cJSON* root = cJSON_CreateObject();
-    cJSON_AddStringToObject(root, "type", "hello");
-    cJSON_AddNumberToObject(root, "version", 3);
-    cJSON_AddStringToObject(root, "transport", "udp");
-    cJSON* features = cJSON_CreateObject();
+    JsonWriter writer;
+    writer.BeginObject();
+    writer.Add("type", "hello");
+    writer.Add("version", 3);
+    writer.Add("transport", "udp");
+    writer.Key("features").BeginObject();
 #if CONFIG_USE_SERVER_AEC
-    cJSON_AddBoolToObject(features, "aec", true);
+    writer.Add("aec", true);
 #endif
-    cJSON_AddBoolToObject(features, "mcp", true);
-    cJSON_AddItemToObject(root, "features", features);
-    cJSON* audio_params = cJSON_CreateObject();
-    cJSON_AddStringToObject(audio_params, "format", "opus");
-    cJSON_AddNumberToObject(audio_params, "sample_rate", 16000);
-    cJSON_AddNumberToObject(audio_params, "channels", 1);
-    cJSON_AddNumberToObject(audio_params, "frame_duration", OPUS_FRAME_DURATION_MS);
-    cJSON_AddItemToObject(root, "audio_params", audio_params);
-    auto json_str = cJSON_PrintUnformatted(root);
-    std::string message(json_str);
-    cJSON_free(json_str);
-    cJSON_Delete(root);
-    return message;
+    writer.Add("mcp", true);
+    writer.EndObject();
+    writer.Key("audio_params").BeginObject();
+    writer.Add("format", "opus");
+    writer.Add("sample_rate", 16000);
+    writer.Add("channels", 1);
+    writer.Add("frame_duration", OPUS_FRAME_DURATION_MS);
+    writer.EndObject();
+    writer.EndObject();
+    return writer.Release();
 }
 
 void MqttProtocol::ParseServerHello(const cJSON* root) {
@@ -318,11 +453,15 @@ void MqttProtocol::ParseServerHello(const cJSON* root) {
         ESP_LOGE(TAG, "Unsupported transport: %s", transport->valuestring);
         return;
     }
+    Application::GetInstance().GetInteractionTimeline().Mark(kInteractionPhaseServerHello);
 
     auto session_id = cJSON_GetObjectItem(root, "session_id");
     if (cJSON_IsString(session_id)) {
-        session_id_ = session_id->valuestring;
-        ESP_LOGI(TAG, "Session ID: %s", session_id_.c_str());
+        {
+            std::lock_guard<std::mutex> lock(channel_mutex_);
+            session_id_ = session_id->valuestring;
+        }
+        ESP_LOGI(TAG, "Session ID: %s", session_id->valuestring);
     }
 
     // Get sample rate from hello message
@@ -347,6 +486,8 @@ void MqttProtocol::ParseServerHello(const cJSON* root) {
     udp_port_ = cJSON_GetObjectItem(udp, "port")->valueint;
     auto key = cJSON_GetObjectItem(udp, "key")->valuestring;
     auto nonce = cJSON_GetObjectItem(udp, "nonce")->valuestring;
+    auto resume_ttl = cJSON_GetObjectItem(udp, "resume_ttl");
+    udp_resume_ttl_seconds_ = cJSON_IsNumber(resume_ttl) ? resume_ttl->valueint : 0;
 
     // auto encryption = cJSON_GetObjectItem(udp, "encryption")->valuestring;
     // ESP_LOGI(TAG, "UDP server: %s, port: %d, encryption: %s", udp_server_.c_str(), udp_port_, encryption);
@@ -378,5 +519,5 @@ std::string MqttProtocol::DecodeHexString(const std::string& hex_string) {
 }
 
 bool MqttProtocol::IsAudioChannelOpened() const {
-    return udp_ != nullptr && !error_occurred_ && !IsTimeout();
+    return udp_ != nullptr && session_opened_ && !error_occurred_ && !IsTimeout();
 }
@@ -22,6 +22,15 @@
 #define MQTT_RECONNECT_INTERVAL_MS 60000
 
 #define MQTT_PROTOCOL_SERVER_HELLO_EVENT (1 << 0)
+#define MQTT_PROTOCOL_UDP_RESUME_EVENT (1 << 1)
+
+// UDP packet types, the first byte of the packet header
+#define MQTT_UDP_PACKET_TYPE_AUDIO 0x01
+#define MQTT_UDP_PACKET_TYPE_RESUME 0x02
+
+// Resume request is retried once, the whole handshake is bounded by attempts * timeout
+#define MQTT_UDP_RESUME_ATTEMPTS 2
+#define MQTT_UDP_RESUME_TIMEOUT_MS 250
 
 class MqttProtocol : public Protocol {
 public:
@@ -42,6 +51,7 @@ private:
 
     std::string publish_topic_;
 
+    // Guards udp_, the session state and session_id_
     std::mutex channel_mutex_;
     std::unique_ptr<Mqtt> mqtt_;
     std::unique_ptr<Udp> udp_;
@@ -52,8 +62,18 @@ private:
     uint32_t local_sequence_;
     uint32_t remote_sequence_;
     esp_timer_handle_t reconnect_timer_;
+    // Read by the UDP receive callback on the network task
+    std::atomic<bool> session_opened_ = false;
+
+    // UDP session resume, enabled when the server hello contains udp.resume_ttl.
+    // After goodbye the UDP session is kept until resume_deadline_us_.
+    // Written on the MQTT task by the server hello and goodbye, read by CloseAudioChannel()
+    std::atomic<int> udp_resume_ttl_seconds_ = 0;
+    int64_t resume_deadline_us_ = 0;
 
     bool StartMqttClient(bool report_error=false);
+    bool ResumeUdpSession();
+    bool SendUdpPacket(uint8_t type, const uint8_t* payload, size_t size, uint32_t timestamp);
     void ParseServerHello(const cJSON* root);
     std::string DecodeHexString(const std::string& hex_string);
 
@@ -1,10 +1,12 @@
 #include "protocol.h"
+#include "json_writer.h"
 
 #include <esp_log.h>
+#include <esp_timer.h>
 
 #define TAG "Protocol"
 
-void Protocol::OnIncomingJson(std::function<void(const cJSON* root)> callback) {
+void Protocol::OnIncomingJson(std::function<void(const JsonMessage& message)> callback) {
     on_incoming_json_ = callback;
 }
 
@@ -40,42 +42,68 @@ void Protocol::SetError(const std::string& message) {
 }
 
 void Protocol::SendAbortSpeaking(AbortReason reason) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"abort\"";
+    JsonWriter writer;
+    writer.BeginObject().Add("session_id", session_id_).Add("type", "abort");
     if (reason == kAbortReasonWakeWordDetected) {
-        message += ",\"reason\":\"wake_word_detected\"";
+        writer.Add("reason", "wake_word_detected");
     }
-    message += "}";
-    SendText(message);
+    writer.EndObject();
+    SendText(writer.str());
 }
 
 void Protocol::SendWakeWordDetected(const std::string& wake_word) {
-    std::string json = "{\"session_id\":\"" + session_id_ + 
-                      "\",\"type\":\"listen\",\"state\":\"detect\",\"text\":\"" + wake_word + "\"}";
-    SendText(json);
+    JsonWriter writer;
+    writer.BeginObject()
+        .Add("session_id", session_id_)
+        .Add("type", "listen")
+        .Add("state", "detect")
+        .Add("text", wake_word)
+        .EndObject();
+    SendText(writer.str());
 }
 
 void Protocol::SendStartListening(ListeningMode mode) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\"";
-    message += ",\"type\":\"listen\",\"state\":\"start\"";
+    JsonWriter writer;
+    writer.BeginObject().Add("session_id", session_id_).Add("type", "listen").Add("state", "start");
     if (mode == kListeningModeRealtime) {
-        message += ",\"mode\":\"realtime\"";
+        writer.Add("mode", "realtime");
     } else if (mode == kListeningModeAutoStop) {
-        message += ",\"mode\":\"auto\"";
+        writer.Add("mode", "auto");
     } else {
-        message += ",\"mode\":\"manual\"";
+        writer.Add("mode", "manual");
     }
-    message += "}";
-    SendText(message);
+    writer.EndObject();
+    SendText(writer.str());
 }
 
 void Protocol::SendStopListening() {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"listen\",\"state\":\"stop\"}";
-    SendText(message);
+    JsonWriter writer;
+    writer.BeginObject().Add("session_id", session_id_).Add("type", "listen").Add("state", "stop").EndObject();
+    SendText(writer.str());
 }
 
 void Protocol::SendMcpMessage(const std::string& payload) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"mcp\",\"payload\":" + payload + "}";
-    SendText(message);
+    // Reserve for the envelope so that large payloads (e.g. tools/list) are copied only once
+    JsonWriter writer(payload.size() + 64);
+    writer.BeginObject().Add("session_id", session_id_).Add("type", "mcp").AddRaw("payload", payload).EndObject();
+    SendText(writer.str());
+}
+
+void Protocol::SendPing() {
+    JsonWriter writer;
+    writer.BeginObject().Add("type", "ping").Key("timestamp").Int(TransportStats::NowMs()).EndObject();
+    SendText(writer.str());
+}
+
+void Protocol::HandlePong(const JsonMessage& message) {
+    double sent_ms;
+    if (!message.GetNumber("timestamp", sent_ms)) {
+        // Plain keepalive response without timing information
+        return;
+    }
+    double server_time_ms;
+    bool has_server_time = message.GetNumber("server_time", server_time_ms);
+    transport_stats_.OnPong((int64_t)sent_ms, has_server_time ? (int64_t)server_time_ms : -1);
 }
 
 bool Protocol::IsTimeout() const {
@@ -88,3 +116,24 @@ bool Protocol::IsTimeout() const {
     }
     return timeout;
 }
+
+void Protocol::RecordChannelOpen(int64_t start_time_us, bool success, bool reused) {
+    int elapsed_ms = (int)((esp_timer_get_time() - start_time_us) / 1000);
+    auto& stats = channel_open_stats_;
+    if (!success) {
+        stats.failure_count++;
+        ESP_LOGW(TAG, "Audio channel open failed after %d ms", elapsed_ms);
+        return;
+    }
+    stats.open_count++;
+    if (reused) {
+        stats.reuse_count++;
+    }
+    stats.last_open_ms = elapsed_ms;
+    stats.total_open_ms += elapsed_ms;
+    if (elapsed_ms > stats.max_open_ms) {
+        stats.max_open_ms = elapsed_ms;
+    }
+    ESP_LOGI(TAG, "Audio channel opened in %d ms (%s), avg %d ms, max %d ms", elapsed_ms, reused ? "warm" : "cold",
+        (int)(stats.total_open_ms / stats.open_count), stats.max_open_ms);
+}
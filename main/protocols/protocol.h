@@ -1,11 +1,16 @@
 #ifndef PROTOCOL_H
 #define PROTOCOL_H
 
+#include "json_message.h"
+#include "transport_stats.h"
+#include "session_recorder.h"
+
 #include <cJSON.h>
 #include <string>
 #include <functional>
 #include <chrono>
 #include <vector>
+#include <atomic>
 
 struct AudioStreamPacket {
     int sample_rate = 0;
@@ -35,6 +40,15 @@ enum AbortReason {
     kAbortReasonWakeWordDetected
 };
 
+struct ChannelOpenStats {
+    uint32_t open_count = 0;      // Successful opens
+    uint32_t reuse_count = 0;     // Opens that reused a warm connection
+    uint32_t failure_count = 0;
+    int last_open_ms = 0;
+    int max_open_ms = 0;
+    int64_t total_open_ms = 0;
+};
+
 enum ListeningMode {
     kListeningModeAutoStop,
     kListeningModeManualStop,
@@ -54,9 +68,22 @@ public:
     inline const std::string& session_id() const {
         return session_id_;
     }
+    inline const ChannelOpenStats& channel_open_stats() const {
+        return channel_open_stats_;
+    }
+    inline const JsonArena& json_arena() const {
+        return json_arena_;
+    }
+    inline const TransportStats& transport_stats() const {
+        return transport_stats_;
+    }
+    // Optional capture of the session traffic for offline replay
+    inline SessionRecorder& session_recorder() {
+        return session_recorder_;
+    }
 
     void OnIncomingAudio(std::function<void(std::unique_ptr<AudioStreamPacket> packet)> callback);
-    void OnIncomingJson(std::function<void(const cJSON* root)> callback);
+    void OnIncomingJson(std::function<void(const JsonMessage& message)> callback);
     void OnAudioChannelOpened(std::function<void()> callback);
     void OnAudioChannelClosed(std::function<void()> callback);
     void OnNetworkError(std::function<void(const std::string& message)> callback);
@@ -73,9 +100,11 @@ public:
     virtual void SendStopListening();
     virtual void SendAbortSpeaking(AbortReason reason);
     virtual void SendMcpMessage(const std::string& message);
+    // Timestamped ping, the server echoes the timestamp in a pong to measure RTT
+    virtual void SendPing();
 
 protected:
-    std::function<void(const cJSON* root)> on_incoming_json_;
+    std::function<void(const JsonMessage& message)> on_incoming_json_;
     std::function<void(std::unique_ptr<AudioStreamPacket> packet)> on_incoming_audio_;
     std::function<void()> on_audio_channel_opened_;
     std::function<void()> on_audio_channel_closed_;
@@ -85,13 +114,20 @@ protected:
 
     int server_sample_rate_ = 24000;
     int server_frame_duration_ = 60;
-    bool error_occurred_ = false;
+    std::atomic<bool> error_occurred_ = false;
     std::string session_id_;
     std::chrono::time_point<std::chrono::steady_clock> last_incoming_time_;
+    ChannelOpenStats channel_open_stats_;
+    // Scratch memory for incoming messages, only used by the receiving task
+    JsonArena json_arena_;
+    TransportStats transport_stats_;
+    SessionRecorder session_recorder_;
 
     virtual bool SendText(const std::string& text) = 0;
     virtual void SetError(const std::string& message);
     virtual bool IsTimeout() const;
+    void RecordChannelOpen(int64_t start_time_us, bool success, bool reused = false);
+    void HandlePong(const JsonMessage& message);
 };
 
 #endif // PROTOCOL_H
@@ -0,0 +1,194 @@
+#include "session_recorder.h"
+#include "board.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <sys/time.h>
+#include <cstdlib>
+#include <cstring>
+
+#define TAG "SessionRecorder"
+
+SessionRecorder::~SessionRecorder() {
+    Stop();
+    if (writer_done_ != nullptr) {
+        vSemaphoreDelete(writer_done_);
+    }
+}
+
+bool SessionRecorder::Start(const std::string& target) {
+    Stop();
+
+    if (writer_done_ == nullptr) {
+        writer_done_ = xSemaphoreCreateBinary();
+        if (writer_done_ == nullptr) {
+            ESP_LOGE(TAG, "Failed to create the writer semaphore");
+            return false;
+        }
+    }
+
+    if (target.rfind("udp://", 0) == 0) {
+        auto address = target.substr(6);
+        auto pos = address.rfind(':');
+        char* end = nullptr;
+        long port = pos == std::string::npos ? 0 : strtol(address.c_str() + pos + 1, &end, 10);
+        if (pos == std::string::npos || pos == 0 || end == address.c_str() + pos + 1 || *end != '\0' || port < 1 || port > 65535) {
+            ESP_LOGE(TAG, "Invalid target %s, expected udp://host:port", target.c_str());
+            return false;
+        }
+        udp_ = Board::GetInstance().GetNetwork()->CreateUdp(4);
+        if (!udp_->Connect(address.substr(0, pos), (int)port)) {
+            ESP_LOGE(TAG, "Failed to connect to %s", target.c_str());
+            udp_.reset();
+            return false;
+        }
+    } else {
+        file_ = fopen(target.c_str(), "wb");
+        if (file_ == nullptr) {
+            ESP_LOGE(TAG, "Failed to open %s", target.c_str());
+            return false;
+        }
+    }
+
+    SessionRecordFileHeader header;
+    memcpy(header.magic, SESSION_RECORD_MAGIC, sizeof(header.magic));
+    header.version = SESSION_RECORD_VERSION;
+    header.header_size = sizeof(header);
+    header.unix_time_ms = 0;
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    // Before the clock is set from the server, the time is close to the epoch
+    if (tv.tv_sec > 1700000000) {
+        header.unix_time_ms = (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        target_ = target;
+        stats_ = Stats();
+        buffer_.clear();
+        buffer_.reserve(SESSION_RECORDER_BUFFER_SIZE);
+        buffer_.append((const char*)&header, sizeof(header));
+        start_time_us_ = esp_timer_get_time();
+    }
+
+    stop_requested_ = false;
+    active_ = true;
+    auto ret = xTaskCreate([](void* arg) {
+        auto recorder = (SessionRecorder*)arg;
+        recorder->WriterTask();
+        vTaskDelete(NULL);
+    }, "session_recorder", 4096, this, 1, nullptr);
+    if (ret != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create the writer task");
+        active_ = false;
+        CloseSink();
+        return false;
+    }
+    ESP_LOGI(TAG, "Recording session to %s", target.c_str());
+    return true;
+}
+
+void SessionRecorder::Stop() {
+    if (!active_) {
+        return;
+    }
+    active_ = false;
+    stop_requested_ = true;
+    // The writer task flushes what is left and gives writer_done_ before it exits
+    xSemaphoreTake(writer_done_, portMAX_DELAY);
+    CloseSink();
+
+    auto stats = GetStats();
+    ESP_LOGI(TAG, "Recording stopped: %lu records, %llu bytes, %lu dropped", (unsigned long)stats.records,
+        (unsigned long long)stats.bytes, (unsigned long)stats.dropped);
+}
+
+void SessionRecorder::CloseSink() {
+    if (file_ != nullptr) {
+        fclose(file_);
+        file_ = nullptr;
+    }
+    udp_.reset();
+}
+
+SessionRecorder::Stats SessionRecorder::GetStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+void SessionRecorder::Append(SessionRecordType type, const void* data, size_t size, uint32_t timestamp) {
+    SessionRecordHeader header;
+    header.type = type;
+    header.flags = 0;
+    if (size > UINT16_MAX) {
+        size = UINT16_MAX;
+        header.flags |= SESSION_RECORD_FLAG_TRUNCATED;
+    }
+    header.size = size;
+    header.timestamp = timestamp;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    header.time_ms = (uint32_t)((esp_timer_get_time() - start_time_us_) / 1000);
+    if (buffer_.size() + sizeof(header) + size > SESSION_RECORDER_BUFFER_SIZE) {
+        // The sink can not keep up, drop rather than block the caller
+        stats_.dropped++;
+        return;
+    }
+    buffer_.append((const char*)&header, sizeof(header));
+    buffer_.append((const char*)data, size);
+    stats_.records++;
+    stats_.bytes += sizeof(header) + size;
+}
+
+void SessionRecorder::WriterTask() {
+    std::string pending;
+    pending.reserve(SESSION_RECORDER_BUFFER_SIZE);
+    while (true) {
+        bool stopping = stop_requested_;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            pending.swap(buffer_);
+        }
+        if (!pending.empty()) {
+            Write(pending);
+            pending.clear();
+        }
+        if (stopping) {
+            break;
+        }
+        vTaskDelay(pdMS_TO_TICKS(SESSION_RECORDER_FLUSH_INTERVAL_MS));
+    }
+    xSemaphoreGive(writer_done_);
+}
+
+void SessionRecorder::Write(const std::string& data) {
+    if (file_ != nullptr) {
+        if (fwrite(data.data(), 1, data.size(), file_) != data.size()) {
+            ESP_LOGE(TAG, "Failed to write %s", target_.c_str());
+        }
+        return;
+    }
+    if (udp_ == nullptr) {
+        return;
+    }
+
+    // Pack whole records into each datagram so that a lost datagram does not break the stream
+    size_t offset = 0;
+    size_t datagram_start = 0;
+    if (data.size() >= sizeof(SessionRecordFileHeader) && memcmp(data.data(), SESSION_RECORD_MAGIC, 4) == 0) {
+        offset = sizeof(SessionRecordFileHeader);
+    }
+    while (offset < data.size()) {
+        auto header = (const SessionRecordHeader*)(data.data() + offset);
+        size_t record_size = sizeof(SessionRecordHeader) + header->size;
+        if (offset + record_size - datagram_start > SESSION_RECORDER_UDP_DATAGRAM_SIZE && offset > datagram_start) {
+            udp_->Send(data.substr(datagram_start, offset - datagram_start));
+            datagram_start = offset;
+        }
+        offset += record_size;
+    }
+    if (offset > datagram_start) {
+        udp_->Send(data.substr(datagram_start, offset - datagram_start));
+    }
+}
@@ -0,0 +1,106 @@
+#ifndef SESSION_RECORDER_H
+#define SESSION_RECORDER_H
+
+#include <udp.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#define SESSION_RECORD_MAGIC "XZSR"
+#define SESSION_RECORD_VERSION 1
+// Records are staged in memory and written by a low priority task, so that
+// a slow sink (SD card, network) never blocks the audio path
+#define SESSION_RECORDER_BUFFER_SIZE (32 * 1024)
+#define SESSION_RECORDER_FLUSH_INTERVAL_MS 100
+#define SESSION_RECORDER_UDP_DATAGRAM_SIZE 1400
+
+enum SessionRecordType : uint8_t {
+    kSessionRecordIncomingAudio = 1,
+    kSessionRecordOutgoingAudio = 2,
+    kSessionRecordIncomingJson = 3,
+    kSessionRecordOutgoingJson = 4,
+};
+
+#define SESSION_RECORD_FLAG_TRUNCATED 0x01
+
+/*
+ * Log layout (little endian):
+ *   file header: magic "XZSR", u16 version, u16 header size, i64 unix time ms (0 if unknown)
+ *   record:      u8 type, u8 flags, u16 size, u32 time ms since start, u32 audio timestamp, payload
+ * Incoming audio is recorded after the transport framing is removed, so a replay
+ * feeds exactly what the decoder saw. Over UDP each datagram carries whole records.
+ */
+struct SessionRecordFileHeader {
+    char magic[4];
+    uint16_t version;
+    uint16_t header_size;
+    int64_t unix_time_ms;
+} __attribute__((packed));
+
+struct SessionRecordHeader {
+    uint8_t type;
+    uint8_t flags;
+    uint16_t size;
+    uint32_t time_ms;
+    uint32_t timestamp;
+} __attribute__((packed));
+
+class SessionRecorder {
+public:
+    struct Stats {
+        uint32_t records = 0;
+        uint32_t dropped = 0;
+        uint64_t bytes = 0;
+    };
+
+    SessionRecorder() = default;
+    ~SessionRecorder();
+    SessionRecorder(const SessionRecorder&) = delete;
+    SessionRecorder& operator=(const SessionRecorder&) = delete;
+
+    // target is a file path (e.g. /sdcard/session.bin) or udp://host:port
+    bool Start(const std::string& target);
+    void Stop();
+
+    inline bool active() const {
+        return active_.load(std::memory_order_relaxed);
+    }
+
+    // Cheap no-ops while the recorder is inactive
+    inline void Record(SessionRecordType type, const void* data, size_t size, uint32_t timestamp = 0) {
+        if (active()) {
+            Append(type, data, size, timestamp);
+        }
+    }
+
+    Stats GetStats() const;
+    const std::string& target() const { return target_; }
+
+private:
+    std::atomic<bool> active_ = false;
+    mutable std::mutex mutex_;
+    std::string target_;
+    std::string buffer_;
+    Stats stats_;
+    int64_t start_time_us_ = 0;
+
+    FILE* file_ = nullptr;
+    std::unique_ptr<Udp> udp_;
+    // Given by the writer task when it has flushed the buffer and exits
+    SemaphoreHandle_t writer_done_ = nullptr;
+    std::atomic<bool> stop_requested_ = false;
+
+    void Append(SessionRecordType type, const void* data, size_t size, uint32_t timestamp);
+    void WriterTask();
+    void Write(const std::string& data);
+    void CloseSink();
+};
+
+#endif // SESSION_RECORDER_H
@@ -0,0 +1,173 @@
+#include "transport_stats.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#define TAG "TransportStats"
+
+int64_t TransportStats::NowMs() {
+    return esp_timer_get_time() / 1000;
+}
+
+void TransportStats::Reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    bool has_clock_offset = stats_.has_clock_offset;
+    int64_t clock_offset_ms = stats_.clock_offset_ms;
+    stats_ = Snapshot();
+    stats_.session_start_us = esp_timer_get_time();
+    stats_.has_clock_offset = has_clock_offset;
+    stats_.clock_offset_ms = clock_offset_ms;
+
+    has_transit_ = false;
+    last_transit_us_ = 0;
+    jitter_us_ = 0;
+    has_sequence_ = false;
+    first_sequence_ = 0;
+    highest_sequence_ = 0;
+    received_sequences_ = 0;
+    sequence_window_ = 0;
+}
+
+void TransportStats::OnSent(size_t bytes, bool success) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (success) {
+        stats_.tx_packets++;
+        stats_.tx_bytes += bytes;
+    } else {
+        stats_.tx_failures++;
+    }
+}
+
+void TransportStats::OnReceived(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.rx_packets++;
+    stats_.rx_bytes += bytes;
+}
+
+void TransportStats::OnAudioReceived(size_t bytes, uint32_t timestamp) {
+    int64_t arrival_us = esp_timer_get_time();
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.rx_packets++;
+    stats_.rx_bytes += bytes;
+
+    // Arrival times alone are paced by the server's send buffer, not the media clock, so packets
+    // without a timestamp (websocket protocol v1 and v3) count but do not feed the jitter
+    if (timestamp == 0) {
+        return;
+    }
+    int64_t transit_us = arrival_us - (int64_t)timestamp * 1000;
+    if (has_transit_) {
+        int64_t d = transit_us - last_transit_us_;
+        if (d < 0) {
+            d = -d;
+        }
+        jitter_us_ += (d - jitter_us_) / 16;
+        stats_.jitter_ms = (int)(jitter_us_ / 1000);
+    }
+    last_transit_us_ = transit_us;
+    has_transit_ = true;
+}
+
+void TransportStats::OnSequence(uint32_t sequence) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!has_sequence_) {
+        has_sequence_ = true;
+        first_sequence_ = sequence;
+        highest_sequence_ = sequence;
+        received_sequences_ = 1;
+        sequence_window_ = 1;
+    } else if (sequence > highest_sequence_) {
+        uint32_t shift = sequence - highest_sequence_;
+        sequence_window_ = shift < 64 ? (sequence_window_ << shift) | 1 : 1;
+        highest_sequence_ = sequence;
+        received_sequences_++;
+    } else {
+        // A sequence seen in the window is a duplicate, otherwise a late packet; older ones count as late
+        uint32_t age = highest_sequence_ - sequence;
+        if (age < 64 && (sequence_window_ >> age) & 1) {
+            stats_.duplicate_packets++;
+            return;
+        }
+        if (age < 64) {
+            sequence_window_ |= 1ull << age;
+        }
+        received_sequences_++;
+        stats_.reordered_packets++;
+    }
+    stats_.expected_packets = highest_sequence_ - first_sequence_ + 1;
+    stats_.lost_packets = stats_.expected_packets > received_sequences_ ? stats_.expected_packets - received_sequences_ : 0;
+}
+
+void TransportStats::OnPong(int64_t sent_ms, int64_t server_time_ms) {
+    int64_t now_ms = NowMs();
+    int rtt_ms = (int)(now_ms - sent_ms);
+    if (rtt_ms < 0 || rtt_ms > 60000) {
+        ESP_LOGW(TAG, "Ignore pong with invalid timestamp, rtt: %d ms", rtt_ms);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.rtt_samples++;
+    stats_.last_rtt_ms = rtt_ms;
+    if (stats_.min_rtt_ms < 0 || rtt_ms < stats_.min_rtt_ms) {
+        stats_.min_rtt_ms = rtt_ms;
+    }
+    if (stats_.smoothed_rtt_ms < 0) {
+        stats_.smoothed_rtt_ms = rtt_ms;
+    } else {
+        stats_.smoothed_rtt_ms = (stats_.smoothed_rtt_ms * 7 + rtt_ms) / 8;
+    }
+
+    // The sample with the lowest round trip has the smallest asymmetry error
+    if (server_time_ms >= 0 && (min_offset_rtt_ms_ < 0 || rtt_ms <= min_offset_rtt_ms_)) {
+        min_offset_rtt_ms_ = rtt_ms;
+        stats_.clock_offset_ms = server_time_ms - (sent_ms + rtt_ms / 2);
+        stats_.has_clock_offset = true;
+    }
+}
+
+TransportStats::Snapshot TransportStats::GetSnapshot() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+void TransportStats::WriteJson(JsonWriter& writer) const {
+    auto stats = GetSnapshot();
+    int64_t duration_ms = stats.session_start_us > 0 ? (esp_timer_get_time() - stats.session_start_us) / 1000 : 0;
+
+    writer.BeginObject();
+    writer.Key("duration_ms").Int(duration_ms);
+    writer.Key("tx").BeginObject()
+        .Key("bytes").Int(stats.tx_bytes)
+        .Key("packets").Int(stats.tx_packets)
+        .Key("failures").Int(stats.tx_failures)
+        .Key("kbps").Int(duration_ms > 0 ? (int64_t)(stats.tx_bytes * 8 / duration_ms) : 0)
+        .EndObject();
+    writer.Key("rx").BeginObject()
+        .Key("bytes").Int(stats.rx_bytes)
+        .Key("packets").Int(stats.rx_packets)
+        .Key("kbps").Int(duration_ms > 0 ? (int64_t)(stats.rx_bytes * 8 / duration_ms) : 0)
+        .Key("expected").Int(stats.expected_packets)
+        .Key("lost").Int(stats.lost_packets)
+        .Key("reordered").Int(stats.reordered_packets)
+        .Key("duplicates").Int(stats.duplicate_packets)
+        .Key("jitter_ms").Int(stats.jitter_ms)
+        .EndObject();
+    writer.Key("rtt").BeginObject()
+        .Key("samples").Int(stats.rtt_samples)
+        .Key("last_ms").Int(stats.last_rtt_ms)
+        .Key("min_ms").Int(stats.min_rtt_ms)
+        .Key("smoothed_ms").Int(stats.smoothed_rtt_ms)
+        .EndObject();
+    if (stats.has_clock_offset) {
+        writer.Key("clock_offset_ms").Int(stats.clock_offset_ms);
+    }
+    writer.EndObject();
+}
+
+void TransportStats::Print() const {
+    auto stats = GetSnapshot();
+    ESP_LOGI(TAG, "tx: %lu pkts %llu bytes %lu fail, rx: %lu pkts %llu bytes, lost %lu/%lu, jitter %d ms, rtt %d ms (min %d)",
+        stats.tx_packets, stats.tx_bytes, stats.tx_failures, stats.rx_packets, stats.rx_bytes,
+        stats.lost_packets, stats.expected_packets, stats.jitter_ms, stats.smoothed_rtt_ms, stats.min_rtt_ms);
+}
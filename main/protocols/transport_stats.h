@@ -0,0 +1,77 @@
+#ifndef TRANSPORT_STATS_H
+#define TRANSPORT_STATS_H
+
+#include "json_writer.h"
+
+#include <cstdint>
+#include <mutex>
+
+/*
+ * Link quality of the current audio session.
+ * Updated from the network task (receive) and the main task (send), so all
+ * accessors take a lock. Counters are reset when an audio channel is opened,
+ * the clock offset estimate is kept because it describes the clocks, not the session.
+ */
+class TransportStats {
+public:
+    struct Snapshot {
+        int64_t session_start_us = 0;
+        uint64_t tx_bytes = 0;
+        uint64_t rx_bytes = 0;
+        uint32_t tx_packets = 0;
+        uint32_t rx_packets = 0;
+        uint32_t tx_failures = 0;
+        // Loss from sequence numbers (only transports with sequences, e.g. UDP)
+        uint32_t expected_packets = 0;
+        uint32_t lost_packets = 0;
+        uint32_t reordered_packets = 0;
+        uint32_t duplicate_packets = 0;
+        // Interarrival jitter of downlink audio with timestamps (RFC 3550 estimator)
+        int jitter_ms = 0;
+        // Round trip time from ping/pong
+        uint32_t rtt_samples = 0;
+        int last_rtt_ms = -1;
+        int min_rtt_ms = -1;
+        int smoothed_rtt_ms = -1;
+        // Server clock minus device uptime clock, in ms
+        bool has_clock_offset = false;
+        int64_t clock_offset_ms = 0;
+    };
+
+    void Reset();
+
+    void OnSent(size_t bytes, bool success);
+    void OnReceived(size_t bytes);
+    // timestamp is the packet timestamp in ms, 0 if the transport does not carry one, then no jitter is measured
+    void OnAudioReceived(size_t bytes, uint32_t timestamp);
+    void OnSequence(uint32_t sequence);
+    // sent_ms is the echoed ping timestamp, server_time_ms is negative if not provided
+    void OnPong(int64_t sent_ms, int64_t server_time_ms);
+
+    Snapshot GetSnapshot() const;
+    void WriteJson(JsonWriter& writer) const;
+    void Print() const;
+
+    static int64_t NowMs();
+
+private:
+    mutable std::mutex mutex_;
+    Snapshot stats_;
+
+    // Jitter state
+    bool has_transit_ = false;
+    int64_t last_transit_us_ = 0;
+    int64_t jitter_us_ = 0;
+
+    // Sequence state
+    bool has_sequence_ = false;
+    uint32_t first_sequence_ = 0;
+    uint32_t highest_sequence_ = 0;
+    uint32_t received_sequences_ = 0;
+    // Bit i is set when highest_sequence_ - i was received
+    uint64_t sequence_window_ = 0;
+
+    int min_offset_rtt_ms_ = -1;
+};
+
+#endif // TRANSPORT_STATS_H
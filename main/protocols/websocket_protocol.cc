@@ -3,6 +3,8 @@
 #include "system_info.h"
 #include "application.h"
 #include "settings.h"
+#include "json_writer.h"
+#include "tracing.h"
 
 #include <cstring>
 #include <cJSON.h>
@@ -14,9 +16,34 @@
 
 WebsocketProtocol::WebsocketProtocol() {
     event_group_handle_ = xEventGroupCreate();
+
+    esp_timer_create_args_t keepalive_timer_args = {
+        .callback = [](void* arg) {
+            WebsocketProtocol* protocol = (WebsocketProtocol*)arg;
+            auto alive = protocol->alive_;  // Capture alive flag
+            Application::GetInstance().Schedule([protocol, alive]() {
+                if (*alive) {
+                    protocol->OnKeepaliveTimer();
+                }
+            });
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "ws_keepalive",
+        .skip_unhandled_events = true,
+    };
+    esp_timer_create(&keepalive_timer_args, &keepalive_timer_);
 }
 
 WebsocketProtocol::~WebsocketProtocol() {
+    // Mark as dead first to prevent any pending scheduled tasks from executing
+    *alive_ = false;
+
+    if (keepalive_timer_ != nullptr) {
+        esp_timer_stop(keepalive_timer_);
+        esp_timer_delete(keepalive_timer_);
+    }
+    ResetWebsocket();
     vEventGroupDelete(event_group_handle_);
 }
 
@@ -26,9 +53,11 @@ bool WebsocketProtocol::Start() {
 }
 
 bool WebsocketProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
+    std::lock_guard<std::mutex> lock(websocket_mutex_);
     if (websocket_ == nullptr || !websocket_->IsConnected()) {
         return false;
     }
+    session_recorder_.Record(kSessionRecordOutgoingAudio, packet->payload.data(), packet->payload.size(), packet->timestamp);
 
     if (version_ == 2) {
         std::string serialized;
@@ -41,7 +70,9 @@ bool WebsocketProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
         bp2->payload_size = htonl(packet->payload.size());
         memcpy(bp2->payload, packet->payload.data(), packet->payload.size());
 
-        return websocket_->Send(serialized.data(), serialized.size(), true);
+        bool success = websocket_->Send(serialized.data(), serialized.size(), true);
+        transport_stats_.OnSent(serialized.size(), success);
+        return success;
     } else if (version_ == 3) {
         std::string serialized;
         serialized.resize(sizeof(BinaryProtocol3) + packet->payload.size());
@@ -51,35 +82,172 @@ bool WebsocketProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
         bp3->payload_size = htons(packet->payload.size());
         memcpy(bp3->payload, packet->payload.data(), packet->payload.size());
 
-        return websocket_->Send(serialized.data(), serialized.size(), true);
+        bool success = websocket_->Send(serialized.data(), serialized.size(), true);
+        transport_stats_.OnSent(serialized.size(), success);
+        return success;
     } else {
-        return websocket_->Send(packet->payload.data(), packet->payload.size(), true);
+        bool success = websocket_->Send(packet->payload.data(), packet->payload.size(), true);
+        transport_stats_.OnSent(packet->payload.size(), success);
+        return success;
     }
 }
 
 bool WebsocketProtocol::SendText(const std::string& text) {
+    std::unique_lock<std::mutex> lock(websocket_mutex_);
     if (websocket_ == nullptr || !websocket_->IsConnected()) {
         return false;
     }
+    TRACE_INSTANT("tx_json", text.size());
+    session_recorder_.Record(kSessionRecordOutgoingJson, text.data(), text.size());
 
     if (!websocket_->Send(text)) {
         ESP_LOGE(TAG, "Failed to send text: %s", text.c_str());
+        transport_stats_.OnSent(text.size(), false);
+        lock.unlock();
         SetError(Lang::Strings::SERVER_ERROR);
         return false;
     }
 
+    transport_stats_.OnSent(text.size(), true);
     return true;
 }
 
+// The audio sender task may be inside SendAudio, take the connection out under the lock
+// and destroy it outside, its receive callbacks must not wait for the lock
+void WebsocketProtocol::ResetWebsocket() {
+    std::shared_ptr<WebSocket> websocket;
+    {
+        std::lock_guard<std::mutex> lock(websocket_mutex_);
+        websocket = std::move(websocket_);
+    }
+    websocket.reset();
+}
+
+std::shared_ptr<WebSocket> WebsocketProtocol::GetWebsocket() const {
+    std::lock_guard<std::mutex> lock(websocket_mutex_);
+    return websocket_;
+}
+
 bool WebsocketProtocol::IsAudioChannelOpened() const {
-    return websocket_ != nullptr && websocket_->IsConnected() && !error_occurred_ && !IsTimeout();
+    auto websocket = GetWebsocket();
+    return websocket != nullptr && websocket->IsConnected() && session_opened_ && !error_occurred_ && !IsTimeout();
 }
 
 void WebsocketProtocol::CloseAudioChannel() {
-    websocket_.reset();
+    auto websocket = GetWebsocket();
+    if (idle_timeout_seconds_ <= 0 || websocket == nullptr || !websocket->IsConnected() || error_occurred_) {
+        esp_timer_stop(keepalive_timer_);
+        ResetWebsocket();
+        // Notify here in case the disconnected callback was not fired by the reset
+        if (session_opened_) {
+            session_opened_ = false;
+            if (on_audio_channel_closed_ != nullptr) {
+                on_audio_channel_closed_();
+            }
+        }
+        return;
+    }
+
+    // Keep the connection warm, only end the logical session
+    JsonWriter writer;
+    writer.BeginObject().Add("session_id", session_id_).Add("type", "goodbye").EndObject();
+    SendText(writer.str());
+    session_opened_ = false;
+    idle_since_us_ = esp_timer_get_time();
+    esp_timer_stop(keepalive_timer_);
+    esp_timer_start_periodic(keepalive_timer_, ping_interval_seconds_ * 1000000LL);
+    ESP_LOGI(TAG, "Audio session closed, keep connection for %d seconds", idle_timeout_seconds_);
+
+    if (on_audio_channel_closed_ != nullptr) {
+        on_audio_channel_closed_();
+    }
+}
+
+void WebsocketProtocol::OnKeepaliveTimer() {
+    // Runs on the main task, which must not wait for a handshake
+    std::unique_lock<std::mutex> channel_lock(channel_mutex_, std::try_to_lock);
+    if (!channel_lock.owns_lock()) {
+        // The open stopped the timer, this callback was queued before
+        return;
+    }
+    if (session_opened_) {
+        // The keepalive is only needed while the connection is idle
+        esp_timer_stop(keepalive_timer_);
+        return;
+    }
+    auto websocket = GetWebsocket();
+    if (websocket == nullptr || !websocket->IsConnected()) {
+        esp_timer_stop(keepalive_timer_);
+        ResetWebsocket();
+        return;
+    }
+
+    auto idle_seconds = (esp_timer_get_time() - idle_since_us_) / 1000000;
+    if (idle_seconds >= idle_timeout_seconds_) {
+        ESP_LOGI(TAG, "Connection idle for %d seconds, closing", (int)idle_seconds);
+        esp_timer_stop(keepalive_timer_);
+        ResetWebsocket();
+        return;
+    }
+    SendPing();
 }
 
 bool WebsocketProtocol::OpenAudioChannel() {
+    auto start_time = esp_timer_get_time();
+    // Held for the whole handshake, so that the keepalive timer does not reset the connection meanwhile
+    std::lock_guard<std::mutex> channel_lock(channel_mutex_);
+    Settings settings("websocket", false);
+    std::string url = settings.GetString("url");
+    idle_timeout_seconds_ = settings.GetInt("idle_timeout", 0);
+    ping_interval_seconds_ = settings.GetInt("ping_interval", WEBSOCKET_DEFAULT_PING_INTERVAL_SECONDS);
+    if (ping_interval_seconds_ <= 0) {
+        ping_interval_seconds_ = WEBSOCKET_DEFAULT_PING_INTERVAL_SECONDS;
+    }
+
+    error_occurred_ = false;
+    session_opened_ = false;
+    transport_stats_.Reset();
+    esp_timer_stop(keepalive_timer_);
+    xEventGroupClearBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT);
+
+    auto warm_websocket = GetWebsocket();
+    bool reused = idle_timeout_seconds_ > 0 && warm_websocket != nullptr && warm_websocket->IsConnected() && url == connected_url_;
+    warm_websocket.reset();
+    if (reused) {
+        ESP_LOGI(TAG, "Reusing warm websocket connection");
+    } else if (!ConnectWebsocket()) {
+        RecordChannelOpen(start_time, false);
+        return false;
+    }
+
+    // Send hello message to describe the client
+    auto message = GetHelloMessage();
+    if (!SendText(message)) {
+        RecordChannelOpen(start_time, false);
+        return false;
+    }
+
+    // Wait for server hello
+    EventBits_t bits = xEventGroupWaitBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT, pdTRUE, pdFALSE, pdMS_TO_TICKS(10000));
+    if (!(bits & WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT)) {
+        ESP_LOGE(TAG, "Failed to receive server hello");
+        SetError(Lang::Strings::SERVER_TIMEOUT);
+        RecordChannelOpen(start_time, false);
+        return false;
+    }
+
+    session_opened_ = true;
+    last_incoming_time_ = std::chrono::steady_clock::now();
+    RecordChannelOpen(start_time, true, reused);
+
+    if (on_audio_channel_opened_ != nullptr) {
+        on_audio_channel_opened_();
+    }
+
+    return true;
+}
+
+bool WebsocketProtocol::ConnectWebsocket() {
     Settings settings("websocket", false);
     std::string url = settings.GetString("url");
     std::string token = settings.GetString("token");
@@ -88,11 +256,14 @@ bool WebsocketProtocol::OpenAudioChannel() {
         version_ = version;
     }
 
-    error_occurred_ = false;
+    ResetWebsocket();
+    connected_url_.clear();
 
+    // The connection is set up on its own and published once connected, SendAudio and the main task
+    // only ever see a websocket_ that nobody else is configuring
     auto network = Board::GetInstance().GetNetwork();
-    websocket_ = network->CreateWebSocket(1);
-    if (websocket_ == nullptr) {
+    std::shared_ptr<WebSocket> websocket = network->CreateWebSocket(1);
+    if (websocket == nullptr) {
         ESP_LOGE(TAG, "Failed to create websocket");
         return false;
     }
@@ -102,15 +273,25 @@ bool WebsocketProtocol::OpenAudioChannel() {
         if (token.find(" ") == std::string::npos) {
             token = "Bearer " + token;
         }
-        websocket_->SetHeader("Authorization", token.c_str());
+        websocket->SetHeader("Authorization", token.c_str());
     }
-    websocket_->SetHeader("Protocol-Version", std::to_string(version_).c_str());
-    websocket_->SetHeader("Device-Id", SystemInfo::GetMacAddress().c_str());
-    websocket_->SetHeader("Client-Id", Board::GetInstance().GetUuid().c_str());
+    websocket->SetHeader("Protocol-Version", std::to_string(version_).c_str());
+    websocket->SetHeader("Device-Id", SystemInfo::GetMacAddress().c_str());
+    websocket->SetHeader("Client-Id", Board::GetInstance().GetUuid().c_str());
 
-    websocket_->OnData([this](const char* data, size_t len, bool binary) {
+    websocket->OnData([this](const char* data, size_t len, bool binary) {
         if (binary) {
+            if (!session_opened_) {
+                transport_stats_.OnReceived(len);
+            } else if (version_ == 2 && len >= sizeof(BinaryProtocol2)) {
+                transport_stats_.OnAudioReceived(len, ntohl(((BinaryProtocol2*)data)->timestamp));
+            } else {
+                transport_stats_.OnAudioReceived(len, 0);
+            }
             if (on_incoming_audio_ != nullptr) {
+                auto packet = std::make_unique<AudioStreamPacket>();
+                packet->sample_rate = server_sample_rate_;
+                packet->frame_duration = server_frame_duration_;
                 if (version_ == 2) {
                     BinaryProtocol2* bp2 = (BinaryProtocol2*)data;
                     bp2->version = ntohs(bp2->version);
@@ -118,110 +299,93 @@ bool WebsocketProtocol::OpenAudioChannel() {
                     bp2->timestamp = ntohl(bp2->timestamp);
                     bp2->payload_size = ntohl(bp2->payload_size);
                     auto payload = (uint8_t*)bp2->payload;
-                    on_incoming_audio_(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
-                        .sample_rate = server_sample_rate_,
-                        .frame_duration = server_frame_duration_,
-                        .timestamp = bp2->timestamp,
-                        .payload = std::vector<uint8_t>(payload, payload + bp2->payload_size)
-                    }));
+                    packet->timestamp = bp2->timestamp;
+                    packet->payload.assign(payload, payload + bp2->payload_size);
                 } else if (version_ == 3) {
                     BinaryProtocol3* bp3 = (BinaryProtocol3*)data;
                     bp3->type = bp3->type;
                     bp3->payload_size = ntohs(bp3->payload_size);
                     auto payload = (uint8_t*)bp3->payload;
-                    on_incoming_audio_(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
-                        .sample_rate = server_sample_rate_,
-                        .frame_duration = server_frame_duration_,
-                        .timestamp = 0,
-                        .payload = std::vector<uint8_t>(payload, payload + bp3->payload_size)
-                    }));
+                    packet->payload.assign(payload, payload + bp3->payload_size);
                 } else {
-                    on_incoming_audio_(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
-                        .sample_rate = server_sample_rate_,
-                        .frame_duration = server_frame_duration_,
-                        .timestamp = 0,
-                        .payload = std::vector<uint8_t>((uint8_t*)data, (uint8_t*)data + len)
-                    }));
+                    packet->payload.assign((uint8_t*)data, (uint8_t*)data + len);
                 }
+                TRACE_INSTANT("rx_audio", packet->payload.size());
+                session_recorder_.Record(kSessionRecordIncomingAudio, packet->payload.data(), packet->payload.size(), packet->timestamp);
+                on_incoming_audio_(std::move(packet));
             }
         } else {
-            // Parse JSON data
-            auto root = cJSON_Parse(data);
-            auto type = cJSON_GetObjectItem(root, "type");
-            if (cJSON_IsString(type)) {
-                if (strcmp(type->valuestring, "hello") == 0) {
-                    ParseServerHello(root);
+            // Index JSON data in place, the cJSON tree is only built when needed
+            transport_stats_.OnReceived(len);
+            TRACE_INSTANT("rx_json", len);
+            session_recorder_.Record(kSessionRecordIncomingJson, data, len);
+            JsonMessage message(data, len, json_arena_);
+            if (!message.Parse()) {
+                ESP_LOGE(TAG, "Failed to parse json message: %.*s", (int)len, data);
+            } else if (message.type().empty()) {
+                ESP_LOGE(TAG, "Missing message type, data: %.*s", (int)len, data);
+            } else if (message.type() == "hello") {
+                // The index accepts some text that cJSON rejects, then there is no tree
+                auto root = message.tree();
+                if (root == nullptr) {
+                    ESP_LOGE(TAG, "Invalid server hello");
                 } else {
-                    if (on_incoming_json_ != nullptr) {
-                        on_incoming_json_(root);
-                    }
+                    ParseServerHello(root);
                 }
-            } else {
-                ESP_LOGE(TAG, "Missing message type, data: %s", data);
+            } else if (message.type() == "pong") {
+                HandlePong(message);
+            } else if (on_incoming_json_ != nullptr) {
+                on_incoming_json_(message);
             }
-            cJSON_Delete(root);
         }
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
 
-    websocket_->OnDisconnected([this]() {
+    websocket->OnDisconnected([this]() {
         ESP_LOGI(TAG, "Websocket disconnected");
-        if (on_audio_channel_closed_ != nullptr) {
+        // A warm connection without an active session closes silently
+        if (session_opened_ && on_audio_channel_closed_ != nullptr) {
+            session_opened_ = false;
             on_audio_channel_closed_();
         }
     });
 
     ESP_LOGI(TAG, "Connecting to websocket server: %s with version: %d", url.c_str(), version_);
-    if (!websocket_->Connect(url.c_str())) {
-        ESP_LOGE(TAG, "Failed to connect to websocket server, code=%d", websocket_->GetLastError());
+    if (!websocket->Connect(url.c_str())) {
+        ESP_LOGE(TAG, "Failed to connect to websocket server, code=%d", websocket->GetLastError());
         SetError(Lang::Strings::SERVER_NOT_CONNECTED);
         return false;
     }
 
-    // Send hello message to describe the client
-    auto message = GetHelloMessage();
-    if (!SendText(message)) {
-        return false;
-    }
-
-    // Wait for server hello
-    EventBits_t bits = xEventGroupWaitBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT, pdTRUE, pdFALSE, pdMS_TO_TICKS(10000));
-    if (!(bits & WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT)) {
-        ESP_LOGE(TAG, "Failed to receive server hello");
-        SetError(Lang::Strings::SERVER_TIMEOUT);
-        return false;
-    }
-
-    if (on_audio_channel_opened_ != nullptr) {
-        on_audio_channel_opened_();
+    {
+        std::lock_guard<std::mutex> lock(websocket_mutex_);
+        websocket_ = websocket;
     }
-
+    connected_url_ = url;
     return true;
 }
 
 std::string WebsocketProtocol::GetHelloMessage() {
     // keys: message type, version, audio_params (format, sample_rate, channels)
-    cJSON* root = cJSON_CreateObject();
-    cJSON_AddStringToObject(root, "type", "hello");
-    cJSON_AddNumberToObject(root, "version", version_);
-    cJSON* features = cJSON_CreateObject();
+    JsonWriter writer;
+    writer.BeginObject();
+    writer.Add("type", "hello");
+    writer.Add("version", version_);
+    writer.Key("features").BeginObject();
 #if CONFIG_USE_SERVER_AEC
-    cJSON_AddBoolToObject(features, "aec", true);
+    writer.Add("aec", true);
 #endif
-    cJSON_AddBoolToObject(features, "mcp", true);
-    cJSON_AddItemToObject(root, "features", features);
-    cJSON_AddStringToObject(root, "transport", "websocket");
-    cJSON* audio_params = cJSON_CreateObject();
-    cJSON_AddStringToObject(audio_params, "format", "opus");
-    cJSON_AddNumberToObject(audio_params, "sample_rate", 16000);
-    cJSON_AddNumberToObject(audio_params, "channels", 1);
-    cJSON_AddNumberToObject(audio_params, "frame_duration", OPUS_FRAME_DURATION_MS);
-    cJSON_AddItemToObject(root, "audio_params", audio_params);
-    auto json_str = cJSON_PrintUnformatted(root);
-    std::string message(json_str);
-    cJSON_free(json_str);
-    cJSON_Delete(root);
-    return message;
+    writer.Add("mcp", true);
+    writer.EndObject();
+    writer.Add("transport", "websocket");
+    writer.Key("audio_params").BeginObject();
+    writer.Add("format", "opus");
+    writer.Add("sample_rate", 16000);
+    writer.Add("channels", 1);
+    writer.Add("frame_duration", OPUS_FRAME_DURATION_MS);
+    writer.EndObject();
+    writer.EndObject();
+    return writer.Release();
 }
 
 void WebsocketProtocol::ParseServerHello(const cJSON* root) {
@@ -230,6 +394,7 @@ void WebsocketProtocol::ParseServerHello(const cJSON* root) {
         ESP_LOGE(TAG, "Unsupported transport: %s", transport->valuestring);
         return;
     }
+    Application::GetInstance().GetInteractionTimeline().Mark(kInteractionPhaseServerHello);
 
     auto session_id = cJSON_GetObjectItem(root, "session_id");
     if (cJSON_IsString(session_id)) {
@@ -7,9 +7,17 @@
 #include <web_socket.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
+#include <esp_timer.h>
+
+#include <memory>
+#include <atomic>
+#include <mutex>
 
 #define WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT (1 << 0)
 
+// Default keepalive interval for a warm connection, can be overridden by the "ping_interval" setting
+#define WEBSOCKET_DEFAULT_PING_INTERVAL_SECONDS 30
+
 class WebsocketProtocol : public Protocol {
 public:
     WebsocketProtocol();
@@ -22,10 +30,31 @@ public:
     bool IsAudioChannelOpened() const override;
 
 private:
+    // Alive flag for safe scheduled callbacks - set to false in destructor
+    std::shared_ptr<std::atomic<bool>> alive_ = std::make_shared<std::atomic<bool>>(true);
+
     EventGroupHandle_t event_group_handle_;
-    std::unique_ptr<WebSocket> websocket_;
+    // Guards websocket_ replacement against SendAudio on the audio sender task. Other accessors
+    // work on a copy taken under the lock, see GetWebsocket()
+    mutable std::mutex websocket_mutex_;
+    std::shared_ptr<WebSocket> websocket_;
+    // Held by OpenAudioChannel() on the open worker, keepalive callbacks already queued on the main task skip
+    std::mutex channel_mutex_;
     int version_ = 1;
-
+    std::atomic<bool> session_opened_ = false;
+    std::string connected_url_;
+
+    // Warm connection policy, configured by the "idle_timeout" and "ping_interval" settings.
+    // When idle_timeout is 0 the connection is closed together with the audio channel.
+    int idle_timeout_seconds_ = 0;
+    int ping_interval_seconds_ = WEBSOCKET_DEFAULT_PING_INTERVAL_SECONDS;
+    esp_timer_handle_t keepalive_timer_ = nullptr;
+    int64_t idle_since_us_ = 0;
+
+    bool ConnectWebsocket();
+    void ResetWebsocket();
+    std::shared_ptr<WebSocket> GetWebsocket() const;
+    void OnKeepaliveTimer();
     void ParseServerHello(const cJSON* root);
     bool SendText(const std::string& text) override;
     std::string GetHelloMessage();
@@ -0,0 +1,181 @@
+#include "schedule_queue.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#define TAG "ScheduleQueue"
+
+static_assert((SCHEDULE_QUEUE_SIZE & (SCHEDULE_QUEUE_SIZE - 1)) == 0, "SCHEDULE_QUEUE_SIZE must be a power of two");
+
+static const int64_t kLatencyBoundsUs[SCHEDULE_HISTOGRAM_BUCKETS - 1] = { 1000, 5000, 20000, 100000, 500000 };
+static const uint32_t kDepthBounds[SCHEDULE_HISTOGRAM_BUCKETS - 1] = { 1, 4, 16, 32, 64 };
+
+ScheduleQueue::ScheduleQueue() {
+    for (uint32_t i = 0; i < SCHEDULE_QUEUE_SIZE; i++) {
+        slots_[i].sequence.store(i, std::memory_order_relaxed);
+        slots_[i].enqueue_time_us = 0;
+    }
+}
+
+void ScheduleQueue::Push(ScheduledTask&& task, const std::source_location& site) {
+    int64_t now_us = esp_timer_get_time();
+    pushed_.fetch_add(1, std::memory_order_relaxed);
+    if (task.on_heap()) {
+        heap_callables_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    if (!overflow_active_.load(std::memory_order_acquire) && TryPush(task, site, now_us)) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(overflow_mutex_);
+    overflow_active_.store(true, std::memory_order_release);
+    overflow_.push_back(OverflowTask{ std::move(task), site, now_us });
+    overflowed_.fetch_add(1, std::memory_order_relaxed);
+    RecordDepth(SCHEDULE_QUEUE_SIZE + overflow_.size());
+}
+
+bool ScheduleQueue::TryPush(ScheduledTask& task, const std::source_location& site, int64_t now_us) {
+    uint32_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    Slot* slot;
+    while (true) {
+        slot = &slots_[pos & (SCHEDULE_QUEUE_SIZE - 1)];
+        uint32_t sequence = slot->sequence.load(std::memory_order_acquire);
+        int32_t diff = (int32_t)(sequence - pos);
+        if (diff == 0) {
+            // The slot is free for this position, claim it
+            if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // The consumer has not released this slot yet, the ring is full
+            return false;
+        } else {
+            pos = enqueue_pos_.load(std::memory_order_relaxed);
+        }
+    }
+
+    slot->task = std::move(task);
+    slot->site = site;
+    slot->enqueue_time_us = now_us;
+    slot->sequence.store(pos + 1, std::memory_order_release);
+    RecordDepth(pos + 1 - dequeue_pos_.load(std::memory_order_relaxed));
+    return true;
+}
+
+bool ScheduleQueue::Pop(ScheduledTask& task, std::source_location& site) {
+    if (overflow_draining_.empty()) {
+        uint32_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+        Slot& slot = slots_[pos & (SCHEDULE_QUEUE_SIZE - 1)];
+        uint32_t sequence = slot.sequence.load(std::memory_order_acquire);
+        if ((int32_t)(sequence - (pos + 1)) == 0) {
+            task = std::move(slot.task);
+            site = slot.site;
+            RecordLatency(slot.enqueue_time_us, site);
+            // Release the slot for the producer one lap ahead
+            slot.sequence.store(pos + SCHEDULE_QUEUE_SIZE, std::memory_order_release);
+            dequeue_pos_.store(pos + 1, std::memory_order_relaxed);
+            return true;
+        }
+
+        // The ring is empty, everything still in it is newer than the overflow list
+        if (!overflow_active_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(overflow_mutex_);
+        overflow_draining_.swap(overflow_);
+        overflow_active_.store(false, std::memory_order_release);
+        if (overflow_draining_.empty()) {
+            return false;
+        }
+    }
+
+    auto& front = overflow_draining_.front();
+    task = std::move(front.task);
+    site = front.site;
+    RecordLatency(front.enqueue_time_us, site);
+    overflow_draining_.pop_front();
+    return true;
+}
+
+void ScheduleQueue::RecordDepth(uint32_t depth) {
+    int bucket = 0;
+    while (bucket < SCHEDULE_HISTOGRAM_BUCKETS - 1 && depth > kDepthBounds[bucket]) {
+        bucket++;
+    }
+    depth_histogram_[bucket].fetch_add(1, std::memory_order_relaxed);
+
+    uint32_t max_depth = max_depth_.load(std::memory_order_relaxed);
+    while (depth > max_depth && !max_depth_.compare_exchange_weak(max_depth, depth, std::memory_order_relaxed)) {
+    }
+}
+
+void ScheduleQueue::RecordLatency(int64_t enqueue_time_us, const std::source_location& site) {
+    int64_t latency_us = esp_timer_get_time() - enqueue_time_us;
+    int bucket = 0;
+    while (bucket < SCHEDULE_HISTOGRAM_BUCKETS - 1 && latency_us >= kLatencyBoundsUs[bucket]) {
+        bucket++;
+    }
+
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    executed_++;
+    latency_histogram_[bucket]++;
+    if (latency_us > max_latency_us_) {
+        max_latency_us_ = latency_us;
+        max_latency_site_ = site;
+    }
+}
+
+ScheduleQueue::Stats ScheduleQueue::GetStats() const {
+    Stats stats;
+    stats.pushed = pushed_.load(std::memory_order_relaxed);
+    stats.overflowed = overflowed_.load(std::memory_order_relaxed);
+    stats.heap_callables = heap_callables_.load(std::memory_order_relaxed);
+    stats.max_depth = max_depth_.load(std::memory_order_relaxed);
+    for (int i = 0; i < SCHEDULE_HISTOGRAM_BUCKETS; i++) {
+        stats.depth_histogram[i] = depth_histogram_[i].load(std::memory_order_relaxed);
+    }
+
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats.executed = executed_;
+    stats.max_latency_us = max_latency_us_;
+    stats.max_latency_site = max_latency_site_;
+    for (int i = 0; i < SCHEDULE_HISTOGRAM_BUCKETS; i++) {
+        stats.latency_histogram[i] = latency_histogram_[i];
+    }
+    return stats;
+}
+
+void ScheduleQueue::ResetStats() {
+    pushed_ = 0;
+    overflowed_ = 0;
+    heap_callables_ = 0;
+    max_depth_ = 0;
+    for (auto& count : depth_histogram_) {
+        count = 0;
+    }
+
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    executed_ = 0;
+    max_latency_us_ = 0;
+    max_latency_site_ = std::source_location();
+    for (auto& count : latency_histogram_) {
+        count = 0;
+    }
+}
+
+void ScheduleQueue::Print() const {
+    auto stats = GetStats();
+    if (stats.pushed == 0) {
+        return;
+    }
+    auto& l = stats.latency_histogram;
+    auto& d = stats.depth_histogram;
+    ESP_LOGI(TAG, "Schedule: %lu pushed, %lu overflowed, %lu on heap, max latency %d ms (%s:%d), max depth %lu",
+        (unsigned long)stats.pushed, (unsigned long)stats.overflowed, (unsigned long)stats.heap_callables,
+        (int)(stats.max_latency_us / 1000), SourceFileName(stats.max_latency_site.file_name()),
+        (int)stats.max_latency_site.line(), (unsigned long)stats.max_depth);
+    ESP_LOGI(TAG, "Latency <1/<5/<20/<100/<500/more ms: %lu/%lu/%lu/%lu/%lu/%lu, depth <=1/4/16/32/64/more: %lu/%lu/%lu/%lu/%lu/%lu",
+        (unsigned long)l[0], (unsigned long)l[1], (unsigned long)l[2], (unsigned long)l[3], (unsigned long)l[4], (unsigned long)l[5],
+        (unsigned long)d[0], (unsigned long)d[1], (unsigned long)d[2], (unsigned long)d[3], (unsigned long)d[4], (unsigned long)d[5]);
+}
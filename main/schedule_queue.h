@@ -0,0 +1,104 @@
+#ifndef SCHEDULE_QUEUE_H
+#define SCHEDULE_QUEUE_H
+
+#include "inline_function.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <source_location>
+
+// Inline storage per task, enough for `this` plus two std::string captures
+#define SCHEDULE_TASK_INLINE_SIZE 64
+// Ring capacity, must be a power of two
+#define SCHEDULE_QUEUE_SIZE 64
+#define SCHEDULE_HISTOGRAM_BUCKETS 6
+
+using ScheduledTask = InlineFunction<SCHEDULE_TASK_INLINE_SIZE>;
+
+// "/path/to/main/application.cc" -> "application.cc", for printing call sites
+inline const char* SourceFileName(const char* path) {
+    const char* slash = strrchr(path, '/');
+    return slash != nullptr ? slash + 1 : path;
+}
+
+/*
+ * Bounded lock-free multi-producer, single-consumer queue of main task callbacks
+ * (sequence-numbered ring, Vyukov style). Any task may Push(), only the main task Pop()s.
+ * When the ring is full, tasks go to a mutex protected overflow list so that nothing
+ * is lost; producers keep using the overflow list until the consumer drained it,
+ * which keeps the order of tasks pushed by the same producer.
+ */
+class ScheduleQueue {
+public:
+    struct Stats {
+        uint32_t pushed = 0;
+        uint32_t executed = 0;
+        uint32_t overflowed = 0;      // Pushed to the overflow list because the ring was full
+        uint32_t heap_callables = 0;  // Captures larger than the inline storage
+        uint32_t max_depth = 0;
+        int64_t max_latency_us = 0;
+        std::source_location max_latency_site;
+        // Upper bounds: latency 1, 5, 20, 100, 500 ms and above; depth 1, 4, 16, 32, 64 and above
+        uint32_t latency_histogram[SCHEDULE_HISTOGRAM_BUCKETS] = {};
+        uint32_t depth_histogram[SCHEDULE_HISTOGRAM_BUCKETS] = {};
+    };
+
+    ScheduleQueue();
+
+    // site is the caller of Application::Schedule(), kept for diagnostics
+    void Push(ScheduledTask&& task, const std::source_location& site);
+    // Consumer only. Returns false when the queue is empty.
+    bool Pop(ScheduledTask& task, std::source_location& site);
+
+    Stats GetStats() const;
+    void ResetStats();
+    void Print() const;
+
+private:
+    struct Slot {
+        std::atomic<uint32_t> sequence;
+        ScheduledTask task;
+        std::source_location site;
+        int64_t enqueue_time_us;
+    };
+
+    struct OverflowTask {
+        ScheduledTask task;
+        std::source_location site;
+        int64_t enqueue_time_us;
+    };
+
+    Slot slots_[SCHEDULE_QUEUE_SIZE];
+    std::atomic<uint32_t> enqueue_pos_ = 0;
+    // Only written by the consumer, read by producers for the depth histogram
+    std::atomic<uint32_t> dequeue_pos_ = 0;
+
+    std::mutex overflow_mutex_;
+    std::atomic<bool> overflow_active_ = false;
+    std::deque<OverflowTask> overflow_;
+    // Consumer only: overflow tasks taken out of the list, run before newer ring tasks
+    std::deque<OverflowTask> overflow_draining_;
+
+    // Producer side counters
+    std::atomic<uint32_t> pushed_ = 0;
+    std::atomic<uint32_t> overflowed_ = 0;
+    std::atomic<uint32_t> heap_callables_ = 0;
+    std::atomic<uint32_t> depth_histogram_[SCHEDULE_HISTOGRAM_BUCKETS] = {};
+    std::atomic<uint32_t> max_depth_ = 0;
+
+    // Consumer side counters, guarded for readers on other tasks
+    mutable std::mutex stats_mutex_;
+    uint32_t executed_ = 0;
+    int64_t max_latency_us_ = 0;
+    std::source_location max_latency_site_;
+    uint32_t latency_histogram_[SCHEDULE_HISTOGRAM_BUCKETS] = {};
+
+    bool TryPush(ScheduledTask& task, const std::source_location& site, int64_t now_us);
+    void RecordDepth(uint32_t depth);
+    void RecordLatency(int64_t enqueue_time_us, const std::source_location& site);
+};
+
+#endif // SCHEDULE_QUEUE_H
@@ -0,0 +1,70 @@
+#ifndef SHA256_DIGEST_H
+#define SHA256_DIGEST_H
+
+#include <mbedtls/sha256.h>
+
+#include <array>
+#include <cctype>
+#include <cstdint>
+#include <string>
+
+/*
+ * Incremental SHA-256 for data that is streamed to flash. mbedtls uses the SHA accelerator
+ * when CONFIG_MBEDTLS_HARDWARE_SHA is enabled, and falls back to software while it is busy.
+ */
+class Sha256Digest {
+public:
+    using Digest = std::array<uint8_t, 32>;
+
+    Sha256Digest() {
+        mbedtls_sha256_init(&context_);
+        mbedtls_sha256_starts(&context_, 0);
+    }
+    ~Sha256Digest() {
+        mbedtls_sha256_free(&context_);
+    }
+    Sha256Digest(const Sha256Digest&) = delete;
+    Sha256Digest& operator=(const Sha256Digest&) = delete;
+
+    void Update(const void* data, size_t size) {
+        if (size > 0) {
+            mbedtls_sha256_update(&context_, static_cast<const unsigned char*>(data), size);
+        }
+    }
+
+    Digest Finish() {
+        Digest digest;
+        mbedtls_sha256_finish(&context_, digest.data());
+        return digest;
+    }
+
+    static std::string ToHex(const Digest& digest) {
+        static const char* const kHex = "0123456789abcdef";
+        std::string hex;
+        hex.reserve(digest.size() * 2);
+        for (auto byte : digest) {
+            hex.push_back(kHex[byte >> 4]);
+            hex.push_back(kHex[byte & 0x0F]);
+        }
+        return hex;
+    }
+
+    // Compares with a hex digest as sent by the server, in either case
+    static bool Matches(const Digest& digest, const std::string& hex) {
+        auto expected = ToHex(digest);
+        if (hex.size() != expected.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < hex.size(); i++) {
+            if (std::tolower(static_cast<unsigned char>(hex[i])) != expected[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    mbedtls_sha256_context context_;
+};
+
+#endif // SHA256_DIGEST_H
@@ -0,0 +1,242 @@
+#include "stream_decompressor.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <algorithm>
+#include <cstring>
+
+#define TAG "StreamDecompressor"
+
+StreamDecompressor::StreamDecompressor(OutputCallback output, size_t start_offset)
+    : output_(std::move(output)), produced_(start_offset) {
+    if (start_offset > 0) {
+        mode_ = kModeRaw;
+    }
+}
+
+StreamDecompressor::~StreamDecompressor() {
+    heap_caps_free(window_);
+}
+
+bool StreamDecompressor::Feed(const char* data, size_t size) {
+    if (mode_ == kModeDetect) {
+        // The first block is normally large enough to check the magic in place
+        if (pending_.empty() && size >= 4) {
+            mode_ = memcmp(data, STREAM_COMPRESSED_MAGIC, 4) == 0 ? kModeCompressed : kModeRaw;
+        } else {
+            size_t length = std::min(size, 4 - pending_.size());
+            pending_.append(data, length);
+            data += length;
+            size -= length;
+            if (pending_.size() < 4) {
+                return true;
+            }
+            mode_ = memcmp(pending_.data(), STREAM_COMPRESSED_MAGIC, 4) == 0 ? kModeCompressed : kModeRaw;
+            std::string first;
+            first.swap(pending_);
+            if (!Feed(first.data(), first.size())) {
+                return false;
+            }
+        }
+    }
+
+    if (mode_ == kModeRaw) {
+        if (size == 0) {
+            return true;
+        }
+        size_t offset = produced_;
+        produced_ += size;
+        return output_(offset, data, size);
+    }
+    return FeedCompressed(reinterpret_cast<const uint8_t*>(data), size);
+}
+
+bool StreamDecompressor::FeedCompressed(const uint8_t* data, size_t size) {
+    while (size > 0) {
+        switch (state_) {
+        case kStateHeader: {
+            size_t length = std::min(size, STREAM_COMPRESSED_HEADER_SIZE - field_size_);
+            memcpy(field_ + field_size_, data, length);
+            field_size_ += length;
+            data += length;
+            size -= length;
+            if (field_size_ == STREAM_COMPRESSED_HEADER_SIZE && !ParseHeader()) {
+                return false;
+            }
+            break;
+        }
+        case kStateToken: {
+            uint8_t token = *data++;
+            size--;
+            literal_length_ = token >> 4;
+            match_length_ = (token & 0x0F) + STREAM_COMPRESSED_MIN_MATCH;
+            if (literal_length_ > original_size_ - produced_) {
+                ESP_LOGE(TAG, "Literals past the end at %u", produced_);
+                return false;
+            }
+            if (literal_length_ == 15) {
+                state_ = kStateLiteralLength;
+            } else if (literal_length_ > 0) {
+                state_ = kStateLiterals;
+            } else if (!EndOfLiterals()) {
+                return false;
+            }
+            break;
+        }
+        case kStateLiteralLength: {
+            uint8_t value = *data++;
+            size--;
+            literal_length_ += value;
+            if (literal_length_ > original_size_ - produced_) {
+                ESP_LOGE(TAG, "Literals past the end at %u", produced_);
+                return false;
+            }
+            if (value != 255) {
+                state_ = kStateLiterals;
+            }
+            break;
+        }
+        case kStateLiterals: {
+            size_t length = std::min(size, literal_length_);
+            if (!PutLiterals(data, length)) {
+                return false;
+            }
+            data += length;
+            size -= length;
+            literal_length_ -= length;
+            if (literal_length_ == 0 && !EndOfLiterals()) {
+                return false;
+            }
+            break;
+        }
+        case kStateOffset:
+            field_[field_size_++] = *data++;
+            size--;
+            if (field_size_ == 2) {
+                match_offset_ = field_[0] | (field_[1] << 8);
+                if (match_offset_ == 0 || match_offset_ > produced_ || match_offset_ > window_mask_ + 1) {
+                    ESP_LOGE(TAG, "Invalid match offset %u at %u", match_offset_, produced_);
+                    return false;
+                }
+                if (match_length_ == 15 + STREAM_COMPRESSED_MIN_MATCH) {
+                    state_ = kStateMatchLength;
+                } else if (!CopyMatch()) {
+                    return false;
+                }
+            }
+            break;
+        case kStateMatchLength: {
+            uint8_t value = *data++;
+            size--;
+            match_length_ += value;
+            if (value != 255 && !CopyMatch()) {
+                return false;
+            }
+            break;
+        }
+        case kStateDone:
+            ESP_LOGE(TAG, "Data after the end of the compressed stream");
+            return false;
+        }
+    }
+    return true;
+}
+
+bool StreamDecompressor::ParseHeader() {
+    uint8_t window_bits = field_[4];
+    uint32_t original_size;
+    memcpy(&original_size, field_ + 8, sizeof(original_size));
+    if (window_bits < STREAM_COMPRESSED_MIN_WINDOW_BITS || window_bits > STREAM_COMPRESSED_MAX_WINDOW_BITS) {
+        ESP_LOGE(TAG, "Unsupported window of %u bits", window_bits);
+        return false;
+    }
+    size_t window_size = 1 << window_bits;
+    window_ = static_cast<uint8_t*>(heap_caps_malloc(window_size, MALLOC_CAP_SPIRAM));
+    if (window_ == nullptr) {
+        window_ = static_cast<uint8_t*>(heap_caps_malloc(window_size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT));
+        if (window_ == nullptr) {
+            ESP_LOGE(TAG, "Failed to allocate the %u byte window", window_size);
+            return false;
+        }
+    }
+    window_mask_ = window_size - 1;
+    original_size_ = original_size;
+    ESP_LOGD(TAG, "Decompressing %u bytes with a %u byte window", original_size_, window_size);
+    field_size_ = 0;
+    state_ = original_size_ > 0 ? kStateToken : kStateDone;
+    return true;
+}
+
+bool StreamDecompressor::EndOfLiterals() {
+    if (produced_ == original_size_) {
+        state_ = kStateDone;
+    } else {
+        state_ = kStateOffset;
+        field_size_ = 0;
+    }
+    return true;
+}
+
+bool StreamDecompressor::PutLiterals(const uint8_t* data, size_t size) {
+    // flushed_ is a multiple of the window size, the unflushed bytes start at the beginning of the window
+    while (size > 0) {
+        if (produced_ - flushed_ > window_mask_ && !Flush()) {
+            return false;
+        }
+        size_t length = std::min(size, window_mask_ + 1 - (produced_ - flushed_));
+        memcpy(window_ + (produced_ & window_mask_), data, length);
+        produced_ += length;
+        data += length;
+        size -= length;
+    }
+    return true;
+}
+
+bool StreamDecompressor::CopyMatch() {
+    if (match_length_ > original_size_ - produced_) {
+        ESP_LOGE(TAG, "Match past the end at %u", produced_);
+        return false;
+    }
+    size_t remaining = match_length_;
+    while (remaining > 0) {
+        if (produced_ - flushed_ > window_mask_ && !Flush()) {
+            return false;
+        }
+        size_t source = (produced_ - match_offset_) & window_mask_;
+        // A match shorter than its offset is copied in contiguous runs, a longer one repeats its bytes
+        size_t length = std::min({ remaining, window_mask_ + 1 - (produced_ - flushed_), window_mask_ + 1 - source, match_offset_ });
+        memmove(window_ + (produced_ & window_mask_), window_ + source, length);
+        produced_ += length;
+        remaining -= length;
+    }
+    state_ = produced_ == original_size_ ? kStateDone : kStateToken;
+    return true;
+}
+
+bool StreamDecompressor::Flush() {
+    size_t size = produced_ - flushed_;
+    if (size == 0) {
+        return true;
+    }
+    size_t offset = flushed_;
+    flushed_ = produced_;
+    return output_(offset, reinterpret_cast<const char*>(window_), size);
+}
+
+bool StreamDecompressor::Finish() {
+    if (mode_ == kModeDetect) {
+        // Shorter than the magic
+        mode_ = kModeRaw;
+        std::string rest;
+        rest.swap(pending_);
+        return rest.empty() || Feed(rest.data(), rest.size());
+    }
+    if (mode_ == kModeRaw) {
+        return true;
+    }
+    if (state_ != kStateDone) {
+        ESP_LOGE(TAG, "The compressed stream ended after %u of %u bytes", produced_, original_size_);
+        return false;
+    }
+    return Flush();
+}
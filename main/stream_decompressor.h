@@ -0,0 +1,93 @@
+#ifndef STREAM_DECOMPRESSOR_H
+#define STREAM_DECOMPRESSOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#define STREAM_COMPRESSED_MAGIC "XZC1"
+#define STREAM_COMPRESSED_HEADER_SIZE 12
+#define STREAM_COMPRESSED_MIN_WINDOW_BITS 10
+#define STREAM_COMPRESSED_MAX_WINDOW_BITS 16
+#define STREAM_COMPRESSED_MIN_MATCH 4
+
+/*
+ * Decompresses a download made by scripts/stream_compress.py as it is received, so that a compressed
+ * firmware or assets image is written to flash as the original bytes. Streams without the magic
+ * pass through unchanged, the same URL may serve either.
+ *
+ * Format, little endian:
+ *   header     "XZC1", window bits (u8), 3 reserved bytes, original size (u32)
+ *   sequences  until the original size is produced
+ *     token    literal count (high 4 bits), match length - 4 (low 4 bits); 15 continues in the
+ *              next bytes, each added until one is not 255
+ *     literals
+ *     offset   (u16) back from the end of the output, at most the window size; left out, with the
+ *              match, when the literals complete the output
+ * Memory is the window, 1 << window bits, in PSRAM when available.
+ */
+class StreamDecompressor {
+public:
+    // Receives the output in order, offset in the original image; returns false to stop
+    using OutputCallback = std::function<bool(size_t offset, const char* data, size_t size)>;
+
+    // A stream that starts at start_offset > 0 is the rest of an uncompressed download
+    explicit StreamDecompressor(OutputCallback output, size_t start_offset = 0);
+    ~StreamDecompressor();
+    StreamDecompressor(const StreamDecompressor&) = delete;
+    StreamDecompressor& operator=(const StreamDecompressor&) = delete;
+
+    // Feeds the next part of the stream, false if it is not valid or the output failed
+    bool Feed(const char* data, size_t size);
+    // Outputs the rest, true if a compressed stream ended exactly with the original size
+    bool Finish();
+
+    // Known once the first 4 bytes are received
+    bool compressed() const { return mode_ == kModeCompressed; }
+    // The original size of a compressed stream, from its header
+    size_t original_size() const { return original_size_; }
+    size_t bytes_output() const { return produced_; }
+
+private:
+    enum Mode {
+        kModeDetect,
+        kModeRaw,
+        kModeCompressed,
+    };
+    enum State {
+        kStateHeader,
+        kStateToken,
+        kStateLiteralLength,
+        kStateLiterals,
+        kStateOffset,
+        kStateMatchLength,
+        kStateDone,
+    };
+
+    OutputCallback output_;
+    Mode mode_ = kModeDetect;
+    State state_ = kStateHeader;
+    std::string pending_;  // The first bytes, until the magic can be checked
+
+    uint8_t field_[STREAM_COMPRESSED_HEADER_SIZE];
+    size_t field_size_ = 0;
+    size_t literal_length_ = 0;
+    size_t match_length_ = 0;
+    size_t match_offset_ = 0;
+
+    size_t original_size_ = 0;
+    size_t produced_ = 0;
+    size_t flushed_ = 0;
+    uint8_t* window_ = nullptr;
+    size_t window_mask_ = 0;
+
+    bool FeedCompressed(const uint8_t* data, size_t size);
+    bool ParseHeader();
+    bool EndOfLiterals();
+    bool CopyMatch();
+    bool PutLiterals(const uint8_t* data, size_t size);
+    bool Flush();
+};
+
+#endif // STREAM_DECOMPRESSOR_H
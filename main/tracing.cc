@@ -0,0 +1,305 @@
+#include "tracing.h"
+#include "board.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+#define TAG "Tracer"
+
+// Without PSRAM only a short trace fits in internal RAM
+#define TRACE_INTERNAL_RAM_EVENTS 512
+
+#ifndef CONFIG_EVENT_TRACE_BUFFER_EVENTS
+#define CONFIG_EVENT_TRACE_BUFFER_EVENTS 8192
+#endif
+
+// "udp://host:port", the port must be a number in 1..65535
+static bool ParseUdpTarget(const std::string& target, std::string& host, int& port) {
+    auto address = target.substr(6);
+    auto pos = address.rfind(':');
+    if (pos == std::string::npos || pos == 0 || pos + 1 == address.size()) {
+        return false;
+    }
+    const char* digits = address.c_str() + pos + 1;
+    char* end = nullptr;
+    long value = strtol(digits, &end, 10);
+    if (*end != '\0' || value < 1 || value > 65535) {
+        return false;
+    }
+    host = address.substr(0, pos);
+    port = (int)value;
+    return true;
+}
+
+bool Tracer::Start() {
+    if (uploading_) {
+        ESP_LOGW(TAG, "Upload in progress");
+        return false;
+    }
+    recording_ = false;
+
+    if (events_ == nullptr) {
+        // Round down to a power of two so the ring index is a mask
+        uint32_t capacity = 1;
+        while (capacity * 2 <= CONFIG_EVENT_TRACE_BUFFER_EVENTS) {
+            capacity *= 2;
+        }
+        events_ = (Event*)heap_caps_calloc(capacity, sizeof(Event), MALLOC_CAP_SPIRAM);
+        if (events_ == nullptr) {
+            capacity = TRACE_INTERNAL_RAM_EVENTS;
+            events_ = (Event*)heap_caps_calloc(capacity, sizeof(Event), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+            if (events_ == nullptr) {
+                ESP_LOGE(TAG, "Failed to allocate the trace buffer");
+                return false;
+            }
+            ESP_LOGW(TAG, "No PSRAM, trace buffer limited to %lu events", (unsigned long)capacity);
+        }
+        capacity_ = capacity;
+    } else {
+        memset((void*)events_, 0, capacity_ * sizeof(Event));
+    }
+
+    next_index_ = 0;
+    recording_ = true;
+    ESP_LOGI(TAG, "Tracing started, %lu events", (unsigned long)capacity_);
+    return true;
+}
+
+void Tracer::Stop() {
+    recording_ = false;
+}
+
+void Tracer::Append(TraceEventType type, const char* name, int32_t value) {
+    uint32_t index = next_index_.fetch_add(1, std::memory_order_relaxed);
+    auto& event = events_[index & (capacity_ - 1)];
+    event.sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    event.timestamp_us = (uint32_t)esp_timer_get_time();
+    event.name = name;
+    event.value = value;
+    event.type = type;
+    event.task = CurrentTaskIndex();
+    event.core = (uint8_t)xPortGetCoreID();
+    event.sequence.store(index + 1, std::memory_order_release);
+}
+
+uint8_t Tracer::CurrentTaskIndex() {
+    TaskHandle_t current = xTaskGetCurrentTaskHandle();
+    for (int i = 0; i < TRACE_MAX_TASKS; i++) {
+        auto& slot = tasks_[i];
+        TaskHandle_t handle = slot.handle.load(std::memory_order_acquire);
+        if (handle == current) {
+            return i;
+        }
+        if (handle == nullptr) {
+            // Claim the first free slot, another task may win the race for it
+            if (slot.handle.compare_exchange_strong(handle, current, std::memory_order_acq_rel)) {
+                strncpy(slot.name, pcTaskGetName(current), sizeof(slot.name) - 1);
+                return i;
+            }
+            if (handle == current) {
+                return i;
+            }
+        }
+    }
+    // Handles of deleted tasks may be reused, a new task then shows under the old name
+    return TRACE_MAX_TASKS;
+}
+
+Tracer::Stats Tracer::GetStats() const {
+    Stats stats;
+    stats.recording = recording_;
+    stats.capacity = capacity_;
+    stats.recorded = next_index_;
+    stats.uploading = uploading_;
+    return stats;
+}
+
+bool Tracer::Upload(const std::string& target) {
+    if (events_ == nullptr) {
+        ESP_LOGE(TAG, "Tracing was never started");
+        return false;
+    }
+    std::string host;
+    int port = 0;
+    if (target.rfind("udp://", 0) == 0 && !ParseUdpTarget(target, host, port)) {
+        ESP_LOGE(TAG, "Invalid UDP target %s, expected udp://host:port", target.c_str());
+        return false;
+    }
+    bool expected = false;
+    if (!uploading_.compare_exchange_strong(expected, true)) {
+        ESP_LOGW(TAG, "Upload in progress");
+        return false;
+    }
+    upload_target_ = target;
+    auto ret = xTaskCreate([](void* arg) {
+        auto tracer = (Tracer*)arg;
+        tracer->UploadTask();
+        tracer->uploading_ = false;
+        vTaskDelete(NULL);
+    }, "trace_upload", 4096, this, 1, nullptr);
+    if (ret != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create the upload task");
+        uploading_ = false;
+        return false;
+    }
+    return true;
+}
+
+void Tracer::UploadTask() {
+    bool was_recording = recording_.exchange(false);
+    // Let events that were being written when recording stopped complete
+    vTaskDelay(pdMS_TO_TICKS(10));
+
+    uint32_t end = next_index_;
+    uint32_t begin = end > capacity_ ? end - capacity_ : 0;
+    auto valid = [this](uint32_t index) {
+        return events_[index & (capacity_ - 1)].sequence.load(std::memory_order_acquire) == index + 1;
+    };
+
+    // Name table, indexed by the events
+    std::unordered_map<const char*, uint16_t> name_indices;
+    std::vector<const char*> names;
+    uint32_t event_count = 0;
+    for (uint32_t i = begin; i != end; i++) {
+        if (!valid(i)) {
+            continue;
+        }
+        auto name = events_[i & (capacity_ - 1)].name;
+        if (name_indices.emplace(name, (uint16_t)names.size()).second) {
+            names.push_back(name);
+        }
+        event_count++;
+    }
+    int task_count = 0;
+    while (task_count < TRACE_MAX_TASKS && tasks_[task_count].handle.load() != nullptr) {
+        task_count++;
+    }
+
+    // Sink, connection id 5 is not used by the protocols or the session recorder, only by the background assets download
+    const std::string& target = upload_target_;
+    FILE* file = nullptr;
+    std::unique_ptr<Udp> udp;
+    std::unique_ptr<Http> http;
+    auto network = Board::GetInstance().GetNetwork();
+    if (target.rfind("udp://", 0) == 0) {
+        std::string host;
+        int port = 0;
+        if (ParseUdpTarget(target, host, port)) {
+            udp = network->CreateUdp(5);
+            if (!udp->Connect(host, port)) {
+                udp.reset();
+            }
+        }
+    } else if (target.rfind("http://", 0) == 0 || target.rfind("https://", 0) == 0) {
+        http = network->CreateHttp(5);
+        http->SetHeader("Content-Type", "application/octet-stream");
+        if (!http->Open("POST", target)) {
+            http.reset();
+        }
+    } else {
+        file = fopen(target.c_str(), "wb");
+    }
+    if (file == nullptr && udp == nullptr && http == nullptr) {
+        ESP_LOGE(TAG, "Failed to open %s", target.c_str());
+        recording_ = was_recording;
+        return;
+    }
+
+    // Each UDP datagram starts with the u32 offset of its data in the dump,
+    // an empty datagram at the total size marks the end
+    std::string chunk;
+    uint32_t offset = 0;
+    bool ok = true;
+    auto flush = [&]() {
+        if (udp != nullptr) {
+            std::string datagram((const char*)&offset, sizeof(offset));
+            datagram += chunk;
+            ok = udp->Send(datagram) > 0 && ok;
+            // Pace the datagrams so the receiver and lwIP buffers keep up
+            vTaskDelay(pdMS_TO_TICKS(2));
+        } else if (http != nullptr) {
+            ok = http->Write(chunk.data(), chunk.size()) >= 0 && ok;
+        } else {
+            ok = fwrite(chunk.data(), 1, chunk.size(), file) == chunk.size() && ok;
+        }
+        offset += chunk.size();
+        chunk.clear();
+    };
+    auto write = [&](const void* data, size_t size) {
+        if (chunk.size() + size > TRACE_UDP_DATAGRAM_SIZE) {
+            flush();
+        }
+        chunk.append((const char*)data, size);
+    };
+    auto write_string = [&](const char* str) {
+        uint8_t length = strnlen(str, UINT8_MAX);
+        write(&length, sizeof(length));
+        write(str, length);
+    };
+
+    TraceFileHeader header;
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    header.header_size = sizeof(header);
+    header.event_count = event_count;
+    header.name_count = names.size();
+    header.task_count = task_count;
+    header.time_us = esp_timer_get_time();
+    write(&header, sizeof(header));
+    for (auto name : names) {
+        write_string(name);
+    }
+    for (int i = 0; i < task_count; i++) {
+        write_string(tasks_[i].name);
+    }
+
+    for (uint32_t i = begin; i != end; i++) {
+        auto& event = events_[i & (capacity_ - 1)];
+        if (!valid(i)) {
+            continue;
+        }
+        auto it = name_indices.find(event.name);
+        if (it == name_indices.end()) {
+            continue;
+        }
+        TraceFileEvent out = {};
+        out.timestamp_us = event.timestamp_us;
+        out.value = event.value;
+        out.name = it->second;
+        out.type = event.type;
+        out.task = event.task;
+        out.core = event.core;
+        write(&out, sizeof(out));
+    }
+    if (!chunk.empty()) {
+        flush();
+    }
+
+    if (udp != nullptr) {
+        flush();
+    } else if (http != nullptr) {
+        http->Write("", 0);
+        if (http->GetStatusCode() != 200) {
+            ESP_LOGE(TAG, "Unexpected status code: %d", http->GetStatusCode());
+            ok = false;
+        }
+        http->Close();
+    } else {
+        fclose(file);
+    }
+
+    recording_ = was_recording;
+    if (ok) {
+        ESP_LOGI(TAG, "Uploaded %lu events (%lu bytes) to %s", (unsigned long)event_count, (unsigned long)offset, target.c_str());
+    } else {
+        ESP_LOGE(TAG, "Failed to upload the trace to %s", target.c_str());
+    }
+}
@@ -0,0 +1,151 @@
+#ifndef TRACING_H
+#define TRACING_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#define TRACE_MAGIC "XZTR"
+#define TRACE_VERSION 1
+// Tasks named in a trace, later tasks are recorded as "?"
+#define TRACE_MAX_TASKS 32
+#define TRACE_UDP_DATAGRAM_SIZE 1400
+
+enum TraceEventType : uint8_t {
+    kTraceEventBegin = 'B',
+    kTraceEventEnd = 'E',
+    kTraceEventInstant = 'i',
+    kTraceEventCounter = 'C',
+};
+
+/*
+ * Dump layout (little endian), converted to Chrome trace JSON by scripts/trace_to_chrome.py:
+ *   header: magic "XZTR", u16 version, u16 header size, u32 event count, u16 name count,
+ *           u16 task count, i64 esp_timer time of the dump in us
+ *   names, then task names: u8 length, bytes
+ *   event:  u32 timestamp us (low 32 bits of esp_timer), i32 value, u16 name index,
+ *           u8 type, u8 task index, u8 core, 3 reserved bytes
+ */
+struct TraceFileHeader {
+    char magic[4];
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t event_count;
+    uint16_t name_count;
+    uint16_t task_count;
+    int64_t time_us;
+} __attribute__((packed));
+
+struct TraceFileEvent {
+    uint32_t timestamp_us;
+    int32_t value;
+    uint16_t name;
+    uint8_t type;
+    uint8_t task;
+    uint8_t core;
+    uint8_t reserved[3];
+} __attribute__((packed));
+
+/*
+ * System wide event trace. Events go into a ring buffer in PSRAM (CONFIG_EVENT_TRACE_BUFFER_EVENTS),
+ * the oldest are overwritten. Recording is lock-free and safe from any task, but not from ISRs.
+ * Names must be string literals, only the pointer is stored.
+ */
+class Tracer {
+public:
+    struct Stats {
+        bool recording = false;
+        uint32_t capacity = 0;
+        uint32_t recorded = 0;  // Since Start(), the ring keeps the last `capacity`
+        bool uploading = false;
+    };
+
+    static Tracer& GetInstance() {
+        static Tracer instance;
+        return instance;
+    }
+
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+
+    // Clears the ring and starts recording, the buffer is allocated on first use
+    bool Start();
+    void Stop();
+
+    inline void Record(TraceEventType type, const char* name, int32_t value = 0) {
+        if (recording_.load(std::memory_order_relaxed)) {
+            Append(type, name, value);
+        }
+    }
+
+    // target is a file path, udp://host:port or an http(s):// URL to POST to.
+    // The ring is dumped by a low priority task, recording pauses while it runs.
+    bool Upload(const std::string& target);
+    Stats GetStats() const;
+
+private:
+    struct Event {
+        std::atomic<uint32_t> sequence;  // Ring index + 1 once written, 0 while being written
+        uint32_t timestamp_us;
+        const char* name;
+        int32_t value;
+        uint8_t type;
+        uint8_t task;
+        uint8_t core;
+    };
+
+    struct TaskSlot {
+        std::atomic<TaskHandle_t> handle;
+        char name[configMAX_TASK_NAME_LEN];
+    };
+
+    Event* events_ = nullptr;
+    uint32_t capacity_ = 0;
+    std::atomic<bool> recording_ = false;
+    std::atomic<uint32_t> next_index_ = 0;
+    TaskSlot tasks_[TRACE_MAX_TASKS] = {};
+
+    std::atomic<bool> uploading_ = false;
+    std::string upload_target_;
+
+    Tracer() = default;
+
+    void Append(TraceEventType type, const char* name, int32_t value);
+    uint8_t CurrentTaskIndex();
+    void UploadTask();
+};
+
+// Emits begin/end events for the enclosing block
+class TraceScope {
+public:
+    explicit TraceScope(const char* name) : name_(name) {
+        Tracer::GetInstance().Record(kTraceEventBegin, name_);
+    }
+    ~TraceScope() {
+        Tracer::GetInstance().Record(kTraceEventEnd, name_);
+    }
+
+private:
+    const char* name_;
+};
+
+#if CONFIG_USE_EVENT_TRACING
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define TRACE_BEGIN(name, value) Tracer::GetInstance().Record(kTraceEventBegin, name, value)
+#define TRACE_END(name) Tracer::GetInstance().Record(kTraceEventEnd, name)
+#define TRACE_INSTANT(name, value) Tracer::GetInstance().Record(kTraceEventInstant, name, value)
+#define TRACE_COUNTER(name, value) Tracer::GetInstance().Record(kTraceEventCounter, name, value)
+#else
+#define TRACE_SCOPE(name) do {} while (0)
+#define TRACE_BEGIN(name, value) do {} while (0)
+#define TRACE_END(name) do {} while (0)
+#define TRACE_INSTANT(name, value) do {} while (0)
+#define TRACE_COUNTER(name, value) do {} while (0)
+#endif
+
+#endif // TRACING_H
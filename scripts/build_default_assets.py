@@ -11,6 +11,7 @@ Usage:
 """
 
 import argparse
+import hashlib
 import io
 import os
 import shutil
@@ -19,6 +20,8 @@ import json
 import struct
 from datetime import datetime
 
+from stream_compress import compress as compress_stream, compress_asset
+
 
 # =============================================================================
 # Pack model functions (from pack_model.py)
@@ -334,23 +337,51 @@ def generate_config_json(build_dir, assets_dir):
 # Simplified SPIFFS assets generation (from spiffs_assets_gen.py)
 # =============================================================================
 
+ASSETS_DIGEST_MAGIC = b'ZSHA'
+ASSETS_FILE_HASHES_MAGIC = b'ZFHT'
+
+
 def compute_checksum(data):
     checksum = sum(data) & 0xFFFF
     return checksum
 
 
+def write_assets_manifest(out_file, final_data, file_entries):
+    """
+    Write <name>.manifest.json next to the assets file, for differential updates on the device.
+    Each entry is (name, offset of the 0x5A5A prefix in the file, size, width, height, sha256).
+    """
+    manifest = {
+        'version': 1,
+        'size': len(final_data),
+        'sha256': hashlib.sha256(final_data).hexdigest(),
+        'files': [
+            {'name': name, 'offset': offset, 'size': size, 'width': width, 'height': height, 'sha256': digest.hex()}
+            for name, offset, size, width, height, digest in file_entries
+        ],
+    }
+    manifest_path = os.path.splitext(out_file)[0] + '.manifest.json'
+    with open(manifest_path, 'w') as f:
+        json.dump(manifest, f, indent=1)
+    return manifest_path
+
+
 def sort_key(filename):
-    basename, extension = os.path.splitext(filename)
-    return extension, basename
+    # The firmware binary searches the file table, so it is in byte order of the names
+    return filename.encode('utf-8')
 
 
-def pack_assets_simple(target_path, include_path, out_file, assets_path, max_name_len=32):
+def pack_assets_simple(target_path, include_path, out_file, assets_path, max_name_len=32, compress_resident=False):
     """
     Simplified version of pack_assets that handles basic file packing
     """
     merged_data = bytearray()
     file_info_list = []
+    file_hashes = []
     skip_files = ['config.json']
+    compressed_files = 0
+    original_size = 0
+    compressed_size = 0
 
     # Ensure output directory exists
     os.makedirs(os.path.dirname(out_file), exist_ok=True)
@@ -366,18 +397,27 @@ def pack_assets_simple(target_path, include_path, out_file, assets_path, max_nam
             continue
             
         file_name = os.path.basename(file_path)
-        file_size = os.path.getsize(file_path)
+        with open(file_path, 'rb') as bin_file:
+            bin_data = bin_file.read()
+
+        # Compressed or mapped in place, by how the firmware reads the file
+        stored_data = compress_asset(file_name, bin_data, compress_resident)
+        if len(stored_data) != len(bin_data):
+            compressed_files += 1
+            original_size += len(bin_data)
+            compressed_size += len(stored_data)
+        file_size = len(stored_data)
 
         file_info_list.append((file_name, len(merged_data), file_size, 0, 0))
         # Add 0x5A5A prefix to merged_data
         merged_data.extend(b'\x5A' * 2)
 
-        with open(file_path, 'rb') as bin_file:
-            bin_data = bin_file.read()
-
-        merged_data.extend(bin_data)
+        merged_data.extend(stored_data)
+        file_hashes.append(hashlib.sha256(stored_data).digest())
 
     total_files = len(file_info_list)
+    if compressed_files > 0:
+        print(f"Compressed {compressed_files} files: {original_size} -> {compressed_size} bytes")
 
     mmap_table = bytearray()
     for file_name, offset, file_size, width, height in file_info_list:
@@ -395,9 +435,20 @@ def pack_assets_simple(target_path, include_path, out_file, assets_path, max_nam
     combined_data_length = len(combined_data).to_bytes(4, byteorder='little')
     header_data = total_files.to_bytes(4, byteorder='little') + combined_checksum.to_bytes(4, byteorder='little')
     final_data = header_data + combined_data_length + combined_data
+    # SHA-256 trailer, checked by the firmware while downloading; older firmware stops at combined_data_length
+    final_data += ASSETS_DIGEST_MAGIC + hashlib.sha256(final_data).digest()
+    # Per-file hashes, in table order, so that the firmware can compare the files with a manifest
+    final_data += ASSETS_FILE_HASHES_MAGIC + total_files.to_bytes(4, byteorder='little') + b''.join(file_hashes)
 
     with open(out_file, 'wb') as output_bin:
         output_bin.write(final_data)
+    data_start = len(header_data) + len(combined_data_length) + len(mmap_table)
+    manifest_path = write_assets_manifest(out_file, final_data, [
+        (file_name[:max_name_len], data_start + offset, file_size, width, height, digest)
+        for (file_name, offset, file_size, width, height), digest in zip(file_info_list, file_hashes)
+    ])
+    print(f"sha256: {hashlib.sha256(final_data).hexdigest()}")
+    print(f"manifest: {os.path.basename(manifest_path)}")
 
     # Generate header file
     current_year = datetime.now().year
@@ -547,6 +598,19 @@ def read_wake_word_type_from_sdkconfig(sdkconfig_path):
     return config_values
 
 
+def read_assets_compress_resident_from_sdkconfig(sdkconfig_path):
+    """
+    Read CONFIG_ASSETS_COMPRESS_RESIDENT from sdkconfig
+    """
+    if not os.path.exists(sdkconfig_path):
+        return False
+    with io.open(sdkconfig_path, "r") as f:
+        for line in f:
+            if line.strip() == 'CONFIG_ASSETS_COMPRESS_RESIDENT=y':
+                return True
+    return False
+
+
 def read_custom_wake_word_from_sdkconfig(sdkconfig_path):
     """
     Read custom wake word configuration from sdkconfig
@@ -698,7 +762,7 @@ def get_emoji_collection_path(default_emoji_collection, xiaozhi_fonts_path):
         return None
 
 
-def build_assets_integrated(wakenet_model_paths, multinet_model_paths, text_font_path, emoji_collection_path, extra_files_path, output_path, multinet_model_info=None):
+def build_assets_integrated(wakenet_model_paths, multinet_model_paths, text_font_path, emoji_collection_path, extra_files_path, output_path, multinet_model_info=None, compress=False, compress_resident=False):
     """
     Build assets using integrated functions (no external dependencies)
     """
@@ -734,16 +798,29 @@ def build_assets_integrated(wakenet_model_paths, multinet_model_paths, text_font
         # Use simplified packing function
         include_path = config_data['include_path']
         image_file = config_data['image_file']
-        pack_assets_simple(assets_dir, include_path, image_file, "assets", int(config_data['name_length']))
+        pack_assets_simple(assets_dir, include_path, image_file, "assets", int(config_data['name_length']), compress_resident)
         
         # Copy final assets.bin to output location
         if os.path.exists(image_file):
             shutil.copy2(image_file, output_path)
             print(f"Successfully generated assets.bin: {output_path}")
             
+            # The manifest for differential updates goes next to it
+            manifest_path = os.path.splitext(image_file)[0] + '.manifest.json'
+            if os.path.exists(manifest_path):
+                shutil.copy2(manifest_path, os.path.splitext(output_path)[0] + '.manifest.json')
+
             # Show size information
             total_size = os.path.getsize(output_path)
             print(f"Assets file size: {total_size / 1024:.2f}K ({total_size} bytes)")
+
+            # Compressed copy for the download, decompressed by the firmware while it is written
+            if compress:
+                with open(output_path, 'rb') as f:
+                    compressed = compress_stream(f.read())
+                with open(output_path + '.xzc', 'wb') as f:
+                    f.write(compressed)
+                print(f"Compressed assets: {output_path}.xzc ({len(compressed)} bytes, {100.0 * len(compressed) / max(total_size, 1):.1f}%)")
             
             return True
         else:
@@ -768,6 +845,7 @@ def main():
     parser.add_argument('--esp_sr_model_path', help='Path to ESP-SR model directory')
     parser.add_argument('--xiaozhi_fonts_path', help='Path to xiaozhi-fonts component directory')
     parser.add_argument('--extra_files', help='Path to extra files directory to be included in assets')
+    parser.add_argument('--compress', action='store_true', help='Also write <output>.xzc, compressed for the download')
     
     args = parser.parse_args()
     
@@ -870,7 +948,8 @@ def main():
     
     # Build the assets
     success = build_assets_integrated(wakenet_model_paths, multinet_model_paths, text_font_path, emoji_collection_path, 
-                                     extra_files_path, args.output, multinet_model_info)
+                                     extra_files_path, args.output, multinet_model_info, args.compress,
+                                     read_assets_compress_resident_from_sdkconfig(args.sdkconfig))
     
     if not success:
         sys.exit(1)
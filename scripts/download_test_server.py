@@ -0,0 +1,167 @@
+#!/usr/bin/env python3
+"""
+HTTP server for testing resumable OTA and assets downloads (main/download_checkpoint.h).
+Serves files with an ETag and Range / If-Range support, and drops the connection part way
+through the body to simulate a network loss.
+
+  python download_test_server.py build/xiaozhi.bin --drop-after 1048576 --drops 2
+  python download_test_server.py build/generated_assets.bin --no-range     server without Range support
+  python download_test_server.py build/xiaozhi.bin --change-etag           file "changes" after each drop
+
+On the device, call the MCP tool self.upgrade_firmware or self.assets.set_download_url with the
+printed URL and SHA-256. Each attempt after a drop should log "Resuming the ota download at ...".
+"""
+
+import argparse
+import hashlib
+import http.server
+import os
+import re
+import socket
+import struct
+import sys
+import threading
+import time
+
+RANGE_PATTERN = re.compile(r"bytes=(\d+)-(\d*)$")
+
+
+class DownloadHandler(http.server.BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def do_HEAD(self):
+        self.handle_get(head_only=True)
+
+    def do_GET(self):
+        self.handle_get(head_only=False)
+
+    def handle_get(self, head_only):
+        server = self.server
+        name = os.path.basename(self.path.split("?", 1)[0])
+        entry = server.files.get(name)
+        if entry is None:
+            self.send_error(404)
+            return
+        data, digest = entry
+        etag = '"%s-%d"' % (digest[:16], server.generation)
+        total = len(data)
+
+        first, last = 0, total - 1
+        partial = False
+        range_header = self.headers.get("Range")
+        if range_header and not server.args.no_range:
+            if_range = self.headers.get("If-Range")
+            match = RANGE_PATTERN.match(range_header.strip())
+            if match and (if_range is None or if_range == etag):
+                first = int(match.group(1))
+                if match.group(2):
+                    last = min(int(match.group(2)), total - 1)
+                if first > last:
+                    self.send_response(416)
+                    self.send_header("Content-Range", "bytes */%d" % total)
+                    self.send_header("Content-Length", "0")
+                    self.end_headers()
+                    return
+                partial = True
+
+        self.send_response(206 if partial else 200)
+        self.send_header("Content-Type", "application/octet-stream")
+        self.send_header("Content-Length", str(last - first + 1))
+        if not server.args.no_etag:
+            self.send_header("ETag", etag)
+        if not server.args.no_range:
+            self.send_header("Accept-Ranges", "bytes")
+        if partial:
+            self.send_header("Content-Range", "bytes %d-%d/%d" % (first, last, total))
+        self.end_headers()
+        print("%s %s %s bytes %d-%d/%d" % (self.client_address[0], name, 206 if partial else 200, first, last, total))
+        if head_only:
+            return
+
+        drop_after = None
+        with server.lock:
+            if server.drops_left != 0 and server.args.drop_after > 0:
+                drop_after = server.args.drop_after
+                server.drops_left -= 1
+        self.send_body(data, first, last + 1, drop_after)
+
+    def send_body(self, data, start, end, drop_after):
+        chunk = 4096
+        sent = 0
+        begin = time.time()
+        position = start
+        while position < end:
+            size = min(chunk, end - position)
+            if drop_after is not None and sent + size > drop_after:
+                size = drop_after - sent
+                if size > 0:
+                    self.wfile.write(data[position:position + size])
+                    sent += size
+                print("  dropped the connection after %d bytes, at offset %d" % (sent, position + size))
+                if self.server.args.change_etag:
+                    self.server.generation += 1
+                # Reset instead of a clean close, as a lost network would look to the device
+                self.connection.setsockopt(socket.SOL_SOCKET, socket.SO_LINGER, struct.pack("ii", 1, 0))
+                self.close_connection = True
+                self.connection.close()
+                return
+            self.wfile.write(data[position:position + size])
+            position += size
+            sent += size
+            if self.server.args.rate > 0:
+                expected = sent / (self.server.args.rate * 1024)
+                elapsed = time.time() - begin
+                if expected > elapsed:
+                    time.sleep(expected - elapsed)
+        print("  sent %d bytes" % sent)
+
+    def log_message(self, format, *args):
+        pass
+
+
+def local_ip():
+    s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    try:
+        s.connect(("8.8.8.8", 80))
+        return s.getsockname()[0]
+    except OSError:
+        return "127.0.0.1"
+    finally:
+        s.close()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="HTTP server with Range support that injects disconnects")
+    parser.add_argument("files", nargs="+", help="files to serve, by base name")
+    parser.add_argument("--port", type=int, default=8090)
+    parser.add_argument("--drop-after", type=int, default=0, help="drop each response after this many body bytes")
+    parser.add_argument("--drops", type=int, default=1, help="number of responses to drop, -1 for all")
+    parser.add_argument("--rate", type=int, default=0, help="limit the speed to this many KB/s")
+    parser.add_argument("--no-range", action="store_true", help="ignore Range requests, always send the whole file")
+    parser.add_argument("--no-etag", action="store_true", help="do not send an ETag")
+    parser.add_argument("--change-etag", action="store_true", help="change the ETag after each drop")
+    args = parser.parse_args()
+
+    server = http.server.ThreadingHTTPServer(("0.0.0.0", args.port), DownloadHandler)
+    server.args = args
+    server.lock = threading.Lock()
+    server.drops_left = args.drops
+    server.generation = 0
+    server.files = {}
+    host = local_ip()
+    for path in args.files:
+        with open(path, "rb") as f:
+            data = f.read()
+        digest = hashlib.sha256(data).hexdigest()
+        server.files[os.path.basename(path)] = (data, digest)
+        print("http://%s:%d/%s  %d bytes  sha256 %s" % (host, args.port, os.path.basename(path), len(data), digest))
+
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,156 @@
+#!/usr/bin/env python3
+"""
+Creates firmware deltas for the streaming delta OTA (main/firmware_delta_patcher.h).
+The delta rebuilds new.bin from the image running on the device, which must be exactly old.bin.
+
+  python firmware_delta.py create old.bin new.bin -o delta.bin
+  python firmware_delta.py apply old.bin delta.bin -o new.bin      check a delta on the host
+
+Publish the delta as firmware.delta_url in the OTA response, next to firmware.url. The device
+falls back to the full image when the delta does not match its running firmware.
+"""
+
+import argparse
+import hashlib
+import struct
+import sys
+
+MAGIC = b"XZD1"
+OP_COPY = 0x01
+OP_INSERT = 0x02
+# Matches shorter than this cost more as a COPY than as an INSERT
+BLOCK_SIZE = 32
+INDEX_STRIDE = 8
+
+
+def index_source(source):
+    index = {}
+    for offset in range(0, len(source) - BLOCK_SIZE + 1, INDEX_STRIDE):
+        index.setdefault(source[offset:offset + BLOCK_SIZE], offset)
+    return index
+
+
+def create_delta(source, target):
+    index = index_source(source)
+    commands = []
+    pending = bytearray()
+    position = 0
+    copied = 0
+
+    def flush_insert():
+        if pending:
+            commands.append(struct.pack("<BI", OP_INSERT, len(pending)) + bytes(pending))
+            pending.clear()
+
+    while position < len(target):
+        match = None
+        if position + BLOCK_SIZE <= len(target):
+            # Source blocks are indexed every INDEX_STRIDE bytes, so look for one at the next stride
+            for shift in range(INDEX_STRIDE):
+                block = target[position + shift:position + shift + BLOCK_SIZE]
+                if len(block) == BLOCK_SIZE and block in index:
+                    match = (index[block], position + shift)
+                    break
+        if match is None:
+            step = min(INDEX_STRIDE, len(target) - position)
+            pending += target[position:position + step]
+            position += step
+            continue
+
+        source_start, target_start = match
+        # Extend backwards into the bytes not written yet
+        while target_start > position and source_start > 0 and source[source_start - 1] == target[target_start - 1]:
+            source_start -= 1
+            target_start -= 1
+        source_end, target_end = source_start + BLOCK_SIZE, target_start + BLOCK_SIZE
+        while target_end < len(target) and source_end < len(source) and source[source_end] == target[target_end]:
+            source_end += 1
+            target_end += 1
+
+        pending += target[position:target_start]
+        flush_insert()
+        commands.append(struct.pack("<BII", OP_COPY, source_start, target_end - target_start))
+        copied += target_end - target_start
+        position = target_end
+    flush_insert()
+
+    header = MAGIC + struct.pack("<I", len(source)) + hashlib.sha256(source).digest() \
+        + struct.pack("<I", len(target)) + hashlib.sha256(target).digest()
+    return header + b"".join(commands), copied
+
+
+def apply_delta(source, delta):
+    if delta[:4] != MAGIC:
+        raise ValueError("not a firmware delta")
+    source_size, = struct.unpack_from("<I", delta, 4)
+    source_sha256 = delta[8:40]
+    target_size, = struct.unpack_from("<I", delta, 40)
+    target_sha256 = delta[44:76]
+    if hashlib.sha256(source[:source_size]).digest() != source_sha256:
+        raise ValueError("the delta was not made for this source")
+
+    target = bytearray()
+    position = 76
+    while position < len(delta):
+        op = delta[position]
+        if op == OP_COPY:
+            offset, length = struct.unpack_from("<II", delta, position + 1)
+            if offset + length > source_size:
+                raise ValueError("copy out of bounds at %d" % position)
+            target += source[offset:offset + length]
+            position += 9
+        elif op == OP_INSERT:
+            length, = struct.unpack_from("<I", delta, position + 1)
+            target += delta[position + 5:position + 5 + length]
+            position += 5 + length
+        else:
+            raise ValueError("unknown command 0x%02x at %d" % (op, position))
+    if len(target) != target_size or hashlib.sha256(target).digest() != target_sha256:
+        raise ValueError("the result does not match the target")
+    return bytes(target)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Create or apply firmware deltas for the streaming delta OTA")
+    subparsers = parser.add_subparsers(dest="command", required=True)
+    create = subparsers.add_parser("create", help="create a delta from old.bin to new.bin")
+    create.add_argument("old")
+    create.add_argument("new")
+    create.add_argument("-o", "--output", required=True)
+    apply = subparsers.add_parser("apply", help="rebuild new.bin from old.bin and a delta")
+    apply.add_argument("old")
+    apply.add_argument("delta")
+    apply.add_argument("-o", "--output", required=True)
+    args = parser.parse_args()
+
+    if args.command == "create":
+        with open(args.old, "rb") as f:
+            source = f.read()
+        with open(args.new, "rb") as f:
+            target = f.read()
+        delta, copied = create_delta(source, target)
+        # Never publish a delta that does not apply
+        apply_delta(source, delta)
+        with open(args.output, "wb") as f:
+            f.write(delta)
+        print("source: %d bytes, target: %d bytes, copied: %d bytes" % (len(source), len(target), copied))
+        print("delta: %d bytes, %.1f%% of the target" % (len(delta), 100.0 * len(delta) / max(len(target), 1)))
+        print("sha256: %s" % hashlib.sha256(target).hexdigest())
+    else:
+        with open(args.old, "rb") as f:
+            source = f.read()
+        with open(args.delta, "rb") as f:
+            delta = f.read()
+        try:
+            target = apply_delta(source, delta)
+        except ValueError as e:
+            print("error: %s" % e, file=sys.stderr)
+            return 1
+        with open(args.output, "wb") as f:
+            f.write(target)
+        print("rebuilt %d bytes, sha256 %s" % (len(target), hashlib.sha256(target).hexdigest()))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,108 @@
+"""
+AES-128-CTR compatible with mbedtls_aes_crypt_ctr as used by MqttProtocol.
+
+The 16 byte packet header is used as the initial counter block, incremented
+as a 128-bit big-endian integer. Uses the `cryptography` package when it is
+installed, otherwise falls back to a small pure Python AES implementation,
+which is fast enough for a handful of 60ms Opus frames per second.
+"""
+
+try:
+    from cryptography.hazmat.primitives.ciphers import Cipher, algorithms, modes
+    HAVE_CRYPTOGRAPHY = True
+except ImportError:
+    HAVE_CRYPTOGRAPHY = False
+
+
+_SBOX = [
+    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+    0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+    0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+    0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+    0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+    0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+    0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+    0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+    0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+    0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+    0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+    0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+    0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+    0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+    0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+    0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16,
+]
+
+_RCON = [0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36]
+
+
+def _xtime(a):
+    a <<= 1
+    return (a ^ 0x1b) & 0xff if a & 0x100 else a
+
+
+def _expand_key(key):
+    words = [list(key[i:i + 4]) for i in range(0, 16, 4)]
+    for i in range(4, 44):
+        temp = list(words[i - 1])
+        if i % 4 == 0:
+            temp = temp[1:] + temp[:1]
+            temp = [_SBOX[b] for b in temp]
+            temp[0] ^= _RCON[i // 4 - 1]
+        words.append([words[i - 4][j] ^ temp[j] for j in range(4)])
+    return [sum(words[r * 4:r * 4 + 4], []) for r in range(11)]
+
+
+def _encrypt_block(round_keys, block):
+    s = [b ^ k for b, k in zip(block, round_keys[0])]
+    for r in range(1, 11):
+        # SubBytes + ShiftRows, state is column major
+        s = [_SBOX[s[(i + 4 * (i % 4)) % 16]] for i in range(16)]
+        if r != 10:
+            # MixColumns
+            mixed = []
+            for c in range(4):
+                a = s[c * 4:c * 4 + 4]
+                t = a[0] ^ a[1] ^ a[2] ^ a[3]
+                mixed += [a[i] ^ t ^ _xtime(a[i] ^ a[(i + 1) % 4]) for i in range(4)]
+            s = mixed
+        s = [b ^ k for b, k in zip(s, round_keys[r])]
+    return bytes(s)
+
+
+class AesCtr:
+    def __init__(self, key):
+        if len(key) != 16:
+            raise ValueError("AES-128 key must be 16 bytes")
+        self.key = bytes(key)
+        if not HAVE_CRYPTOGRAPHY:
+            self.round_keys = _expand_key(self.key)
+
+    def crypt(self, nonce, data):
+        """Encrypt or decrypt data, nonce is the 16 byte initial counter block"""
+        if HAVE_CRYPTOGRAPHY:
+            cipher = Cipher(algorithms.AES(self.key), modes.CTR(bytes(nonce)))
+            return cipher.encryptor().update(bytes(data))
+
+        counter = int.from_bytes(nonce, "big")
+        out = bytearray(len(data))
+        for offset in range(0, len(data), 16):
+            stream = _encrypt_block(self.round_keys, counter.to_bytes(16, "big"))
+            chunk = data[offset:offset + 16]
+            for i, b in enumerate(chunk):
+                out[offset + i] = b ^ stream[i]
+            counter = (counter + 1) & ((1 << 128) - 1)
+        return bytes(out)
+
+
+if __name__ == "__main__":
+    # FIPS-197 appendix C.1 test vector
+    key = bytes(range(16))
+    plain = bytes.fromhex("00112233445566778899aabbccddeeff")
+    assert _encrypt_block(_expand_key(key), plain).hex() == "69c4e0d86a7b0430d8cdb78070b4c55a"
+    # NIST SP 800-38A F.5.1 CTR-AES128
+    ctr = AesCtr(bytes.fromhex("2b7e151628aed2a6abf7158809cf4f3c"))
+    out = ctr.crypt(bytes.fromhex("f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff"),
+                    bytes.fromhex("6bc1bee22e409f96e93d7e117393172aae2d8a571e03ac9c9eb76fac45af8e51"))
+    assert out.hex() == "874d6191b620e3261bef6864990db6ce9806f66b7970fdff8617187bb9fffdff"
+    print("AES-CTR self test passed")
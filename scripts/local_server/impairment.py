@@ -0,0 +1,43 @@
+"""
+Network impairment for downlink packets: random loss, jitter and reordering.
+"""
+
+import asyncio
+import random
+
+
+class Impairment:
+    def __init__(self, loss=0.0, jitter_ms=0, reorder=0.0, seed=None):
+        self.loss = loss
+        self.jitter_ms = jitter_ms
+        self.reorder = reorder
+        self.random = random.Random(seed)
+        self.sent = 0
+        self.dropped = 0
+        self.reordered = 0
+
+    @property
+    def enabled(self):
+        return self.loss > 0 or self.jitter_ms > 0 or self.reorder > 0
+
+    def submit(self, send, frame_ms):
+        """
+        Schedule send() (a coroutine function) according to the impairment.
+        A reordered packet is held back for two frames so that it lands after its successors.
+        """
+        if self.loss > 0 and self.random.random() < self.loss:
+            self.dropped += 1
+            return
+        delay_ms = self.random.uniform(0, self.jitter_ms) if self.jitter_ms > 0 else 0
+        if self.reorder > 0 and self.random.random() < self.reorder:
+            delay_ms += frame_ms * 2
+            self.reordered += 1
+        self.sent += 1
+        if delay_ms <= 0:
+            asyncio.ensure_future(send())
+        else:
+            loop = asyncio.get_running_loop()
+            loop.call_later(delay_ms / 1000, lambda: asyncio.ensure_future(send()))
+
+    def summary(self):
+        return f"sent {self.sent}, dropped {self.dropped}, reordered {self.reordered}"
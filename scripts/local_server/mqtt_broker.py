@@ -0,0 +1,135 @@
+"""
+Minimal MQTT 3.1.1 broker on asyncio, enough for MqttProtocol.
+
+The device does not subscribe to a topic, a cloud broker routes server
+messages to it by client id. This broker therefore does not route between
+clients at all: every PUBLISH from a device is handed to the application
+callback, and the application publishes back to a specific client.
+"""
+
+import asyncio
+import struct
+
+CONNECT = 1
+CONNACK = 2
+PUBLISH = 3
+PUBACK = 4
+SUBSCRIBE = 8
+SUBACK = 9
+UNSUBSCRIBE = 10
+UNSUBACK = 11
+PINGREQ = 12
+PINGRESP = 13
+DISCONNECT = 14
+
+
+def _encode_length(length):
+    out = bytearray()
+    while True:
+        byte = length % 128
+        length //= 128
+        if length:
+            byte |= 0x80
+        out.append(byte)
+        if not length:
+            return bytes(out)
+
+
+def _read_string(data, offset):
+    length = struct.unpack_from(">H", data, offset)[0]
+    return data[offset + 2:offset + 2 + length], offset + 2 + length
+
+
+class MqttClient:
+    def __init__(self, reader, writer):
+        self.reader = reader
+        self.writer = writer
+        self.client_id = ""
+        self.username = ""
+        self.remote_address = writer.get_extra_info("peername")
+
+    async def publish(self, topic, payload):
+        if isinstance(payload, str):
+            payload = payload.encode("utf-8")
+        body = struct.pack(">H", len(topic)) + topic.encode() + payload
+        self.writer.write(bytes([PUBLISH << 4]) + _encode_length(len(body)) + body)
+        await self.writer.drain()
+
+    async def read_packet(self):
+        header = await self.reader.readexactly(1)
+        multiplier = 1
+        length = 0
+        while True:
+            byte = (await self.reader.readexactly(1))[0]
+            length += (byte & 0x7F) * multiplier
+            if not byte & 0x80:
+                break
+            multiplier *= 128
+        body = await self.reader.readexactly(length) if length else b""
+        return header[0] >> 4, header[0] & 0x0F, body
+
+    def send(self, packet_type, body=b"", flags=0):
+        self.writer.write(bytes([(packet_type << 4) | flags]) + _encode_length(len(body)) + body)
+
+
+async def serve(host, port, on_connect, on_message, on_disconnect):
+    """
+    on_connect(client), on_message(client, topic, payload) and on_disconnect(client)
+    are coroutines called by the broker
+    """
+    async def on_client(reader, writer):
+        client = MqttClient(reader, writer)
+        connected = False
+        try:
+            while True:
+                packet_type, flags, body = await client.read_packet()
+                if packet_type == CONNECT:
+                    # Protocol name, level, flags, keepalive, then the payload
+                    _, offset = _read_string(body, 0)
+                    connect_flags = body[offset + 1]
+                    offset += 4
+                    client_id, offset = _read_string(body, offset)
+                    client.client_id = client_id.decode()
+                    if connect_flags & 0x04:
+                        _, offset = _read_string(body, offset)
+                        _, offset = _read_string(body, offset)
+                    if connect_flags & 0x80:
+                        username, offset = _read_string(body, offset)
+                        client.username = username.decode()
+                    client.send(CONNACK, b"\x00\x00")
+                    await writer.drain()
+                    connected = True
+                    await on_connect(client)
+                elif packet_type == PUBLISH:
+                    qos = (flags >> 1) & 0x03
+                    topic, offset = _read_string(body, 0)
+                    if qos > 0:
+                        packet_id = body[offset:offset + 2]
+                        offset += 2
+                        if qos == 1:
+                            client.send(PUBACK, packet_id)
+                    await on_message(client, topic.decode(), body[offset:])
+                elif packet_type == SUBSCRIBE:
+                    packet_id = body[:2]
+                    offset = 2
+                    granted = bytearray()
+                    while offset < len(body):
+                        _, offset = _read_string(body, offset)
+                        offset += 1
+                        granted.append(0)
+                    client.send(SUBACK, packet_id + bytes(granted))
+                elif packet_type == UNSUBSCRIBE:
+                    client.send(UNSUBACK, body[:2])
+                elif packet_type == PINGREQ:
+                    client.send(PINGRESP)
+                elif packet_type == DISCONNECT:
+                    break
+                await writer.drain()
+        except (asyncio.IncompleteReadError, ConnectionError):
+            pass
+        finally:
+            writer.close()
+            if connected:
+                await on_disconnect(client)
+
+    return await asyncio.start_server(on_client, host, port)
@@ -0,0 +1,63 @@
+"""
+Minimal Ogg demuxer that extracts raw Opus packets from an .ogg file,
+the same format as the sounds under main/assets.
+"""
+
+import struct
+
+
+def read_opus_packets(path):
+    """Returns (packets, sample_rate), OpusHead and OpusTags are skipped"""
+    with open(path, "rb") as f:
+        data = f.read()
+
+    packets = []
+    pending = b""
+    offset = 0
+    while offset + 27 <= len(data):
+        if data[offset:offset + 4] != b"OggS":
+            raise ValueError(f"Invalid Ogg page at offset {offset}")
+        segment_count = data[offset + 26]
+        lacing = data[offset + 27:offset + 27 + segment_count]
+        offset += 27 + segment_count
+        for size in lacing:
+            pending += data[offset:offset + size]
+            offset += size
+            # A lacing value below 255 terminates the packet
+            if size < 255:
+                packets.append(pending)
+                pending = b""
+
+    sample_rate = 48000
+    if packets and packets[0].startswith(b"OpusHead"):
+        sample_rate = struct.unpack_from("<I", packets[0], 12)[0]
+    audio = [p for p in packets if not p.startswith(b"OpusHead") and not p.startswith(b"OpusTags")]
+    return audio, sample_rate
+
+
+def packet_duration_ms(packet):
+    """Duration of an Opus packet from its TOC byte (RFC 6716 section 3.1)"""
+    if not packet:
+        return 0
+    config = packet[0] >> 3
+    if config < 12:
+        frame_ms = (10, 20, 40, 60)[config % 4]
+    elif config < 16:
+        frame_ms = (10, 20)[config % 2]
+    else:
+        frame_ms = (2.5, 5, 10, 20)[config % 4]
+    code = packet[0] & 0x03
+    if code == 0:
+        frames = 1
+    elif code in (1, 2):
+        frames = 2
+    else:
+        frames = packet[1] & 0x3F if len(packet) > 1 else 1
+    return frame_ms * frames
+
+
+if __name__ == "__main__":
+    import sys
+    packets, sample_rate = read_opus_packets(sys.argv[1])
+    total_ms = sum(packet_duration_ms(p) for p in packets)
+    print(f"{len(packets)} packets, {total_ms} ms, input sample rate {sample_rate}")
@@ -0,0 +1,613 @@
+#!/usr/bin/env python3
+"""
+Local stand-in server for the xiaozhi WebSocket and MQTT+UDP protocols.
+
+It serves the OTA check-version endpoint that points the device at itself,
+then speaks either transport: hello negotiation, BinaryProtocol 1/2/3 framing,
+AES-CTR UDP audio, stt/llm/tts/mcp messages and timestamped ping/pong.
+TTS audio is streamed from an Ogg Opus file at real time or faster, with
+optional loss, jitter and reordering, and the uplink timing is recorded.
+
+No third party packages are required.
+"""
+
+import argparse
+import asyncio
+import csv
+import json
+import os
+import socket
+import struct
+import time
+import uuid
+
+from aes_ctr import AesCtr
+from impairment import Impairment
+from ogg_opus import read_opus_packets, packet_duration_ms
+import mqtt_broker
+import session_log
+import ws_server
+
+UDP_TYPE_AUDIO = 0x01
+UDP_TYPE_RESUME = 0x02
+
+DEFAULT_TTS = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "..", "main", "assets", "common", "success.ogg")
+
+
+def now_ms():
+    return int(time.time() * 1000)
+
+
+def log(session, message):
+    print(f"[{time.strftime('%H:%M:%S')}] [{session}] {message}", flush=True)
+
+
+class UplinkRecorder:
+    """Records the arrival time of every uplink audio packet to a CSV file"""
+
+    def __init__(self, path):
+        self.file = open(path, "w", newline="") if path else None
+        self.writer = csv.writer(self.file) if self.file else None
+        if self.writer:
+            self.writer.writerow(["session_id", "transport", "arrival_ms", "offset_ms", "gap_ms", "device_timestamp", "size"])
+
+    def record(self, session_id, transport, offset_ms, gap_ms, device_timestamp, size):
+        if self.writer:
+            self.writer.writerow([session_id, transport, now_ms(), f"{offset_ms:.1f}", f"{gap_ms:.1f}", device_timestamp, size])
+            self.file.flush()
+
+
+class Session:
+    """Transport independent conversation logic"""
+
+    transport_name = ""
+
+    def __init__(self, server):
+        self.server = server
+        self.args = server.args
+        self.session_id = ""
+        self.impairment = Impairment(self.args.loss, self.args.jitter_ms, self.args.reorder, self.args.seed)
+        self.tts_task = None
+        self.listening = False
+        self.listen_mode = "auto"
+        self.responded = False
+        self.uplink_start = None
+        self.uplink_last = None
+        self.uplink_frames = 0
+        self.uplink_max_gap = 0.0
+        self.mcp_next_id = 1
+
+    # Transport specific
+    async def send_text(self, text):
+        raise NotImplementedError
+
+    async def send_audio(self, packet, timestamp):
+        raise NotImplementedError
+
+    async def send_hello(self, message):
+        raise NotImplementedError
+
+    async def send_json(self, message):
+        await self.send_text(json.dumps(message, ensure_ascii=False))
+
+    def audio_params(self):
+        return {
+            "format": "opus",
+            "sample_rate": self.args.sample_rate,
+            "channels": 1,
+            "frame_duration": self.server.frame_duration,
+        }
+
+    def new_session(self):
+        self.cancel_tts()
+        self.session_id = uuid.uuid4().hex[:8]
+        self.listening = False
+        self.responded = False
+
+    async def handle_json(self, message):
+        message_type = message.get("type")
+        if message_type == "hello":
+            self.new_session()
+            log(self.session_id, f"hello from device: {json.dumps(message, ensure_ascii=False)}")
+            await self.send_hello(message)
+            if self.server.replay_records:
+                self.cancel_tts()
+                self.tts_task = asyncio.ensure_future(self.replay())
+            if self.args.mcp:
+                await self.send_mcp("initialize", {"capabilities": {}})
+                await self.send_mcp("tools/list", {"withUserTools": True})
+                if self.args.mcp_call:
+                    name, arguments = self.args.mcp_call
+                    await self.send_mcp("tools/call", {"name": name, "arguments": json.loads(arguments)})
+            if self.args.benchmark and not self.server.benchmark_started:
+                self.server.benchmark_started = True
+                log(self.session_id, f"benchmark: {self.args.benchmark} interactions, {self.args.benchmark_interval} s apart")
+                await self.send_mcp("tools/call", {"name": "self.benchmark.wake_to_audio", "arguments": {
+                    "count": self.args.benchmark, "interval_seconds": self.args.benchmark_interval}})
+        elif message_type == "listen":
+            await self.handle_listen(message)
+        elif message_type == "abort":
+            log(self.session_id, f"abort, reason: {message.get('reason')}")
+            self.cancel_tts()
+            await self.send_json({"session_id": self.session_id, "type": "tts", "state": "stop"})
+        elif message_type == "ping":
+            await self.send_json({"type": "pong", "timestamp": message.get("timestamp"), "server_time": now_ms()})
+        elif message_type == "mcp":
+            self.handle_mcp(message.get("payload", {}))
+        elif message_type == "goodbye":
+            log(self.session_id, "goodbye")
+            self.cancel_tts()
+            self.listening = False
+            self.on_goodbye()
+        else:
+            log(self.session_id, f"message: {json.dumps(message, ensure_ascii=False)}")
+
+    def on_goodbye(self):
+        pass
+
+    async def handle_listen(self, message):
+        state = message.get("state")
+        if state == "start":
+            self.listening = True
+            self.responded = False
+            self.listen_mode = message.get("mode", "auto")
+            self.uplink_start = None
+            self.uplink_last = None
+            self.uplink_frames = 0
+            self.uplink_max_gap = 0.0
+            log(self.session_id, f"listen start, mode: {self.listen_mode}")
+        elif state == "stop":
+            log(self.session_id, "listen stop")
+            self.finish_listening()
+            await self.respond()
+        elif state == "detect":
+            log(self.session_id, f"wake word detected: {message.get('text')}")
+            if self.server.benchmark_started:
+                self.server.benchmark_runs += 1
+                log(self.session_id, f"benchmark run {self.server.benchmark_runs}/{self.args.benchmark}")
+            await self.respond()
+
+    async def handle_audio(self, payload, device_timestamp=0):
+        now = time.monotonic()
+        if self.uplink_start is None:
+            self.uplink_start = now
+            self.uplink_last = now
+        offset_ms = (now - self.uplink_start) * 1000
+        gap_ms = (now - self.uplink_last) * 1000
+        self.uplink_last = now
+        self.uplink_frames += 1
+        self.uplink_max_gap = max(self.uplink_max_gap, gap_ms)
+        self.server.recorder.record(self.session_id, self.transport_name, offset_ms, gap_ms, device_timestamp, len(payload))
+
+        # Emulate server side VAD: respond after a fixed amount of speech
+        if self.listening and self.listen_mode != "manual" and not self.responded:
+            if self.uplink_frames * self.server.frame_duration >= self.args.listen_seconds * 1000:
+                self.finish_listening()
+                await self.respond()
+
+    def finish_listening(self):
+        if self.uplink_start is not None and self.uplink_frames > 1:
+            duration_ms = (self.uplink_last - self.uplink_start) * 1000
+            log(self.session_id, f"uplink {self.uplink_frames} frames in {duration_ms:.0f} ms, "
+                f"mean gap {duration_ms / (self.uplink_frames - 1):.1f} ms, max gap {self.uplink_max_gap:.1f} ms")
+        if self.listen_mode != "realtime":
+            self.listening = False
+
+    async def respond(self):
+        if self.responded or self.server.replay_records:
+            return
+        self.responded = True
+        await self.send_json({"session_id": self.session_id, "type": "stt", "text": self.args.stt_text})
+        await self.send_json({"session_id": self.session_id, "type": "llm", "emotion": "happy", "text": "😀"})
+        self.cancel_tts()
+        self.tts_task = asyncio.ensure_future(self.stream_tts())
+
+    def cancel_tts(self):
+        if self.tts_task is not None and not self.tts_task.done():
+            self.tts_task.cancel()
+        self.tts_task = None
+
+    async def stream_tts(self):
+        await self.send_json({"session_id": self.session_id, "type": "tts", "state": "start"})
+        await self.send_json({"session_id": self.session_id, "type": "tts", "state": "sentence_start", "text": self.args.tts_text})
+
+        loop = asyncio.get_running_loop()
+        start = loop.time()
+        position_ms = 0
+        frames = 0
+        for _ in range(self.args.tts_repeat):
+            for packet in self.server.tts_packets:
+                if self.args.speed > 0:
+                    delay = start + position_ms / self.args.speed / 1000 - loop.time()
+                    if delay > 0:
+                        await asyncio.sleep(delay)
+                duration = packet_duration_ms(packet)
+                timestamp = int(position_ms)
+                self.impairment.submit(lambda p=packet, t=timestamp: self.send_audio(p, t), duration)
+                position_ms += duration
+                frames += 1
+
+        # Let delayed packets go out before ending the sentence
+        await asyncio.sleep((self.args.jitter_ms + 2 * self.server.frame_duration) / 1000)
+        elapsed_ms = (loop.time() - start) * 1000
+        log(self.session_id, f"tts {frames} frames, {position_ms:.0f} ms audio in {elapsed_ms:.0f} ms, {self.impairment.summary()}")
+        await self.send_json({"session_id": self.session_id, "type": "tts", "state": "stop"})
+        if self.server.benchmark_runs >= self.args.benchmark > 0 and not self.server.benchmark_reported:
+            # The device logs each run, fetch the aggregate before it closes the last session
+            self.server.benchmark_reported = True
+            await self.send_mcp("tools/call", {"name": "self.system.get_interaction_latency", "arguments": {}})
+
+    async def replay(self):
+        """Send the recorded downlink of a session log with its original timing"""
+        records = self.server.replay_records
+        log(self.session_id, f"replaying {len(records)} records, {records[-1].time_ms - records[0].time_ms} ms")
+        loop = asyncio.get_running_loop()
+        start = loop.time()
+        for record in records:
+            if self.args.speed > 0:
+                delay = start + (record.time_ms - records[0].time_ms) / self.args.speed / 1000 - loop.time()
+                if delay > 0:
+                    await asyncio.sleep(delay)
+            if record.type == session_log.INCOMING_JSON:
+                await self.send_text(record.payload.decode("utf-8"))
+            elif self.impairment.enabled:
+                self.impairment.submit(lambda r=record: self.send_audio(r.payload, r.timestamp), self.server.frame_duration)
+            else:
+                await self.send_audio(record.payload, record.timestamp)
+        log(self.session_id, f"replay finished in {(loop.time() - start) * 1000:.0f} ms")
+
+    async def send_mcp(self, method, params):
+        payload = {"jsonrpc": "2.0", "id": self.mcp_next_id, "method": method, "params": params}
+        self.mcp_next_id += 1
+        await self.send_json({"session_id": self.session_id, "type": "mcp", "payload": payload})
+
+    def handle_mcp(self, payload):
+        result = payload.get("result")
+        if isinstance(result, dict) and "tools" in result:
+            names = [tool.get("name") for tool in result["tools"]]
+            log(self.session_id, f"mcp tools: {', '.join(names)}")
+        else:
+            log(self.session_id, f"mcp: {json.dumps(payload, ensure_ascii=False)}")
+
+
+class WebsocketSession(Session):
+    transport_name = "websocket"
+
+    def __init__(self, server, connection):
+        super().__init__(server)
+        self.connection = connection
+        self.version = int(connection.headers.get("protocol-version", "1"))
+
+    async def run(self):
+        log("ws", f"connected from {self.connection.remote_address}, path {self.connection.path}, "
+            f"device {self.connection.headers.get('device-id')}, version {self.version}")
+        try:
+            while True:
+                data = await self.connection.recv()
+                if isinstance(data, str):
+                    await self.handle_json(json.loads(data))
+                elif self.version == 2:
+                    _, _, _, timestamp, size = struct.unpack_from(">HHIII", data)
+                    await self.handle_audio(data[16:16 + size], timestamp)
+                elif self.version == 3:
+                    _, _, size = struct.unpack_from(">BBH", data)
+                    await self.handle_audio(data[4:4 + size])
+                else:
+                    await self.handle_audio(data)
+        finally:
+            self.cancel_tts()
+            log(self.session_id or "ws", "disconnected")
+
+    async def send_text(self, text):
+        await self.connection.send(text)
+
+    async def send_audio(self, packet, timestamp):
+        if self.connection.closed:
+            return
+        if self.version == 2:
+            data = struct.pack(">HHIII", 2, 0, 0, timestamp, len(packet)) + packet
+        elif self.version == 3:
+            data = struct.pack(">BBH", 0, 0, len(packet)) + packet
+        else:
+            data = packet
+        try:
+            await self.connection.send(data)
+        except ws_server.ConnectionClosed:
+            pass
+
+    async def send_hello(self, message):
+        await self.send_json({
+            "type": "hello",
+            "transport": "websocket",
+            "session_id": self.session_id,
+            "audio_params": self.audio_params(),
+        })
+
+
+class MqttSession(Session):
+    transport_name = "mqtt"
+
+    def __init__(self, server, client):
+        super().__init__(server)
+        self.client = client
+        self.topic = f"devices/p2p/{client.client_id}"
+        self.key = None
+        self.nonce = None
+        self.aes = None
+        self.ssrc = None
+        self.udp_address = None
+        self.local_sequence = 0
+        self.parked_until = None
+
+    async def send_text(self, text):
+        await self.client.publish(self.topic, text)
+
+    async def send_hello(self, message):
+        self.server.udp.unregister(self)
+        self.key = os.urandom(16)
+        self.ssrc = os.urandom(4)
+        # |type 1u|flags 1u|payload_len 2u|ssrc 4u|timestamp 4u|sequence 4u|
+        self.nonce = bytes([UDP_TYPE_AUDIO, 0, 0, 0]) + self.ssrc + bytes(8)
+        self.aes = AesCtr(self.key)
+        self.local_sequence = 0
+        self.parked_until = None
+        self.server.udp.register(self)
+        udp = {
+            "server": self.args.public_host,
+            "port": self.args.udp_port,
+            "encryption": "aes-128-ctr",
+            "key": self.key.hex(),
+            "nonce": self.nonce.hex(),
+        }
+        if self.args.resume_ttl > 0:
+            udp["resume_ttl"] = self.args.resume_ttl
+        await self.send_json({
+            "type": "hello",
+            "transport": "udp",
+            "session_id": self.session_id,
+            "audio_params": self.audio_params(),
+            "udp": udp,
+        })
+
+    def on_goodbye(self):
+        if self.args.resume_ttl > 0:
+            self.parked_until = time.monotonic() + self.args.resume_ttl
+        else:
+            self.server.udp.unregister(self)
+
+    def build_packet(self, packet_type, payload, timestamp):
+        self.local_sequence += 1
+        header = bytearray(self.nonce)
+        header[0] = packet_type
+        struct.pack_into(">H", header, 2, len(payload))
+        struct.pack_into(">II", header, 8, timestamp & 0xFFFFFFFF, self.local_sequence)
+        return bytes(header) + self.aes.crypt(header, payload)
+
+    async def send_audio(self, packet, timestamp):
+        if self.udp_address is None:
+            log(self.session_id, "no uplink packet received yet, UDP address unknown")
+            return
+        self.server.udp.sendto(self.build_packet(UDP_TYPE_AUDIO, packet, timestamp), self.udp_address)
+
+    def handle_udp(self, data, address):
+        self.udp_address = address
+        header = data[:16]
+        payload = self.aes.crypt(header, data[16:])
+        timestamp = struct.unpack_from(">I", header, 8)[0]
+        if data[0] == UDP_TYPE_RESUME:
+            if payload.decode(errors="replace") != self.session_id:
+                log(self.session_id, "resume with unknown session id, ignored")
+                return
+            if self.parked_until is not None and time.monotonic() > self.parked_until:
+                log(self.session_id, "resume after TTL expired, ignored")
+                return
+            self.parked_until = None
+            log(self.session_id, "UDP session resumed")
+            self.server.udp.sendto(self.build_packet(UDP_TYPE_RESUME, self.session_id.encode(), 0), address)
+        elif data[0] == UDP_TYPE_AUDIO:
+            asyncio.ensure_future(self.handle_audio(payload, timestamp))
+
+
+class UdpAudioServer(asyncio.DatagramProtocol):
+    def __init__(self):
+        self.transport = None
+        self.sessions = {}
+
+    def connection_made(self, transport):
+        self.transport = transport
+
+    def register(self, session):
+        self.sessions[session.ssrc] = session
+
+    def unregister(self, session):
+        if session.ssrc is not None:
+            self.sessions.pop(session.ssrc, None)
+
+    def sendto(self, data, address):
+        self.transport.sendto(data, address)
+
+    def datagram_received(self, data, address):
+        if len(data) < 16:
+            return
+        session = self.sessions.get(data[4:8])
+        if session is None:
+            print(f"UDP packet from {address} with unknown ssrc {data[4:8].hex()}", flush=True)
+            return
+        session.handle_udp(data, address)
+
+
+class LocalServer:
+    def __init__(self, args):
+        self.args = args
+        self.tts_packets, _ = read_opus_packets(args.tts)
+        self.frame_duration = int(packet_duration_ms(self.tts_packets[0])) if self.tts_packets else 60
+        self.recorder = UplinkRecorder(args.record)
+        self.udp = UdpAudioServer()
+        self.mqtt_sessions = {}
+        self.replay_records = []
+        # Wake to first audio benchmark driven through MCP
+        self.benchmark_started = False
+        self.benchmark_runs = 0
+        self.benchmark_reported = False
+        if args.replay:
+            # hello and pong are answered live, everything else is sent as recorded
+            _, records = session_log.read_log(args.replay)
+            for record in records:
+                if record.type == session_log.INCOMING_AUDIO:
+                    self.replay_records.append(record)
+                elif record.type == session_log.INCOMING_JSON:
+                    message_type = json.loads(record.payload).get("type")
+                    if message_type not in ("hello", "pong"):
+                        self.replay_records.append(record)
+            if not self.replay_records:
+                raise ValueError(f"No downlink records in {args.replay}")
+
+    def ota_response(self, headers):
+        response = {
+            "server_time": {"timestamp": now_ms(), "timezone_offset": -time.timezone // 60},
+            "firmware": {"version": "0.0.0", "url": ""},
+        }
+        if self.args.transport == "websocket":
+            websocket = {
+                "url": f"ws://{self.args.public_host}:{self.args.ws_port}/xiaozhi/v1/",
+                "token": "local-test",
+                "version": self.args.protocol_version,
+            }
+            if self.args.idle_timeout > 0:
+                websocket["idle_timeout"] = self.args.idle_timeout
+            response["websocket"] = websocket
+        else:
+            device_id = headers.get("device-id", "unknown")
+            response["mqtt"] = {
+                "endpoint": f"{self.args.public_host}:{self.args.mqtt_port}",
+                "client_id": f"GID_local@@@{device_id.replace(':', '_')}",
+                "username": "local",
+                "password": "local",
+                "publish_topic": "device-server",
+                "keepalive": 240,
+            }
+        return response
+
+    async def handle_ota(self, reader, writer):
+        try:
+            request = await reader.readuntil(b"\r\n\r\n")
+            lines = request.decode("latin-1").split("\r\n")
+            headers = {}
+            for line in lines[1:]:
+                if ":" in line:
+                    name, value = line.split(":", 1)
+                    headers[name.strip().lower()] = value.strip()
+            length = int(headers.get("content-length", "0"))
+            if length:
+                await reader.readexactly(length)
+            body = json.dumps(self.ota_response(headers)).encode()
+            writer.write(b"HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n"
+                         + f"Content-Length: {len(body)}\r\nConnection: close\r\n\r\n".encode() + body)
+            await writer.drain()
+            log("ota", f"{lines[0]} from {headers.get('device-id')}, transport {self.args.transport}")
+        except (asyncio.IncompleteReadError, asyncio.LimitOverrunError, ConnectionError):
+            pass
+        finally:
+            writer.close()
+
+    async def handle_websocket(self, connection):
+        await WebsocketSession(self, connection).run()
+
+    async def on_mqtt_connect(self, client):
+        log("mqtt", f"client {client.client_id} connected from {client.remote_address}")
+        old = self.mqtt_sessions.get(client.client_id)
+        session = MqttSession(self, client)
+        if old is not None:
+            # Keep the UDP session so that a resume after reconnect still works
+            for name in ("session_id", "key", "nonce", "aes", "ssrc", "udp_address", "local_sequence", "parked_until"):
+                setattr(session, name, getattr(old, name))
+            old.cancel_tts()
+            if session.ssrc is not None:
+                self.udp.register(session)
+        self.mqtt_sessions[client.client_id] = session
+
+    async def on_mqtt_message(self, client, topic, payload):
+        session = self.mqtt_sessions.get(client.client_id)
+        if session is not None:
+            await session.handle_json(json.loads(payload))
+
+    async def on_mqtt_disconnect(self, client):
+        log("mqtt", f"client {client.client_id} disconnected")
+        session = self.mqtt_sessions.get(client.client_id)
+        if session is not None and session.client is client:
+            session.cancel_tts()
+
+    async def run(self):
+        args = self.args
+        loop = asyncio.get_running_loop()
+        servers = [await asyncio.start_server(self.handle_ota, args.host, args.ota_port)]
+        if args.transport == "websocket":
+            servers.append(await ws_server.serve(self.handle_websocket, args.host, args.ws_port))
+        else:
+            servers.append(await mqtt_broker.serve(args.host, args.mqtt_port,
+                                                   self.on_mqtt_connect, self.on_mqtt_message, self.on_mqtt_disconnect))
+            await loop.create_datagram_endpoint(lambda: self.udp, local_addr=(args.host, args.udp_port))
+
+        print(f"OTA URL: http://{args.public_host}:{args.ota_port}/xiaozhi/ota/", flush=True)
+        if args.transport == "websocket":
+            print(f"WebSocket: ws://{args.public_host}:{args.ws_port}/xiaozhi/v1/ (binary protocol {args.protocol_version})", flush=True)
+        else:
+            print(f"MQTT: {args.public_host}:{args.mqtt_port}, UDP: {args.udp_port}", flush=True)
+        print(f"TTS: {len(self.tts_packets)} packets x {args.tts_repeat}, {self.frame_duration} ms frames, "
+              f"speed {args.speed if args.speed > 0 else 'unlimited'}", flush=True)
+        if self.udp.transport is None and args.transport == "mqtt":
+            raise RuntimeError("Failed to open UDP port")
+        await asyncio.gather(*(server.serve_forever() for server in servers))
+
+
+def detect_public_host():
+    # No packet is sent, connect() only selects the outgoing interface
+    with socket.socket(socket.AF_INET, socket.SOCK_DGRAM) as s:
+        try:
+            s.connect(("8.8.8.8", 80))
+            return s.getsockname()[0]
+        except OSError:
+            return "127.0.0.1"
+
+
+def main():
+    parser = argparse.ArgumentParser(description="本地协议测试服务器 (WebSocket / MQTT+UDP)")
+    parser.add_argument("--transport", choices=["websocket", "mqtt"], default="websocket", help="下发给设备的协议 (默认: websocket)")
+    parser.add_argument("--host", default="0.0.0.0", help="监听地址")
+    parser.add_argument("--public-host", default=None, help="设备访问本机使用的 IP (默认自动检测)")
+    parser.add_argument("--ota-port", type=int, default=8002)
+    parser.add_argument("--ws-port", type=int, default=8000)
+    parser.add_argument("--mqtt-port", type=int, default=1883)
+    parser.add_argument("--udp-port", type=int, default=8884)
+    parser.add_argument("--protocol-version", type=int, choices=[1, 2, 3], default=1, help="WebSocket 二进制协议版本")
+    parser.add_argument("--sample-rate", type=int, default=24000, help="hello 中下发的下行采样率")
+    parser.add_argument("--tts", default=DEFAULT_TTS, help="TTS 使用的 Ogg Opus 文件")
+    parser.add_argument("--tts-repeat", type=int, default=1, help="TTS 音频重复次数，用于长时间压测")
+    parser.add_argument("--speed", type=float, default=1.0, help="下发速度倍数，1 为实时，0 为不限速")
+    parser.add_argument("--tts-text", default="这是本地测试服务器的回复。")
+    parser.add_argument("--stt-text", default="你好")
+    parser.add_argument("--listen-seconds", type=float, default=3.0, help="自动模式下收到多少秒语音后开始回复")
+    parser.add_argument("--loss", type=float, default=0.0, help="下行丢包率 (0-1)")
+    parser.add_argument("--jitter-ms", type=int, default=0, help="下行随机延迟上限 (毫秒)")
+    parser.add_argument("--reorder", type=float, default=0.0, help="下行乱序概率 (0-1)")
+    parser.add_argument("--seed", type=int, default=None, help="随机种子，便于复现")
+    parser.add_argument("--resume-ttl", type=int, default=0, help="MQTT UDP 会话恢复时间 (秒)，0 为关闭")
+    parser.add_argument("--idle-timeout", type=int, default=0, help="WebSocket 空闲保持时间 (秒)，0 为关闭")
+    parser.add_argument("--mcp", action="store_true", help="hello 后发送 MCP initialize 与 tools/list")
+    parser.add_argument("--mcp-call", nargs=2, metavar=("NAME", "ARGUMENTS"), help="tools/list 后调用的工具，例如 self.get_device_status '{}'")
+    parser.add_argument("--record", default=None, help="上行音频到达时间记录 CSV 文件")
+    parser.add_argument("--benchmark", type=int, default=0, help="首次 hello 后通过 MCP 让设备自动进行 N 次唤醒对话，统计唤醒到首个 TTS 音频的耗时")
+    parser.add_argument("--benchmark-interval", type=int, default=3, help="自动唤醒对话的间隔 (秒)")
+    parser.add_argument("--replay", default=None, help="hello 后按原始时序重放 SessionRecorder 日志中的下行消息与音频")
+    args = parser.parse_args()
+    if args.public_host is None:
+        args.public_host = detect_public_host()
+
+    try:
+        asyncio.run(LocalServer(args).run())
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,178 @@
+#!/usr/bin/env python3
+"""
+Reader and tools for session logs written by SessionRecorder (main/protocols/session_recorder.h).
+
+  python session_log.py receive --port 9999 -o session.bin   receive a log streamed to udp://host:9999
+  python session_log.py dump session.bin                     list the records
+  python session_log.py stats session.bin                    per type counts and downlink timing
+  python session_log.py diff a.bin b.bin                     compare the downlink audio of two sessions
+
+A log is replayed to a device with `server.py --replay session.bin`.
+"""
+
+import argparse
+import socket
+import struct
+import sys
+
+MAGIC = b"XZSR"
+FILE_HEADER = struct.Struct("<4sHHq")
+RECORD_HEADER = struct.Struct("<BBHII")
+
+INCOMING_AUDIO = 1
+OUTGOING_AUDIO = 2
+INCOMING_JSON = 3
+OUTGOING_JSON = 4
+TYPE_NAMES = {
+    INCOMING_AUDIO: "audio <-",
+    OUTGOING_AUDIO: "audio ->",
+    INCOMING_JSON: "json  <-",
+    OUTGOING_JSON: "json  ->",
+}
+FLAG_TRUNCATED = 0x01
+
+
+class Record:
+    __slots__ = ("type", "flags", "time_ms", "timestamp", "payload")
+
+    def __init__(self, record_type, flags, time_ms, timestamp, payload):
+        self.type = record_type
+        self.flags = flags
+        self.time_ms = time_ms
+        self.timestamp = timestamp
+        self.payload = payload
+
+    @property
+    def is_audio(self):
+        return self.type in (INCOMING_AUDIO, OUTGOING_AUDIO)
+
+    @property
+    def is_incoming(self):
+        return self.type in (INCOMING_AUDIO, INCOMING_JSON)
+
+
+def read_log(path):
+    """Returns (unix_time_ms, records). A log received over UDP may miss its file header."""
+    with open(path, "rb") as f:
+        data = f.read()
+    unix_time_ms = 0
+    offset = 0
+    if data[:4] == MAGIC:
+        _, version, header_size, unix_time_ms = FILE_HEADER.unpack_from(data)
+        if version != 1:
+            raise ValueError(f"Unsupported log version {version}")
+        offset = header_size
+
+    records = []
+    while offset + RECORD_HEADER.size <= len(data):
+        record_type, flags, size, time_ms, timestamp = RECORD_HEADER.unpack_from(data, offset)
+        offset += RECORD_HEADER.size
+        if record_type not in TYPE_NAMES or offset + size > len(data):
+            raise ValueError(f"Corrupted record at offset {offset - RECORD_HEADER.size}")
+        records.append(Record(record_type, flags, time_ms, timestamp, data[offset:offset + size]))
+        offset += size
+    return unix_time_ms, records
+
+
+def receive(args):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind((args.host, args.port))
+    print(f"Listening on udp://{args.host}:{args.port}, writing {args.output}, Ctrl+C to stop")
+    total = 0
+    with open(args.output, "wb") as f:
+        try:
+            while True:
+                data, address = sock.recvfrom(65536)
+                f.write(data)
+                f.flush()
+                total += len(data)
+                print(f"\r{total} bytes from {address[0]}", end="", flush=True)
+        except KeyboardInterrupt:
+            print()
+
+
+def dump(args):
+    unix_time_ms, records = read_log(args.log)
+    if unix_time_ms:
+        print(f"start time: {unix_time_ms} ms")
+    for record in records:
+        if record.is_audio:
+            detail = f"{len(record.payload)} bytes, timestamp {record.timestamp}"
+        else:
+            detail = record.payload.decode("utf-8", errors="replace")
+        truncated = " (truncated)" if record.flags & FLAG_TRUNCATED else ""
+        print(f"{record.time_ms:>9} ms  {TYPE_NAMES[record.type]}  {detail}{truncated}")
+
+
+def downlink_gaps(records):
+    times = [r.time_ms for r in records if r.type == INCOMING_AUDIO]
+    return [b - a for a, b in zip(times, times[1:])]
+
+
+def stats(args):
+    _, records = read_log(args.log)
+    if not records:
+        print("empty log")
+        return
+    for record_type, name in TYPE_NAMES.items():
+        selected = [r for r in records if r.type == record_type]
+        size = sum(len(r.payload) for r in selected)
+        print(f"{name}: {len(selected)} records, {size} bytes")
+    print(f"duration: {records[-1].time_ms - records[0].time_ms} ms")
+    gaps = downlink_gaps(records)
+    if gaps:
+        gaps.sort()
+        print(f"downlink audio gap: mean {sum(gaps) / len(gaps):.1f} ms, p50 {gaps[len(gaps) // 2]} ms, "
+              f"p99 {gaps[min(len(gaps) - 1, len(gaps) * 99 // 100)]} ms, max {gaps[-1]} ms")
+
+
+def diff(args):
+    _, a = read_log(args.a)
+    _, b = read_log(args.b)
+    audio_a = [r for r in a if r.type == INCOMING_AUDIO]
+    audio_b = [r for r in b if r.type == INCOMING_AUDIO]
+    mismatches = 0
+    for index, (x, y) in enumerate(zip(audio_a, audio_b)):
+        if x.payload != y.payload:
+            mismatches += 1
+            if mismatches <= 10:
+                print(f"packet {index} differs: {len(x.payload)} vs {len(y.payload)} bytes")
+    print(f"downlink audio: {len(audio_a)} vs {len(audio_b)} packets, {mismatches} payload mismatches")
+    if audio_a and audio_b:
+        # Timing relative to the first downlink packet of each session
+        deltas = [(y.time_ms - audio_b[0].time_ms) - (x.time_ms - audio_a[0].time_ms) for x, y in zip(audio_a, audio_b)]
+        print(f"arrival time drift: min {min(deltas)} ms, max {max(deltas)} ms, final {deltas[-1]} ms")
+    identical = mismatches == 0 and len(audio_a) == len(audio_b)
+    print("identical" if identical else "different")
+    return 0 if identical else 1
+
+
+def main():
+    parser = argparse.ArgumentParser(description="SessionRecorder 日志工具")
+    subparsers = parser.add_subparsers(dest="command", required=True)
+
+    p = subparsers.add_parser("receive", help="接收设备通过 UDP 发送的日志")
+    p.add_argument("--host", default="0.0.0.0")
+    p.add_argument("--port", type=int, default=9999)
+    p.add_argument("-o", "--output", default="session.bin")
+    p.set_defaults(func=receive)
+
+    p = subparsers.add_parser("dump", help="列出所有记录")
+    p.add_argument("log")
+    p.set_defaults(func=dump)
+
+    p = subparsers.add_parser("stats", help="统计信息")
+    p.add_argument("log")
+    p.set_defaults(func=stats)
+
+    p = subparsers.add_parser("diff", help="比较两个日志的下行音频")
+    p.add_argument("a")
+    p.add_argument("b")
+    p.set_defaults(func=diff)
+
+    args = parser.parse_args()
+    sys.exit(args.func(args) or 0)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,154 @@
+"""
+Minimal RFC 6455 WebSocket server on asyncio, enough for WebsocketProtocol:
+handshake, text/binary/continuation frames, ping/pong and close.
+"""
+
+import asyncio
+import base64
+import hashlib
+import struct
+
+WS_GUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+OP_CONTINUATION = 0x0
+OP_TEXT = 0x1
+OP_BINARY = 0x2
+OP_CLOSE = 0x8
+OP_PING = 0x9
+OP_PONG = 0xA
+
+
+class ConnectionClosed(Exception):
+    pass
+
+
+class WebSocketConnection:
+    def __init__(self, reader, writer, path, headers):
+        self.reader = reader
+        self.writer = writer
+        self.path = path
+        self.headers = headers
+        self.remote_address = writer.get_extra_info("peername")
+        self.closed = False
+        self.send_lock = asyncio.Lock()
+
+    async def recv(self):
+        """Returns str for text messages and bytes for binary messages"""
+        message = b""
+        message_opcode = None
+        while True:
+            header = await self._read_exactly(2)
+            fin = header[0] & 0x80
+            opcode = header[0] & 0x0F
+            masked = header[1] & 0x80
+            length = header[1] & 0x7F
+            if length == 126:
+                length = struct.unpack(">H", await self._read_exactly(2))[0]
+            elif length == 127:
+                length = struct.unpack(">Q", await self._read_exactly(8))[0]
+            mask = await self._read_exactly(4) if masked else None
+            payload = await self._read_exactly(length)
+            if mask:
+                payload = bytes(b ^ mask[i % 4] for i, b in enumerate(payload))
+
+            if opcode == OP_PING:
+                await self._send_frame(OP_PONG, payload)
+                continue
+            if opcode == OP_PONG:
+                continue
+            if opcode == OP_CLOSE:
+                if not self.closed:
+                    await self._send_frame(OP_CLOSE, payload[:2])
+                self.closed = True
+                raise ConnectionClosed()
+
+            if opcode != OP_CONTINUATION:
+                message_opcode = opcode
+            message += payload
+            if fin:
+                return message.decode("utf-8") if message_opcode == OP_TEXT else message
+
+    async def send(self, data):
+        if isinstance(data, str):
+            await self._send_frame(OP_TEXT, data.encode("utf-8"))
+        else:
+            await self._send_frame(OP_BINARY, bytes(data))
+
+    async def close(self):
+        if not self.closed:
+            self.closed = True
+            try:
+                await self._send_frame(OP_CLOSE, struct.pack(">H", 1000))
+            except ConnectionError:
+                pass
+        self.writer.close()
+
+    async def _read_exactly(self, size):
+        try:
+            return await self.reader.readexactly(size)
+        except (asyncio.IncompleteReadError, ConnectionError):
+            self.closed = True
+            raise ConnectionClosed()
+
+    async def _send_frame(self, opcode, payload):
+        # Server frames are never masked
+        length = len(payload)
+        if length < 126:
+            header = struct.pack(">BB", 0x80 | opcode, length)
+        elif length < 65536:
+            header = struct.pack(">BBH", 0x80 | opcode, 126, length)
+        else:
+            header = struct.pack(">BBQ", 0x80 | opcode, 127, length)
+        async with self.send_lock:
+            if self.writer.is_closing():
+                raise ConnectionClosed()
+            self.writer.write(header + payload)
+            await self.writer.drain()
+
+
+async def _handshake(reader, writer):
+    request = await reader.readuntil(b"\r\n\r\n")
+    lines = request.decode("latin-1").split("\r\n")
+    method, path, _ = lines[0].split(" ", 2)
+    headers = {}
+    for line in lines[1:]:
+        if ":" in line:
+            name, value = line.split(":", 1)
+            headers[name.strip().lower()] = value.strip()
+
+    key = headers.get("sec-websocket-key")
+    if method != "GET" or key is None:
+        writer.write(b"HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\n\r\n")
+        await writer.drain()
+        writer.close()
+        return None
+
+    accept = base64.b64encode(hashlib.sha1((key + WS_GUID).encode()).digest()).decode()
+    writer.write((
+        "HTTP/1.1 101 Switching Protocols\r\n"
+        "Upgrade: websocket\r\n"
+        "Connection: Upgrade\r\n"
+        f"Sec-WebSocket-Accept: {accept}\r\n\r\n"
+    ).encode())
+    await writer.drain()
+    return WebSocketConnection(reader, writer, path, headers)
+
+
+async def serve(handler, host, port):
+    """handler(connection) is called for each accepted connection"""
+    async def on_client(reader, writer):
+        try:
+            connection = await _handshake(reader, writer)
+        except (asyncio.IncompleteReadError, asyncio.LimitOverrunError, ConnectionError, ValueError):
+            writer.close()
+            return
+        if connection is None:
+            return
+        try:
+            await handler(connection)
+        except ConnectionClosed:
+            pass
+        finally:
+            writer.close()
+
+    return await asyncio.start_server(on_client, host, port)
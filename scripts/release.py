@@ -6,6 +6,8 @@ import argparse
 from pathlib import Path
 from typing import Optional
 
+from stream_compress import compress
+
 # Switch to project root directory
 os.chdir(Path(__file__).resolve().parent.parent)
 
@@ -57,6 +59,22 @@ def zip_bin(name: str, version: str) -> None:
         zipf.write("build/merged-binary.bin", arcname="merged-binary.bin")
     print(f"zip bin to {output_path} done")
 
+
+def compress_app_bin(name: str, version: str) -> None:
+    """Compress build/xiaozhi.bin to releases/v{version}_{name}.bin.xzc, for firmware.compressed_url in OTA"""
+    app_bin = Path("build/xiaozhi.bin")
+    if not app_bin.exists():
+        print(f"[WARN] {app_bin} does not exist, skip compression", file=sys.stderr)
+        return
+    out_dir = Path("releases")
+    out_dir.mkdir(exist_ok=True)
+    output_path = out_dir / f"v{version}_{name}.bin.xzc"
+
+    data = app_bin.read_bytes()
+    compressed = compress(data)
+    output_path.write_bytes(compressed)
+    print(f"compress {app_bin} to {output_path} done, {len(data)} -> {len(compressed)} bytes")
+
 ################################################################################
 # board / variant related functions
 ################################################################################
@@ -241,6 +259,9 @@ def release(board_type: str, config_filename: str = "config.json", *, filter_nam
         # Zip
         zip_bin(name, project_version)
 
+        # Compressed app image for OTA
+        compress_app_bin(name, project_version)
+
 ################################################################################
 # CLI entry
 ################################################################################
@@ -274,6 +295,7 @@ if __name__ == "__main__":
             sys.exit(1)
         project_ver = get_project_version()
         zip_bin(curr_board_type, project_ver)
+        compress_app_bin(curr_board_type, project_ver)
         sys.exit(0)
 
     # Compile mode
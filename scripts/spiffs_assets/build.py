@@ -345,6 +345,7 @@ def main():
 
     parser.add_argument('--res_path', help='Path to res directory')
     parser.add_argument('--target_board', help='Path to target board directory')
+    parser.add_argument('--compress', action='store_true', help='Also write build/assets.bin.xzc, compressed for the download')
     
     args = parser.parse_args()
     
@@ -393,6 +394,17 @@ def main():
     
     # Copy build/output/assets.bin to build/assets.bin
     shutil.copy(os.path.join(build_dir, "output", "assets.bin"), os.path.join(build_dir, "assets.bin"))
+
+    # Compressed copy for the download, decompressed by the firmware while it is written
+    if args.compress:
+        try:
+            subprocess.run([
+                sys.executable, os.path.join(os.path.dirname(script_dir), "stream_compress.py"),
+                os.path.join(build_dir, "assets.bin")
+            ], check=True)
+        except subprocess.CalledProcessError as e:
+            print(f"Error: Failed to compress assets.bin: {e}")
+            sys.exit(1)
     print("Build completed!")
 
 
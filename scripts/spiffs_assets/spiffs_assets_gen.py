@@ -1,6 +1,7 @@
 # SPDX-FileCopyrightText: 2024-2025 Espressif Systems (Shanghai) CO LTD
 # SPDX-License-Identifier: Apache-2.0
 import io
+import hashlib
 import os
 import argparse
 import json
@@ -52,13 +53,35 @@ def generate_header_filename(path):
     header_filename = f'mmap_generate_{asset_name}.h'
     return header_filename
 
+ASSETS_DIGEST_MAGIC = b'ZSHA'
+ASSETS_FILE_HASHES_MAGIC = b'ZFHT'
+
 def compute_checksum(data):
     checksum = sum(data) & 0xFFFF
     return checksum
 
+def write_assets_manifest(out_file, final_data, file_entries):
+    """
+    Write <name>.manifest.json next to the assets file, for differential updates on the device.
+    Each entry is (name, offset of the 0x5A5A prefix in the file, size, width, height, sha256).
+    """
+    manifest = {
+        'version': 1,
+        'size': len(final_data),
+        'sha256': hashlib.sha256(final_data).hexdigest(),
+        'files': [
+            {'name': name, 'offset': offset, 'size': size, 'width': width, 'height': height, 'sha256': digest.hex()}
+            for name, offset, size, width, height, digest in file_entries
+        ],
+    }
+    manifest_path = os.path.splitext(out_file)[0] + '.manifest.json'
+    with open(manifest_path, 'w') as f:
+        json.dump(manifest, f, indent=1)
+    return manifest_path
+
 def sort_key(filename):
-    basename, extension = os.path.splitext(filename)
-    return extension, basename
+    # The firmware binary searches the file table, so it is in byte order of the names
+    return filename.encode('utf-8')
 
 def download_v8_script(convert_path):
     """
@@ -401,6 +424,7 @@ def pack_assets(config: PackModelsConfig):
 
     merged_data = bytearray()
     file_info_list = []
+    file_hashes = []
     skip_files = ['config.json', 'lvgl_image_converter']
 
     file_list = sorted(os.listdir(target_path), key=sort_key)
@@ -437,6 +461,7 @@ def pack_assets(config: PackModelsConfig):
             bin_data = bin_file.read()
 
         merged_data.extend(bin_data)
+        file_hashes.append(hashlib.sha256(bin_data).digest())
 
     total_files = len(file_info_list)
 
@@ -456,9 +481,18 @@ def pack_assets(config: PackModelsConfig):
     combined_data_length = len(combined_data).to_bytes(4, byteorder='little')
     header_data = total_files.to_bytes(4, byteorder='little') + combined_checksum.to_bytes(4, byteorder='little')
     final_data = header_data + combined_data_length + combined_data
+    # SHA-256 trailer, checked by the firmware while downloading; older firmware stops at combined_data_length
+    final_data += ASSETS_DIGEST_MAGIC + hashlib.sha256(final_data).digest()
+    # Per-file hashes, in table order, so that the firmware can compare the files with a manifest
+    final_data += ASSETS_FILE_HASHES_MAGIC + total_files.to_bytes(4, byteorder='little') + b''.join(file_hashes)
 
     with open(out_file, 'wb') as output_bin:
         output_bin.write(final_data)
+    data_start = len(header_data) + len(combined_data_length) + len(mmap_table)
+    manifest_path = write_assets_manifest(out_file, final_data, [
+        (file_name[:int(max_name_len)], data_start + offset, file_size, width, height, digest)
+        for (file_name, offset, file_size, width, height), digest in zip(file_info_list, file_hashes)
+    ])
 
     os.makedirs(assets_include_path, exist_ok=True)
     current_year = datetime.now().year
@@ -488,6 +522,8 @@ def pack_assets(config: PackModelsConfig):
         output_header.write('};\n')
 
     print(f'All bin files have been merged into {os.path.basename(out_file)}')
+    print(f'sha256: {hashlib.sha256(final_data).hexdigest()}')
+    print(f'manifest: {os.path.basename(manifest_path)}')
 
 def copy_assets(config: AssetCopyConfig):
     """
@@ -0,0 +1,229 @@
+#!/usr/bin/env python3
+"""
+Compresses firmware and assets images for the streaming decompression on the device
+(main/stream_decompressor.h). The device writes the original bytes to flash as the compressed file
+is received, so the SHA-256 to publish is the one of the original image, as printed.
+
+  python stream_compress.py build/xiaozhi.bin -o xiaozhi.bin.xzc
+  python stream_compress.py build/generated_assets.bin --window-bits 15     32 KB window, needs PSRAM to spare
+  python stream_compress.py --decompress xiaozhi.bin.xzc -o xiaozhi.bin     check a file on the host
+
+Serve the compressed firmware as firmware.compressed_url in the OTA response. Assets download URLs
+may point to either file, the device tells them apart by the magic.
+
+The assets packers also use compress_asset() to store single files compressed in the partition.
+"""
+
+import argparse
+import hashlib
+import struct
+import sys
+
+MAGIC = b"XZC1"
+MIN_MATCH = 4
+DEFAULT_WINDOW_BITS = 14
+MIN_WINDOW_BITS = 10
+MAX_WINDOW_BITS = 16
+# Candidates tried for each position, more is slower and compresses a little better
+MAX_CHAIN = 8
+
+# Assets files by how the firmware reads them (main/assets_cache.h)
+ASSETS_READ_ONCE = ('.json',)           # Parsed at load, then released
+ASSETS_ON_DEMAND = ('.aaf',)            # Played one at a time, cached while recently used
+ASSETS_IN_PLACE = ('srmodels.bin',)     # Mapped by the speech models, never compressed
+# A decompressed copy is only worth it when it saves this much of the partition
+ASSETS_MIN_SAVING = 0.1
+
+
+def _write_length(out, length):
+    while length >= 255:
+        out.append(255)
+        length -= 255
+    out.append(length)
+
+
+def _write_sequence(out, literals, match_length, offset):
+    literal_count = len(literals)
+    match_code = match_length - MIN_MATCH if match_length else 0
+    out.append((min(literal_count, 15) << 4) | min(match_code, 15))
+    if literal_count >= 15:
+        _write_length(out, literal_count - 15)
+    out += literals
+    if match_length:
+        out += struct.pack("<H", offset)
+        if match_code >= 15:
+            _write_length(out, match_code - 15)
+
+
+def _match_length(data, a, b, limit):
+    """Length of the common run at a and b, up to limit, compared in slices"""
+    length = 0
+    step = 16
+    while length < limit:
+        size = min(step, limit - length)
+        if data[a + length:a + length + size] == data[b + length:b + length + size]:
+            length += size
+            step = min(step * 2, 4096)
+        elif size > 1:
+            step = max(size // 2, 1)
+        else:
+            break
+    return length
+
+
+def compress(data, window_bits=DEFAULT_WINDOW_BITS):
+    if not MIN_WINDOW_BITS <= window_bits <= MAX_WINDOW_BITS:
+        raise ValueError("window bits must be between %d and %d" % (MIN_WINDOW_BITS, MAX_WINDOW_BITS))
+    # The offset is 16 bits
+    max_offset = min(1 << window_bits, 65535)
+    out = bytearray(MAGIC + struct.pack("<B3xI", window_bits, len(data)))
+    chains = {}
+    literal_start = 0
+    position = 0
+    end = len(data)
+
+    def insert(at):
+        key = data[at:at + MIN_MATCH]
+        chain = chains.get(key)
+        if chain is None:
+            chains[key] = [at]
+        else:
+            chain.append(at)
+            if len(chain) > MAX_CHAIN:
+                del chain[0]
+
+    while position + MIN_MATCH <= end:
+        best_length = 0
+        best_offset = 0
+        chain = chains.get(data[position:position + MIN_MATCH])
+        if chain:
+            limit = end - position
+            for candidate in reversed(chain):
+                offset = position - candidate
+                if offset > max_offset:
+                    break
+                length = _match_length(data, candidate, position, limit)
+                if length > best_length:
+                    best_length = length
+                    best_offset = offset
+                    if length == limit:
+                        break
+        if best_length < MIN_MATCH:
+            insert(position)
+            position += 1
+            continue
+
+        _write_sequence(out, data[literal_start:position], best_length, best_offset)
+        # Long matches only index their start and end, the middle is rarely needed again
+        match_end = position + best_length
+        for at in range(position, min(match_end, position + 16)):
+            insert(at)
+        for at in range(max(position + 16, match_end - 16), min(match_end, end - MIN_MATCH + 1)):
+            insert(at)
+        position = match_end
+        literal_start = position
+
+    if literal_start < end:
+        _write_sequence(out, data[literal_start:], 0, 0)
+    return bytes(out)
+
+
+def compress_asset(name, data, resident=False):
+    """
+    Returns the bytes to store for an assets file. Files that the firmware reads once or on demand
+    are compressed; with resident, so are the fonts and images that stay decompressed in memory for
+    the whole session, for boards with PSRAM to spare. The others stay mapped in place.
+    """
+    lower = name.lower()
+    if lower in ASSETS_IN_PLACE:
+        return data
+    if not (lower.endswith(ASSETS_READ_ONCE) or lower.endswith(ASSETS_ON_DEMAND) or resident):
+        return data
+    compressed = compress(data)
+    if len(compressed) > len(data) * (1 - ASSETS_MIN_SAVING):
+        return data
+    return compressed
+
+
+def _read_length(data, position, length):
+    while True:
+        value = data[position]
+        position += 1
+        length += value
+        if value != 255:
+            return position, length
+
+
+def decompress(data):
+    if data[:4] != MAGIC:
+        raise ValueError("not a compressed image")
+    window_bits, original_size = struct.unpack_from("<B3xI", data, 4)
+    window = 1 << window_bits
+    out = bytearray()
+    position = 12
+    while len(out) < original_size:
+        token = data[position]
+        position += 1
+        literal_count = token >> 4
+        if literal_count == 15:
+            position, literal_count = _read_length(data, position, literal_count)
+        out += data[position:position + literal_count]
+        position += literal_count
+        if len(out) >= original_size:
+            break
+        offset, = struct.unpack_from("<H", data, position)
+        position += 2
+        match_length = (token & 0x0F) + MIN_MATCH
+        if match_length == 15 + MIN_MATCH:
+            position, match_length = _read_length(data, position, match_length)
+        if offset == 0 or offset > len(out) or offset > window:
+            raise ValueError("invalid offset %d at %d" % (offset, position))
+        start = len(out) - offset
+        while match_length > 0:
+            length = min(match_length, offset)
+            out += out[start:start + length]
+            start += length
+            match_length -= length
+    if len(out) != original_size or position != len(data):
+        raise ValueError("the stream does not end with the image")
+    return bytes(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compress images for the streaming decompression on the device")
+    parser.add_argument("input")
+    parser.add_argument("-o", "--output", help="default: the input with .xzc appended")
+    parser.add_argument("--window-bits", type=int, default=DEFAULT_WINDOW_BITS,
+                        help="window of 2^bits bytes, allocated by the device (default %d)" % DEFAULT_WINDOW_BITS)
+    parser.add_argument("--decompress", action="store_true", help="decompress instead")
+    args = parser.parse_args()
+
+    with open(args.input, "rb") as f:
+        data = f.read()
+    if args.decompress:
+        try:
+            result = decompress(data)
+        except (ValueError, IndexError, struct.error) as e:
+            print("error: %s" % e, file=sys.stderr)
+            return 1
+        output = args.output or args.input.removesuffix(".xzc")
+        with open(output, "wb") as f:
+            f.write(result)
+        print("%s: %d bytes, sha256 %s" % (output, len(result), hashlib.sha256(result).hexdigest()))
+        return 0
+
+    output = args.output or args.input + ".xzc"
+    result = compress(data, args.window_bits)
+    # Never publish a file that does not decompress to the image
+    if decompress(result) != data:
+        print("error: the compressed file does not decompress to the input", file=sys.stderr)
+        return 1
+    with open(output, "wb") as f:
+        f.write(result)
+    print("%s: %d -> %d bytes (%.1f%%)" % (output, len(data), len(result), 100.0 * len(result) / max(len(data), 1)))
+    print("sha256: %s" % hashlib.sha256(data).hexdigest())
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,236 @@
+#!/usr/bin/env python3
+"""
+Receive and convert event traces written by Tracer (main/tracing.h) to Chrome trace JSON,
+which can be opened in chrome://tracing or https://ui.perfetto.dev
+
+  python trace_to_chrome.py receive --port 9998 -o trace.bin   receive an upload to udp://host:9998
+  python trace_to_chrome.py serve --port 8080 -o trace.bin     receive an upload to http://host:8080/
+  python trace_to_chrome.py convert trace.bin -o trace.json    convert a dump
+  python trace_to_chrome.py stats trace.bin                    per event counts and durations
+
+On the device, enable CONFIG_USE_EVENT_TRACING and call the MCP tool self.trace.upload with the target.
+"""
+
+import argparse
+import http.server
+import json
+import socket
+import struct
+import sys
+from collections import defaultdict
+
+MAGIC = b"XZTR"
+HEADER = struct.Struct("<4sHHIHHq")
+EVENT = struct.Struct("<IiHBBB3x")
+OFFSET = struct.Struct("<I")
+SOURCE_SUFFIXES = (".cc", ".cpp", ".c", ".h")
+
+
+class Trace:
+    def __init__(self, names, tasks, events, time_us):
+        self.names = names
+        self.tasks = tasks
+        # (timestamp us, type, name, value, task, core)
+        self.events = events
+        self.time_us = time_us
+
+    def task_name(self, index):
+        return self.tasks[index] if index < len(self.tasks) else "?"
+
+
+def parse(data):
+    if len(data) < HEADER.size:
+        raise ValueError("file too short")
+    magic, version, header_size, event_count, name_count, task_count, time_us = HEADER.unpack_from(data)
+    if magic != MAGIC:
+        raise ValueError("bad magic %r" % magic)
+    if version != 1:
+        raise ValueError("unsupported version %d" % version)
+    offset = header_size
+
+    def read_strings(count):
+        nonlocal offset
+        strings = []
+        for _ in range(count):
+            length = data[offset]
+            strings.append(data[offset + 1:offset + 1 + length].decode("utf-8", "replace"))
+            offset += 1 + length
+        return strings
+
+    names = read_strings(name_count)
+    tasks = read_strings(task_count)
+
+    # Timestamps are the low 32 bits of the device clock, unwrapped against the dump time
+    low = time_us & 0xFFFFFFFF
+    events = []
+    for _ in range(event_count):
+        if offset + EVENT.size > len(data):
+            print("warning: %d of %d events present" % (len(events), event_count), file=sys.stderr)
+            break
+        timestamp, value, name, event_type, task, core = EVENT.unpack_from(data, offset)
+        offset += EVENT.size
+        timestamp = time_us - ((low - timestamp) & 0xFFFFFFFF)
+        events.append((timestamp, chr(event_type), names[name], value, task, core))
+    return Trace(names, tasks, events, time_us)
+
+
+def to_chrome(trace):
+    out = [{"name": "process_name", "ph": "M", "pid": 1, "args": {"name": "xiaozhi"}}]
+    used_tasks = sorted({event[4] for event in trace.events})
+    for task in used_tasks:
+        out.append({"name": "thread_name", "ph": "M", "pid": 1, "tid": task, "args": {"name": trace.task_name(task)}})
+
+    for timestamp, event_type, name, value, task, core in trace.events:
+        event = {"name": name, "ph": event_type, "ts": timestamp, "pid": 1, "tid": task}
+        if event_type == "B":
+            # Scheduled tasks are named by source file, the value is the line of the Schedule() call
+            if name.endswith(SOURCE_SUFFIXES) and value > 0:
+                event["name"] = "%s:%d" % (name, value)
+            event["args"] = {"core": core, "value": value}
+        elif event_type == "i":
+            event["s"] = "t"
+            event["args"] = {"core": core, "value": value}
+        elif event_type == "C":
+            event["args"] = {name: value}
+        out.append(event)
+    return {"traceEvents": out, "displayTimeUnit": "ms"}
+
+
+def cmd_convert(args):
+    with open(args.input, "rb") as f:
+        trace = parse(f.read())
+    output = args.output or args.input.rsplit(".", 1)[0] + ".json"
+    with open(output, "w") as f:
+        json.dump(to_chrome(trace), f)
+    print("%d events, %d tasks -> %s" % (len(trace.events), len(trace.tasks), output))
+
+
+def cmd_stats(args):
+    with open(args.input, "rb") as f:
+        trace = parse(f.read())
+    if not trace.events:
+        print("no events")
+        return
+    span_ms = (trace.events[-1][0] - trace.events[0][0]) / 1000
+    print("%d events over %.1f ms, tasks: %s" % (len(trace.events), span_ms, ", ".join(trace.tasks)))
+
+    # Durations from begin/end pairs, nested per task
+    stacks = defaultdict(list)
+    durations = defaultdict(list)
+    counts = defaultdict(int)
+    for timestamp, event_type, name, value, task, core in trace.events:
+        if event_type == "B":
+            stacks[task].append((name, timestamp))
+        elif event_type == "E":
+            if stacks[task]:
+                begin_name, begin = stacks[task].pop()
+                durations[(trace.task_name(task), begin_name)].append(timestamp - begin)
+        else:
+            counts[(event_type, name)] += 1
+
+    print("%-20s %-24s %8s %10s %10s %10s" % ("task", "scope", "count", "avg ms", "max ms", "total ms"))
+    for (task, name), values in sorted(durations.items(), key=lambda item: -sum(item[1])):
+        print("%-20s %-24s %8d %10.2f %10.2f %10.1f" % (task, name, len(values), sum(values) / len(values) / 1000,
+                                                     max(values) / 1000, sum(values) / 1000))
+    for (event_type, name), count in sorted(counts.items()):
+        print("%-20s %-24s %8d" % ("counter" if event_type == "C" else "instant", name, count))
+
+
+def cmd_receive(args):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind(("0.0.0.0", args.port))
+    print("Waiting for a trace on udp port %d" % args.port)
+    chunks = {}
+    total = None
+    sock.settimeout(None)
+    while total is None:
+        try:
+            datagram, address = sock.recvfrom(65536)
+        except socket.timeout:
+            print("warning: end of trace not received", file=sys.stderr)
+            break
+        if len(datagram) < OFFSET.size:
+            continue
+        (offset,) = OFFSET.unpack_from(datagram)
+        payload = datagram[OFFSET.size:]
+        if not payload:
+            total = offset
+            break
+        if not chunks:
+            print("Receiving from %s:%d" % address)
+        chunks[offset] = payload
+        sock.settimeout(5)
+
+    data = bytearray()
+    missing = 0
+    for offset in sorted(chunks):
+        if offset > len(data):
+            missing += offset - len(data)
+            data.extend(b"\0" * (offset - len(data)))
+        data[offset:offset + len(chunks[offset])] = chunks[offset]
+    if total is not None and len(data) < total:
+        missing += total - len(data)
+    if missing:
+        print("warning: %d bytes lost and zero filled" % missing, file=sys.stderr)
+    with open(args.output, "wb") as f:
+        f.write(data)
+    print("%d bytes -> %s" % (len(data), args.output))
+
+
+def cmd_serve(args):
+    output = args.output
+
+    class Handler(http.server.BaseHTTPRequestHandler):
+        def do_POST(self):
+            if self.headers.get("Transfer-Encoding", "").lower() == "chunked":
+                body = bytearray()
+                while True:
+                    size = int(self.rfile.readline().strip().split(b";")[0], 16)
+                    if size == 0:
+                        self.rfile.readline()
+                        break
+                    body.extend(self.rfile.read(size))
+                    self.rfile.readline()
+            else:
+                body = self.rfile.read(int(self.headers.get("Content-Length", 0)))
+            with open(output, "wb") as f:
+                f.write(body)
+            print("%d bytes from %s -> %s" % (len(body), self.client_address[0], output))
+            self.send_response(200)
+            self.send_header("Content-Length", "0")
+            self.end_headers()
+
+    server = http.server.HTTPServer(("0.0.0.0", args.port), Handler)
+    print("Waiting for a trace on http port %d" % args.port)
+    server.handle_request()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest="command", required=True)
+
+    p = sub.add_parser("convert", help="convert a dump to Chrome trace JSON")
+    p.add_argument("input")
+    p.add_argument("-o", "--output")
+    p.set_defaults(func=cmd_convert)
+
+    p = sub.add_parser("stats", help="print per scope durations")
+    p.add_argument("input")
+    p.set_defaults(func=cmd_stats)
+
+    p = sub.add_parser("receive", help="receive a dump over UDP")
+    p.add_argument("--port", type=int, default=9998)
+    p.add_argument("-o", "--output", default="trace.bin")
+    p.set_defaults(func=cmd_receive)
+
+    p = sub.add_parser("serve", help="receive a dump over HTTP POST")
+    p.add_argument("--port", type=int, default=8080)
+    p.add_argument("-o", "--output", default="trace.bin")
+    p.set_defaults(func=cmd_serve)
+
+    args = parser.parse_args()
+    args.func(args)
+
+
+if __name__ == "__main__":
+    main()